@@ -0,0 +1,212 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "alloc.h"
+
+/**
+ * @file alloc.c
+ * @author Jason Wang
+ * This program provides the allocators a map can be given: the default one built on malloc, and a page allocator
+ * that maps bucket arrays and block slabs directly, backed by ordinary, transparent huge or explicit huge pages.
+ * Huge pages let one TLB entry cover 2MB instead of 4KB, which matters once a table is far larger than the TLB reach.
+ */
+
+/** Size of a huge page on x86-64 and most other 64-bit platforms. */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/** Size of an ordinary page. */
+#define SMALL_PAGE_SIZE 4096
+
+/** Alignment of every large region, the cache line bucket blocks are laid out on. */
+#define LARGE_ALIGNMENT 64
+
+/**
+ * Allocates a small object with malloc.
+ * @param ctx Unused.
+ * @param size The size of the object.
+ * @return A pointer to the object, or NULL on memory allocation failure.
+ */
+static void* mallocAlloc(void* ctx, size_t size) {
+    return malloc(size);
+}
+
+/**
+ * Frees a small object allocated with mallocAlloc.
+ * @param ctx Unused.
+ * @param ptr A pointer to the object.
+ * @param size Unused.
+ */
+static void mallocFree(void* ctx, void* ptr, size_t size) {
+    free(ptr);
+}
+
+/**
+ * Allocates a zero-filled large region on a cache line with posix_memalign, as calloc only aligns to 16 bytes.
+ * @param ctx Unused.
+ * @param size The size of the region.
+ * @return A pointer to the region, or NULL on memory allocation failure.
+ */
+static void* mallocAllocLarge(void* ctx, size_t size) {
+    void* ptr;
+    if (posix_memalign(&ptr, LARGE_ALIGNMENT, size) != 0)
+        return NULL;
+    return memset(ptr, 0, size);
+}
+
+MapAllocator const mallocAllocator = { mallocAlloc, mallocFree, mallocAllocLarge, mallocFree, 0, NULL };
+
+/**
+ * State of the page allocator for one kind of pages.
+ */
+typedef struct {
+    PageMode mode;
+    PageStats stats;
+} PageState;
+
+/** One state per kind of pages, indexed by PageMode. */
+static PageState states[] = {
+    { PAGES_NORMAL, { 0 } },
+    { PAGES_TRANSPARENT_HUGE, { 0 } },
+    { PAGES_HUGETLB, { 0 } },
+};
+
+/**
+ * Rounds the size of a large region up to the length actually mapped for it.
+ * Regions of at least one huge page are mapped in whole huge pages when huge pages are wanted; anything smaller
+ * can't use a huge page anyway and is mapped in ordinary pages. Allocation and free use the same rule.
+ * @param mode The kind of pages wanted.
+ * @param size The size of the region.
+ * @return The length of the mapping.
+ */
+static size_t mappedLength(PageMode mode, size_t size) {
+    size_t page = mode != PAGES_NORMAL && size >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : SMALL_PAGE_SIZE;
+    return (size + page - 1) / page * page;
+}
+
+/**
+ * Maps an anonymous region aligned to a huge page and asks for it to be backed by transparent huge pages.
+ * A bit more than needed is mapped so the region can be aligned, and the unaligned ends are unmapped again.
+ * @param length The length of the region, a multiple of the huge page size.
+ * @return A pointer to the region, or NULL if it can't be mapped.
+ */
+static void* mapTransparentHuge(size_t length) {
+    char* raw = mmap(NULL, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+        return NULL;
+
+    char* aligned = (char*)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    if (aligned > raw)
+        munmap(raw, aligned - raw);
+    munmap(aligned + length, raw + HUGE_PAGE_SIZE - aligned);
+
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, length, MADV_HUGEPAGE);
+#endif
+    return aligned;
+}
+
+/**
+ * Maps a zero-filled large region with the kind of pages the state asks for.
+ * Explicit huge pages fall back to transparent huge pages when the hugetlbfs pool is empty,
+ * and transparent huge pages fall back to ordinary pages when the region is too small for them.
+ * @param ctx A pointer to the PageState.
+ * @param size The size of the region.
+ * @return A pointer to the region, or NULL on memory allocation failure.
+ */
+static void* pageAllocLarge(void* ctx, size_t size) {
+    PageState* state = (PageState*)ctx;
+    size_t length = mappedLength(state->mode, size);
+    void* ptr = NULL;
+
+    if (length % HUGE_PAGE_SIZE == 0 && state->mode != PAGES_NORMAL) {
+#ifdef MAP_HUGETLB
+        if (state->mode == PAGES_HUGETLB) {
+            ptr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (ptr == MAP_FAILED) {
+                ptr = NULL;
+                __atomic_fetch_add(&state->stats.fallbacks, 1, __ATOMIC_RELAXED);
+            } else
+                __atomic_fetch_add(&state->stats.hugetlbRegions, 1, __ATOMIC_RELAXED);
+        }
+#endif
+        if (!ptr)
+            ptr = mapTransparentHuge(length);
+    } else {
+        if (state->mode != PAGES_NORMAL)
+            __atomic_fetch_add(&state->stats.fallbacks, 1, __ATOMIC_RELAXED);
+        ptr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED)
+            ptr = NULL;
+    }
+
+    if (ptr) {
+        __atomic_fetch_add(&state->stats.regions, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&state->stats.bytes, length, __ATOMIC_RELAXED);
+    }
+    return ptr;
+}
+
+/**
+ * Unmaps a large region mapped by pageAllocLarge.
+ * @param ctx A pointer to the PageState.
+ * @param ptr A pointer to the region.
+ * @param size The size the region was allocated with.
+ */
+static void pageFreeLarge(void* ctx, void* ptr, size_t size) {
+    PageState* state = (PageState*)ctx;
+    if (!ptr)
+        return;
+
+    size_t length = mappedLength(state->mode, size);
+    munmap(ptr, length);
+    __atomic_fetch_sub(&state->stats.regions, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&state->stats.bytes, length, __ATOMIC_RELAXED);
+}
+
+/** One page allocator per kind of pages, indexed by PageMode. */
+static MapAllocator const pageAllocators[] = {
+    { mallocAlloc, mallocFree, pageAllocLarge, pageFreeLarge, SMALL_PAGE_SIZE, &states[PAGES_NORMAL] },
+    { mallocAlloc, mallocFree, pageAllocLarge, pageFreeLarge, HUGE_PAGE_SIZE, &states[PAGES_TRANSPARENT_HUGE] },
+    { mallocAlloc, mallocFree, pageAllocLarge, pageFreeLarge, HUGE_PAGE_SIZE, &states[PAGES_HUGETLB] },
+};
+
+/**
+ * Returns the allocator that maps large regions with the given kind of pages.
+ * Small objects such as VTypes still come from malloc.
+ * @param mode The kind of pages to back bucket arrays and block slabs with.
+ * @return A pointer to the allocator, which lives for the whole program.
+ */
+MapAllocator const* pageAllocator(PageMode mode) {
+    return &pageAllocators[mode];
+}
+
+/**
+ * Parses the name of a kind of pages, as given on the driver's command line.
+ * @param name "normal", "thp" or "hugetlb".
+ * @param mode Where the kind of pages is stored.
+ * @return true if the name is known, false otherwise.
+ */
+_Bool parsePageMode(char const* name, PageMode* mode) {
+    static char const* const names[] = { "normal", "thp", "hugetlb" };
+    for (int i = 0; i < 3; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *mode = (PageMode)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Reports the counters of the page allocator for the given kind of pages.
+ * @param mode The kind of pages.
+ * @param stats A pointer to the PageStats to be filled in.
+ */
+void pageAllocatorStats(PageMode mode, PageStats* stats) {
+    PageStats* s = &states[mode].stats;
+    stats->regions = __atomic_load_n(&s->regions, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&s->bytes, __ATOMIC_RELAXED);
+    stats->hugetlbRegions = __atomic_load_n(&s->hugetlbRegions, __ATOMIC_RELAXED);
+    stats->fallbacks = __atomic_load_n(&s->fallbacks, __ATOMIC_RELAXED);
+}
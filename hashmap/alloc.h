@@ -0,0 +1,64 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+
+/** Allocator hooks used by a Map for its bucket array, its block slabs and, optionally, VType objects. */
+typedef struct MapAllocatorStruct {
+    /** Allocate a small object of the given size: a VType, its text, or scratch space used while compressing it. */
+    void* (*alloc)(void* ctx, size_t size);
+
+    /** Free a small object; size is the size it was allocated with. */
+    void (*free)(void* ctx, void* ptr, size_t size);
+
+    /** Allocate a large, zero-filled region such as a bucket array or a block slab, aligned to 64 bytes. */
+    void* (*allocLarge)(void* ctx, size_t size);
+
+    /** Free a large region; size is the size it was allocated with. */
+    void (*freeLarge)(void* ctx, void* ptr, size_t size);
+
+    /** Page size large regions are backed by; slabs are made a multiple of it. */
+    size_t pageSize;
+
+    /** Arbitrary pointer passed to every hook. */
+    void* ctx;
+} MapAllocator;
+
+/** Kinds of pages the page allocator can back large regions with. */
+typedef enum {
+    /** Ordinary pages from an anonymous mapping. */
+    PAGES_NORMAL,
+    /** Transparent huge pages requested with madvise(MADV_HUGEPAGE). */
+    PAGES_TRANSPARENT_HUGE,
+    /** Explicit hugetlbfs pages from MAP_HUGETLB, falling back to transparent huge pages. */
+    PAGES_HUGETLB
+} PageMode;
+
+/** Counters kept by the page allocator. */
+typedef struct {
+    /** Number of large regions currently mapped. */
+    size_t regions;
+
+    /** Bytes currently mapped for large regions. */
+    size_t bytes;
+
+    /** Number of regions that got explicit huge pages so far. */
+    size_t hugetlbRegions;
+
+    /** Number of regions that had to fall back to a weaker kind of page. */
+    size_t fallbacks;
+} PageStats;
+
+/* The default allocator, built on malloc and posix_memalign. */
+extern MapAllocator const mallocAllocator;
+
+/* Return the allocator that backs large regions with the given kind of pages; small objects still come from malloc. */
+MapAllocator const* pageAllocator(PageMode mode);
+
+/* Parse a page mode name: "normal", "thp" or "hugetlb". Returns 0 for an unknown name. */
+_Bool parsePageMode(char const* name, PageMode* mode);
+
+/* Report the counters of the page allocator for the given kind of pages. */
+void pageAllocatorStats(PageMode mode, PageStats* stats);
+
+#endif // ALLOC_H
@@ -0,0 +1,702 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "art.h"
+
+/**
+ * @file art.c
+ * @author Jason Wang
+ * This program provides an adaptive radix tree over the keys of a map, used to find every key with a given prefix
+ * in key order without walking the whole table. Inner nodes come in four sizes, for up to 4, 16, 48 and 256 children,
+ * and switch size as children come and go, so sparse and dense levels both stay compact. Runs of bytes every key below
+ * a node shares are stored once in the node (path compression) rather than as a chain of single-child nodes.
+ * Leaves are the map's own key objects, tagged in the low bit of the child pointer, so the tree stores no key bytes
+ * besides the compressed prefixes. Integer keys are indexed by their decimal text, the same bytes they are hashed by,
+ * and keys are ordered by their bytes, so "10" sorts before "9".
+ */
+
+/** Kinds of inner nodes, by the number of children they hold. */
+#define NODE4 0
+#define NODE16 1
+#define NODE48 2
+#define NODE256 3
+
+/**
+ * Header shared by every inner node: its kind, its number of children and its compressed prefix.
+ */
+typedef struct {
+    uint8_t type;
+    uint16_t count;
+    uint32_t prefixLen;
+    unsigned char* prefix;
+} ArtNode;
+
+/** Node with up to 4 children, with their key bytes kept sorted. */
+typedef struct {
+    ArtNode n;
+    unsigned char keys[4];
+    void* children[4];
+} Node4;
+
+/** Node with up to 16 children, with their key bytes kept sorted. */
+typedef struct {
+    ArtNode n;
+    unsigned char keys[16];
+    void* children[16];
+} Node16;
+
+/** Node with up to 48 children; index maps a key byte to its child's slot plus one, or 0 for none. */
+typedef struct {
+    ArtNode n;
+    unsigned char index[256];
+    void* children[48];
+} Node48;
+
+/** Node with a child slot for every key byte. */
+typedef struct {
+    ArtNode n;
+    void* children[256];
+} Node256;
+
+/** Size of each kind of inner node, indexed by its type. */
+static size_t const nodeSizes[] = { sizeof(Node4), sizeof(Node16), sizeof(Node48), sizeof(Node256) };
+
+/**
+ * ArtStruct holding the root of the tree and its size counters.
+ */
+struct ArtStruct {
+    void* root;
+    size_t keys;
+    size_t nodes[4];
+    size_t bytes;
+    size_t keyBytes;
+};
+
+/**
+ * The bytes a key is indexed by: a Text key's characters, or an Integer key's decimal text.
+ */
+typedef struct {
+    char const* bytes;
+    size_t len;
+    char buffer[12];
+} KeyBytes;
+
+/**
+ * Finds the bytes a key is indexed by.
+ * @param key A pointer to the key.
+ * @param kb Where the bytes are described; an Integer key's text is written into its buffer.
+ */
+static void keyBytes(VType const* key, KeyBytes* kb) {
+    if (key->type == 'I') {
+        kb->len = sprintf(kb->buffer, "%d", key->value.integer);
+        kb->bytes = kb->buffer;
+    } else {
+        kb->bytes = key->value.text;
+        kb->len = key->length;
+    }
+}
+
+/**
+ * Returns the byte of a key at a depth in the tree.
+ * Every key is treated as ending in a 0 byte, so a key that is a prefix of another still gets a leaf of its own.
+ * @param kb The bytes of the key.
+ * @param depth The position of the byte.
+ * @return The byte, or 0 past the end of the key.
+ */
+static unsigned char byteAt(KeyBytes const* kb, size_t depth) {
+    return depth < kb->len ? (unsigned char)kb->bytes[depth] : 0;
+}
+
+/**
+ * Checks whether a child pointer is a leaf.
+ * @param p The child pointer.
+ * @return true if it points at a key, false if it points at an inner node.
+ */
+static _Bool isLeaf(void const* p) {
+    return (uintptr_t)p & 1;
+}
+
+/**
+ * Makes a leaf child pointer for a key.
+ * @param key A pointer to the key.
+ * @return The tagged pointer.
+ */
+static void* makeLeaf(VType* key) {
+    return (void*)((uintptr_t)key | 1);
+}
+
+/**
+ * Returns the key a leaf child pointer stands for.
+ * @param p The tagged pointer.
+ * @return A pointer to the key.
+ */
+static VType* leafKey(void const* p) {
+    return (VType*)((uintptr_t)p & ~(uintptr_t)1);
+}
+
+/**
+ * Checks whether a leaf holds the key with the given bytes.
+ * @param leaf The tagged pointer.
+ * @param kb The bytes of the key.
+ * @return true if the leaf's key has exactly those bytes.
+ */
+static _Bool leafMatches(void const* leaf, KeyBytes const* kb) {
+    KeyBytes lb;
+    keyBytes(leafKey(leaf), &lb);
+    return lb.len == kb->len && memcmp(lb.bytes, kb->bytes, kb->len) == 0;
+}
+
+/**
+ * Allocates an empty inner node of the given kind.
+ * @param this A pointer to the tree.
+ * @param type The kind of node.
+ * @return A pointer to the node, or NULL on memory allocation failure.
+ */
+static ArtNode* allocNode(Art* this, int type) {
+    ArtNode* n = (ArtNode*)calloc(1, nodeSizes[type]);
+    if (n) {
+        n->type = type;
+        this->nodes[type]++;
+        this->bytes += nodeSizes[type];
+    }
+    return n;
+}
+
+/**
+ * Frees an inner node, but not its prefix, which may have been handed to a replacement node.
+ * @param this A pointer to the tree.
+ * @param n A pointer to the node.
+ */
+static void freeNode(Art* this, ArtNode* n) {
+    this->nodes[n->type]--;
+    this->bytes -= nodeSizes[n->type];
+    free(n);
+}
+
+/**
+ * Replaces the compressed prefix of a node with a copy of the given bytes, which may overlap the old prefix.
+ * @param this A pointer to the tree.
+ * @param n A pointer to the node.
+ * @param bytes The new prefix.
+ * @param len The length of the new prefix.
+ * @return true if the prefix was set, false on memory allocation failure, in which case the node keeps its prefix.
+ */
+static _Bool setPrefix(Art* this, ArtNode* n, unsigned char const* bytes, size_t len) {
+    unsigned char* prefix = NULL;
+    if (len) {
+        if (!(prefix = (unsigned char*)malloc(len)))
+            return 0;
+        memcpy(prefix, bytes, len);
+    }
+    free(n->prefix);
+    this->bytes += len;
+    this->bytes -= n->prefixLen;
+    n->prefix = prefix;
+    n->prefixLen = len;
+    return 1;
+}
+
+/**
+ * Finds the slot holding the child for a key byte.
+ * @param n A pointer to the node.
+ * @param byte The key byte.
+ * @return A pointer to the child slot, or NULL if the node has no child for the byte.
+ */
+static void** findChild(ArtNode* n, unsigned char byte) {
+    switch (n->type) {
+    case NODE4: {
+        Node4* n4 = (Node4*)n;
+        for (int i = 0; i < n->count; i++) {
+            if (n4->keys[i] == byte)
+                return &n4->children[i];
+        }
+        return NULL;
+    }
+    case NODE16: {
+        Node16* n16 = (Node16*)n;
+        for (int i = 0; i < n->count; i++) {
+            if (n16->keys[i] == byte)
+                return &n16->children[i];
+        }
+        return NULL;
+    }
+    case NODE48: {
+        Node48* n48 = (Node48*)n;
+        return n48->index[byte] ? &n48->children[n48->index[byte] - 1] : NULL;
+    }
+    default: {
+        Node256* n256 = (Node256*)n;
+        return n256->children[byte] ? &n256->children[byte] : NULL;
+    }
+    }
+}
+
+/**
+ * Returns the next child of a node in key byte order.
+ * @param n A pointer to the node.
+ * @param pos The position to continue from, 0 for the first child; advanced past the child returned.
+ * @param byte Where the key byte of the child is stored.
+ * @return The child pointer, or NULL once every child has been returned.
+ */
+static void* nextChild(ArtNode const* n, int* pos, unsigned char* byte) {
+    switch (n->type) {
+    case NODE4:
+    case NODE16: {
+        unsigned char const* keys = n->type == NODE4 ? ((Node4 const*)n)->keys : ((Node16 const*)n)->keys;
+        void* const* children = n->type == NODE4 ? ((Node4 const*)n)->children : ((Node16 const*)n)->children;
+        if (*pos >= n->count)
+            return NULL;
+        *byte = keys[*pos];
+        return children[(*pos)++];
+    }
+    case NODE48: {
+        Node48 const* n48 = (Node48 const*)n;
+        for (; *pos < 256; (*pos)++) {
+            if (n48->index[*pos]) {
+                *byte = *pos;
+                return n48->children[n48->index[(*pos)++] - 1];
+            }
+        }
+        return NULL;
+    }
+    default: {
+        Node256 const* n256 = (Node256 const*)n;
+        for (; *pos < 256; (*pos)++) {
+            if (n256->children[*pos]) {
+                *byte = *pos;
+                return n256->children[(*pos)++];
+            }
+        }
+        return NULL;
+    }
+    }
+}
+
+/**
+ * Moves the header and children of a node into a node of another kind, which replaces it in its parent.
+ * @param this A pointer to the tree.
+ * @param ref The slot in the parent that points at the node.
+ * @param n A pointer to the node.
+ * @param type The kind of the replacement node.
+ * @return A pointer to the replacement node, or NULL on memory allocation failure, in which case nothing changes.
+ */
+static ArtNode* changeKind(Art* this, void** ref, ArtNode* n, int type) {
+    ArtNode* m = allocNode(this, type);
+    if (!m)
+        return NULL;
+    m->prefixLen = n->prefixLen;
+    m->prefix = n->prefix;
+
+    int pos = 0;
+    unsigned char byte;
+    void* child;
+    while ((child = nextChild(n, &pos, &byte))) {
+        if (type == NODE4) {
+            ((Node4*)m)->keys[m->count] = byte;
+            ((Node4*)m)->children[m->count] = child;
+        } else if (type == NODE16) {
+            ((Node16*)m)->keys[m->count] = byte;
+            ((Node16*)m)->children[m->count] = child;
+        } else if (type == NODE48) {
+            ((Node48*)m)->children[m->count] = child;
+            ((Node48*)m)->index[byte] = m->count + 1;
+        } else
+            ((Node256*)m)->children[byte] = child;
+        m->count++;
+    }
+
+    *ref = m;
+    freeNode(this, n);
+    return m;
+}
+
+/**
+ * Adds a child for a key byte the node doesn't have a child for yet, moving to a bigger kind of node when it is full.
+ * @param this A pointer to the tree.
+ * @param ref The slot in the parent that points at the node.
+ * @param n A pointer to the node.
+ * @param byte The key byte.
+ * @param child The child pointer.
+ * @return true if the child was added, false on memory allocation failure.
+ */
+static _Bool addChild(Art* this, void** ref, ArtNode* n, unsigned char byte, void* child) {
+    static int const capacities[] = { 4, 16, 48, 256 };
+    if (n->count == capacities[n->type] && !(n = changeKind(this, ref, n, n->type + 1)))
+        return 0;
+
+    if (n->type == NODE4 || n->type == NODE16) {
+        unsigned char* keys = n->type == NODE4 ? ((Node4*)n)->keys : ((Node16*)n)->keys;
+        void** children = n->type == NODE4 ? ((Node4*)n)->children : ((Node16*)n)->children;
+        int i = n->count;
+        while (i > 0 && keys[i - 1] > byte) {
+            keys[i] = keys[i - 1];
+            children[i] = children[i - 1];
+            i--;
+        }
+        keys[i] = byte;
+        children[i] = child;
+    } else if (n->type == NODE48) {
+        Node48* n48 = (Node48*)n;
+        int slot = 0;
+        while (n48->children[slot])
+            slot++;
+        n48->children[slot] = child;
+        n48->index[byte] = slot + 1;
+    } else
+        ((Node256*)n)->children[byte] = child;
+    n->count++;
+    return 1;
+}
+
+/**
+ * Removes the child for a key byte, moving to a smaller kind of node when few children are left.
+ * A 4-child node left with one child is replaced by that child; an inner child takes over the node's prefix.
+ * @param this A pointer to the tree.
+ * @param ref The slot in the parent that points at the node.
+ * @param n A pointer to the node.
+ * @param byte The key byte.
+ * @param slot The slot of the child, from 'findChild'.
+ */
+static void removeChild(Art* this, void** ref, ArtNode* n, unsigned char byte, void** slot) {
+    if (n->type == NODE4 || n->type == NODE16) {
+        unsigned char* keys = n->type == NODE4 ? ((Node4*)n)->keys : ((Node16*)n)->keys;
+        void** children = n->type == NODE4 ? ((Node4*)n)->children : ((Node16*)n)->children;
+        int i = slot - children;
+        memmove(&keys[i], &keys[i + 1], n->count - i - 1);
+        memmove(&children[i], &children[i + 1], (n->count - i - 1) * sizeof(void*));
+    } else if (n->type == NODE48) {
+        ((Node48*)n)->index[byte] = 0;
+        *slot = NULL;
+    } else
+        *slot = NULL;
+    n->count--;
+
+    // Shrink a little below the next smaller capacity, so a node on the boundary doesn't flip back and forth.
+    if (n->type == NODE256 && n->count == 37)
+        changeKind(this, ref, n, NODE48);
+    else if (n->type == NODE48 && n->count == 12)
+        changeKind(this, ref, n, NODE16);
+    else if (n->type == NODE16 && n->count == 3)
+        changeKind(this, ref, n, NODE4);
+    else if (n->type == NODE4 && n->count == 1) {
+        Node4* n4 = (Node4*)n;
+        void* child = n4->children[0];
+        if (!isLeaf(child)) {
+            // The child's prefix becomes this node's prefix, the byte leading to the child and the child's own prefix.
+            ArtNode* c = (ArtNode*)child;
+            size_t len = n->prefixLen + 1 + c->prefixLen;
+            unsigned char* prefix = (unsigned char*)malloc(len);
+            if (!prefix)
+                return;
+            if (n->prefixLen)
+                memcpy(prefix, n->prefix, n->prefixLen);
+            prefix[n->prefixLen] = n4->keys[0];
+            if (c->prefixLen)
+                memcpy(prefix + n->prefixLen + 1, c->prefix, c->prefixLen);
+            free(c->prefix);
+            this->bytes += len - c->prefixLen;
+            c->prefix = prefix;
+            c->prefixLen = len;
+        }
+        setPrefix(this, n, NULL, 0);
+        *ref = child;
+        freeNode(this, n);
+    }
+}
+
+/**
+ * Inserts a key into the subtree in a slot.
+ * @param this A pointer to the tree.
+ * @param ref The slot pointing at the subtree.
+ * @param key A pointer to the key.
+ * @param kb The bytes of the key.
+ * @param depth The number of key bytes consumed by the nodes above the subtree.
+ * @return true if the key was inserted, false if it is already there or on memory allocation failure.
+ */
+static _Bool insertAt(Art* this, void** ref, VType* key, KeyBytes const* kb, size_t depth) {
+    void* node = *ref;
+    if (!node) {
+        *ref = makeLeaf(key);
+        return 1;
+    }
+
+    if (isLeaf(node)) {
+        // Split the leaf: a new node holds the bytes both keys share, with the two keys below it.
+        KeyBytes ob;
+        keyBytes(leafKey(node), &ob);
+        size_t limit = (kb->len > ob.len ? kb->len : ob.len) + 1;
+        size_t i = depth;
+        while (i < limit && byteAt(kb, i) == byteAt(&ob, i))
+            i++;
+        if (i == limit)
+            return 0;
+
+        void* split = allocNode(this, NODE4);
+        if (!split)
+            return 0;
+        if (!setPrefix(this, (ArtNode*)split, (unsigned char const*)kb->bytes + depth, i - depth)) {
+            freeNode(this, (ArtNode*)split);
+            return 0;
+        }
+        addChild(this, &split, (ArtNode*)split, byteAt(&ob, i), node);
+        addChild(this, &split, (ArtNode*)split, byteAt(kb, i), makeLeaf(key));
+        *ref = split;
+        return 1;
+    }
+
+    ArtNode* n = (ArtNode*)node;
+    if (n->prefixLen) {
+        size_t p = 0;
+        while (p < n->prefixLen && n->prefix[p] == byteAt(kb, depth + p))
+            p++;
+        if (p < n->prefixLen) {
+            // The key leaves the prefix part way: a new node takes the part before it, with the old node and the key below.
+            void* split = allocNode(this, NODE4);
+            if (!split)
+                return 0;
+            unsigned char byte = n->prefix[p];
+            if (!setPrefix(this, (ArtNode*)split, n->prefix, p) ||
+                !setPrefix(this, n, n->prefix + p + 1, n->prefixLen - p - 1)) {
+                setPrefix(this, (ArtNode*)split, NULL, 0);
+                freeNode(this, (ArtNode*)split);
+                return 0;
+            }
+            addChild(this, &split, (ArtNode*)split, byte, n);
+            addChild(this, &split, (ArtNode*)split, byteAt(kb, depth + p), makeLeaf(key));
+            *ref = split;
+            return 1;
+        }
+        depth += n->prefixLen;
+    }
+
+    void** child = findChild(n, byteAt(kb, depth));
+    if (child)
+        return insertAt(this, child, key, kb, depth + 1);
+    return addChild(this, ref, n, byteAt(kb, depth), makeLeaf(key));
+}
+
+/**
+ * Removes a key from the subtree in a slot.
+ * @param this A pointer to the tree.
+ * @param ref The slot pointing at the subtree.
+ * @param kb The bytes of the key.
+ * @param depth The number of key bytes consumed by the nodes above the subtree.
+ * @return true if the key was removed, false if it isn't there.
+ */
+static _Bool removeAt(Art* this, void** ref, KeyBytes const* kb, size_t depth) {
+    void* node = *ref;
+    if (!node)
+        return 0;
+    if (isLeaf(node)) {
+        if (!leafMatches(node, kb))
+            return 0;
+        *ref = NULL;
+        return 1;
+    }
+
+    ArtNode* n = (ArtNode*)node;
+    for (size_t p = 0; p < n->prefixLen; p++) {
+        if (n->prefix[p] != byteAt(kb, depth + p))
+            return 0;
+    }
+    depth += n->prefixLen;
+
+    unsigned char byte = byteAt(kb, depth);
+    void** child = findChild(n, byte);
+    if (!child)
+        return 0;
+    if (!isLeaf(*child))
+        return removeAt(this, child, kb, depth + 1);
+    if (!leafMatches(*child, kb))
+        return 0;
+    removeChild(this, ref, n, byte, child);
+    return 1;
+}
+
+/**
+ * State of a scan: where it starts and who gets the keys.
+ */
+typedef struct {
+    char const* from;
+    size_t len;
+    _Bool inclusive;
+    ArtVisitor fn;
+    void* ctx;
+} Scan;
+
+/**
+ * Visits every key in a subtree in order.
+ * @param node The subtree.
+ * @param s A pointer to the scan.
+ * @return false if the visitor stopped the scan, true otherwise.
+ */
+static _Bool visitAll(void* node, Scan* s) {
+    if (isLeaf(node))
+        return s->fn(leafKey(node), s->ctx);
+
+    int pos = 0;
+    unsigned char byte;
+    void* child;
+    while ((child = nextChild((ArtNode*)node, &pos, &byte))) {
+        if (!visitAll(child, s))
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * Visits the keys in a subtree that come after the scan's starting point, in order.
+ * The path to the subtree matches the first 'depth' bytes of the starting point, so at each node only children with
+ * the starting point's next byte need to be searched further; children with smaller bytes are skipped and children
+ * with bigger bytes are visited whole.
+ * @param node The subtree, or NULL.
+ * @param depth The number of bytes of the starting point matched by the path to the subtree.
+ * @param s A pointer to the scan.
+ * @return false if the visitor stopped the scan, true otherwise.
+ */
+static _Bool scanFrom(void* node, size_t depth, Scan* s) {
+    if (!node)
+        return 1;
+
+    if (isLeaf(node)) {
+        KeyBytes kb;
+        keyBytes(leafKey(node), &kb);
+        size_t common = kb.len < s->len ? kb.len : s->len;
+        int cmp = memcmp(kb.bytes, s->from, common);
+        if (cmp == 0)
+            cmp = kb.len < s->len ? -1 : kb.len > s->len;
+        if (cmp > 0 || (cmp == 0 && s->inclusive))
+            return s->fn(leafKey(node), s->ctx);
+        return 1;
+    }
+
+    ArtNode* n = (ArtNode*)node;
+    for (size_t p = 0; p < n->prefixLen; p++) {
+        // Past the end of the starting point every key below here extends it, so comes after it.
+        if (depth + p >= s->len)
+            return visitAll(node, s);
+        unsigned char b = (unsigned char)s->from[depth + p];
+        if (n->prefix[p] < b)
+            return 1;
+        if (n->prefix[p] > b)
+            return visitAll(node, s);
+    }
+    depth += n->prefixLen;
+
+    int pos = 0;
+    unsigned char byte;
+    void* child;
+    while ((child = nextChild(n, &pos, &byte))) {
+        _Bool more;
+        if (depth >= s->len)
+            more = isLeaf(child) ? scanFrom(child, depth + 1, s) : visitAll(child, s);
+        else if (byte < (unsigned char)s->from[depth])
+            continue;
+        else if (byte == (unsigned char)s->from[depth])
+            more = scanFrom(child, depth + 1, s);
+        else
+            more = visitAll(child, s);
+        if (!more)
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * Frees a subtree's inner nodes and prefixes; the keys are not freed.
+ * @param this A pointer to the tree.
+ * @param node The subtree.
+ */
+static void freeSubtree(Art* this, void* node) {
+    if (!node || isLeaf(node))
+        return;
+
+    int pos = 0;
+    unsigned char byte;
+    void* child;
+    while ((child = nextChild((ArtNode*)node, &pos, &byte)))
+        freeSubtree(this, child);
+    setPrefix(this, (ArtNode*)node, NULL, 0);
+    freeNode(this, (ArtNode*)node);
+}
+
+/**
+ * Creates a new, empty adaptive radix tree on the heap.
+ * Memory allocated for the tree should be freed by the caller with 'artFree' when no longer needed.
+ * @return A pointer to the tree, or NULL on memory allocation failure.
+ */
+Art* makeArt() {
+    return (Art*)calloc(1, sizeof(Art));
+}
+
+/**
+ * Adds a key to the tree. The tree keeps a pointer to the key object, which must stay valid until it is removed.
+ * @param this A pointer to the tree.
+ * @param key A pointer to the key.
+ * @return true if the key was added, false if a key with the same bytes is already there or on memory allocation failure.
+ */
+_Bool artInsert(Art* this, VType* key) {
+    KeyBytes kb;
+    keyBytes(key, &kb);
+    if (!insertAt(this, &this->root, key, &kb, 0))
+        return 0;
+    this->keys++;
+    this->keyBytes += kb.len;
+    return 1;
+}
+
+/**
+ * Removes the key with the same bytes as the given one from the tree.
+ * @param this A pointer to the tree.
+ * @param key A pointer to a key with the bytes to remove.
+ * @return true if the key was removed, false if it isn't there.
+ */
+_Bool artRemove(Art* this, VType const* key) {
+    KeyBytes kb;
+    keyBytes(key, &kb);
+    if (!removeAt(this, &this->root, &kb, 0))
+        return 0;
+    this->keys--;
+    this->keyBytes -= kb.len;
+    return 1;
+}
+
+/**
+ * Visits the keys from a starting point onwards, in byte order, until the visitor returns false.
+ * To visit the keys with a prefix, start at the prefix inclusively and stop at the first key without it.
+ * To continue a scan, start after the last key visited.
+ * @param this A pointer to the tree.
+ * @param from The bytes of the starting point.
+ * @param len The number of bytes.
+ * @param inclusive Whether a key equal to the starting point is visited.
+ * @param fn The callback invoked with each key and the 'ctx' pointer.
+ * @param ctx An arbitrary pointer passed through to the callback.
+ */
+void artScan(Art* this, char const* from, size_t len, _Bool inclusive, ArtVisitor fn, void* ctx) {
+    Scan s = { from, len, inclusive, fn, ctx };
+    scanFrom(this->root, 0, &s);
+}
+
+/**
+ * Reports the size counters of the tree.
+ * @param this A pointer to the tree.
+ * @param stats A pointer to the ArtStats to be filled in.
+ */
+void artStats(Art const* this, ArtStats* stats) {
+    stats->keys = this->keys;
+    memcpy(stats->nodes, this->nodes, sizeof(stats->nodes));
+    stats->bytes = this->bytes;
+    stats->keyBytes = this->keyBytes;
+}
+
+/**
+ * Frees the memory occupied by the tree. The keys it indexes are not freed.
+ * @param this A pointer to the tree to be freed.
+ */
+void artFree(Art* this) {
+    if (!this)
+        return;
+    freeSubtree(this, this->root);
+    free(this);
+}
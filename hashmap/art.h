@@ -0,0 +1,36 @@
+#ifndef ART_H
+#define ART_H
+
+#include <stddef.h>
+#include "vtype.h"
+
+// Define your Art struct here
+typedef struct ArtStruct Art;
+
+// Callback used by artScan; return 0 to stop the scan.
+typedef _Bool (*ArtVisitor)(VType* key, void* ctx);
+
+/** Size counters reported for an adaptive radix tree. */
+typedef struct {
+    /** Number of keys indexed. */
+    size_t keys;
+
+    /** Number of inner nodes of each size: 4, 16, 48 and 256 children. */
+    size_t nodes[4];
+
+    /** Memory used by the inner nodes and their compressed prefixes, in bytes. */
+    size_t bytes;
+
+    /** Total length of the keys indexed, in bytes. */
+    size_t keyBytes;
+} ArtStats;
+
+/*Function prototypes*/
+Art* makeArt();
+_Bool artInsert(Art* this, VType* key);
+_Bool artRemove(Art* this, VType const* key);
+void artScan(Art* this, char const* from, size_t len, _Bool inclusive, ArtVisitor fn, void* ctx);
+void artStats(Art const* this, ArtStats* stats);
+void artFree(Art* this);
+
+#endif // ART_H
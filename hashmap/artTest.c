@@ -0,0 +1,147 @@
+// Simple test program for the adaptive radix tree and the prefix scans built on it.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "art.h"
+#include "map.h"
+
+#define KEYS 20000
+
+// Collects the keys visited by a scan as text.
+typedef struct {
+    char seen[256][32];
+    size_t count;
+    size_t limit;
+} Collected;
+
+static _Bool collectKey(VType* key, void* ctx) {
+    Collected* c = (Collected*)ctx;
+    if (c->count == c->limit)
+        return 0;
+    snprintf(c->seen[c->count++], 32, "%.*s", (int)key->length, key->value.text);
+    return 1;
+}
+
+static _Bool collectPair(VType const* key, VType const* value, void* ctx) {
+    Collected* c = (Collected*)ctx;
+    assert(value);
+    if (key->type == 'I')
+        snprintf(c->seen[c->count++], 32, "%d", key->value.integer);
+    else
+        snprintf(c->seen[c->count++], 32, "%.*s", (int)key->length, key->value.text);
+    return 1;
+}
+
+int main() {
+    // Keys that are prefixes of each other and share long runs, inserted out of order.
+    char const* words[] = { "user:10", "user:1", "user", "user:2", "users", "admin", "user:100", "use", "" };
+    size_t n = sizeof(words) / sizeof(words[0]);
+    Art* art = makeArt();
+    VType* keys[sizeof(words) / sizeof(words[0])];
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = makeText((char*)words[i]);
+        assert(artInsert(art, keys[i]));
+    }
+    assert(!artInsert(art, keys[0]));
+
+    // Everything comes back in byte order.
+    Collected c = { .limit = 64 };
+    artScan(art, "", 0, 1, collectKey, &c);
+    char const* sorted[] = { "", "admin", "use", "user", "user:1", "user:10", "user:100", "user:2", "users" };
+    assert(c.count == n);
+    for (size_t i = 0; i < n; i++)
+        assert(strcmp(c.seen[i], sorted[i]) == 0);
+
+    // A scan starts at, or just after, any point, whether or not it is a key.
+    c = (Collected){ .limit = 2 };
+    artScan(art, "user:1", 6, 0, collectKey, &c);
+    assert(c.count == 2 && strcmp(c.seen[0], "user:10") == 0 && strcmp(c.seen[1], "user:100") == 0);
+    c = (Collected){ .limit = 64 };
+    artScan(art, "user:15", 7, 1, collectKey, &c);
+    assert(c.count == 2 && strcmp(c.seen[0], "user:2") == 0);
+    c = (Collected){ .limit = 64 };
+    artScan(art, "v", 1, 1, collectKey, &c);
+    assert(c.count == 0);
+
+    // Removing keys leaves the rest in order.
+    VType probe = { 'T', 4, { .text = "user" }, 0 };
+    assert(artRemove(art, &probe) && !artRemove(art, &probe));
+    assert(artRemove(art, keys[5]));
+    c = (Collected){ .limit = 64 };
+    artScan(art, "us", 2, 1, collectKey, &c);
+    assert(c.count == 6 && strcmp(c.seen[0], "use") == 0 && strcmp(c.seen[1], "user:1") == 0);
+    for (size_t i = 0; i < n; i++) {
+        if (i != 2 && i != 5)
+            assert(artRemove(art, keys[i]));
+    }
+    ArtStats stats;
+    artStats(art, &stats);
+    assert(stats.keys == 0 && stats.bytes == 0);
+    artFree(art);
+    for (size_t i = 0; i < n; i++)
+        freeVType(keys[i]);
+
+    // A Map keeps its index in step with sets and removes; node sizes grow and shrink with the keys.
+    Map* map = makeMapBackend(0, MAP_CUCKOO, NULL);
+    assert(mapScan(map, "", 0, NULL, 0, 0, collectPair, &c) == -1);
+    assert(mapEnableIndex(map));
+    char buffer[32];
+    for (int i = 0; i < KEYS; i++) {
+        sprintf(buffer, "app/session:%08d/state", i * 7919 % KEYS);
+        mapSet(map, makeText(buffer), makeInteger(i));
+    }
+    mapSet(map, makeInteger(42), makeInteger(0));
+    // One level with every byte value below it and one with 40, for the two bigger node sizes.
+    for (int i = 1; i < 256; i++) {
+        sprintf(buffer, "tag:%c", i);
+        mapSet(map, makeText(buffer), makeInteger(i));
+        if (i <= 40) {
+            sprintf(buffer, "mid:%c", i + 32);
+            mapSet(map, makeText(buffer), makeInteger(i));
+        }
+    }
+    assert(mapIndexStats(map, &stats));
+    printf("index: %zu keys, %zu/%zu/%zu/%zu nodes, %zu bytes for %zu key bytes\n", stats.keys, stats.nodes[0],
+           stats.nodes[1], stats.nodes[2], stats.nodes[3], stats.bytes, stats.keyBytes);
+    assert(stats.keys == KEYS + 1 + 255 + 40 && stats.nodes[1] > 0 && stats.nodes[2] > 0 && stats.nodes[3] > 0);
+    assert(stats.bytes < stats.keyBytes);
+
+    c = (Collected){ 0 };
+    assert(mapScan(map, "app/session:0000012", 19, NULL, 0, 0, collectPair, &c) == 10);
+    assert(strcmp(c.seen[0], "app/session:00000120/state") == 0 && strcmp(c.seen[9], "app/session:00000129/state") == 0);
+
+    // A cursor picks up where a limited scan stopped.
+    c = (Collected){ 0 };
+    assert(mapScan(map, "app/session:0000012", 19, NULL, 0, 4, collectPair, &c) == 4);
+    assert(mapScan(map, "app/session:0000012", 19, c.seen[3], strlen(c.seen[3]), 0, collectPair, &c) == 6);
+    assert(c.count == 10 && strcmp(c.seen[4], "app/session:00000124/state") == 0);
+
+    c = (Collected){ 0 };
+    assert(mapScan(map, "4", 1, NULL, 0, 0, collectPair, &c) == 1 && strcmp(c.seen[0], "42") == 0);
+
+    for (int i = 0; i < KEYS; i++) {
+        if (i % 100 != 0) {
+            sprintf(buffer, "app/session:%08d/state", i);
+            assert(mapRemoveText(map, buffer, strlen(buffer)));
+        }
+    }
+    for (int i = 1; i < 256; i++) {
+        sprintf(buffer, "tag:%c", i);
+        assert(mapRemoveText(map, buffer, strlen(buffer)));
+    }
+    for (int i = 1; i <= 30; i++) {
+        sprintf(buffer, "mid:%c", i + 32);
+        assert(mapRemoveText(map, buffer, strlen(buffer)));
+    }
+    mapIndexStats(map, &stats);
+    assert(stats.keys == KEYS / 100 + 1 + 10 && stats.nodes[2] == 0 && stats.nodes[3] == 0);
+    c = (Collected){ 0 };
+    assert(mapScan(map, "app/session:", 12, NULL, 0, 0, collectPair, &c) == KEYS / 100);
+    assert(strcmp(c.seen[1], "app/session:00000100/state") == 0);
+    mapFree(map);
+
+    return EXIT_SUCCESS;
+}
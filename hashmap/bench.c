@@ -0,0 +1,653 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+#include "inttable.h"
+#include "lz.h"
+#include "map.h"
+#include "textops.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define BENCH_RDTSC 1
+#endif
+
+/**
+ * @file bench.c
+ * @author Jason Wang
+ * This program is the benchmark harness for the map components. Each benchmark is run by name,
+ * for example "./bench text", and prints one line per measurement.
+ */
+
+/** Sink for computed results, so the compiler can't drop the work being measured. */
+static volatile unsigned int sink;
+
+/**
+ * Reads a timestamp for measuring short intervals.
+ * On x86 this is the time-stamp counter, so differences are in reference cycles; elsewhere it is nanoseconds.
+ * @return The current timestamp.
+ */
+static uint64_t ticks() {
+#ifdef BENCH_RDTSC
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/** Unit of the values returned by ticks(). */
+#ifdef BENCH_RDTSC
+#define TICK_UNIT "cycles"
+#else
+#define TICK_UNIT "ns"
+#endif
+
+/**
+ * The Text hash as hashVType computed it before lengths were stored: djb2 up to the terminating NUL.
+ * @param str The NUL-terminated string to hash.
+ * @return The djb2 hash of the string.
+ */
+static unsigned int djb2Baseline(char const* str) {
+    unsigned int hash = 5381;
+    int c;
+    while ((c = *str++))
+        hash = ((hash << 5) + hash) + c; // hash * 33 + c
+    return hash;
+}
+
+/** Number of strings of each length used by the text benchmark. */
+#define TEXT_KEYS 1024
+
+/** Number of bytes each text measurement runs over. */
+#define TEXT_BYTES (64 << 20)
+
+/**
+ * Makes 'count' pairs of identical random strings of the given length, shaped like composite keys.
+ * Each pair is allocated separately so comparisons can't short-circuit on equal pointers.
+ * @param count The number of pairs.
+ * @param len The length of every string.
+ * @param a Where the first string of each pair is stored.
+ * @param b Where the second string of each pair is stored.
+ */
+static void makeTextKeys(int count, size_t len, char** a, char** b) {
+    for (int i = 0; i < count; i++) {
+        a[i] = (char*)malloc(len + 1);
+        for (size_t j = 0; j < len; j++)
+            a[i][j] = j % 9 == 8 ? ':' : 'a' + rand() % 26;
+        a[i][len] = '\0';
+        b[i] = strdup(a[i]);
+    }
+}
+
+/**
+ * Measures Text hashing and equality in cycles per byte for several key lengths.
+ * The baseline rows are the code used before lengths were stored (djb2 up to the NUL and strcmp);
+ * the other rows are each kernel this CPU can run. Equality is measured on equal strings, the worst case.
+ * @param argc number of benchmark arguments
+ * @param argv benchmark arguments (unused)
+ * @return Exit status: 0 for success.
+ */
+static int benchText(int argc, char* argv[]) {
+    static size_t const lengths[] = { 16, 64, 128, 256, 1024 };
+    int kernelCount;
+    TextKernel const* kernels = textKernels(&kernelCount);
+    char* a[TEXT_KEYS];
+    char* b[TEXT_KEYS];
+
+    printf("%-8s %-16s %12s %12s\n", "length", "kernel", "hash " TICK_UNIT "/B", "equal " TICK_UNIT "/B");
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        size_t len = lengths[l];
+        long rounds = TEXT_BYTES / (len * TEXT_KEYS);
+        double bytes = (double)rounds * TEXT_KEYS * len;
+        makeTextKeys(TEXT_KEYS, len, a, b);
+
+        uint64_t start = ticks();
+        for (long r = 0; r < rounds; r++)
+            for (int i = 0; i < TEXT_KEYS; i++)
+                sink += djb2Baseline(a[i]);
+        double hashCost = (ticks() - start) / bytes;
+
+        start = ticks();
+        for (long r = 0; r < rounds; r++)
+            for (int i = 0; i < TEXT_KEYS; i++)
+                sink += strcmp(a[i], b[i]) == 0;
+        double equalCost = (ticks() - start) / bytes;
+        printf("%-8zu %-16s %12.3f %12.3f\n", len, "baseline", hashCost, equalCost);
+
+        for (int k = 0; k < kernelCount; k++) {
+            start = ticks();
+            for (long r = 0; r < rounds; r++)
+                for (int i = 0; i < TEXT_KEYS; i++)
+                    sink += kernels[k].hash(a[i], len);
+            hashCost = (ticks() - start) / bytes;
+
+            start = ticks();
+            for (long r = 0; r < rounds; r++)
+                for (int i = 0; i < TEXT_KEYS; i++)
+                    sink += kernels[k].equal(a[i], b[i], len);
+            equalCost = (ticks() - start) / bytes;
+            printf("%-8zu %-16s %12.3f %12.3f\n", len, kernels[k].name, hashCost, equalCost);
+        }
+
+        for (int i = 0; i < TEXT_KEYS; i++) {
+            free(a[i]);
+            free(b[i]);
+        }
+    }
+
+    printf("selected kernel: %s\n", textKernel()->name);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Opens a hardware counter for data TLB load misses of the calling thread, in user space only.
+ * @return A file descriptor for the counter, or -1 if perf events aren't available.
+ */
+static int openTlbCounter() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**
+ * Reads how much of the process's anonymous memory is backed by transparent huge pages.
+ * @return The AnonHugePages total from /proc/self/smaps_rollup in kB, or -1 if it can't be read.
+ */
+static long anonHugeKb() {
+    FILE* fp = fopen("/proc/self/smaps_rollup", "r");
+    if (!fp)
+        return -1;
+
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1)
+            break;
+    }
+    fclose(fp);
+    return kb;
+}
+
+/**
+ * Builds a map of Integer keys with the given kind of pages and measures random lookups on it.
+ * Runs in a child process per kind of pages, so each measurement starts from a fresh address space.
+ * Only the bucket array and block slabs come from the page allocator; the key and value VTypes still come from malloc,
+ * so the measured reduction is the part due to the table itself.
+ * @param mode The kind of pages the map is built with.
+ * @param name The name of the kind of pages.
+ * @param entries The number of keys in the map.
+ * @param lookups The number of lookups measured.
+ */
+static void measureTlb(PageMode mode, char const* name, long entries, long lookups) {
+    Map* map = makeMap(entries, pageAllocator(mode));
+    for (long i = 0; i < entries; i++)
+        mapSet(map, makeInteger(i), makeInteger(i));
+
+    int fd = openTlbCounter();
+    uint64_t misses = 0;
+    VType probe = { 'I', 0, { .integer = 0 } };
+    unsigned int seed = 12345;
+
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    uint64_t start = ticks();
+    for (long i = 0; i < lookups; i++) {
+        seed = seed * 1103515245 + 12345;
+        probe.value.integer = (seed >> 1) % entries;
+        sink += mapGet(map, &probe) != NULL;
+    }
+    uint64_t elapsed = ticks() - start;
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &misses, sizeof(misses)) != sizeof(misses))
+            misses = 0;
+        close(fd);
+    }
+
+    PageStats pages;
+    pageAllocatorStats(mode, &pages);
+    if (fd >= 0)
+        printf("%-8s %14.2f %14.4f %12zu %12ld\n", name, (double)elapsed / lookups, (double)misses / lookups,
+               pages.bytes >> 20, anonHugeKb() >> 10);
+    else
+        printf("%-8s %14.2f %14s %12zu %12ld\n", name, (double)elapsed / lookups, "n/a",
+               pages.bytes >> 20, anonHugeKb() >> 10);
+    mapFree(map);
+}
+
+/**
+ * Measures random lookups on a large map with its table on ordinary, transparent huge and explicit huge pages.
+ * Reports the time and data TLB load misses per lookup, the memory mapped for the table and how much of the
+ * process ended up on transparent huge pages.
+ * @param argc number of benchmark arguments
+ * @param argv benchmark arguments: [entries] [lookups], 10M and 5M by default
+ * @return Exit status: 0 for success.
+ */
+static int benchTlb(int argc, char* argv[]) {
+    static char const* const names[] = { "normal", "thp", "hugetlb" };
+    long entries = argc > 0 ? atol(argv[0]) : 10000000;
+    long lookups = argc > 1 ? atol(argv[1]) : 5000000;
+
+    printf("%ld entries, %ld random lookups\n", entries, lookups);
+    printf("%-8s %14s %14s %12s %12s\n", "pages", TICK_UNIT "/lookup", "dTLB miss/op", "table MB", "THP MB");
+    fflush(stdout);
+    for (int mode = PAGES_NORMAL; mode <= PAGES_HUGETLB; mode++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            measureTlb((PageMode)mode, names[mode], entries, lookups);
+            fflush(stdout);
+            _exit(EXIT_SUCCESS);
+        }
+        if (pid > 0)
+            waitpid(pid, NULL, 0);
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Compares two tick counts for qsort.
+ * @param a A pointer to the first count.
+ * @param b A pointer to the second count.
+ * @return Negative, zero or positive as the first count is smaller, equal or larger.
+ */
+static int compareTicks(void const* a, void const* b) {
+    uint64_t x = *(uint64_t const*)a;
+    uint64_t y = *(uint64_t const*)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Times every lookup of a run of random keys one at a time and prints the latency percentiles.
+ * @param map The map to look keys up in.
+ * @param name The name of the row.
+ * @param keys The number of keys stored in the map, 0 to entries - 1.
+ * @param lookups The number of lookups.
+ * @param miss Whether to look up keys that are absent instead of present.
+ * @param samples Space for one tick count per lookup.
+ */
+static void measureLatency(Map* map, char const* name, long keys, long lookups, _Bool miss, uint64_t* samples) {
+    unsigned int seed = 12345;
+    for (long i = 0; i < lookups; i++) {
+        seed = seed * 1103515245 + 12345;
+        int key = (seed >> 1) % keys + (miss ? keys : 0);
+        uint64_t start = ticks();
+        sink += mapGetInt(map, key) != NULL;
+        samples[i] = ticks() - start;
+    }
+
+    qsort(samples, lookups, sizeof(uint64_t), compareTicks);
+    printf("%-16s %-6s %10lu %10lu %10lu %10lu\n", name, miss ? "miss" : "hit", (unsigned long)samples[lookups / 2],
+           (unsigned long)samples[lookups * 99 / 100], (unsigned long)samples[lookups * 999 / 1000],
+           (unsigned long)samples[lookups - 1]);
+}
+
+/**
+ * Measures the latency distribution of single lookups with chained buckets and with cuckoo hashing.
+ * Each map is built without presizing, so both carry whatever their growth left behind. The tail percentiles are the
+ * point: a chained lookup walks a chain of data-dependent length, a cuckoo lookup reads at most two buckets.
+ * @param argc number of benchmark arguments
+ * @param argv benchmark arguments: [entries] [lookups], 1M and 2M by default
+ * @return Exit status: 0 for success.
+ */
+static int benchLatency(int argc, char* argv[]) {
+    static struct {
+        char const* name;
+        MapBackend backend;
+    } const backends[] = { { "chained", MAP_CHAINED }, { "cuckoo", MAP_CUCKOO } };
+    long entries = argc > 0 ? atol(argv[0]) : 1000000;
+    long lookups = argc > 1 ? atol(argv[1]) : 2000000;
+    uint64_t* samples = (uint64_t*)malloc(lookups * sizeof(uint64_t));
+    if (!samples)
+        return EXIT_FAILURE;
+
+    printf("%ld entries, %ld lookups, in %s\n", entries, lookups, TICK_UNIT);
+    printf("%-16s %-6s %10s %10s %10s %10s\n", "backend", "lookup", "p50", "p99", "p99.9", "max");
+    for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+        Map* map = makeMapBackend(0, backends[b].backend, NULL);
+        for (long i = 0; i < entries; i++)
+            mapSet(map, makeInteger(i), makeInteger(i));
+        measureLatency(map, backends[b].name, entries, lookups, 0, samples);
+        measureLatency(map, backends[b].name, entries, lookups, 1, samples);
+        mapFree(map);
+    }
+
+    free(samples);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Measures the LZ codec on JSON-like blobs of several sizes: compression ratio and speed in both directions.
+ * @param argc number of benchmark arguments
+ * @param argv benchmark arguments (unused)
+ * @return Exit status: 0 for success.
+ */
+static int benchCompress(int argc, char* argv[]) {
+    static size_t const sizes[] = { 1024, 4096, 16384, 65536 };
+    size_t max = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+    char* json = (char*)malloc(max + 128);
+    char* packed = (char*)malloc(max + max / 255 + 16);
+    char* unpacked = (char*)malloc(max);
+    if (!json || !packed || !unpacked)
+        return EXIT_FAILURE;
+
+    size_t len = 0;
+    for (int i = 0; len < max; i++)
+        len += sprintf(json + len, "{\"id\":%d,\"user\":\"u%d\",\"score\":%d,\"active\":%s},", i, rand() % 100000,
+                       rand() % 1000, i % 3 ? "true" : "false");
+
+    printf("%-8s %8s %14s %14s\n", "size", "ratio", "compress MB/s", "decomp. MB/s");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size_t size = sizes[i];
+        long rounds = (64 << 20) / size;
+        size_t clen = 0;
+
+        struct timespec t0, t1, t2;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (long r = 0; r < rounds; r++)
+            clen = lzCompress(json, size, packed, size + size / 255 + 16);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        for (long r = 0; r < rounds; r++)
+            sink += lzDecompress(packed, clen, unpacked, size);
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+
+        double mb = (double)rounds * size / (1 << 20);
+        double compressSeconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        double decompressSeconds = (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) / 1e9;
+        printf("%-8zu %8.2f %14.0f %14.0f\n", size, (double)size / clen, mb / compressSeconds, mb / decompressSeconds);
+    }
+
+    free(json);
+    free(packed);
+    free(unpacked);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Measures what tracking hot keys adds to a lookup, without tracking and at several sample rates.
+ * Lookups follow a skewed pattern, a quarter of them on one key, so the tracker's heap is exercised too.
+ * @param argc number of benchmark arguments
+ * @param argv benchmark arguments: [entries], 1M by default
+ * @return Exit status: 0 for success.
+ */
+static int benchHotKeys(int argc, char* argv[]) {
+    long entries = argc > 0 ? atol(argv[0]) : 1000000;
+    long lookups = 20000000;
+    Map* map = makeMap(entries, NULL);
+    int* keys = (int*)malloc(lookups * sizeof(int));
+    if (!map || !keys || entries <= 0)
+        return EXIT_FAILURE;
+    for (long i = 0; i < entries; i++)
+        mapSet(map, makeInteger(i), makeInteger(i));
+    for (long i = 0; i < lookups; i++)
+        keys[i] = i % 4 == 0 ? 42 : rand() % entries;
+
+    static unsigned int const rates[] = { 0, 1, 16, 64, 256 };
+    printf("%-10s %10s %10s\n", "sampling", "ns/lookup", "samples");
+    for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+        if (rates[r] == 0)
+            mapDisableHotKeys(map);
+        else
+            mapEnableHotKeys(map, 16, rates[r]);
+
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (long i = 0; i < lookups; i++)
+            sink += mapGetInt(map, keys[i]) != NULL;
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        HotKeysStats stats = { 0 };
+        mapHotKeysStats(map, &stats);
+        char name[16];
+        snprintf(name, sizeof(name), rates[r] ? "1 in %u" : "off", rates[r]);
+        double nanos = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+        printf("%-10s %10.1f %10zu\n", name, nanos / lookups, stats.samples);
+    }
+
+    free(keys);
+    mapFree(map);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Counts the pairs of a range query, as a mapRange callback.
+ * @param key Unused.
+ * @param value Unused.
+ * @param ctx A pointer to the count.
+ * @return true, to visit the whole range.
+ */
+static _Bool countRanged(VType const* key, VType const* value, void* ctx) {
+    (*(long*)ctx)++;
+    return 1;
+}
+
+/**
+ * Measures what the ordered indexes add to the cost of a set, and how fast a range query streams pairs.
+ * Keys are inserted in a scrambled order so the B+-tree splits all over rather than only at its right edge.
+ * @param argc number of benchmark arguments
+ * @param argv benchmark arguments: [entries], 1M by default
+ * @return Exit status: 0 for success.
+ */
+static int benchOrdered(int argc, char* argv[]) {
+    static char const* const modes[] = { "no index", "range index", "prefix index" };
+    long entries = argc > 0 ? atol(argv[0]) : 1000000;
+
+    printf("%ld entries, scrambled Integer keys\n", entries);
+    printf("%-14s %12s %16s\n", "map", "ns per set", "range Mpairs/s");
+    for (int m = 0; m < 3; m++) {
+        Map* map = makeMap(0, NULL);
+        if (m == 1)
+            mapEnableRangeIndex(map);
+        else if (m == 2)
+            mapEnableIndex(map);
+
+        struct timespec t0, t1, t2;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (long i = 0; i < entries; i++) {
+            int key = (int)(i * 7919 % entries);
+            mapSet(map, makeInteger(key), makeInteger(key));
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        long pairs = 0;
+        if (m == 1) {
+            for (int r = 0; r < 10; r++)
+                mapRange(map, 0, (int)entries, 0, countRanged, &pairs);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+
+        double setNanos = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / entries;
+        double rangeSeconds = (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) / 1e9;
+        if (pairs)
+            printf("%-14s %12.1f %16.1f\n", modes[m], setNanos, pairs / rangeSeconds / 1e6);
+        else
+            printf("%-14s %12.1f %16s\n", modes[m], setNanos, "-");
+        mapFree(map);
+    }
+    return EXIT_SUCCESS;
+}
+
+/** Number of lock-protected maps the keys are spread over when counting with locks. */
+#define COUNTER_SHARDS 64
+
+/**
+ * One map of the lock-based counters and the lock serializing its updates, padded to a cache line of its own.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    Map* map;
+    char pad[64 - (sizeof(pthread_mutex_t) + sizeof(Map*)) % 64];
+} CounterShard;
+
+/**
+ * What one counting thread works on: either the lock-free table or the lock-protected shards.
+ */
+typedef struct {
+    IntTable* table;
+    CounterShard* shards;
+    long keys;
+    long ops;
+    unsigned int seed;
+} CounterTask;
+
+/**
+ * Adds one to an Integer value, creating it at 1, as a mapUpsert callback.
+ * @param value A pointer to the value slot.
+ * @param ctx Unused.
+ * @return true, to keep the update.
+ */
+static _Bool addOne(VType** value, void* ctx) {
+    if (*value)
+        (*value)->value.integer++;
+    else
+        *value = makeInteger(1);
+    return *value != NULL;
+}
+
+/**
+ * Increments random counters, as a thread body.
+ * @param arg A pointer to the thread's CounterTask.
+ * @return NULL.
+ */
+static void* countRandom(void* arg) {
+    CounterTask* task = (CounterTask*)arg;
+    unsigned int state = task->seed;
+    for (long i = 0; i < task->ops; i++) {
+        state = state * 1103515245U + 12345U;
+        int key = (int)((state >> 8) % task->keys);
+        if (task->table) {
+            intTableIncr(task->table, key, 1, NULL);
+        } else {
+            CounterShard* shard = &task->shards[(unsigned int)key % COUNTER_SHARDS];
+            VType k = { 'I', 0, { .integer = key }, 0 };
+            pthread_mutex_lock(&shard->lock);
+            mapUpsert(shard->map, &k, addOne, NULL);
+            pthread_mutex_unlock(&shard->lock);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Measures increments per second of shared counters from 1 to a number of threads, with the lock-free int table and
+ * with maps sharded over mutexes. Gains from more threads need as many free cores; on fewer the two only show their
+ * single-thread cost and how they behave when preempted.
+ * @param argc number of benchmark arguments
+ * @param argv benchmark arguments: [keys] [ops per thread] [max threads], 100K, 2M and 8 by default
+ * @return Exit status: 0 for success.
+ */
+static int benchCounters(int argc, char* argv[]) {
+    long keys = argc > 0 ? atol(argv[0]) : 100000;
+    long ops = argc > 1 ? atol(argv[1]) : 2000000;
+    int maxThreads = argc > 2 ? atoi(argv[2]) : 8;
+    if (keys < 1 || ops < 1 || maxThreads < 1)
+        return EXIT_FAILURE;
+    pthread_t* threads = (pthread_t*)malloc(maxThreads * sizeof(pthread_t));
+    CounterTask* tasks = (CounterTask*)malloc(maxThreads * sizeof(CounterTask));
+    if (!threads || !tasks)
+        return EXIT_FAILURE;
+
+    printf("%ld counters, %ld increments per thread, %ld cores online\n", keys, ops, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-8s %16s %16s\n", "threads", "lock-free Mops/s", "sharded Mops/s");
+    for (int n = 1; n <= maxThreads; n *= 2) {
+        double rates[2];
+        for (int mode = 0; mode < 2; mode++) {
+            IntTable* table = NULL;
+            CounterShard* shards = NULL;
+            if (mode == 0) {
+                table = makeIntTable(keys);
+            } else {
+                shards = (CounterShard*)calloc(COUNTER_SHARDS, sizeof(CounterShard));
+                for (int s = 0; shards && s < COUNTER_SHARDS; s++) {
+                    pthread_mutex_init(&shards[s].lock, NULL);
+                    shards[s].map = makeMap(0, NULL);
+                }
+            }
+            if (!table && !shards)
+                return EXIT_FAILURE;
+
+            struct timespec t0, t1;
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            int started = 0;
+            for (int t = 0; t < n; t++) {
+                tasks[t] = (CounterTask){ table, shards, keys, ops, 2654435761U * (t + 1) };
+                if (pthread_create(&threads[t], NULL, countRandom, &tasks[t]) != 0)
+                    break;
+                started++;
+            }
+            for (int t = 0; t < started; t++)
+                pthread_join(threads[t], NULL);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+            rates[mode] = started * (double)ops / seconds / 1e6;
+
+            intTableFree(table);
+            for (int s = 0; shards && s < COUNTER_SHARDS; s++) {
+                pthread_mutex_destroy(&shards[s].lock);
+                mapFree(shards[s].map);
+            }
+            free(shards);
+        }
+        printf("%-8d %16.1f %16.1f\n", n, rates[0], rates[1]);
+        if (n < maxThreads && n * 2 > maxThreads)
+            n = maxThreads / 2;
+    }
+
+    free(threads);
+    free(tasks);
+    return EXIT_SUCCESS;
+}
+
+/** A benchmark that can be run by name. */
+typedef struct {
+    char const* name;
+    char const* description;
+    int (*run)(int argc, char* argv[]);
+} Benchmark;
+
+/** Every benchmark in the harness. */
+static Benchmark const benchmarks[] = {
+    { "text", "Text hash and equality kernels, in cycles per byte", benchText },
+    { "tlb", "Lookups on a 10M entry map with its table on normal, transparent huge and explicit huge pages", benchTlb },
+    { "latency", "Percentiles of single lookup latency with chained buckets and cuckoo hashing", benchLatency },
+    { "compress", "Compression ratio and speed of the LZ codec on JSON-like values", benchCompress },
+    { "ordered", "Cost per set of the range and prefix indexes, and range query throughput", benchOrdered },
+    { "counters", "Concurrent increments with the lock-free int table and with mutex-sharded maps", benchCounters },
+    { "hotkeys", "Cost per lookup of tracking hot keys at several sample rates", benchHotKeys },
+};
+
+/**
+ * Starting point for the harness: runs the benchmark named by the first argument.
+ * @param argc number of command-line arguments
+ * @param argv list of command-line arguments
+ * @return Exit status: 0 for success, non-zero for errors.
+ */
+int main(int argc, char* argv[]) {
+    int count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+    if (argc >= 2) {
+        for (int i = 0; i < count; i++) {
+            if (strcmp(argv[1], benchmarks[i].name) == 0)
+                return benchmarks[i].run(argc - 2, argv + 2);
+        }
+    }
+
+    fprintf(stderr, "usage: %s <benchmark> [args]\n", argv[0]);
+    for (int i = 0; i < count; i++)
+        fprintf(stderr, "  %-10s %s\n", benchmarks[i].name, benchmarks[i].description);
+    return EXIT_FAILURE;
+}
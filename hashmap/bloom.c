@@ -0,0 +1,179 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bloom.h"
+
+/**
+ * @file bloom.c
+ * @author Jason Wang
+ * This program provides a blocked Bloom filter used to answer lookups for absent keys without probing the map.
+ * Every key maps to a single 64-byte block and all of its bits are set inside that block, so a lookup touches one cache line.
+ */
+
+/** Number of bits in one block; one block fills a 64-byte cache line. */
+#define BLOCK_BITS 512
+
+/** Number of 64-bit words in one block. */
+#define BLOCK_WORDS (BLOCK_BITS / 64)
+
+/** Largest number of bits set per key. */
+#define MAX_HASHES 16
+
+/**
+ * One cache-line-sized block of the filter.
+ */
+typedef struct {
+    uint64_t words[BLOCK_WORDS];
+} Block;
+
+/**
+ * BloomStruct holding the bit array and its sizing.
+ */
+struct BloomStruct {
+    Block* blocks;
+    size_t blockCount;
+    size_t capacity;
+    int hashes;
+    _Bool capped;
+};
+
+/**
+ * Spreads a 32-bit key hash over 64 bits with the splitmix64 finalizer.
+ * The map's hash is cheap and weak in its low bits, so it is remixed before picking a block and bit positions.
+ * @param hash The hash of the key.
+ * @return A well-mixed 64-bit value derived from the hash.
+ */
+static uint64_t mix(unsigned int hash) {
+    uint64_t x = hash + 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * Finds the block a key hash belongs to.
+ * The upper 32 bits of the mixed hash are scaled onto the block count with a multiply instead of a modulo.
+ * @param this A pointer to the Bloom filter.
+ * @param x The mixed hash of the key.
+ * @return A pointer to the block for the key.
+ */
+static Block* blockFor(Bloom const* this, uint64_t x) {
+    return &this->blocks[((x >> 32) * this->blockCount) >> 32];
+}
+
+/**
+ * Creates a new Bloom filter on the heap sized for a number of keys and a target false-positive rate.
+ * The bit array gets -ln(fpr) / ln(2)^2 bits per key, rounded up to whole blocks, and the number of hashes
+ * is chosen to be optimal for the bits per key actually available.
+ * If maxBytes is nonzero, the bit array never grows beyond it and the false-positive rate rises instead.
+ * @param capacity The number of keys the filter should hold at the target rate.
+ * @param fpr The target false-positive rate, between 0 and 1.
+ * @param maxBytes The largest bit array allowed, in bytes, or 0 for no limit.
+ * @return A pointer to the new Bloom filter, or NULL on invalid arguments or memory allocation failure.
+ */
+Bloom* makeBloom(size_t capacity, double fpr, size_t maxBytes) {
+    if (fpr <= 0 || fpr >= 1)
+        return NULL;
+    if (capacity < 1)
+        capacity = 1;
+
+    double bits = ceil(capacity * -log(fpr) / (M_LN2 * M_LN2));
+    size_t blockCount = (size_t)ceil(bits / BLOCK_BITS);
+    _Bool capped = maxBytes && blockCount * sizeof(Block) > maxBytes;
+    if (capped)
+        blockCount = maxBytes / sizeof(Block);
+    if (blockCount < 1)
+        blockCount = 1;
+
+    Bloom* this = (Bloom*)malloc(sizeof(Bloom));
+    if (!this)
+        return NULL;
+
+    // Align the blocks to cache lines so each one really is a single line.
+    if (posix_memalign((void**)&this->blocks, sizeof(Block), blockCount * sizeof(Block)) != 0) {
+        free(this);
+        return NULL;
+    }
+    memset(this->blocks, 0, blockCount * sizeof(Block));
+
+    int hashes = (int)lround((double)blockCount * BLOCK_BITS / capacity * M_LN2);
+    this->hashes = hashes < 1 ? 1 : hashes > MAX_HASHES ? MAX_HASHES : hashes;
+    this->blockCount = blockCount;
+    this->capacity = capacity;
+    this->capped = capped;
+    return this;
+}
+
+/**
+ * Adds a key hash to the Bloom filter.
+ * The bit positions inside the block come from double hashing on the two halves of the lower 32 bits of the mixed hash.
+ * @param this A pointer to the Bloom filter.
+ * @param hash The hash of the key.
+ */
+void bloomAdd(Bloom* this, unsigned int hash) {
+    uint64_t x = mix(hash);
+    Block* block = blockFor(this, x);
+    uint32_t h1 = (uint32_t)x, h2 = (uint32_t)(x >> 16) | 1;
+
+    for (int i = 0; i < this->hashes; i++) {
+        uint32_t bit = (h1 + i * h2) % BLOCK_BITS;
+        block->words[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+/**
+ * Checks whether a key hash may have been added to the Bloom filter.
+ * A false result means the key is definitely absent; a true result may be a false positive.
+ * The required bits are gathered into one mask per word and compared without branching on each bit.
+ * @param this A pointer to the Bloom filter.
+ * @param hash The hash of the key.
+ * @return false if the key was never added, true if it may have been.
+ */
+_Bool bloomMayContain(Bloom const* this, unsigned int hash) {
+    uint64_t x = mix(hash);
+    Block const* block = blockFor(this, x);
+    uint32_t h1 = (uint32_t)x, h2 = (uint32_t)(x >> 16) | 1;
+
+    uint64_t mask[BLOCK_WORDS] = { 0 };
+    for (int i = 0; i < this->hashes; i++) {
+        uint32_t bit = (h1 + i * h2) % BLOCK_BITS;
+        mask[bit / 64] |= 1ULL << (bit % 64);
+    }
+
+    uint64_t missing = 0;
+    for (int i = 0; i < BLOCK_WORDS; i++)
+        missing |= mask[i] & ~block->words[i];
+
+    return missing == 0;
+}
+
+/**
+ * Fills in the sizing and estimated false-positive rate of the Bloom filter.
+ * The estimate uses the classic (1 - e^(-kn/m))^k formula; blocking makes the real rate slightly higher.
+ * The filter doesn't count lookups itself, so the lookup counters are set to zero for the owner to fill in.
+ * @param this A pointer to the Bloom filter.
+ * @param keys The number of keys currently in the filter.
+ * @param stats A pointer to the BloomStats to be filled in.
+ */
+void bloomStats(Bloom const* this, size_t keys, BloomStats* stats) {
+    double bits = (double)this->blockCount * BLOCK_BITS;
+    stats->bytes = this->blockCount * sizeof(Block);
+    stats->hashes = this->hashes;
+    stats->capacity = this->capacity;
+    stats->capped = this->capped;
+    stats->fpr = pow(1 - exp(-this->hashes * (double)keys / bits), this->hashes);
+    stats->lookups = 0;
+    stats->rejected = 0;
+}
+
+/**
+ * Frees the memory occupied by the Bloom filter.
+ * @param this A pointer to the Bloom filter to be freed.
+ */
+void bloomFree(Bloom* this) {
+    if (this) {
+        free(this->blocks);
+        free(this);
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stddef.h>
+
+// Define your Bloom struct here
+typedef struct BloomStruct Bloom;
+
+/** Sizing and hit counters reported for a Bloom filter. */
+typedef struct {
+    /** Memory used by the bit array, in bytes. */
+    size_t bytes;
+
+    /** Number of bits set per key. */
+    int hashes;
+
+    /** Number of keys the filter was sized for. */
+    size_t capacity;
+
+    /** Whether the bit array was cut down to the memory cap, so sizing for more keys wouldn't enlarge it. */
+    _Bool capped;
+
+    /** Estimated false-positive rate for the keys currently in the filter. */
+    double fpr;
+
+    /** Number of lookups checked against the filter. */
+    size_t lookups;
+
+    /** Number of lookups the filter answered as definitely absent. */
+    size_t rejected;
+} BloomStats;
+
+/*Function prototypes*/
+Bloom* makeBloom(size_t capacity, double fpr, size_t maxBytes);
+void bloomAdd(Bloom* this, unsigned int hash);
+_Bool bloomMayContain(Bloom const* this, unsigned int hash);
+void bloomStats(Bloom const* this, size_t keys, BloomStats* stats);
+void bloomFree(Bloom* this);
+
+#endif // BLOOM_H
@@ -0,0 +1,68 @@
+// Simple test program for the Bloom filter component and the filter in front of a Map.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bloom.h"
+#include "map.h"
+
+int main() {
+    // Size a filter for 10000 keys at a 1% false-positive rate.
+    Bloom* b = makeBloom(10000, 0.01, 0);
+    assert(b);
+
+    // Invalid rates should be rejected.
+    assert(!makeBloom(10000, 0, 0));
+    assert(!makeBloom(10000, 1, 0));
+
+    // Add every even hash.
+    for (unsigned int i = 0; i < 20000; i += 2)
+        bloomAdd(b, i * 2654435761u);
+
+    // There must never be a false negative.
+    for (unsigned int i = 0; i < 20000; i += 2)
+        assert(bloomMayContain(b, i * 2654435761u));
+
+    // The odd hashes were never added; only a few should get through.
+    int falsePositives = 0;
+    for (unsigned int i = 1; i < 20000; i += 2)
+        falsePositives += bloomMayContain(b, i * 2654435761u);
+    printf("false positives: %d / 10000\n", falsePositives);
+    assert(falsePositives < 300);
+
+    // Check the reported sizing.
+    BloomStats stats;
+    bloomStats(b, 10000, &stats);
+    assert(stats.capacity == 10000);
+    assert(stats.bytes % 64 == 0);
+    assert(stats.fpr > 0.005 && stats.fpr < 0.02 && !stats.capped);
+
+    // A memory cap should limit the size of the bit array.
+    Bloom* small = makeBloom(1000000, 0.001, 4096);
+    bloomStats(small, 0, &stats);
+    assert(stats.bytes == 4096 && stats.capped);
+
+    bloomFree(b);
+    bloomFree(small);
+
+    // A Map's filter keeps growing with the Map while it is below its cap, and stops at the cap.
+    Map* map = makeMap(0, NULL);
+    Map* capped = makeMap(0, NULL);
+    assert(mapEnableFilter(map, 0.01, 1024 * 1024) && mapEnableFilter(capped, 0.01, 4096));
+    for (int i = 0; i < 50000; i++) {
+        mapSet(map, makeInteger(i), makeInteger(i));
+        mapSet(capped, makeInteger(i), makeInteger(i));
+    }
+    assert(mapFilterStats(map, &stats));
+    printf("filter: %zu bytes for %zu keys, est. fpr %.4f%%\n", stats.bytes, stats.capacity, 100 * stats.fpr);
+    assert(stats.capacity >= 50000 && stats.bytes > 4096 && stats.fpr < 0.02 && !stats.capped);
+    assert(mapFilterStats(capped, &stats));
+    assert(stats.bytes == 4096 && stats.capped);
+    for (int i = 0; i < 50000; i++)
+        assert(mapGetInt(map, i) && mapGetInt(capped, i));
+    mapFree(map);
+    mapFree(capped);
+
+    return EXIT_SUCCESS;
+}
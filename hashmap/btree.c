@@ -0,0 +1,581 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include "btree.h"
+
+/**
+ * @file btree.c
+ * @author Jason Wang
+ * This program provides a B+-tree of ints, used to keep the Integer keys of a map in order for range, minimum, maximum
+ * and successor queries. Every key lives in a leaf and the leaves are chained in key order, so a range query descends
+ * once and then walks the chain. Nodes are 256 bytes, four cache lines, so a leaf holds 60 keys and an inner node
+ * 20 separators; a tree of a million keys is five levels deep. Nodes are split in half when they fill up, except that
+ * appending to the right edge of the tree leaves full nodes behind, so keys inserted in ascending order pack densely.
+ * A remove that leaves a node short borrows from or merges with a sibling.
+ */
+
+/** Most keys in a leaf, and the fewest a remove may leave in a leaf other than the root before it is topped up. */
+#define LEAF_KEYS 60
+#define LEAF_MIN (LEAF_KEYS / 2)
+
+/** Most separator keys in an inner node, which has one more child than separators, and the fewest a remove may leave. */
+#define INNER_KEYS 20
+#define INNER_MIN (INNER_KEYS / 2)
+
+/**
+ * Header shared by leaves and inner nodes.
+ */
+typedef struct {
+    int leaf;
+    int count;
+} BNode;
+
+/**
+ * Leaf holding keys in ascending order, with a link to the next leaf.
+ */
+typedef struct LeafStruct {
+    BNode n;
+    struct LeafStruct* next;
+    int keys[LEAF_KEYS];
+} Leaf;
+
+/**
+ * Inner node: children[i] holds the keys from keys[i - 1] (inclusive) up to keys[i] (exclusive).
+ */
+typedef struct {
+    BNode n;
+    int keys[INNER_KEYS];
+    BNode* children[INNER_KEYS + 1];
+} Inner;
+
+/**
+ * BTreeStruct holding the root of the tree and its size counters.
+ */
+struct BTreeStruct {
+    BNode* root;
+    size_t keys;
+    size_t leaves;
+    size_t inners;
+    int depth;
+
+    /** Inner nodes set aside so an insert never fails half way through splitting, chained through children[0]. */
+    Inner* spares;
+    int spareCount;
+};
+
+/**
+ * Finds the first position in a sorted run of keys whose key is at least the given one.
+ * @param keys The keys.
+ * @param count The number of keys.
+ * @param key The key to look for.
+ * @return The position, or 'count' if every key is smaller.
+ */
+static int lowerBound(int const* keys, int count, int key) {
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (keys[mid] < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * Finds the child of an inner node whose range holds a key.
+ * @param n A pointer to the inner node.
+ * @param key The key.
+ * @return The index of the child.
+ */
+static int childIndex(Inner const* n, int key) {
+    int lo = 0, hi = n->n.count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (n->keys[mid] <= key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * Allocates an empty leaf.
+ * @param this A pointer to the tree.
+ * @return A pointer to the leaf, or NULL on memory allocation failure.
+ */
+static Leaf* allocLeaf(BTree* this) {
+    Leaf* leaf = (Leaf*)malloc(sizeof(Leaf));
+    if (leaf) {
+        leaf->n = (BNode){ 1, 0 };
+        leaf->next = NULL;
+        this->leaves++;
+    }
+    return leaf;
+}
+
+/**
+ * Sets aside enough inner nodes for the splits one insert can cause: one per inner level and one for a new root.
+ * A leaf split happens before anything changes, but an inner node only splits after its child already has,
+ * so it takes its new node from the spares rather than risk failing with the child's half in hand.
+ * @param this A pointer to the tree.
+ * @return true if the spares are there, false on memory allocation failure.
+ */
+static _Bool reserveInners(BTree* this) {
+    while (this->spareCount < this->depth) {
+        Inner* inner = (Inner*)malloc(sizeof(Inner));
+        if (!inner)
+            return 0;
+        inner->children[0] = (BNode*)this->spares;
+        this->spares = inner;
+        this->spareCount++;
+    }
+    return 1;
+}
+
+/**
+ * Takes an empty inner node from the spares.
+ * @param this A pointer to the tree, with spares set aside by 'reserveInners'.
+ * @return A pointer to the inner node.
+ */
+static Inner* allocInner(BTree* this) {
+    Inner* inner = this->spares;
+    this->spares = (Inner*)inner->children[0];
+    this->spareCount--;
+    inner->n = (BNode){ 0, 0 };
+    this->inners++;
+    return inner;
+}
+
+/**
+ * Frees a node, but not its children.
+ * @param this A pointer to the tree.
+ * @param n A pointer to the node.
+ */
+static void freeBNode(BTree* this, BNode* n) {
+    if (n->leaf)
+        this->leaves--;
+    else
+        this->inners--;
+    free(n);
+}
+
+/**
+ * Inserts a key into a subtree. A node that is full is split in two; the new right half and the smallest key
+ * it covers are handed back for the parent to add.
+ * Keys often arrive in ascending order, so a full node on the right edge of the tree that is appended to keeps
+ * all its keys and starts a new node with just the new one, rather than leaving two half-empty nodes behind.
+ * @param this A pointer to the tree.
+ * @param n A pointer to the root of the subtree.
+ * @param key The key.
+ * @param rightmost Whether the subtree is on the right edge of the tree.
+ * @param split Where the new right half is stored when the node splits, otherwise left alone.
+ * @param splitKey Where the smallest key of the new right half is stored when the node splits.
+ * @return 1 if the key was inserted, 0 if it is already there, -1 on memory allocation failure.
+ */
+static int insertAt(BTree* this, BNode* n, int key, _Bool rightmost, BNode** split, int* splitKey) {
+    if (n->leaf) {
+        Leaf* leaf = (Leaf*)n;
+        int i = lowerBound(leaf->keys, n->count, key);
+        if (i < n->count && leaf->keys[i] == key)
+            return 0;
+
+        Leaf* right = NULL;
+        if (n->count == LEAF_KEYS) {
+            if (!(right = allocLeaf(this)))
+                return -1;
+            int half = rightmost && i == LEAF_KEYS ? LEAF_KEYS : LEAF_KEYS / 2;
+            right->n.count = LEAF_KEYS - half;
+            memcpy(right->keys, leaf->keys + half, right->n.count * sizeof(int));
+            n->count = half;
+            right->next = leaf->next;
+            leaf->next = right;
+            if (i > half || half == LEAF_KEYS) {
+                leaf = right;
+                i -= half;
+            }
+        }
+
+        memmove(leaf->keys + i + 1, leaf->keys + i, (leaf->n.count - i) * sizeof(int));
+        leaf->keys[i] = key;
+        leaf->n.count++;
+        if (right) {
+            *split = &right->n;
+            *splitKey = right->keys[0];
+        }
+        return 1;
+    }
+
+    Inner* inner = (Inner*)n;
+    int i = childIndex(inner, key);
+    BNode* childSplit = NULL;
+    int childKey;
+    int result = insertAt(this, inner->children[i], key, rightmost && i == n->count, &childSplit, &childKey);
+    if (result <= 0 || !childSplit)
+        return result;
+
+    // The child split: its right half goes in just after it, first making room by splitting this node if it is full.
+    if (n->count == INNER_KEYS) {
+        Inner* right = allocInner(this);
+        *split = &right->n;
+        if (rightmost && i == INNER_KEYS) {
+            right->children[0] = childSplit;
+            *splitKey = childKey;
+            return 1;
+        }
+
+        int mid = INNER_KEYS / 2;
+        right->n.count = INNER_KEYS - mid - 1;
+        memcpy(right->keys, inner->keys + mid + 1, right->n.count * sizeof(int));
+        memcpy(right->children, inner->children + mid + 1, (right->n.count + 1) * sizeof(BNode*));
+        n->count = mid;
+        *splitKey = inner->keys[mid];
+        if (i > mid) {
+            inner = right;
+            i -= mid + 1;
+        }
+    }
+
+    memmove(inner->keys + i + 1, inner->keys + i, (inner->n.count - i) * sizeof(int));
+    memmove(inner->children + i + 2, inner->children + i + 1, (inner->n.count - i) * sizeof(BNode*));
+    inner->keys[i] = childKey;
+    inner->children[i + 1] = childSplit;
+    inner->n.count++;
+    return 1;
+}
+
+/**
+ * Removes the separator at a position of an inner node and the child to its right.
+ * @param n A pointer to the inner node.
+ * @param i The position of the separator.
+ */
+static void dropSeparator(Inner* n, int i) {
+    memmove(n->keys + i, n->keys + i + 1, (n->n.count - i - 1) * sizeof(int));
+    memmove(n->children + i + 1, n->children + i + 2, (n->n.count - i - 1) * sizeof(BNode*));
+    n->n.count--;
+}
+
+/**
+ * Tops up a leaf left short by a remove, from a sibling that can spare a key or else by merging with a sibling.
+ * @param this A pointer to the tree.
+ * @param p A pointer to the parent.
+ * @param i The index of the short leaf in the parent.
+ */
+static void fixLeaf(BTree* this, Inner* p, int i) {
+    Leaf* child = (Leaf*)p->children[i];
+    Leaf* left = i > 0 ? (Leaf*)p->children[i - 1] : NULL;
+    Leaf* right = i < p->n.count ? (Leaf*)p->children[i + 1] : NULL;
+
+    if (left && left->n.count > LEAF_MIN) {
+        memmove(child->keys + 1, child->keys, child->n.count * sizeof(int));
+        child->keys[0] = left->keys[--left->n.count];
+        child->n.count++;
+        p->keys[i - 1] = child->keys[0];
+    } else if (right && right->n.count > LEAF_MIN) {
+        child->keys[child->n.count++] = right->keys[0];
+        memmove(right->keys, right->keys + 1, --right->n.count * sizeof(int));
+        p->keys[i] = right->keys[0];
+    } else {
+        // Merge the pair into the left one of the two; the right one goes away.
+        if (left) {
+            right = child;
+            child = left;
+            i--;
+        }
+        memcpy(child->keys + child->n.count, right->keys, right->n.count * sizeof(int));
+        child->n.count += right->n.count;
+        child->next = right->next;
+        dropSeparator(p, i);
+        freeBNode(this, &right->n);
+    }
+}
+
+/**
+ * Tops up an inner node left short by a remove, rotating a child through the parent from a sibling that can spare one,
+ * or else merging it with a sibling around the separator between them.
+ * @param this A pointer to the tree.
+ * @param p A pointer to the parent.
+ * @param i The index of the short node in the parent.
+ */
+static void fixInner(BTree* this, Inner* p, int i) {
+    Inner* child = (Inner*)p->children[i];
+    Inner* left = i > 0 ? (Inner*)p->children[i - 1] : NULL;
+    Inner* right = i < p->n.count ? (Inner*)p->children[i + 1] : NULL;
+
+    if (left && left->n.count > INNER_MIN) {
+        memmove(child->keys + 1, child->keys, child->n.count * sizeof(int));
+        memmove(child->children + 1, child->children, (child->n.count + 1) * sizeof(BNode*));
+        child->keys[0] = p->keys[i - 1];
+        child->children[0] = left->children[left->n.count];
+        child->n.count++;
+        p->keys[i - 1] = left->keys[--left->n.count];
+    } else if (right && right->n.count > INNER_MIN) {
+        child->keys[child->n.count] = p->keys[i];
+        child->children[child->n.count + 1] = right->children[0];
+        child->n.count++;
+        p->keys[i] = right->keys[0];
+        memmove(right->keys, right->keys + 1, (right->n.count - 1) * sizeof(int));
+        memmove(right->children, right->children + 1, right->n.count * sizeof(BNode*));
+        right->n.count--;
+    } else {
+        if (left) {
+            right = child;
+            child = left;
+            i--;
+        }
+        child->keys[child->n.count] = p->keys[i];
+        memcpy(child->keys + child->n.count + 1, right->keys, right->n.count * sizeof(int));
+        memcpy(child->children + child->n.count + 1, right->children, (right->n.count + 1) * sizeof(BNode*));
+        child->n.count += right->n.count + 1;
+        dropSeparator(p, i);
+        freeBNode(this, &right->n);
+    }
+}
+
+/**
+ * Removes a key from a subtree, rebalancing any child left short on the way back up.
+ * @param this A pointer to the tree.
+ * @param n A pointer to the root of the subtree.
+ * @param key The key.
+ * @return true if the key was removed, false if it isn't there.
+ */
+static _Bool removeAt(BTree* this, BNode* n, int key) {
+    if (n->leaf) {
+        Leaf* leaf = (Leaf*)n;
+        int i = lowerBound(leaf->keys, n->count, key);
+        if (i == n->count || leaf->keys[i] != key)
+            return 0;
+        memmove(leaf->keys + i, leaf->keys + i + 1, (n->count - i - 1) * sizeof(int));
+        n->count--;
+        return 1;
+    }
+
+    Inner* inner = (Inner*)n;
+    int i = childIndex(inner, key);
+    BNode* child = inner->children[i];
+    if (!removeAt(this, child, key))
+        return 0;
+    if (child->leaf && child->count < LEAF_MIN)
+        fixLeaf(this, inner, i);
+    else if (!child->leaf && child->count < INNER_MIN)
+        fixInner(this, inner, i);
+    return 1;
+}
+
+/**
+ * Finds the leaf whose range holds a key.
+ * @param this A pointer to the tree, which must not be empty.
+ * @param key The key.
+ * @return A pointer to the leaf.
+ */
+static Leaf* findLeaf(BTree* this, int key) {
+    BNode* n = this->root;
+    while (!n->leaf)
+        n = ((Inner*)n)->children[childIndex((Inner*)n, key)];
+    return (Leaf*)n;
+}
+
+/**
+ * Frees a subtree.
+ * @param this A pointer to the tree.
+ * @param n A pointer to the root of the subtree.
+ */
+static void freeSubtree(BTree* this, BNode* n) {
+    if (!n->leaf) {
+        for (int i = 0; i <= n->count; i++)
+            freeSubtree(this, ((Inner*)n)->children[i]);
+    }
+    freeBNode(this, n);
+}
+
+/**
+ * Creates a new, empty B+-tree on the heap.
+ * Memory allocated for the tree should be freed by the caller with 'btreeFree' when no longer needed.
+ * @return A pointer to the tree, or NULL on memory allocation failure.
+ */
+BTree* makeBTree() {
+    return (BTree*)calloc(1, sizeof(BTree));
+}
+
+/**
+ * Adds a key to the tree.
+ * @param this A pointer to the tree.
+ * @param key The key.
+ * @return true if the key was added, false if it is already there or on memory allocation failure.
+ */
+_Bool btreeInsert(BTree* this, int key) {
+    if (!this->root) {
+        Leaf* leaf = allocLeaf(this);
+        if (!leaf)
+            return 0;
+        this->root = &leaf->n;
+        this->depth = 1;
+    }
+    if (!reserveInners(this))
+        return 0;
+
+    BNode* split = NULL;
+    int splitKey;
+    int result = insertAt(this, this->root, key, 1, &split, &splitKey);
+    if (split) {
+        // The root split: a new root goes on top, so the tree grows by one level.
+        Inner* root = allocInner(this);
+        root->n.count = 1;
+        root->keys[0] = splitKey;
+        root->children[0] = this->root;
+        root->children[1] = split;
+        this->root = &root->n;
+        this->depth++;
+    }
+    if (result <= 0)
+        return 0;
+    this->keys++;
+    return 1;
+}
+
+/**
+ * Removes a key from the tree.
+ * @param this A pointer to the tree.
+ * @param key The key.
+ * @return true if the key was removed, false if it isn't there.
+ */
+_Bool btreeRemove(BTree* this, int key) {
+    if (!this->root || !removeAt(this, this->root, key))
+        return 0;
+    this->keys--;
+
+    // A root left with a single child hands over to it, and an empty tree drops its last leaf.
+    if (!this->root->leaf && this->root->count == 0) {
+        BNode* root = this->root;
+        this->root = ((Inner*)root)->children[0];
+        freeBNode(this, root);
+        this->depth--;
+    } else if (this->root->leaf && this->root->count == 0) {
+        freeBNode(this, this->root);
+        this->root = NULL;
+        this->depth = 0;
+    }
+    return 1;
+}
+
+/**
+ * Checks whether the tree holds a key.
+ * @param this A pointer to the tree.
+ * @param key The key.
+ * @return true if the key is in the tree.
+ */
+_Bool btreeContains(BTree* this, int key) {
+    if (!this->root)
+        return 0;
+    Leaf* leaf = findLeaf(this, key);
+    int i = lowerBound(leaf->keys, leaf->n.count, key);
+    return i < leaf->n.count && leaf->keys[i] == key;
+}
+
+/**
+ * Visits the keys from 'lo' to 'hi', both inclusive, in ascending order, until the visitor returns false.
+ * The walk descends to the first key once and then follows the leaf chain, so nothing is collected up front.
+ * @param this A pointer to the tree.
+ * @param lo The smallest key to visit.
+ * @param hi The largest key to visit.
+ * @param fn The callback invoked with each key and the 'ctx' pointer.
+ * @param ctx An arbitrary pointer passed through to the callback.
+ */
+void btreeRange(BTree* this, int lo, int hi, BTreeVisitor fn, void* ctx) {
+    if (!this->root || lo > hi)
+        return;
+
+    Leaf* leaf = findLeaf(this, lo);
+    for (int i = lowerBound(leaf->keys, leaf->n.count, lo); leaf; leaf = leaf->next, i = 0) {
+        for (; i < leaf->n.count; i++) {
+            if (leaf->keys[i] > hi || !fn(leaf->keys[i], ctx))
+                return;
+        }
+    }
+}
+
+/**
+ * Finds the smallest key in the tree.
+ * @param this A pointer to the tree.
+ * @param key Where the key is stored.
+ * @return true if the tree has a key, false if it is empty.
+ */
+_Bool btreeMin(BTree* this, int* key) {
+    if (!this->root)
+        return 0;
+    BNode* n = this->root;
+    while (!n->leaf)
+        n = ((Inner*)n)->children[0];
+    *key = ((Leaf*)n)->keys[0];
+    return 1;
+}
+
+/**
+ * Finds the largest key in the tree.
+ * @param this A pointer to the tree.
+ * @param key Where the key is stored.
+ * @return true if the tree has a key, false if it is empty.
+ */
+_Bool btreeMax(BTree* this, int* key) {
+    if (!this->root)
+        return 0;
+    BNode* n = this->root;
+    while (!n->leaf)
+        n = ((Inner*)n)->children[n->count];
+    *key = ((Leaf*)n)->keys[n->count - 1];
+    return 1;
+}
+
+/**
+ * Finds the smallest key in the tree greater than the given one.
+ * @param this A pointer to the tree.
+ * @param key The key to start after, which need not be in the tree.
+ * @param next Where the key found is stored.
+ * @return true if there is a greater key, false otherwise.
+ */
+_Bool btreeNext(BTree* this, int key, int* next) {
+    if (!this->root || key == INT_MAX)
+        return 0;
+
+    Leaf* leaf = findLeaf(this, key + 1);
+    int i = lowerBound(leaf->keys, leaf->n.count, key + 1);
+    // The leaf covering the key may end below it; the successor is then the first key of the next leaf.
+    if (i == leaf->n.count) {
+        if (!(leaf = leaf->next))
+            return 0;
+        i = 0;
+    }
+    *next = leaf->keys[i];
+    return 1;
+}
+
+/**
+ * Reports the size counters of the tree.
+ * @param this A pointer to the tree.
+ * @param stats A pointer to the BTreeStats to be filled in.
+ */
+void btreeStats(BTree const* this, BTreeStats* stats) {
+    stats->keys = this->keys;
+    stats->leaves = this->leaves;
+    stats->inners = this->inners;
+    stats->depth = this->depth;
+    stats->bytes = this->leaves * sizeof(Leaf) + this->inners * sizeof(Inner);
+}
+
+/**
+ * Frees the memory occupied by the tree.
+ * @param this A pointer to the tree to be freed.
+ */
+void btreeFree(BTree* this) {
+    if (!this)
+        return;
+    if (this->root)
+        freeSubtree(this, this->root);
+    while (this->spares) {
+        Inner* spare = this->spares;
+        this->spares = (Inner*)spare->children[0];
+        free(spare);
+    }
+    free(this);
+}
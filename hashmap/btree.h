@@ -0,0 +1,40 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <stddef.h>
+
+// Define your BTree struct here
+typedef struct BTreeStruct BTree;
+
+// Callback used by btreeRange; return 0 to stop the walk.
+typedef _Bool (*BTreeVisitor)(int key, void* ctx);
+
+/** Size counters reported for a B+-tree. */
+typedef struct {
+    /** Number of keys stored. */
+    size_t keys;
+
+    /** Number of leaf and inner nodes. */
+    size_t leaves;
+    size_t inners;
+
+    /** Number of levels, counting the leaves; 0 for an empty tree. */
+    int depth;
+
+    /** Memory used by the nodes, in bytes. */
+    size_t bytes;
+} BTreeStats;
+
+/*Function prototypes*/
+BTree* makeBTree();
+_Bool btreeInsert(BTree* this, int key);
+_Bool btreeRemove(BTree* this, int key);
+_Bool btreeContains(BTree* this, int key);
+void btreeRange(BTree* this, int lo, int hi, BTreeVisitor fn, void* ctx);
+_Bool btreeMin(BTree* this, int* key);
+_Bool btreeMax(BTree* this, int* key);
+_Bool btreeNext(BTree* this, int key, int* next);
+void btreeStats(BTree const* this, BTreeStats* stats);
+void btreeFree(BTree* this);
+
+#endif // BTREE_H
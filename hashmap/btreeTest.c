@@ -0,0 +1,120 @@
+// Simple test program for the B+-tree and the range queries built on it.
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "btree.h"
+#include "map.h"
+
+#define KEYS 200000
+
+// Checks that a walk sees keys in ascending order and counts them.
+typedef struct {
+    long count;
+    long last;
+    long stopAfter;
+} Walk;
+
+static _Bool walkKey(int key, void* ctx) {
+    Walk* w = (Walk*)ctx;
+    assert(w->count == 0 || key > w->last);
+    w->last = key;
+    return ++w->count != w->stopAfter;
+}
+
+static _Bool walkPair(VType const* key, VType const* value, void* ctx) {
+    assert(key->type == 'I' && value->value.integer == key->value.integer * 3);
+    return walkKey(key->value.integer, ctx);
+}
+
+int main() {
+    // Insert the even keys below 2 * KEYS in a scrambled order, so splits happen all over the tree.
+    BTree* tree = makeBTree();
+    int key;
+    assert(!btreeMin(tree, &key) && !btreeMax(tree, &key) && !btreeNext(tree, 0, &key));
+    for (long i = 0; i < KEYS; i++)
+        assert(btreeInsert(tree, (int)(i * 7919 % KEYS) * 2));
+    assert(!btreeInsert(tree, 10));
+
+    BTreeStats stats;
+    btreeStats(tree, &stats);
+    printf("%zu keys, %zu leaves, %zu inner nodes, depth %d, %zu bytes\n", stats.keys, stats.leaves, stats.inners,
+           stats.depth, stats.bytes);
+    assert(stats.keys == KEYS && stats.depth >= 3);
+
+    assert(btreeMin(tree, &key) && key == 0);
+    assert(btreeMax(tree, &key) && key == (KEYS - 1) * 2);
+    assert(btreeNext(tree, 10, &key) && key == 12);
+    assert(btreeNext(tree, 11, &key) && key == 12);
+    assert(btreeNext(tree, -5, &key) && key == 0);
+    assert(!btreeNext(tree, (KEYS - 1) * 2, &key));
+    assert(btreeContains(tree, 1000) && !btreeContains(tree, 1001));
+
+    Walk w = { 0, 0, 0 };
+    btreeRange(tree, 101, 300, walkKey, &w);
+    assert(w.count == 100 && w.last == 300);
+    w = (Walk){ 0, 0, 0 };
+    btreeRange(tree, INT_MIN, INT_MAX, walkKey, &w);
+    assert(w.count == KEYS);
+    w = (Walk){ 0, 0, 5 };
+    btreeRange(tree, 0, INT_MAX, walkKey, &w);
+    assert(w.count == 5 && w.last == 8);
+
+    // Remove most keys, in another scrambled order; the tree shrinks and stays in order.
+    for (long i = 0; i < KEYS; i++) {
+        int k = (int)(i * 104729 % KEYS) * 2;
+        if (k % 1000 != 0)
+            assert(btreeRemove(tree, k));
+    }
+    assert(!btreeRemove(tree, 2) && !btreeRemove(tree, 1));
+    btreeStats(tree, &stats);
+    assert(stats.keys == KEYS / 500 && stats.depth <= 2);
+    w = (Walk){ 0, 0, 0 };
+    btreeRange(tree, INT_MIN, INT_MAX, walkKey, &w);
+    assert(w.count == KEYS / 500);
+    assert(btreeNext(tree, 0, &key) && key == 1000);
+    for (int k = 0; k < KEYS * 2; k += 1000)
+        assert(btreeRemove(tree, k));
+    btreeStats(tree, &stats);
+    assert(stats.keys == 0 && stats.leaves == 0 && stats.inners == 0 && stats.depth == 0);
+    btreeFree(tree);
+
+    // Keys inserted in ascending order fill their leaves instead of leaving them half empty.
+    tree = makeBTree();
+    for (int k = 0; k < KEYS; k++)
+        assert(btreeInsert(tree, k));
+    btreeStats(tree, &stats);
+    assert(stats.leaves == (KEYS + 59) / 60);
+    w = (Walk){ 0, 0, 0 };
+    btreeRange(tree, 1000, 1999, walkKey, &w);
+    assert(w.count == 1000);
+    for (int k = 0; k < KEYS; k += 2)
+        assert(btreeRemove(tree, k));
+    assert(btreeNext(tree, 1000, &key) && key == 1001);
+    btreeFree(tree);
+
+    // A Map keeps its range index in step with sets and removes, and ignores Text keys.
+    Map* map = makeMap(0, NULL);
+    assert(mapRange(map, 0, 10, 0, walkPair, &w) == -1 && !mapMinKey(map, &key));
+    for (int i = -500; i < 500; i++)
+        mapSet(map, makeInteger(i), makeInteger(i * 3));
+    mapSet(map, makeText("text"), makeInteger(0));
+    assert(mapEnableRangeIndex(map));
+    mapSet(map, makeInteger(1000), makeInteger(3000));
+    assert(mapMinKey(map, &key) && key == -500);
+    assert(mapMaxKey(map, &key) && key == 1000);
+    assert(mapNextKey(map, 499, &key) && key == 1000);
+    assert(mapRemoveInt(map, 1000) && !mapNextKey(map, 499, &key));
+
+    w = (Walk){ 0, 0, 0 };
+    assert(mapRange(map, -10, 10, 0, walkPair, &w) == 21 && w.last == 10);
+    w = (Walk){ 0, 0, 0 };
+    assert(mapRange(map, 0, 499, 7, walkPair, &w) == 7 && w.last == 6);
+    mapRangeStats(map, &stats);
+    assert(stats.keys == 1000);
+    mapFree(map);
+
+    return EXIT_SUCCESS;
+}
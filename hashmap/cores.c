@@ -0,0 +1,454 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cores.h"
+
+/**
+ * @file cores.c
+ * @author Jason Wang
+ * This program provides a shared-nothing way to run a map on several cores. Each core runs one thread, pinned to it,
+ * that alone owns a Map holding the keys whose hash sends them to that core, so no lock is taken and no cache line
+ * of a partition is ever written by two cores. One dispatching thread hands requests to the cores through one ring
+ * per core: the dispatcher is its only producer and the core its only consumer, and the core writes its response
+ * into the request's slot, which the dispatcher takes back in order. Requests to different cores run in parallel,
+ * and the dispatcher hands out the responses in the order the requests were submitted.
+ * Each partition is made by its own core after that core is pinned. Linux places a page on the NUMA node of the
+ * CPU that first touches it, so the partition's table, blocks, keys and values end up in memory local to its core.
+ */
+
+/** Number of slots in each core's ring; a power of two. */
+#define CORE_SLOTS 256
+
+/** Number of times an idle thread polls before it yields the CPU, and yields before a core goes to sleep. */
+#define SPIN_POLLS 1000
+#define YIELD_POLLS 100
+
+/**
+ * One request in a core's ring and, once the core has run it, its response.
+ */
+typedef struct {
+    CoreTask task;
+    char* request;
+    size_t len;
+    size_t capacity;
+    CoreReply reply;
+} Slot;
+
+/**
+ * A core: its thread, its partition and its ring.
+ * The counters written by the dispatcher and by the core sit on separate cache lines, so polling one side's counter
+ * doesn't take the line away from the other side.
+ */
+typedef struct {
+    /** Requests submitted so far and responses taken back so far; written by the dispatcher only. */
+    size_t submitted __attribute__((aligned(64)));
+    size_t taken;
+    /** Set by the dispatcher when the core should exit once its ring is empty. */
+    int stop;
+
+    /** Requests run so far; written by the core only. */
+    size_t completed __attribute__((aligned(64)));
+    /** Set while the core sleeps on 'wake' waiting for a request. */
+    int sleeping;
+
+    /** Outcome of making the partition: 0 while it is being made, 1 if it was made, -1 if it wasn't. */
+    int ready __attribute__((aligned(64)));
+    int id;
+    int cpu;
+    Map* map;
+    CoreMap* owner;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    Slot slots[CORE_SLOTS];
+} Core;
+
+/**
+ * Define the CoreMap structure.
+ */
+struct CoreMapStruct {
+    /** The cores, and how many there are. */
+    Core** cores;
+    int count;
+
+    /** Callback making each partition, and its context. */
+    CoreSetup setup;
+    void* ctx;
+
+    /** Ring of the cores (or CORE_ALL) the outstanding requests went to, oldest first. */
+    int* order;
+    size_t orderHead;
+    size_t orderTail;
+    size_t orderCapacity;
+
+    /** Core whose response 'coreMapNext' last returned from its ring, to be taken back on the next call, or -2. */
+    int held;
+
+    /** Responses of a request sent to every core, gathered. */
+    CoreReply gathered;
+};
+
+/**
+ * Appends characters to a response, growing its buffer as needed.
+ * @param reply A pointer to the CoreReply.
+ * @param text The characters.
+ * @param len The number of characters.
+ * @return true if they were appended, false on memory allocation failure.
+ */
+static _Bool appendReply(CoreReply* reply, char const* text, size_t len) {
+    if (reply->len + len + 1 > reply->capacity) {
+        size_t capacity = reply->capacity ? reply->capacity * 2 : 64;
+        while (capacity < reply->len + len + 1)
+            capacity *= 2;
+        char* grown = (char*)realloc(reply->text, capacity);
+        if (!grown)
+            return 0;
+        reply->text = grown;
+        reply->capacity = capacity;
+    }
+    memcpy(reply->text + reply->len, text, len);
+    reply->len += len;
+    reply->text[reply->len] = '\0';
+    return 1;
+}
+
+/**
+ * Appends formatted text to a response, as printf would print it.
+ * @param reply A pointer to the CoreReply.
+ * @param format The printf format.
+ * @return true if the text was appended, false on memory allocation failure.
+ */
+_Bool coreReplyPrintf(CoreReply* reply, char const* format, ...) {
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (len < 0)
+        return 0;
+    if ((size_t)len < sizeof(buffer))
+        return appendReply(reply, buffer, len);
+
+    char* text = (char*)malloc(len + 1);
+    if (!text)
+        return 0;
+    va_start(args, format);
+    vsnprintf(text, len + 1, format, args);
+    va_end(args);
+    _Bool ok = appendReply(reply, text, len);
+    free(text);
+    return ok;
+}
+
+/**
+ * Runs one core: pins its thread, makes its partition, then runs the requests in its ring as they arrive.
+ * An idle core polls for a while, then yields, then sleeps until the dispatcher wakes it, so a busy core answers
+ * without a system call and an idle one costs nothing. Once told to stop, it finishes its ring and frees its partition.
+ * @param arg A pointer to the Core.
+ * @return NULL.
+ */
+static void* runCore(void* arg) {
+    Core* core = (Core*)arg;
+    // A core that can't be pinned still owns its partition; it just may be moved by the scheduler.
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    core->map = core->owner->setup(core->id, core->owner->ctx);
+    __atomic_store_n(&core->ready, core->map ? 1 : -1, __ATOMIC_RELEASE);
+    if (!core->map)
+        return NULL;
+
+    size_t done = 0;
+    int idle = 0;
+    while (1) {
+        if (done < __atomic_load_n(&core->submitted, __ATOMIC_ACQUIRE)) {
+            Slot* slot = &core->slots[done % CORE_SLOTS];
+            slot->reply.len = 0;
+            slot->reply.number = 0;
+            if (slot->reply.text)
+                slot->reply.text[0] = '\0';
+            slot->task(core->map, core->id, slot->request, slot->len, &slot->reply);
+            __atomic_store_n(&core->completed, ++done, __ATOMIC_RELEASE);
+            idle = 0;
+            continue;
+        }
+        if (__atomic_load_n(&core->stop, __ATOMIC_ACQUIRE))
+            break;
+        if (++idle < SPIN_POLLS)
+            continue;
+        if (idle < SPIN_POLLS + YIELD_POLLS) {
+            sched_yield();
+            continue;
+        }
+
+        // The dispatcher checks 'sleeping' after publishing a request, and the core checks for requests after
+        // setting it, so one of them always sees the other and no wake-up is lost.
+        pthread_mutex_lock(&core->lock);
+        __atomic_store_n(&core->sleeping, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&core->submitted, __ATOMIC_SEQ_CST) == done && !__atomic_load_n(&core->stop, __ATOMIC_SEQ_CST))
+            pthread_cond_wait(&core->wake, &core->lock);
+        __atomic_store_n(&core->sleeping, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&core->lock);
+        idle = 0;
+    }
+
+    mapFree(core->map);
+    return NULL;
+}
+
+/**
+ * Wakes a core if it is sleeping, after a request was published to it or it was told to stop.
+ * @param core A pointer to the Core.
+ */
+static void wakeCore(Core* core) {
+    if (!__atomic_load_n(&core->sleeping, __ATOMIC_SEQ_CST))
+        return;
+    pthread_mutex_lock(&core->lock);
+    pthread_cond_signal(&core->wake);
+    pthread_mutex_unlock(&core->lock);
+}
+
+/**
+ * Creates the cores, one thread per core pinned to its own CPU, and waits until each has made its partition.
+ * The CPUs are the ones the process may run on, taken in order; with more cores than CPUs some share one.
+ * @param cores The number of cores, at least 1.
+ * @param setup The callback making each core's partition, called on that core.
+ * @param ctx An arbitrary pointer passed through to the callback.
+ * @return A pointer to the CoreMap, or NULL if a thread or a partition can't be made.
+ */
+CoreMap* makeCoreMap(int cores, CoreSetup setup, void* ctx) {
+    if (cores < 1)
+        return NULL;
+    CoreMap* this = (CoreMap*)calloc(1, sizeof(CoreMap));
+    if (!this)
+        return NULL;
+    this->setup = setup;
+    this->ctx = ctx;
+    this->held = -2;
+    this->orderCapacity = (size_t)cores * CORE_SLOTS;
+    this->cores = (Core**)calloc(cores, sizeof(Core*));
+    this->order = (int*)malloc(this->orderCapacity * sizeof(int));
+    if (!this->cores || !this->order) {
+        coreMapFree(this);
+        return NULL;
+    }
+
+    cpu_set_t allowed;
+    int cpus[CPU_SETSIZE];
+    int cpuCount = 0;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed))
+                cpus[cpuCount++] = cpu;
+        }
+    }
+    if (cpuCount == 0)
+        cpus[cpuCount++] = 0;
+
+    for (int i = 0; i < cores; i++) {
+        Core* core;
+        if (posix_memalign((void**)&core, 64, sizeof(Core)) != 0) {
+            coreMapFree(this);
+            return NULL;
+        }
+        memset(core, 0, sizeof(Core));
+        core->id = i;
+        core->cpu = cpus[i % cpuCount];
+        core->owner = this;
+        pthread_mutex_init(&core->lock, NULL);
+        pthread_cond_init(&core->wake, NULL);
+        if (pthread_create(&core->thread, NULL, runCore, core) != 0) {
+            pthread_mutex_destroy(&core->lock);
+            pthread_cond_destroy(&core->wake);
+            free(core);
+            coreMapFree(this);
+            return NULL;
+        }
+        this->cores[this->count++] = core;
+    }
+
+    _Bool ok = 1;
+    for (int i = 0; i < cores; i++) {
+        int ready;
+        while (!(ready = __atomic_load_n(&this->cores[i]->ready, __ATOMIC_ACQUIRE)))
+            sched_yield();
+        ok &= ready > 0;
+    }
+    if (!ok) {
+        coreMapFree(this);
+        return NULL;
+    }
+    return this;
+}
+
+/**
+ * Retrieves the number of cores.
+ * @param this A pointer to the CoreMap.
+ * @return The number of cores.
+ */
+int coreMapCores(CoreMap* this) {
+    return this->count;
+}
+
+/**
+ * Finds the core whose partition holds a key.
+ * The key's hash is scrambled before it picks the core, so the bits each partition uses for its buckets and tags
+ * are not the ones that chose the partition.
+ * @param this A pointer to the CoreMap.
+ * @param key A pointer to the VType object representing the key.
+ * @return The number of the core owning the key.
+ */
+int coreMapOwner(CoreMap* this, VType const* key) {
+    uint32_t h = hashVType(key) * 2654435761U;
+    return (int)((uint64_t)h * this->count >> 32);
+}
+
+/**
+ * Hands a request to a core, or to every core, without waiting for it to run.
+ * The request is copied into the core's ring. A full ring refuses the request; the caller then takes back a response
+ * with 'coreMapNext' and tries again. A request for every core is only submitted if every ring has room.
+ * @param this A pointer to the CoreMap.
+ * @param core The number of the core to run the request, or CORE_ALL to run it on every core.
+ * @param task The function running the request on the core's partition.
+ * @param tag An arbitrary number returned with the response.
+ * @param request The characters of the request, passed to the task NUL-terminated.
+ * @param len The number of characters in the request.
+ * @return true if the request was submitted, false if a ring is full or on memory allocation failure.
+ */
+_Bool coreMapSubmit(CoreMap* this, int core, CoreTask task, int tag, char const* request, size_t len) {
+    int first = core == CORE_ALL ? 0 : core;
+    int last = core == CORE_ALL ? this->count - 1 : core;
+    for (int i = first; i <= last; i++) {
+        Core* c = this->cores[i];
+        if (c->submitted - c->taken == CORE_SLOTS)
+            return 0;
+        Slot* slot = &c->slots[c->submitted % CORE_SLOTS];
+        if (len + 1 > slot->capacity) {
+            char* grown = (char*)realloc(slot->request, len + 1);
+            if (!grown)
+                return 0;
+            slot->request = grown;
+            slot->capacity = len + 1;
+        }
+    }
+
+    for (int i = first; i <= last; i++) {
+        Core* c = this->cores[i];
+        Slot* slot = &c->slots[c->submitted % CORE_SLOTS];
+        memcpy(slot->request, request, len);
+        slot->request[len] = '\0';
+        slot->len = len;
+        slot->task = task;
+        slot->reply.tag = tag;
+        __atomic_store_n(&c->submitted, c->submitted + 1, __ATOMIC_SEQ_CST);
+        wakeCore(c);
+    }
+    this->order[this->orderTail++ % this->orderCapacity] = core;
+    return 1;
+}
+
+/**
+ * Checks whether a core has run its oldest request not taken back yet, optionally waiting until it has.
+ * @param core A pointer to the Core, which must have such a request.
+ * @param wait Whether to wait.
+ * @return true if the request has run.
+ */
+static _Bool hasRun(Core* core, _Bool wait) {
+    int polls = 0;
+    while (__atomic_load_n(&core->completed, __ATOMIC_ACQUIRE) == core->taken) {
+        if (!wait)
+            return 0;
+        if (++polls >= SPIN_POLLS)
+            sched_yield();
+    }
+    return 1;
+}
+
+/**
+ * Takes back the response to the oldest outstanding request, in the order the requests were submitted.
+ * The responses of a request sent to every core are gathered into one: their texts in core order and their numbers
+ * added up. The response is valid until the next call.
+ * @param this A pointer to the CoreMap.
+ * @param wait Whether to wait for the request to finish running.
+ * @return A pointer to the response, or NULL if no request is outstanding or, without waiting, the oldest hasn't run.
+ */
+CoreReply const* coreMapNext(CoreMap* this, _Bool wait) {
+    if (this->held >= 0) {
+        this->cores[this->held]->taken++;
+        this->held = -2;
+    }
+    if (this->orderHead == this->orderTail)
+        return NULL;
+
+    int core = this->order[this->orderHead % this->orderCapacity];
+    int first = core == CORE_ALL ? 0 : core;
+    int last = core == CORE_ALL ? this->count - 1 : core;
+    for (int i = first; i <= last; i++) {
+        if (!hasRun(this->cores[i], wait))
+            return NULL;
+    }
+    this->orderHead++;
+    if (core != CORE_ALL) {
+        this->held = core;
+        return &this->cores[core]->slots[this->cores[core]->taken % CORE_SLOTS].reply;
+    }
+
+    CoreReply* gathered = &this->gathered;
+    gathered->len = 0;
+    gathered->number = 0;
+    if (gathered->text)
+        gathered->text[0] = '\0';
+    for (int i = 0; i < this->count; i++) {
+        Core* c = this->cores[i];
+        CoreReply* reply = &c->slots[c->taken % CORE_SLOTS].reply;
+        if (reply->len)
+            appendReply(gathered, reply->text, reply->len);
+        gathered->number += reply->number;
+        gathered->tag = reply->tag;
+        c->taken++;
+    }
+    return gathered;
+}
+
+/**
+ * Retrieves the number of requests whose responses haven't been taken back yet.
+ * @param this A pointer to the CoreMap.
+ * @return The number of outstanding requests.
+ */
+size_t coreMapPending(CoreMap* this) {
+    return this->orderTail - this->orderHead;
+}
+
+/**
+ * Stops every core once it has run the requests already submitted, frees the partitions and then the CoreMap.
+ * Responses not taken back are dropped.
+ * @param this A pointer to the CoreMap.
+ */
+void coreMapFree(CoreMap* this) {
+    if (!this)
+        return;
+    for (int i = 0; i < this->count; i++) {
+        Core* core = this->cores[i];
+        __atomic_store_n(&core->stop, 1, __ATOMIC_SEQ_CST);
+        wakeCore(core);
+        pthread_join(core->thread, NULL);
+        for (int s = 0; s < CORE_SLOTS; s++) {
+            free(core->slots[s].request);
+            free(core->slots[s].reply.text);
+        }
+        pthread_mutex_destroy(&core->lock);
+        pthread_cond_destroy(&core->wake);
+        free(core);
+    }
+    free(this->cores);
+    free(this->order);
+    free(this->gathered.text);
+    free(this);
+}
@@ -0,0 +1,41 @@
+#ifndef CORES_H
+#define CORES_H
+
+#include <stddef.h>
+#include "map.h"
+
+// Core number that sends a request to every core, whose responses are gathered.
+#define CORE_ALL (-1)
+
+// Response of a core to one request; the responses of a request sent to every core are gathered into one.
+typedef struct {
+    // Text to print for the request, NUL-terminated, and the size of its buffer
+    char* text;
+    size_t len;
+    size_t capacity;
+    // Number reported by the request, added up over the cores for a request sent to every core
+    long long number;
+    // Tag the request was submitted with
+    int tag;
+} CoreReply;
+
+// Makes the Map partition a core owns; called on that core, so the partition's memory is local to it.
+typedef Map* (*CoreSetup)(int core, void* ctx);
+
+// Runs one request on the partition of the core it was sent to, writing the response into 'reply'.
+typedef void (*CoreTask)(Map* map, int core, char* request, size_t len, CoreReply* reply);
+
+// Define your CoreMap struct here
+typedef struct CoreMapStruct CoreMap;
+
+/*Function prototypes*/
+CoreMap* makeCoreMap(int cores, CoreSetup setup, void* ctx);
+int coreMapCores(CoreMap* this);
+int coreMapOwner(CoreMap* this, VType const* key);
+_Bool coreMapSubmit(CoreMap* this, int core, CoreTask task, int tag, char const* request, size_t len);
+CoreReply const* coreMapNext(CoreMap* this, _Bool wait);
+size_t coreMapPending(CoreMap* this);
+void coreMapFree(CoreMap* this);
+_Bool coreReplyPrintf(CoreReply* reply, char const* format, ...);
+
+#endif // CORES_H
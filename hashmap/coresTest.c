@@ -0,0 +1,83 @@
+// Simple test program for running partitions on their own cores: routing, response order and gathering.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cores.h"
+
+#define CORES 4
+#define KEYS 1000
+#define REQUESTS 200000
+
+// Makes an empty partition.
+static Map* makePartition(int core, void* ctx) {
+    return makeMap(0, NULL);
+}
+
+// Counts one more occurrence of the Integer key in the request and reports "<core> <key> <count>".
+static void countKey(Map* map, int core, char* request, size_t len, CoreReply* reply) {
+    int key = atoi(request);
+    VType* value = mapGetInt(map, key);
+    int count = value ? value->value.integer + 1 : 1;
+    mapSet(map, makeInteger(key), makeInteger(count));
+    coreReplyPrintf(reply, "%d %d %d", core, key, count);
+}
+
+// Reports the size of a partition as the response's number and the core as its text.
+static void partitionSize(Map* map, int core, char* request, size_t len, CoreReply* reply) {
+    reply->number = mapSize(map);
+    coreReplyPrintf(reply, "[%d]", core);
+}
+
+// Checks the response to the i-th request.
+static void checkReply(CoreMap* cores, CoreReply const* reply, int i) {
+    int core, key, count;
+    assert(reply && reply->tag == i % 7);
+    assert(sscanf(reply->text, "%d %d %d", &core, &key, &count) == 3);
+    VType k = { 'I', 0, { .integer = i % KEYS }, 0 };
+    assert(key == i % KEYS && core == coreMapOwner(cores, &k) && count == i / KEYS + 1);
+}
+
+int main() {
+    CoreMap* cores = makeCoreMap(CORES, makePartition, NULL);
+    assert(cores && coreMapCores(cores) == CORES);
+
+    // Requests are pipelined: responses come back in submission order, from the core owning each key, and each core
+    // runs the requests for its keys one after another.
+    int answered = 0;
+    char request[16];
+    for (int i = 0; i < REQUESTS; i++) {
+        int len = snprintf(request, sizeof(request), "%d", i % KEYS);
+        VType k = { 'I', 0, { .integer = i % KEYS }, 0 };
+        while (!coreMapSubmit(cores, coreMapOwner(cores, &k), countKey, i % 7, request, len))
+            checkReply(cores, coreMapNext(cores, 1), answered++);
+        CoreReply const* reply;
+        while ((reply = coreMapNext(cores, 0)))
+            checkReply(cores, reply, answered++);
+    }
+    while (answered < REQUESTS)
+        checkReply(cores, coreMapNext(cores, 1), answered++);
+    assert(coreMapPending(cores) == 0 && !coreMapNext(cores, 1));
+
+    // A request for every core is answered once, with the responses gathered in core order.
+    assert(coreMapSubmit(cores, CORE_ALL, partitionSize, 42, "", 0));
+    CoreReply const* total = coreMapNext(cores, 1);
+    assert(total && total->tag == 42 && total->number == KEYS && strcmp(total->text, "[0][1][2][3]") == 0);
+    printf("%d requests on %d cores, %lld keys\n", REQUESTS, CORES, total->number);
+
+    // Every key went to one core only.
+    int owned[CORES] = { 0 };
+    for (int key = 0; key < KEYS; key++) {
+        VType k = { 'I', 0, { .integer = key }, 0 };
+        owned[coreMapOwner(cores, &k)]++;
+    }
+    for (int c = 0; c < CORES; c++)
+        assert(owned[c] > KEYS / CORES / 2);
+
+    // Outstanding requests still run before the cores stop.
+    assert(coreMapSubmit(cores, 0, countKey, 0, "5", 1));
+    coreMapFree(cores);
+    return 0;
+}
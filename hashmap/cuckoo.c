@@ -0,0 +1,529 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cuckoo.h"
+
+/**
+ * @file cuckoo.c
+ * @author Jason Wang
+ * This program provides a bucketized cuckoo hash table, the backend a map can use instead of chained buckets.
+ * Every key can live in one of two 4-way buckets, and a bucket fills exactly one 64-byte cache line, so a lookup
+ * checks at most two cache lines whatever the data looks like. When both buckets of a new key are full, a breadth-first
+ * search finds the shortest chain of keys that can each move to their other bucket to make room. Keys for which no
+ * such chain exists go to a small stash, and the table doubles when the stash fills up.
+ */
+
+/** Number of slots in a bucket. */
+#define WAYS 4
+
+/** Smallest number of buckets in a table; the bucket count is always a power of two. */
+#define MIN_BUCKETS 64
+
+/** Largest number of buckets the breadth-first search for a relocation path visits per insert. */
+#define MAX_PATH_NODES 256
+
+/** Number of keys the stash holds before a failed insert grows the table instead. */
+#define STASH_SLOTS 8
+
+/** Load at which a failed insert always grows the table rather than use the stash. */
+#define GROW_LOAD 0.85
+
+/** Load below which growing can't be the cure for a failed insert, since the keys must share their hashes. */
+#define MIN_GROW_LOAD 0.5
+
+/** Load a table is sized for when it is made for a given number of keys. */
+#define PRESIZE_LOAD 0.8
+
+/**
+ * One bucket: the hashes and keys of its four slots, filling one cache line.
+ * Values live in a separate array so a probe only reads what it compares.
+ * An empty slot has a NULL key.
+ */
+typedef struct {
+    uint32_t hash[WAYS];
+    VType* key[WAYS];
+} __attribute__((aligned(64))) Bucket;
+
+/**
+ * A key-value pair kept in the stash.
+ */
+typedef struct {
+    VType* key;
+    VType* value;
+    unsigned int hash;
+} StashEntry;
+
+/**
+ * One bucket visited by the breadth-first search for a relocation path.
+ * 'parent' is the search node whose bucket holds, in slot 'way', the key that would move into this bucket.
+ */
+typedef struct {
+    size_t bucket;
+    int parent;
+    int way;
+} PathNode;
+
+/**
+ * CuckooStruct holding the buckets, the values for each slot and the stash.
+ */
+struct CuckooStruct {
+    Bucket* buckets;
+    VType** values;
+    size_t bucketCount;
+    /** Number of keys in the buckets, not counting the stash. */
+    size_t count;
+
+    StashEntry* stash;
+    size_t stashCount;
+    size_t stashCapacity;
+
+    /** Allocator the buckets and values come from. */
+    MapAllocator const* allocator;
+
+    size_t relocations;
+    size_t grows;
+};
+
+/**
+ * Scrambles a hash so both bucket choices depend on all of its bits.
+ * This is the finalizer of MurmurHash3.
+ * @param h The hash.
+ * @return The scrambled hash.
+ */
+static uint32_t mix(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+/**
+ * Returns the first of the two buckets a key with the given hash may live in.
+ * @param this A pointer to the cuckoo table.
+ * @param hash The hash of the key.
+ * @return The index of the bucket.
+ */
+static size_t firstBucket(Cuckoo const* this, unsigned int hash) {
+    return mix(hash) & (this->bucketCount - 1);
+}
+
+/**
+ * Returns the second of the two buckets a key with the given hash may live in.
+ * @param this A pointer to the cuckoo table.
+ * @param hash The hash of the key.
+ * @return The index of the bucket.
+ */
+static size_t secondBucket(Cuckoo const* this, unsigned int hash) {
+    return mix(hash ^ 0x9e3779b9) & (this->bucketCount - 1);
+}
+
+/**
+ * Returns the bucket a key with the given hash may live in other than the one it is in.
+ * @param this A pointer to the cuckoo table.
+ * @param hash The hash of the key.
+ * @param bucket The bucket the key is in.
+ * @return The index of the other bucket.
+ */
+static size_t otherBucket(Cuckoo const* this, unsigned int hash, size_t bucket) {
+    size_t first = firstBucket(this, hash);
+    return bucket == first ? secondBucket(this, hash) : first;
+}
+
+/**
+ * Finds an empty slot in a bucket.
+ * @param bucket A pointer to the bucket.
+ * @return The empty slot, or -1 if the bucket is full.
+ */
+static int freeWay(Bucket const* bucket) {
+    for (int w = 0; w < WAYS; w++) {
+        if (!bucket->key[w])
+            return w;
+    }
+    return -1;
+}
+
+/**
+ * Stores a key-value pair in a slot.
+ * @param this A pointer to the cuckoo table.
+ * @param bucket The index of the bucket.
+ * @param way The slot in the bucket.
+ * @param key A pointer to the key.
+ * @param value A pointer to the value.
+ * @param hash The hash of the key.
+ */
+static void place(Cuckoo* this, size_t bucket, int way, VType* key, VType* value, unsigned int hash) {
+    this->buckets[bucket].hash[way] = hash;
+    this->buckets[bucket].key[way] = key;
+    this->values[bucket * WAYS + way] = value;
+}
+
+/**
+ * Moves the keys along a relocation path found by the search, starting from the bucket with the empty slot,
+ * and stores the new key in the slot this frees in the first bucket.
+ * A path may visit the same bucket twice, in which case a slot can hold a different key by the time it is moved;
+ * every key is checked to belong in the bucket it moves to, and the walk stops if one doesn't.
+ * Every move made up to that point leaves its key in one of its own buckets, so the table is always valid.
+ * @param this A pointer to the cuckoo table.
+ * @param path The nodes of the search.
+ * @param n The node whose bucket has an empty slot.
+ * @param way The empty slot.
+ * @param key A pointer to the new key.
+ * @param value A pointer to the new value.
+ * @param hash The hash of the new key.
+ * @return true if the key was stored, false if the path was no longer valid.
+ */
+static _Bool relocate(Cuckoo* this, PathNode const* path, int n, int way, VType* key, VType* value, unsigned int hash) {
+    while (path[n].parent >= 0) {
+        PathNode const* node = &path[n];
+        size_t from = path[node->parent].bucket;
+        Bucket* bucket = &this->buckets[from];
+        int w = node->way;
+        if (!bucket->key[w] || otherBucket(this, bucket->hash[w], from) != node->bucket)
+            return 0;
+
+        place(this, node->bucket, way, bucket->key[w], this->values[from * WAYS + w], bucket->hash[w]);
+        bucket->key[w] = NULL;
+        this->relocations++;
+        way = w;
+        n = node->parent;
+    }
+
+    place(this, path[n].bucket, way, key, value, hash);
+    return 1;
+}
+
+/**
+ * Stores a new key in one of its two buckets, moving other keys out of the way if both are full.
+ * The search for keys to move visits buckets breadth-first, so the shortest relocation path is used.
+ * @param this A pointer to the cuckoo table.
+ * @param key A pointer to the new key.
+ * @param value A pointer to the new value.
+ * @param hash The hash of the new key.
+ * @param search Whether to search for a relocation path when both buckets are full.
+ * @return true if the key was stored, false if there was no room for it.
+ */
+static _Bool placeInTable(Cuckoo* this, VType* key, VType* value, unsigned int hash, _Bool search) {
+    size_t b1 = firstBucket(this, hash);
+    size_t b2 = secondBucket(this, hash);
+    size_t b = b1;
+    int w = freeWay(&this->buckets[b1]);
+    if (w < 0)
+        w = freeWay(&this->buckets[b = b2]);
+    if (w >= 0) {
+        place(this, b, w, key, value, hash);
+        this->count++;
+        return 1;
+    }
+    if (!search)
+        return 0;
+
+    PathNode path[MAX_PATH_NODES];
+    int head = 0, tail = 0;
+    path[tail++] = (PathNode){ b1, -1, -1 };
+    if (b2 != b1)
+        path[tail++] = (PathNode){ b2, -1, -1 };
+
+    while (head < tail) {
+        int n = head++;
+        Bucket const* bucket = &this->buckets[path[n].bucket];
+        if ((w = freeWay(bucket)) >= 0) {
+            if (!relocate(this, path, n, w, key, value, hash))
+                return 0;
+            this->count++;
+            return 1;
+        }
+        for (w = 0; w < WAYS && tail < MAX_PATH_NODES; w++)
+            path[tail++] = (PathNode){ otherBucket(this, bucket->hash[w], path[n].bucket), n, w };
+    }
+    return 0;
+}
+
+/**
+ * Adds a key-value pair to the stash.
+ * @param this A pointer to the cuckoo table.
+ * @param key A pointer to the key.
+ * @param value A pointer to the value.
+ * @param hash The hash of the key.
+ * @return true if the pair was stored, false on memory allocation failure.
+ */
+static _Bool stashAdd(Cuckoo* this, VType* key, VType* value, unsigned int hash) {
+    if (this->stashCount == this->stashCapacity) {
+        size_t capacity = this->stashCapacity ? this->stashCapacity * 2 : STASH_SLOTS;
+        StashEntry* stash = (StashEntry*)realloc(this->stash, capacity * sizeof(StashEntry));
+        if (!stash)
+            return 0;
+        this->stash = stash;
+        this->stashCapacity = capacity;
+    }
+    this->stash[this->stashCount++] = (StashEntry){ key, value, hash };
+    return 1;
+}
+
+/**
+ * Moves keys from the stash back into the buckets where there is room for them.
+ * @param this A pointer to the cuckoo table.
+ * @param search Whether to search for relocation paths, or only use empty slots in the keys' own buckets.
+ */
+static void drainStash(Cuckoo* this, _Bool search) {
+    for (size_t i = this->stashCount; i-- > 0;) {
+        StashEntry* e = &this->stash[i];
+        if (placeInTable(this, e->key, e->value, e->hash, search))
+            *e = this->stash[--this->stashCount];
+    }
+}
+
+/**
+ * Allocates zero-filled buckets and values for the given number of buckets and makes them the table's.
+ * @param this A pointer to the cuckoo table.
+ * @param bucketCount The number of buckets, a power of two.
+ * @return true if the arrays were allocated, false on memory allocation failure, in which case nothing changes.
+ */
+static _Bool allocTables(Cuckoo* this, size_t bucketCount) {
+    Bucket* buckets = (Bucket*)this->allocator->allocLarge(this->allocator->ctx, bucketCount * sizeof(Bucket));
+    if (!buckets)
+        return 0;
+    VType** values = (VType**)this->allocator->allocLarge(this->allocator->ctx, bucketCount * WAYS * sizeof(VType*));
+    if (!values) {
+        this->allocator->freeLarge(this->allocator->ctx, buckets, bucketCount * sizeof(Bucket));
+        return 0;
+    }
+
+    this->buckets = buckets;
+    this->values = values;
+    this->bucketCount = bucketCount;
+    return 1;
+}
+
+/**
+ * Returns buckets and values to the table's allocator.
+ * @param this A pointer to the cuckoo table.
+ * @param buckets A pointer to the buckets.
+ * @param values A pointer to the values.
+ * @param bucketCount The number of buckets they were allocated for.
+ */
+static void freeTables(Cuckoo* this, Bucket* buckets, VType** values, size_t bucketCount) {
+    this->allocator->freeLarge(this->allocator->ctx, buckets, bucketCount * sizeof(Bucket));
+    this->allocator->freeLarge(this->allocator->ctx, values, bucketCount * WAYS * sizeof(VType*));
+}
+
+/**
+ * Doubles the number of buckets and moves every key into the new buckets, then retries the stashed keys.
+ * Keys that don't fit in the new buckets go to the stash. If memory runs out, the table is left as it was.
+ * @param this A pointer to the cuckoo table.
+ * @return true if the table grew, false on memory allocation failure.
+ */
+static _Bool grow(Cuckoo* this) {
+    Bucket* oldBuckets = this->buckets;
+    VType** oldValues = this->values;
+    size_t oldBucketCount = this->bucketCount;
+    size_t oldCount = this->count;
+    size_t oldStashCount = this->stashCount;
+    if (!allocTables(this, oldBucketCount * 2))
+        return 0;
+
+    this->count = 0;
+    for (size_t b = 0; b < oldBucketCount; b++) {
+        for (int w = 0; w < WAYS; w++) {
+            VType* key = oldBuckets[b].key[w];
+            if (!key)
+                continue;
+            VType* value = oldValues[b * WAYS + w];
+            unsigned int hash = oldBuckets[b].hash[w];
+            if (!placeInTable(this, key, value, hash, 1) && !stashAdd(this, key, value, hash)) {
+                freeTables(this, this->buckets, this->values, this->bucketCount);
+                this->buckets = oldBuckets;
+                this->values = oldValues;
+                this->bucketCount = oldBucketCount;
+                this->count = oldCount;
+                this->stashCount = oldStashCount;
+                return 0;
+            }
+        }
+    }
+
+    freeTables(this, oldBuckets, oldValues, oldBucketCount);
+    this->grows++;
+    drainStash(this, 1);
+    return 1;
+}
+
+/**
+ * Creates a new cuckoo table on the heap sized to hold the given number of keys without growing.
+ * The buckets and values come from the given allocator.
+ * Memory allocated for the table should be freed by the caller with 'cuckooFree' when no longer needed.
+ * @param capacity The number of keys expected.
+ * @param allocator The allocator for the buckets and values, or NULL for malloc.
+ * @return A pointer to the cuckoo table, or NULL on memory allocation failure.
+ */
+Cuckoo* makeCuckoo(size_t capacity, MapAllocator const* allocator) {
+    Cuckoo* c = (Cuckoo*)calloc(1, sizeof(Cuckoo));
+    if (!c)
+        return NULL;
+
+    c->allocator = allocator ? allocator : &mallocAllocator;
+    size_t bucketCount = MIN_BUCKETS;
+    while (bucketCount * WAYS * PRESIZE_LOAD < capacity)
+        bucketCount *= 2;
+    if (!allocTables(c, bucketCount)) {
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+/**
+ * Finds the slot holding the value of a key.
+ * Only the key's two buckets are read, plus the stash when it isn't empty; the second bucket is prefetched
+ * while the first is searched, so both cache misses overlap.
+ * @param this A pointer to the cuckoo table.
+ * @param key A pointer to the key.
+ * @param hash The hash of the key, from 'hashVType'.
+ * @return A pointer to the slot holding the key's value, which may be updated in place, or NULL if the key is absent.
+ */
+VType** cuckooFind(Cuckoo* this, VType const* key, unsigned int hash) {
+    size_t b[2] = { firstBucket(this, hash), secondBucket(this, hash) };
+    __builtin_prefetch(&this->buckets[b[1]]);
+
+    for (int i = 0; i < 2; i++) {
+        Bucket const* bucket = &this->buckets[b[i]];
+        for (int w = 0; w < WAYS; w++) {
+            if (bucket->hash[w] == hash && bucket->key[w] && equalsVType(bucket->key[w], key))
+                return &this->values[b[i] * WAYS + w];
+        }
+    }
+
+    for (size_t i = 0; i < this->stashCount; i++) {
+        if (this->stash[i].hash == hash && equalsVType(this->stash[i].key, key))
+            return &this->stash[i].value;
+    }
+    return NULL;
+}
+
+/**
+ * Inserts a key that isn't in the table yet.
+ * If neither of its buckets has room and no relocation path is found, the key goes to the stash; once the stash
+ * is full, or the table is nearly full, the table doubles instead. When the table is mostly empty, a failed insert means
+ * many keys share a hash, which growing can't fix, so those keys always go to the stash.
+ * The table takes ownership of neither object; they are only stored.
+ * @param this A pointer to the cuckoo table.
+ * @param key A pointer to the key.
+ * @param value A pointer to the value.
+ * @param hash The hash of the key, from 'hashVType'.
+ * @return true if the key was stored, false on memory allocation failure.
+ */
+_Bool cuckooInsert(Cuckoo* this, VType* key, VType* value, unsigned int hash) {
+    if (placeInTable(this, key, value, hash, 1))
+        return 1;
+
+    double load = (double)this->count / (this->bucketCount * WAYS);
+    if ((load >= GROW_LOAD || (this->stashCount >= STASH_SLOTS && load >= MIN_GROW_LOAD)) && grow(this) &&
+        placeInTable(this, key, value, hash, 1))
+        return 1;
+    return stashAdd(this, key, value, hash);
+}
+
+/**
+ * Removes a key from the table, handing back the key and value objects it stored.
+ * The freed slot is offered to stashed keys that belong in that bucket.
+ * @param this A pointer to the cuckoo table.
+ * @param key A pointer to the key to remove.
+ * @param hash The hash of the key, from 'hashVType'.
+ * @param oldKey Where the stored key object is put.
+ * @param oldValue Where the stored value object is put.
+ * @return true if the key was removed, false if it is absent.
+ */
+_Bool cuckooRemove(Cuckoo* this, VType const* key, unsigned int hash, VType** oldKey, VType** oldValue) {
+    VType** slot = cuckooFind(this, key, hash);
+    if (!slot)
+        return 0;
+
+    *oldValue = *slot;
+    if (slot >= this->values && slot < this->values + this->bucketCount * WAYS) {
+        size_t index = slot - this->values;
+        Bucket* bucket = &this->buckets[index / WAYS];
+        *oldKey = bucket->key[index % WAYS];
+        bucket->key[index % WAYS] = NULL;
+        bucket->hash[index % WAYS] = 0;
+        *slot = NULL;
+        this->count--;
+        if (this->stashCount)
+            drainStash(this, 0);
+    } else {
+        StashEntry* e = (StashEntry*)((char*)slot - offsetof(StashEntry, value));
+        *oldKey = e->key;
+        *e = this->stash[--this->stashCount];
+    }
+    return 1;
+}
+
+/**
+ * Visits every key-value pair in the table, the buckets first and then the stash, in no particular order.
+ * The callback must not modify the table; returning false from it stops the walk early.
+ * @param this A pointer to the cuckoo table.
+ * @param fn The callback invoked with each key, its value, its hash and the 'ctx' pointer.
+ * @param ctx An arbitrary pointer passed through to the callback.
+ */
+void cuckooForEach(Cuckoo* this, CuckooVisitor fn, void* ctx) {
+    for (size_t b = 0; b < this->bucketCount; b++) {
+        Bucket const* bucket = &this->buckets[b];
+        for (int w = 0; w < WAYS; w++) {
+            if (bucket->key[w] && !fn(bucket->key[w], this->values[b * WAYS + w], bucket->hash[w], ctx))
+                return;
+        }
+    }
+    for (size_t i = 0; i < this->stashCount; i++) {
+        if (!fn(this->stash[i].key, this->stash[i].value, this->stash[i].hash, ctx))
+            return;
+    }
+}
+
+/**
+ * Replaces every stored key and value with what the given function returns for it, in place.
+ * The replacement key must hash and compare like the one it replaces, as it stays in the same slot.
+ * @param this A pointer to the cuckoo table.
+ * @param replace The function returning the object to store instead of the one it is given.
+ */
+void cuckooReplaceObjects(Cuckoo* this, VType* (*replace)(VType* v)) {
+    for (size_t b = 0; b < this->bucketCount; b++) {
+        Bucket* bucket = &this->buckets[b];
+        for (int w = 0; w < WAYS; w++) {
+            if (bucket->key[w]) {
+                bucket->key[w] = replace(bucket->key[w]);
+                this->values[b * WAYS + w] = replace(this->values[b * WAYS + w]);
+            }
+        }
+    }
+    for (size_t i = 0; i < this->stashCount; i++) {
+        this->stash[i].key = replace(this->stash[i].key);
+        this->stash[i].value = replace(this->stash[i].value);
+    }
+}
+
+/**
+ * Reports the sizing and relocation counters of the table.
+ * @param this A pointer to the cuckoo table.
+ * @param stats A pointer to the CuckooStats to be filled in.
+ */
+void cuckooStats(Cuckoo const* this, CuckooStats* stats) {
+    stats->buckets = this->bucketCount;
+    stats->slots = this->bucketCount * WAYS;
+    stats->keys = this->count + this->stashCount;
+    stats->stashed = this->stashCount;
+    stats->relocations = this->relocations;
+    stats->grows = this->grows;
+}
+
+/**
+ * Frees the memory occupied by the table.
+ * The key and value objects it stores are not freed; the caller owns them.
+ * @param this A pointer to the cuckoo table to be freed.
+ */
+void cuckooFree(Cuckoo* this) {
+    if (!this)
+        return;
+    freeTables(this, this->buckets, this->values, this->bucketCount);
+    free(this->stash);
+    free(this);
+}
@@ -0,0 +1,44 @@
+#ifndef CUCKOO_H
+#define CUCKOO_H
+
+#include <stddef.h>
+#include "vtype.h"
+
+// Define your Cuckoo struct here
+typedef struct CuckooStruct Cuckoo;
+
+// Callback used by cuckooForEach; return 0 to stop the walk.
+typedef _Bool (*CuckooVisitor)(VType* key, VType* value, unsigned int hash, void* ctx);
+
+/** Sizing and relocation counters reported for a cuckoo table. */
+typedef struct {
+    /** Number of 4-way buckets. */
+    size_t buckets;
+
+    /** Number of slots in the buckets. */
+    size_t slots;
+
+    /** Number of keys stored, in the buckets and in the stash. */
+    size_t keys;
+
+    /** Number of keys in the stash because no relocation path was found for them. */
+    size_t stashed;
+
+    /** Number of keys moved to their other bucket to make room for an insert. */
+    size_t relocations;
+
+    /** Number of times the buckets were doubled because an insert found no room. */
+    size_t grows;
+} CuckooStats;
+
+/*Function prototypes*/
+Cuckoo* makeCuckoo(size_t capacity, MapAllocator const* allocator);
+VType** cuckooFind(Cuckoo* this, VType const* key, unsigned int hash);
+_Bool cuckooInsert(Cuckoo* this, VType* key, VType* value, unsigned int hash);
+_Bool cuckooRemove(Cuckoo* this, VType const* key, unsigned int hash, VType** oldKey, VType** oldValue);
+void cuckooForEach(Cuckoo* this, CuckooVisitor fn, void* ctx);
+void cuckooReplaceObjects(Cuckoo* this, VType* (*replace)(VType* v));
+void cuckooStats(Cuckoo const* this, CuckooStats* stats);
+void cuckooFree(Cuckoo* this);
+
+#endif // CUCKOO_H
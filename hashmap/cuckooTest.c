@@ -0,0 +1,173 @@
+// Simple test program for the cuckoo hash table and the Map backend built on it.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cuckoo.h"
+#include "map.h"
+
+#define KEYS 100000
+
+// Number of large regions the checking allocator handed out.
+static int largeRegions = 0;
+
+// Takes a large region from the default allocator, checking it starts on a cache line as the buckets expect.
+static void* alignedAllocLarge(void* ctx, size_t size) {
+    void* ptr = mallocAllocator.allocLarge(mallocAllocator.ctx, size);
+    assert(ptr && ((uintptr_t)ptr & 63) == 0);
+    largeRegions++;
+    return ptr;
+}
+
+static void alignedFreeLarge(void* ctx, void* ptr, size_t size) {
+    mallocAllocator.freeLarge(mallocAllocator.ctx, ptr, size);
+}
+
+static MapAllocator const checkingAllocator = { NULL, NULL, alignedAllocLarge, alignedFreeLarge, 0, NULL };
+
+// Replaces an Integer with a new one holding its negation, freeing the old one.
+static VType* negate(VType* v) {
+    VType* negated = makeInteger(-v->value.integer);
+    freeVType(v);
+    return negated;
+}
+
+// Counts the pairs visited by a walk.
+static _Bool countPair(VType const* key, VType const* value, void* ctx) {
+    (*(size_t*)ctx)++;
+    return 1;
+}
+
+int main() {
+    // Fill a table from its smallest size so it has to grow and relocate along the way; every bucket array it takes
+    // starts on a cache line.
+    Cuckoo* c = makeCuckoo(0, &checkingAllocator);
+    assert(c);
+    VType** keys = (VType**)malloc(KEYS * sizeof(VType*));
+    for (int i = 0; i < KEYS; i++) {
+        keys[i] = makeInteger(i);
+        VType** slot = cuckooFind(c, keys[i], hashVType(keys[i]));
+        assert(!slot);
+        assert(cuckooInsert(c, keys[i], makeInteger(i * 2), hashVType(keys[i])));
+    }
+
+    CuckooStats stats;
+    cuckooStats(c, &stats);
+    printf("buckets: %zu, load %.1f%%, stashed %zu, relocations %zu, grows %zu\n", stats.buckets,
+           100.0 * (stats.keys - stats.stashed) / stats.slots, stats.stashed, stats.relocations, stats.grows);
+    assert(stats.keys == KEYS && stats.grows > 0 && stats.relocations > 0);
+    assert(largeRegions == 2 * ((int)stats.grows + 1));
+
+    for (int i = 0; i < KEYS; i++) {
+        VType** slot = cuckooFind(c, keys[i], hashVType(keys[i]));
+        assert(slot && (*slot)->value.integer == i * 2);
+    }
+
+    // Remove every other key; the rest must still be found.
+    for (int i = 0; i < KEYS; i += 2) {
+        VType* oldKey;
+        VType* oldValue;
+        assert(cuckooRemove(c, keys[i], hashVType(keys[i]), &oldKey, &oldValue));
+        assert(oldKey == keys[i] && oldValue->value.integer == i * 2);
+        freeVType(oldKey);
+        freeVType(oldValue);
+    }
+    for (int i = 1; i < KEYS; i += 2) {
+        VType** slot = cuckooFind(c, keys[i], hashVType(keys[i]));
+        assert(slot && (*slot)->value.integer == i * 2);
+        VType* oldKey;
+        VType* oldValue;
+        assert(cuckooRemove(c, keys[i], hashVType(keys[i]), &oldKey, &oldValue));
+        freeVType(oldKey);
+        freeVType(oldValue);
+    }
+    cuckooStats(c, &stats);
+    assert(stats.keys == 0);
+
+    // Keys that all share one hash only fit two buckets' worth in the table; the rest must go to the stash
+    // without growing the table, and every one of them must still be found and removed.
+    size_t buckets = stats.buckets;
+    for (int i = 0; i < 40; i++) {
+        keys[i] = makeInteger(i);
+        assert(cuckooInsert(c, keys[i], makeInteger(-i), 7));
+    }
+    cuckooStats(c, &stats);
+    assert(stats.keys == 40 && stats.stashed == 32 && stats.buckets == buckets);
+    for (int i = 0; i < 40; i++) {
+        VType** slot = cuckooFind(c, keys[i], 7);
+        assert(slot && (*slot)->value.integer == -i);
+    }
+
+    // Replacing the objects reaches the buckets and the stash; the keys stay where their hash put them. The original
+    // keys are freed by the replacement, so fresh ones look them up from here on.
+    cuckooReplaceObjects(c, negate);
+    for (int i = 0; i < 40; i++) {
+        VType* key = makeInteger(-i);
+        VType** slot = cuckooFind(c, key, 7);
+        assert(slot && (*slot)->value.integer == i);
+        freeVType(key);
+    }
+    cuckooReplaceObjects(c, negate);
+    for (int i = 0; i < 40; i++) {
+        VType* key = makeInteger(i);
+        VType* oldKey;
+        VType* oldValue;
+        assert(cuckooRemove(c, key, 7, &oldKey, &oldValue));
+        assert(oldKey != key && oldValue->value.integer == -i);
+        assert(!cuckooFind(c, key, 7));
+        freeVType(key);
+        freeVType(oldKey);
+        freeVType(oldValue);
+    }
+    cuckooStats(c, &stats);
+    assert(stats.keys == 0 && stats.stashed == 0);
+    cuckooFree(c);
+    free(keys);
+
+    // The Map behaves the same with either backend.
+    Map* chained = makeMap(0, NULL);
+    Map* cuckoo = makeMapBackend(0, MAP_CUCKOO, NULL);
+    for (int i = 0; i < KEYS; i++) {
+        int k = rand() % (KEYS / 2);
+        int op = rand() % 3;
+        if (op == 0) {
+            mapSet(chained, makeInteger(k), makeInteger(i));
+            mapSet(cuckoo, makeInteger(k), makeInteger(i));
+        } else if (op == 1) {
+            assert(mapRemoveInt(chained, k) == mapRemoveInt(cuckoo, k));
+        } else {
+            VType* a = mapGetInt(chained, k);
+            VType* b = mapGetInt(cuckoo, k);
+            assert((!a && !b) || (a && b && equalsVType(a, b)));
+        }
+    }
+    assert(mapSize(chained) == mapSize(cuckoo));
+    size_t visited = 0;
+    mapForEach(cuckoo, countPair, &visited);
+    assert(visited == mapSize(cuckoo));
+    assert(mapCuckooStats(cuckoo, &stats) && !mapCuckooStats(chained, &stats));
+
+    mapFree(chained);
+    mapFree(cuckoo);
+
+    // A cuckoo Map is rebuilt smaller as keys are removed, on aligned buckets again, and keeps every key left.
+    cuckoo = makeMapBackend(0, MAP_CUCKOO, &checkingAllocator);
+    for (int i = 0; i < KEYS; i++)
+        mapSet(cuckoo, makeInteger(i), makeInteger(i * 2));
+    mapCuckooStats(cuckoo, &stats);
+    size_t full = stats.buckets;
+    for (int i = 1000; i < KEYS; i++)
+        assert(mapRemoveInt(cuckoo, i));
+    mapCuckooStats(cuckoo, &stats);
+    printf("shrunk from %zu to %zu buckets for %zu keys\n", full, stats.buckets, stats.keys);
+    assert(stats.keys == 1000 && stats.buckets * 16 <= full);
+    for (int i = 0; i < KEYS; i++) {
+        VType* value = mapGetInt(cuckoo, i);
+        assert(i < 1000 ? value && value->value.integer == i * 2 : !value);
+    }
+    mapFree(cuckoo);
+
+    return EXIT_SUCCESS;
+}
@@ -1,183 +1,1421 @@
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include "cores.h"
+#include "frozen.h"
+#include "input.h"
+#include "latency.h"
+#include "map.h"
+#include "probes.h"
+#include "replication.h"
+#include "snapshot.h"
+#include "trace.h"
 
-/** 
+/**
  * @file driver.c
  * @author Jason Wang
  * This program Using the other components, it reads and processes commands from standard input, updates the map as needed and prints responses to user
  * commands.
 */
 
-#define TABLE_SIZE 100
+/** Maximum length of a command line, with its newline; longer lines are rejected whole. */
+#define MAX_LINE (1024 * 1024)
+
+/** Snapshot file used by bgsave and loaded at startup when given with -s. */
+static char const* snapshotPath = "dump.snap";
+
+/** Kind of pages the map's buckets and nodes are mapped with, and its name, when given with -H. */
+static PageMode pageMode;
+static char const* pageModeName = NULL;
+
+/** Way the map stores its keys, chosen with -m. */
+static MapBackend backend = MAP_CHAINED;
+
+/** Number of keys a scan prints when no limit is given. */
+#define SCAN_LIMIT 10
+
+/** Number of keys hotkeys lists when no count is given, and the most it can list. */
+#define HOT_KEYS_LIST 10
+#define HOT_KEYS_TRACKED 64
+
+/** One in how many operations are sampled when hotkeys on is given no rate. */
+#define HOT_KEYS_SAMPLE 16
+
+/** State of the background save, if one is running. */
+static BgSave bgsave;
+
+/** Frozen map answering fget, built by the last freeze or opened with -f. */
+static FrozenMap* frozen = NULL;
+
+/** Trace every command read is recorded to, with -t. */
+static TraceWriter* trace = NULL;
+
+/** Replicas this driver streams its changes to, with -R, or the primary it follows as a read-only replica, with -F. */
+static Primary* primary = NULL;
+static Replica* replica = NULL;
+
+/** Longest the driver waits idle before checking on replicas being bootstrapped, in milliseconds. */
+#define REPLICATION_POLL_MS 100
+
+/** Latency histograms of the commands run without -P, and with -P one table per core, recorded into by that core. */
+static Latency* latency = NULL;
+static Latency** coreLatency = NULL;
+
+/** Settings each core's partition is made with, with -P. */
+typedef struct {
+    MapAllocator const* allocator;
+    double filterFpr;
+    size_t filterBytes;
+    size_t compressBytes;
+    long chainLimit;
+} MapConfig;
+
+/** Kinds of responses the cores send back with -P, telling the driver how to print them; a hotkeys list is tagged
+    REPLY_HOTKEYS plus the number of keys to print. */
+enum { REPLY_TEXT, REPLY_SIZE, REPLY_STATS, REPLY_COMPACT, REPLY_LATENCY, REPLY_HOTKEYS };
+
+/** Size of the buffer standard input is read ahead into. */
+#define INPUT_BUFFER (64 * 1024)
+
+/** Standard input read ahead, so the driver can tell whether another command is already waiting. */
+typedef struct {
+    char data[INPUT_BUFFER];
+    size_t start;
+    size_t end;
+    _Bool eof;
+} InputBuffer;
+
+/**
+ * This function splits the next whitespace-separated word off the command line.
+ * @param pos a pointer to the current position in the line, advanced past the word
+ * @param len where the length of the word is stored
+ * @return a pointer to the first character of the word, or NULL if the rest of the line is blank
+ */
+static char* nextWord(char** pos, size_t* len) {
+    char* start = *pos;
+    while (isspace((unsigned char)*start))
+        start++;
+    if (*start == '\0')
+        return NULL;
+
+    char* end = start;
+    while (*end != '\0' && !isspace((unsigned char)*end))
+        end++;
+
+    *len = end - start;
+    *pos = end;
+    return start;
+}
+
+/**
+ * This function returns the rest of the command line with surrounding whitespace removed.
+ * @param pos a pointer to the current position in the line
+ * @param len where the length of the remaining text is stored
+ * @return a pointer to the first non-blank character, or NULL if the rest of the line is blank
+ */
+static char* restOfLine(char* pos, size_t* len) {
+    while (isspace((unsigned char)*pos))
+        pos++;
+    size_t n = strlen(pos);
+    while (n > 0 && isspace((unsigned char)pos[n - 1]))
+        n--;
+    if (n == 0)
+        return NULL;
+
+    *len = n;
+    return pos;
+}
+
+/**
+ * This function records a command line to the trace, if one is being written. The driver reads a single stream of
+ * commands, so every command is recorded on connection 0. Recording stops if the trace can't be written.
+ * @param input the command line as read, with its newline
+ */
+static void recordCommand(char const* input) {
+    if (!trace)
+        return;
+    size_t len = strlen(input);
+    while (len > 0 && (input[len - 1] == '\n' || input[len - 1] == '\r'))
+        len--;
+    if (!traceWrite(trace, traceClock(), 0, input, len)) {
+        fprintf(stderr, "Unable to write the trace; recording stopped.\n");
+        traceWriterFree(trace);
+        trace = NULL;
+    }
+}
+
+/**
+ * This function reports the outcome of a background save once the child writing it has finished.
+ * It never blocks, so it is called before every prompt.
+ */
+static void checkBgsave() {
+    BgSaveResult result;
+    if (!bgsavePoll(&bgsave, &result))
+        return;
+
+    if (result.ok)
+        printf("Background saving finished: %zu entries in %ld ms, fork %ld us, pages copied: %ld by parent, %ld by child\n",
+               result.entries, result.elapsedMillis, result.forkMicros, result.parentPagesCopied, result.childPagesCopied);
+    else
+        printf("Background saving failed.\n");
+}
+
+/**
+ * This function reads how much of the driver's memory is resident, from /proc/self/statm.
+ * @return the resident memory in kilobytes, or 0 if it can't be read
+ */
+static long residentKilobytes() {
+    long pages = 0;
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%*s %ld", &pages) != 1)
+            pages = 0;
+        fclose(fp);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/**
+ * This function prints statistics about the map and its optional components.
+ * @param map the map to report on
+ */
+static void printStats(Map* map) {
+    printf("keys: %zu\n", mapSize(map));
+
+    PageStats pages;
+    if (pageModeName) {
+        pageAllocatorStats(pageMode, &pages);
+        printf("pages: %s, %zu regions, %zu bytes, %zu with explicit huge pages, %zu fell back\n",
+               pageModeName, pages.regions, pages.bytes, pages.hugetlbRegions, pages.fallbacks);
+    }
+
+    HashStats hash;
+    mapHashStats(map, &hash);
+    printf("hash: %s, longest chain %zu (limit %zu), %zu rekeys", hash.keyed ? "siphash" : "seeded djb2",
+           hash.longestChain, hash.chainLimit, hash.rekeys);
+    if (hash.rehashPending)
+        printf(", %zu buckets left to rehash", hash.rehashPending);
+    printf("\n");
+
+    MemoryStats memory;
+    if (mapMemoryStats(map, &memory))
+        printf("memory: %zu buckets, %zu table bytes, %zu overflow blocks (%zu free) in %zu slab bytes, "
+               "%zu shrinks, %zu compactions, %ld KB resident\n", memory.buckets, memory.tableBytes, memory.blocks,
+               memory.freeBlocks, memory.slabBytes, memory.shrinks, memory.compactions, residentKilobytes());
+
+    CuckooStats cuckoo;
+    if (mapCuckooStats(map, &cuckoo))
+        printf("cuckoo: %zu buckets, load %.1f%%, %zu stashed, %zu relocations, %zu grows\n", cuckoo.buckets,
+               100.0 * (cuckoo.keys - cuckoo.stashed) / cuckoo.slots, cuckoo.stashed, cuckoo.relocations, cuckoo.grows);
+
+    CompressionStats compression;
+    if (mapCompressionStats(map, &compression))
+        printf("compression: values of %zu+ bytes, %zu stored compressed, %zu -> %zu bytes (ratio %.2f), "
+               "%zu compressed in %.1f us avg, %zu decompressed in %.1f us avg\n",
+               compression.threshold, compression.values, compression.rawBytes, compression.storedBytes,
+               compression.storedBytes ? (double)compression.rawBytes / compression.storedBytes : 1.0,
+               compression.compressions, compression.compressions ? compression.compressNanos / 1e3 / compression.compressions : 0.0,
+               compression.decompressions, compression.decompressions ? compression.decompressNanos / 1e3 / compression.decompressions : 0.0);
+
+    ArtStats index;
+    if (mapIndexStats(map, &index))
+        printf("index: %zu keys, %zu/%zu/%zu/%zu nodes of 4/16/48/256, %zu bytes (%.0f%% of %zu key bytes)\n",
+               index.keys, index.nodes[0], index.nodes[1], index.nodes[2], index.nodes[3], index.bytes,
+               index.keyBytes ? 100.0 * index.bytes / index.keyBytes : 0.0, index.keyBytes);
+
+    BTreeStats range;
+    if (mapRangeStats(map, &range))
+        printf("range: %zu integer keys, %zu leaves, %zu inner nodes, depth %d, %zu bytes\n", range.keys, range.leaves,
+               range.inners, range.depth, range.bytes);
+
+    HotKeysStats hot;
+    if (mapHotKeysStats(map, &hot))
+        printf("hotkeys: %zu tracked, sampling 1 in %u, %zu samples, %zu windows, %zu bytes\n", hot.capacity,
+               hot.sampleRate, hot.samples, hot.windows, hot.bytes);
+
+    BloomStats filter;
+    if (mapFilterStats(map, &filter))
+        printf("filter: %zu bytes, %d hashes, sized for %zu keys, est. fpr %.4f%%, %zu lookups, %zu rejected\n",
+               filter.bytes, filter.hashes, filter.capacity, filter.fpr * 100, filter.lookups, filter.rejected);
+
+    FrozenStats ice;
+    if (frozen) {
+        frozenStats(frozen, &ice);
+        printf("frozen: %zu keys, %zu bytes for %zu bytes of keys and values, %s\n", ice.keys, ice.bytes, ice.rawBytes,
+               ice.mapped ? "mapped from file" : "in memory");
+    }
+
+    if (primary) {
+        ReplicaStatus status[16];
+        size_t replicas = primaryReplicas(primary, status, 16);
+        printf("replication: primary at offset %llu, %zu replicas\n", primaryOffset(primary), replicas);
+        for (size_t i = 0; i < replicas && i < 16; i++)
+            printf("replica %d: %s, acked %llu, lag %llu entries, %zu bytes queued, last ack %.1f s ago\n",
+                   status[i].id, status[i].bootstrapping ? "bootstrapping" : "streaming", status[i].acked,
+                   status[i].lag, status[i].queued, status[i].ackAge);
+    }
+    ReplicaStats follow;
+    if (replica) {
+        replicaStats(replica, &follow);
+        printf("replication: replica at offset %llu (snapshot at %llu), %s, %llu batches, largest %llu entries, "
+               "last batch %.1f s ago\n", follow.applied, follow.snapshotOffset,
+               follow.connected ? "streaming" : "primary lost", follow.batches, follow.largestBatch, follow.batchAge);
+    }
+    printf("\n");
+}
+
+/** Arguments and outcome of an incr, decr or incrby command. */
+typedef struct {
+    /** Amount added to the value. */
+    long long delta;
+    /** Set when the value isn't an integer. */
+    _Bool notInteger;
+    /** Set when the result doesn't fit in an int. */
+    _Bool overflow;
+} Increment;
+
+/**
+ * This function adds an amount to the value of a key, as a mapUpsert callback.
+ * A missing key counts as 0, and a Text value that is entirely a decimal int is turned into an Integer.
+ * An Integer value is updated in place, so incrementing an existing counter allocates nothing.
+ * @param value a pointer to the key's value, or to NULL for a new key
+ * @param ctx a pointer to the Increment
+ * @return true if the value was updated, false if it isn't an integer, the result overflows or memory runs out
+ */
+static _Bool incrementValue(VType** value, void* ctx) {
+    Increment* inc = (Increment*)ctx;
+    int current = 0;
+    if (*value && (*value)->type == 'I')
+        current = (*value)->value.integer;
+    else if (*value && !parseInteger((*value)->value.text, (*value)->length, &current)) {
+        inc->notInteger = 1;
+        return 0;
+    }
 
+    long long result = current + inc->delta;
+    if (result < INT_MIN || result > INT_MAX) {
+        inc->overflow = 1;
+        return 0;
+    }
+
+    if (*value && (*value)->type == 'I') {
+        (*value)->value.integer = (int)result;
+        return 1;
+    }
+
+    VType* integer = makeInteger((int)result);
+    if (!integer)
+        return 0;
+    freeVType(*value);
+    *value = integer;
+    return 1;
+}
+
+/** Text added to the value of a key by an append command. */
 typedef struct {
-    int key;
-    char *value;
-} Entry;
+    char const* text;
+    size_t len;
+} Append;
+
+/**
+ * This function appends text to the value of a key, as a mapUpsert callback.
+ * A missing key starts out empty, and an Integer value is turned into its decimal Text first.
+ * Text grows geometrically with 'appendText', so appending to the same key over and over rarely copies it.
+ * @param value a pointer to the key's value, or to NULL for a new key
+ * @param ctx a pointer to the Append
+ * @return true if the text was appended, false if memory runs out
+ */
+static _Bool appendValue(VType** value, void* ctx) {
+    Append* app = (Append*)ctx;
+    if (!*value) {
+        *value = makeTextLen(app->text, app->len);
+        return *value != NULL;
+    }
+
+    if ((*value)->type == 'I') {
+        char buffer[12];
+        int len = sprintf(buffer, "%d", (*value)->value.integer);
+        VType* text = makeTextLen(buffer, len);
+        if (!text || !appendText(text, app->text, app->len)) {
+            freeVType(text);
+            return 0;
+        }
+        freeVType(*value);
+        *value = text;
+        return 1;
+    }
+    return appendText(*value, app->text, app->len);
+}
+
+/** Progress of a scan command: how many keys it may print and the last one it printed. */
+typedef struct {
+    size_t limit;
+    size_t printed;
+    VType const* last;
+} ScanPrint;
+
+/**
+ * This function prints one key found by a scan, as a mapScan callback.
+ * The scan asks for one key more than it prints, so reaching that key only tells it that more remain.
+ * @param key the key
+ * @param value unused
+ * @param ctx a pointer to the ScanPrint
+ * @return true while the scan may print more keys
+ */
+static _Bool printScanned(VType const* key, VType const* value, void* ctx) {
+    ScanPrint* scan = (ScanPrint*)ctx;
+    if (scan->printed == scan->limit)
+        return 0;
+    printVType(key);
+    printf("\n");
+    scan->printed++;
+    scan->last = key;
+    return 1;
+}
+
+/**
+ * This function runs a scan or keys command: it prints up to a limit of the keys starting with a prefix in byte order,
+ * after a cursor if one is given, and ends with the cursor to continue from when more keys remain.
+ * @param map the map
+ * @param cmd the command, named in its error message
+ * @param prefix the prefix, empty to list every key
+ * @param prefixLen the length of the prefix
+ * @param pos the rest of the command line: an optional limit, then an optional cursor
+ */
+static void runScan(Map* map, char const* cmd, char const* prefix, size_t prefixLen, char* pos) {
+    ScanPrint scan = { SCAN_LIMIT, 0, NULL };
+    char* limit;
+    char* cursor = NULL;
+    size_t limitLen, cursorLen = 0, restLen;
+    char* end = NULL;
+    if (((limit = nextWord(&pos, &limitLen)) &&
+         ((scan.limit = strtoul(limit, &end, 10)), end != limit + limitLen || scan.limit == 0)) ||
+        (limit && (cursor = nextWord(&pos, &cursorLen)) && restOfLine(pos, &restLen))) {
+        printf("Invalid '%s' command format.\n", cmd);
+        return;
+    }
+    long found = mapScan(map, prefix, prefixLen, cursor, cursorLen, scan.limit + 1, printScanned, &scan);
+    if (found < 0)
+        printf("No index; start the driver with -i to %s.\n", strcmp(cmd, "keys") == 0 ? "list keys" : "scan");
+    else if ((size_t)found > scan.printed) {
+        printf("cursor: ");
+        printVType(scan.last);
+        printf("\n");
+    }
+}
+
+/**
+ * This function prints one pair found by a range query, as a mapRange callback.
+ * @param key the key
+ * @param value the value
+ * @param ctx unused
+ * @return true, to print every pair in the range
+ */
+static _Bool printRanged(VType const* key, VType const* value, void* ctx) {
+    printVType(key);
+    printf(" ");
+    printVType(value);
+    printf("\n");
+    return 1;
+}
 
-Entry *table[TABLE_SIZE];
+/**
+ * This function adds a value to a response the way printVType prints it.
+ * @param reply the response
+ * @param value the value
+ */
+static void replyValue(CoreReply* reply, VType const* value) {
+    if (value->type == 'T')
+        coreReplyPrintf(reply, "%s", value->value.text);
+    else if (value->type == 'I')
+        coreReplyPrintf(reply, "%d", value->value.integer);
+}
 
 /**
- * This function calculates the hash value for the given key using the modulo operator.
- * The hash value is used to map the key to an index in the hash table.
- * @param key the integer key for which the hash value needs to be calculated
- * @return the calculated hash value (an index in the hash table)
+ * This function tells whether a command reads or updates a single key, so it can run on the key's partition alone.
+ * @param cmd the command
+ * @return true for set, get, remove, incr, decr, incrby and append
  */
-int hash(int key) {
-    return key % TABLE_SIZE;
+static _Bool isKeyCommand(char const* cmd) {
+    static char const* const commands[] = { "set", "get", "remove", "incr", "decr", "incrby", "append" };
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if (strcmp(cmd, commands[i]) == 0)
+            return 1;
+    }
+    return 0;
 }
 
 /**
- * This function sets a key-value pair in the hashmap by calculating the index using the hash function.
- * If the key already exists in the hashmap, the existing value is updated with the new value.
- * If the key does not exist, a new entry is created and added to the hashmap.
- * Note: The function assumes that the hashmap, `table`, is already initialized and has enough space.
- * @param key the integer key for the key-value pair
- * @param value a pointer to the C string (null-terminated) representing the value associated with the key
+ * This function runs a command on a single key and writes what it prints into a response.
+ * @param map the map, or with -P the partition owning the key
+ * @param cmd the command, one isKeyCommand accepts
+ * @param pos the rest of the command line after the command
+ * @param reply the response the output is appended to
  */
-void set(int key, const char *value) {
-    int index = hash(key);
+static void keyCommand(Map* map, char const* cmd, char* pos, CoreReply* reply) {
+    char* key;
+    char* value;
+    size_t keyLen, valueLen;
 
-    while (table[index] != NULL) {
-        if (table[index]->key == key) {
-            free(table[index]->value);
-            table[index]->value = strdup(value);
+    if (strcmp(cmd, "set") == 0) {
+        if (!(key = nextWord(&pos, &keyLen)) || !(value = restOfLine(pos, &valueLen))) {
+            coreReplyPrintf(reply, "Invalid 'set' command format.\n");
+            return;
+        }
+        if (!mapSet(map, parseValue(key, keyLen), parseValue(value, valueLen)))
+            coreReplyPrintf(reply, "Unable to store the key.\n");
+    } else if (strcmp(cmd, "get") == 0) {
+        if (!(key = nextWord(&pos, &keyLen)) || restOfLine(pos, &valueLen)) {
+            coreReplyPrintf(reply, "Invalid 'get' command format.\n");
             return;
         }
-        index = (index + 1) % TABLE_SIZE;
+        int integer;
+        VType* result = parseInteger(key, keyLen, &integer) ? mapGetInt(map, integer) : mapGetText(map, key, keyLen);
+        if (result) {
+            replyValue(reply, result);
+            coreReplyPrintf(reply, "\n");
+        } else
+            coreReplyPrintf(reply, "Key not found.\n");
+    } else if (strcmp(cmd, "remove") == 0) {
+        if (!(key = nextWord(&pos, &keyLen)) || restOfLine(pos, &valueLen)) {
+            coreReplyPrintf(reply, "Invalid 'remove' command format.\n");
+            return;
+        }
+        int integer;
+        if (parseInteger(key, keyLen, &integer))
+            mapRemoveInt(map, integer);
+        else
+            mapRemoveText(map, key, keyLen);
+    } else if (strcmp(cmd, "append") == 0) {
+        Append app;
+        if (!(key = nextWord(&pos, &keyLen)) || !(app.text = restOfLine(pos, &app.len))) {
+            coreReplyPrintf(reply, "Invalid 'append' command format.\n");
+            return;
+        }
+        VType k;
+        borrowValue(key, keyLen, &k);
+        VType* result = mapUpsert(map, &k, appendValue, &app);
+        if (result && result->type == 'T')
+            coreReplyPrintf(reply, "%u\n", result->length);
+        else
+            coreReplyPrintf(reply, "Unable to update the key.\n");
+    } else {
+        Increment inc = { strcmp(cmd, "decr") == 0 ? -1 : 1, 0, 0 };
+        char* end = NULL;
+        if (!(key = nextWord(&pos, &keyLen)) ||
+            (strcmp(cmd, "incrby") == 0 && (!(value = nextWord(&pos, &valueLen)) ||
+                                            ((inc.delta = strtoll(value, &end, 10)), end != value + valueLen))) ||
+            restOfLine(pos, &valueLen)) {
+            coreReplyPrintf(reply, "Invalid '%s' command format.\n", cmd);
+            return;
+        }
+        VType k;
+        borrowValue(key, keyLen, &k);
+        VType* result = mapUpsert(map, &k, incrementValue, &inc);
+        if (inc.notInteger)
+            coreReplyPrintf(reply, "Value is not an integer.\n");
+        else if (inc.overflow)
+            coreReplyPrintf(reply, "Increment would overflow.\n");
+        else if (!result)
+            coreReplyPrintf(reply, "Unable to update the key.\n");
+        else
+            coreReplyPrintf(reply, "%d\n", result->value.integer);
     }
+}
 
-    Entry *new_entry = malloc(sizeof(Entry));
-    new_entry->key = key;
-    new_entry->value = strdup(value);
+/** What a hotkeys command asks for. */
+typedef struct {
+    /** 'l' to list the hottest keys, '+' to start tracking them, '-' to stop. */
+    char action;
+    /** The number of keys to list, or one in how many operations to sample once tracking starts. */
+    unsigned long count;
+} HotKeysArgs;
 
-    table[index] = new_entry;
+/**
+ * This function parses the arguments of a hotkeys command: "on [rate]", "off" or "[count]".
+ * @param pos the rest of the command line after the command
+ * @param args where the arguments are stored
+ * @return true if the arguments are valid
+ */
+static _Bool parseHotKeys(char* pos, HotKeysArgs* args) {
+    size_t len;
+    char* word = nextWord(&pos, &len);
+    char* end = NULL;
+    args->action = 'l';
+    args->count = HOT_KEYS_LIST;
+    if (word && len == 2 && strncmp(word, "on", 2) == 0) {
+        args->action = '+';
+        args->count = HOT_KEYS_SAMPLE;
+        word = nextWord(&pos, &len);
+    } else if (word && len == 3 && strncmp(word, "off", 3) == 0) {
+        args->action = '-';
+        return !restOfLine(pos, &len);
+    }
+    if (word && ((args->count = strtoul(word, &end, 10)), end != word + len || args->count == 0))
+        return 0;
+    if (args->action == 'l' && args->count > HOT_KEYS_TRACKED)
+        return 0;
+    return !restOfLine(pos, &len);
+}
+
+/**
+ * This function runs a hotkeys command on a map and writes what it prints into a response.
+ * A list is written one "<key> <rate>/s" line per key, hottest first, for printHotKeys to print; when the map isn't
+ * tracking hot keys nothing is written and the response's number is set instead. Starting and stopping tracking is
+ * reported by core 0 only, so with -P it is reported once.
+ * @param map the map, or with -P a core's partition
+ * @param args the parsed arguments
+ * @param core the number of the core, 0 without -P
+ * @param reply the response the output is appended to
+ */
+static void hotKeysCommand(Map* map, HotKeysArgs const* args, int core, CoreReply* reply) {
+    if (args->action == '+') {
+        if (!mapEnableHotKeys(map, HOT_KEYS_TRACKED, args->count))
+            coreReplyPrintf(reply, "Unable to track hot keys.\n");
+        else if (core == 0)
+            coreReplyPrintf(reply, "Tracking hot keys, sampling 1 in %lu operations.\n", args->count);
+    } else if (args->action == '-') {
+        mapDisableHotKeys(map);
+        if (core == 0)
+            coreReplyPrintf(reply, "Stopped tracking hot keys.\n");
+    } else {
+        HotKey top[HOT_KEYS_TRACKED];
+        long n = mapHotKeys(map, top, args->count);
+        reply->number = n < 0;
+        for (long i = 0; i < n; i++) {
+            replyValue(reply, top[i].key);
+            coreReplyPrintf(reply, " %.1f/s\n", top[i].rate);
+        }
+    }
 }
 
 /**
- * This function retrieves the value associated with the given key from the hashmap.
- * If the key is found in the hashmap, a pointer to the corresponding value is returned.
- * If the key is not found, NULL is returned.
- * Note: The function assumes that the hashmap, `table`, is already initialized.
- * @param key the integer key for which the value needs to be retrieved
- * @return a pointer to the C string (null-terminated) representing the value associated with the key, or NULL if the key is not found
+ * This function compares two lines of a hotkeys list by their rates, highest first, as a qsort comparator.
+ * @param a a pointer to one line
+ * @param b a pointer to the other
+ * @return a negative number if 'a' comes first, a positive one if 'b' does, 0 if they are tied
  */
-char *get(int key) {
-    int index = hash(key);
+static int byRate(void const* a, void const* b) {
+    double x = strtod(strrchr(*(char* const*)a, ' ') + 1, NULL);
+    double y = strtod(strrchr(*(char* const*)b, ' ') + 1, NULL);
+    return (x < y) - (x > y);
+}
+
+/**
+ * This function prints the hottest keys of a hotkeys list. With -P the lists of every core are gathered into one
+ * response, so the lines are sorted by rate again before the first 'k' are printed.
+ * @param reply the response holding the list
+ * @param k the number of keys to print
+ */
+static void printHotKeys(CoreReply const* reply, size_t k) {
+    if (reply->number) {
+        printf("Not tracking hot keys; start with 'hotkeys on'.\n");
+        return;
+    }
+    size_t n = 0;
+    char* text = reply->len ? strdup(reply->text) : NULL;
+    char** lines = text ? (char**)malloc((reply->len / 4 + 1) * sizeof(char*)) : NULL;
+    for (char* line = lines ? strtok(text, "\n") : NULL; line; line = strtok(NULL, "\n"))
+        lines[n++] = line;
+    qsort(lines, n, sizeof(char*), byRate);
+    for (size_t i = 0; i < n && i < k; i++)
+        printf("%s\n", lines[i]);
+    if (n == 0)
+        printf("No hot keys yet.\n");
+    free(lines);
+    free(text);
+}
 
-    while (table[index] != NULL) {
-        if (table[index]->key == key) {
-            return table[index]->value;
+/**
+ * This function parses the arguments of a latency command: nothing to list the latencies, or "reset".
+ * @param pos the rest of the command line after the command
+ * @param reset where whether to reset is stored
+ * @return true if the arguments are valid
+ */
+static _Bool parseLatency(char* pos, _Bool* reset) {
+    size_t len;
+    char* word = nextWord(&pos, &len);
+    *reset = word && len == 5 && strncmp(word, "reset", 5) == 0;
+    return (!word || *reset) && !restOfLine(pos, &len);
+}
+
+/**
+ * This function prints the latency percentiles of every command run since the window started, in microseconds.
+ * @param table the latency histograms
+ */
+static void printLatency(Latency const* table) {
+    LatencySummary summaries[LATENCY_COMMANDS];
+    size_t n = latencySummaries(table, summaries, LATENCY_COMMANDS);
+    printf("latency over the last %.1f s, in microseconds:\n", latencyWindow(table));
+    if (n == 0) {
+        printf("No commands timed yet.\n");
+        return;
+    }
+    printf("%-10s %10s %10s %10s %10s %10s %10s %10s\n", "command", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (size_t i = 0; i < n; i++) {
+        LatencySummary const* l = &summaries[i];
+        printf("%-10s %10llu %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f\n", l->command, l->count, l->mean / 1000,
+               l->p50 / 1000.0, l->p90 / 1000.0, l->p99 / 1000.0, l->p999 / 1000.0, l->max / 1000.0);
+    }
+}
+
+/**
+ * This function makes the partition of one core with -P, as a CoreSetup callback, with the settings the single map
+ * gets without -P.
+ * The core's latency histograms are made with it, on the same core.
+ * @param core the number of the core
+ * @param ctx a pointer to the MapConfig
+ * @return the partition, or NULL if it, its filter or its histograms can't be allocated
+ */
+static Map* makePartition(int core, void* ctx) {
+    MapConfig const* config = (MapConfig const*)ctx;
+    if (!(coreLatency[core] = makeLatency()))
+        return NULL;
+    Map* map = makeMapBackend(0, backend, config->allocator);
+    if (!map)
+        return NULL;
+    if (config->compressBytes)
+        mapEnableCompression(map, config->compressBytes);
+    if (config->chainLimit >= 0)
+        mapSetChainLimit(map, config->chainLimit);
+    if (config->filterFpr && !mapEnableFilter(map, config->filterFpr, config->filterBytes)) {
+        mapFree(map);
+        return NULL;
+    }
+    return map;
+}
+
+/**
+ * This function runs one command line on a core's partition with -P, as a CoreTask callback.
+ * Single-key commands print as they would without -P; size reports the partition's size as the response's number,
+ * and stats a line about the partition, so the driver can add them up over the cores. compact compacts the partition
+ * and reports its size, or a line saying it couldn't, and hotkeys lists the partition's hottest keys.
+ * Every command is timed into the core's latency histograms, except that a command sent to every core is only timed
+ * on core 0, so it is counted once; latency reset empties the core's histograms, and latency itself does nothing
+ * here, since the driver adds up the histograms of all cores once every core has reached it.
+ * @param map the partition
+ * @param core the number of the core
+ * @param request the command line
+ * @param len unused
+ * @param reply the response
+ */
+static void runOnCore(Map* map, int core, char* request, size_t len, CoreReply* reply) {
+    unsigned long long started = latencyClock();
+    char cmd[20];
+    if (sscanf(request, "%19s", cmd) != 1)
+        return;
+    char* pos = strstr(request, cmd) + strlen(cmd);
+
+    PROBE1(command_start, cmd);
+    if (strcmp(cmd, "latency") == 0) {
+        _Bool reset;
+        if (parseLatency(pos, &reset) && reset) {
+            latencyReset(coreLatency[core]);
+            if (core == 0)
+                coreReplyPrintf(reply, "Latency window reset.\n");
         }
-        index = (index + 1) % TABLE_SIZE;
+        return;
     }
 
-    return NULL;
+    if (isKeyCommand(cmd)) {
+        keyCommand(map, cmd, pos, reply);
+    } else if (strcmp(cmd, "size") == 0) {
+        reply->number = mapSize(map);
+    } else if (strcmp(cmd, "stats") == 0) {
+        HashStats hash;
+        mapHashStats(map, &hash);
+        reply->number = mapSize(map);
+        coreReplyPrintf(reply, "core %d: %zu keys, %s, longest chain %zu, %zu rekeys\n", core, mapSize(map),
+                        hash.keyed ? "siphash" : "seeded djb2", hash.longestChain, hash.rekeys);
+    } else if (strcmp(cmd, "hotkeys") == 0) {
+        HotKeysArgs args;
+        if (parseHotKeys(pos, &args))
+            hotKeysCommand(map, &args, core, reply);
+    } else if (strcmp(cmd, "compact") == 0) {
+        reply->number = mapSize(map);
+        if (!mapCompact(map))
+            coreReplyPrintf(reply, "Unable to compact core %d.\n", core);
+    }
+    if (isKeyCommand(cmd) || core == 0) {
+        unsigned long long nanos = latencyClock() - started;
+        latencyRecord(coreLatency[core], cmd, nanos);
+        PROBE2(command_end, cmd, nanos);
+    }
 }
 
-// Remove a key-value pair from the hashmap
-void remove_entry(int key) {
-    int index = hash(key);
+/**
+ * This function tells whether another line of input can be read without waiting for it, so the driver only flushes
+ * its responses when it is about to wait for a command. A program feeding commands through a pipe then sees every
+ * response as soon as the driver is idle, while a file read in one go is answered with full buffers.
+ * @param in the input read ahead
+ * @return true if a whole line is buffered, the input has ended or more of it can be read at once
+ */
+static _Bool inputWaiting(InputBuffer* in) {
+    if (in->eof || memchr(in->data + in->start, '\n', in->end - in->start))
+        return 1;
+    struct pollfd fd = { STDIN_FILENO, POLLIN, 0 };
+    return poll(&fd, 1, 0) > 0;
+}
 
-    while (table[index] != NULL) {
-        if (table[index]->key == key) {
-            free(table[index]->value);
-            free(table[index]);
-            table[index] = NULL;
-            return;
+/**
+ * This function reads the next line of standard input, as getline would, into a buffer grown as needed.
+ * A line longer than MAX_LINE is read to its end and dropped, so no part of it runs as a command of its own.
+ * @param in the input read ahead
+ * @param line where the buffer is kept; the line is stored in it with its newline and NUL-terminated
+ * @param capacity the size of the buffer, kept with it
+ * @return 1 if a line was read, 0 at the end of the input, or -1 if the line was too long or memory ran out
+ */
+static int readInput(InputBuffer* in, char** line, size_t* capacity) {
+    size_t len = 0;
+    _Bool dropped = 0;
+    while (1) {
+        size_t buffered = in->end - in->start;
+        char* nl = memchr(in->data + in->start, '\n', buffered);
+        size_t n = nl ? (size_t)(nl + 1 - (in->data + in->start)) : buffered;
+        if (!dropped && len + n > MAX_LINE) {
+            dropped = 1;
+        } else if (!dropped && len + n + 1 > *capacity) {
+            size_t grown = *capacity ? *capacity : 1024;
+            while (grown < len + n + 1)
+                grown *= 2;
+            char* bigger = (char*)realloc(*line, grown);
+            if (bigger) {
+                *line = bigger;
+                *capacity = grown;
+            } else {
+                dropped = 1;
+            }
         }
-        index = (index + 1) % TABLE_SIZE;
+        if (!dropped) {
+            memcpy(*line + len, in->data + in->start, n);
+            len += n;
+            (*line)[len] = '\0';
+        }
+        in->start += n;
+        if (nl || in->eof)
+            return dropped ? -1 : len > 0;
+
+        in->start = in->end = 0;
+        ssize_t got = read(STDIN_FILENO, in->data, sizeof(in->data));
+        if (got > 0)
+            in->end = got;
+        else if (got == 0 || errno != EINTR)
+            in->eof = 1;
+    }
+}
+
+/** Map a replica applies the primary's log to, and the response the commands' output goes to and is dropped. */
+typedef struct {
+    Map* map;
+    CoreReply reply;
+} Applier;
+
+/**
+ * This function applies one command of the primary's log on a replica, as a replicaApply callback.
+ * @param command the command line
+ * @param len its length
+ * @param ctx a pointer to the Applier
+ */
+static void applyReplicated(char* command, size_t len, void* ctx) {
+    Applier* applier = (Applier*)ctx;
+    char cmd[20];
+    if (sscanf(command, "%19s", cmd) != 1 || !isKeyCommand(cmd))
+        return;
+    keyCommand(applier->map, cmd, strstr(command, cmd) + strlen(cmd), &applier->reply);
+    applier->reply.len = 0;
+}
+
+/**
+ * This function does the replication work that is ready: a replica applies the log that has arrived as one batch,
+ * and a primary takes on new replicas, reads their acknowledgements and sends them the log.
+ * @param applier the map and response a replica applies the log with
+ * @param idle whether the driver is about to wait for input, so a primary sends all the log it has queued
+ */
+static void replicate(Applier* applier, _Bool idle) {
+    if (replica)
+        replicaApply(replica, applyReplicated, applier);
+    if (primary)
+        primaryService(primary, applier->map, idle);
+}
+
+/**
+ * This function waits for the next line of input while replicating: the log keeps being applied or sent while no
+ * command comes. Without replication it returns at once and the read itself waits.
+ * @param in the input read ahead
+ * @param applier the map and response a replica applies the log with
+ */
+static void waitForInput(InputBuffer* in, Applier* applier) {
+    while ((primary || (replica && replicaFd(replica) >= 0)) && !inputWaiting(in)) {
+        struct pollfd fds[32];
+        int n = 0;
+        fds[n++] = (struct pollfd){ STDIN_FILENO, POLLIN, 0 };
+        if (primary)
+            n += primaryPollFds(primary, fds + n, 31);
+        if (replica && replicaFd(replica) >= 0)
+            fds[n++] = (struct pollfd){ replicaFd(replica), POLLIN, 0 };
+        poll(fds, n, REPLICATION_POLL_MS);
+        replicate(applier, 1);
     }
 }
 
 /**
- * This function removes a key-value pair from the hashmap based on the provided key.
- * If the key is found in the hashmap, the corresponding entry is removed, and memory allocated for the entry's value and the entry itself is freed.
- * If the key is not found, the function does nothing and simply returns.
- * Note: The function assumes that the hashmap, `table`, is already initialized.
- * @param key the integer key for the key-value pair to be removed
+ * This function prints the next response from the cores with -P, after the prompt of the command it answers.
+ * @param cores the cores
+ * @param wait whether to wait for the response
+ * @param prompted whether the prompt was already printed, cleared once the response is
+ * @return true if a response was printed, false if none is outstanding or, without waiting, it isn't ready
  */
-void free_map() {
-    for (int i = 0; i < TABLE_SIZE; i++) {
-        if (table[i] != NULL) {
-            free(table[i]->value);
-            free(table[i]);
+static _Bool printCoreReply(CoreMap* cores, _Bool wait, _Bool* prompted) {
+    CoreReply const* reply = coreMapNext(cores, wait);
+    if (!reply)
+        return 0;
+    if (!*prompted)
+        printf("cmd> ");
+    *prompted = 0;
+
+    if (reply->tag == REPLY_SIZE) {
+        printf("%lld\n\n", reply->number);
+    } else if (reply->tag == REPLY_STATS) {
+        printf("keys: %lld\n", reply->number);
+        PageStats pages;
+        if (pageModeName) {
+            pageAllocatorStats(pageMode, &pages);
+            printf("pages: %s, %zu regions, %zu bytes, %zu with explicit huge pages, %zu fell back\n",
+                   pageModeName, pages.regions, pages.bytes, pages.hugetlbRegions, pages.fallbacks);
         }
+        printf("%s\n", reply->len ? reply->text : "");
+    } else if (reply->tag == REPLY_LATENCY) {
+        Latency* merged = makeLatency();
+        for (int core = 0; merged && core < coreMapCores(cores); core++)
+            latencyMerge(merged, coreLatency[core]);
+        if (merged)
+            printLatency(merged);
+        else
+            printf("Unable to add up the latencies.\n");
+        latencyFree(merged);
+    } else if (reply->tag >= REPLY_HOTKEYS) {
+        printHotKeys(reply, reply->tag - REPLY_HOTKEYS);
+    } else if (reply->tag == REPLY_COMPACT) {
+        if (reply->len)
+            fputs(reply->text, stdout);
+        else
+            printf("Compacted %lld entries, %ld KB resident.\n", reply->number, residentKilobytes());
+    } else if (reply->len) {
+        fputs(reply->text, stdout);
     }
+    return 1;
 }
 
 /**
- * Returns the number of key-value pairs in the hashmap.
- * @return The number of key-value pairs.
+ * This function runs the command loop with -P: one partition per core, each owned by a thread pinned to its core.
+ * Single-key commands go to the core owning the key without waiting for earlier ones to finish, so commands for
+ * different cores run in parallel while this thread reads on. size, stats, compact, hotkeys and latency go to every core and
+ * their answers are added up. Responses are printed in the order the commands were read, exactly as without -P; whenever no
+ * more input is waiting, every outstanding response is printed before the driver blocks to read.
+ * Other commands need the whole map in one place and are refused.
+ * @param count the number of cores
+ * @param config the settings every partition is made with
+ * @return Exit status: 0 for success, non-zero for errors.
  */
-int size() {
-    int count = 0;
-    for (int i = 0; i < TABLE_SIZE; i++) {
-        if (table[i] != NULL) {
-            count++;
+static int runCores(int count, MapConfig* config) {
+    coreLatency = (Latency**)calloc(count, sizeof(Latency*));
+    CoreMap* cores = coreLatency ? makeCoreMap(count, makePartition, config) : NULL;
+    if (!cores) {
+        for (int core = 0; coreLatency && core < count; core++)
+            latencyFree(coreLatency[core]);
+        free(coreLatency);
+        fprintf(stderr, "Unable to start %d cores.\n", count);
+        return EXIT_FAILURE;
+    }
+
+    static InputBuffer in;
+    char* input = NULL;
+    size_t inputCapacity = 0;
+    char cmd[20];
+    _Bool prompted = 0;
+    while (1) {
+        if (!inputWaiting(&in)) {
+            while (printCoreReply(cores, 1, &prompted))
+                ;
+            printf("cmd> ");
+            prompted = 1;
+            fflush(stdout);
+        }
+        int got = readInput(&in, &input, &inputCapacity);
+        if (!got)
+            break;
+        if (got > 0)
+            recordCommand(input);
+
+        int core = -2;
+        int tag = REPLY_TEXT;
+        char const* refusal = NULL;
+        if (got < 0) {
+            refusal = "Line too long.\n";
+        } else if (sscanf(input, "%19s", cmd) != 1) {
+            refusal = "Invalid command.\n";
+        } else if (isKeyCommand(cmd)) {
+            char* pos = strstr(input, cmd) + strlen(cmd);
+            size_t keyLen;
+            char* key = nextWord(&pos, &keyLen);
+            VType k;
+            borrowValue(key ? key : "", key ? keyLen : 0, &k);
+            core = coreMapOwner(cores, &k);
+        } else if (strcmp(cmd, "size") == 0 || strcmp(cmd, "stats") == 0 || strcmp(cmd, "compact") == 0) {
+            core = CORE_ALL;
+            tag = strcmp(cmd, "size") == 0 ? REPLY_SIZE : strcmp(cmd, "stats") == 0 ? REPLY_STATS : REPLY_COMPACT;
+        } else if (strcmp(cmd, "hotkeys") == 0) {
+            HotKeysArgs args;
+            if (!parseHotKeys(strstr(input, cmd) + strlen(cmd), &args)) {
+                refusal = "Invalid 'hotkeys' command format.\n";
+            } else {
+                core = CORE_ALL;
+                tag = args.action == 'l' ? REPLY_HOTKEYS + (int)args.count : REPLY_TEXT;
+            }
+        } else if (strcmp(cmd, "latency") == 0) {
+            _Bool reset;
+            if (!parseLatency(strstr(input, cmd) + strlen(cmd), &reset)) {
+                refusal = "Invalid 'latency' command format.\n";
+            } else {
+                core = CORE_ALL;
+                tag = reset ? REPLY_TEXT : REPLY_LATENCY;
+            }
+        } else if (strcmp(cmd, "quit") == 0) {
+            break;
+        } else {
+            static char const* const wholeMap[] = { "scan", "keys", "range", "min", "max", "succ", "import",
+                                                    "bgsave", "bgstatus", "freeze", "fget" };
+            refusal = "Unknown command.\n";
+            for (size_t i = 0; i < sizeof(wholeMap) / sizeof(wholeMap[0]); i++) {
+                if (strcmp(cmd, wholeMap[i]) == 0)
+                    refusal = "Not available with -P.\n";
+            }
+        }
+
+        if (refusal) {
+            while (printCoreReply(cores, 1, &prompted))
+                ;
+            if (!prompted)
+                printf("cmd> ");
+            prompted = 0;
+            fputs(refusal, stdout);
+            continue;
+        }
+        while (!coreMapSubmit(cores, core, runOnCore, tag, input, strlen(input))) {
+            if (!printCoreReply(cores, 1, &prompted)) {
+                fprintf(stderr, "Unable to queue a command.\n");
+                break;
+            }
         }
+        // The histograms are added up when the latency response is printed, so wait for it before running anything
+        // else, or the sum would count commands read after it.
+        while (printCoreReply(cores, tag == REPLY_LATENCY, &prompted))
+            ;
     }
-    return count;
+
+    while (printCoreReply(cores, 1, &prompted))
+        ;
+    if (!prompted)
+        printf("cmd> ");
+    free(input);
+    coreMapFree(cores);
+    for (int core = 0; core < count; core++)
+        latencyFree(coreLatency[core]);
+    free(coreLatency);
+    return 0;
+}
+
+/**
+ * This function parses a byte count given as an option: decimal digits only, with no sign and no overflow.
+ * @param text the option's argument
+ * @param bytes where the count is stored
+ * @return true if the argument is a valid count
+ */
+static _Bool parseBytes(char const* text, size_t* bytes) {
+    char* end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (!isdigit((unsigned char)text[0]) || *end || errno == ERANGE || value > SIZE_MAX)
+        return 0;
+    *bytes = (size_t)value;
+    return 1;
 }
 
 /**
  * Main loop for a command-line interface (CLI) with a hashmap.
- * Supports commands: set, get, remove, size, quit.
- * CLI continues until 'quit' command is entered.
- * Note: Functions 'set', 'get', 'remove_entry', and 'free_map' should be defined elsewhere.
- * Assumes hashmap 'table' is initialized and has enough space.
+ * Supports commands: set, get, remove, incr, decr, incrby, append, scan, keys, range, min, max, succ, size, stats,
+ * compact, hotkeys, latency, import, bgsave, bgstatus, freeze, fget, quit.
+ * CLI continues until 'quit' command is entered or the input ends.
+ * With -s <file>, the snapshot in that file is loaded at startup and bgsave writes to it.
+ * With -b <fpr>, a Bloom filter with that false-positive rate answers lookups for absent keys; -B <bytes> caps its memory.
+ * With -H normal|thp|hugetlb, the map's buckets and nodes are mapped directly with that kind of pages.
+ * With -m cuckoo, the map uses bucketized cuckoo hashing instead of chained buckets.
+ * With -z <bytes>, Text values at least that long are stored compressed.
+ * With -i, a radix tree index over the keys lets scan list the keys with a prefix.
+ * With -r, a B+-tree over the Integer keys answers range, min, max and succ.
+ * With -c <length>, the map switches to a keyed hash once a chain grows past that length; 0 never switches.
+ * With -f <file>, the frozen map in that file is mapped at startup for fget.
+ * With -t <file>, every command read is recorded with its arrival time to that trace file, for replay.
+ * With -P <cores>, the map is split into that many partitions, each owned by a thread pinned to its own core;
+ * -s, -i, -r, -f, -R and -F need the whole map in one place and can't be combined with it.
+ * With -R <socket>, replicas can connect to that Unix socket; each gets a snapshot, then every change made to the map.
+ * With -F <socket>, the driver is a read-only replica of the primary listening on that socket.
+ * @param argc number of command-line arguments
+ * @param argv list of command-line arguments
  * @return Exit status: 0 for success, non-zero for errors.
  */
-int main() {
+int main(int argc, char* argv[]) {
+    int opt;
+    _Bool load = 0;
+    double filterFpr = 0;
+    size_t filterBytes = 0;
+    size_t compressBytes = 0;
+    _Bool index = 0;
+    _Bool ordered = 0;
+    long chainLimit = -1;
+    char const* frozenPath = NULL;
+    char const* tracePath = NULL;
+    char const* primaryPath = NULL;
+    char const* replicaPath = NULL;
+    int cores = 0;
+    while ((opt = getopt(argc, argv, "s:b:B:H:m:z:irc:f:t:P:R:F:")) != -1) {
+        if (opt == 's') {
+            snapshotPath = optarg;
+            load = 1;
+        } else if (opt == 'b') {
+            filterFpr = atof(optarg);
+        } else if (opt == 'B' && parseBytes(optarg, &filterBytes)) {
+            continue;
+        } else if (opt == 'H' && parsePageMode(optarg, &pageMode)) {
+            pageModeName = optarg;
+        } else if (opt == 'z' && parseBytes(optarg, &compressBytes)) {
+            continue;
+        } else if (opt == 'i') {
+            index = 1;
+        } else if (opt == 'r') {
+            ordered = 1;
+        } else if (opt == 'c' && (chainLimit = atol(optarg)) >= 0) {
+            continue;
+        } else if (opt == 'f') {
+            frozenPath = optarg;
+        } else if (opt == 't') {
+            tracePath = optarg;
+        } else if (opt == 'P' && (cores = atoi(optarg)) > 0) {
+            continue;
+        } else if (opt == 'R') {
+            primaryPath = optarg;
+        } else if (opt == 'F') {
+            replicaPath = optarg;
+        } else if (opt == 'm' && (strcmp(optarg, "chained") == 0 || strcmp(optarg, "cuckoo") == 0)) {
+            backend = strcmp(optarg, "cuckoo") == 0 ? MAP_CUCKOO : MAP_CHAINED;
+        } else {
+            fprintf(stderr, "usage: %s [-s snapshot] [-b filter-fpr] [-B filter-bytes] [-H normal|thp|hugetlb] [-m chained|cuckoo] [-z compress-bytes] [-i] [-r] [-c chain-limit] [-f frozen] [-t trace] [-P cores] [-R replication-socket | -F primary-socket]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (tracePath && !(trace = makeTraceWriter(tracePath))) {
+        fprintf(stderr, "Unable to create trace %s.\n", tracePath);
+        return EXIT_FAILURE;
+    }
+
+    if ((primaryPath && replicaPath) || (replicaPath && load)) {
+        fprintf(stderr, "-F can't be combined with -R or -s.\n");
+        return EXIT_FAILURE;
+    }
+    if (cores) {
+        if (load || index || ordered || frozenPath || primaryPath || replicaPath) {
+            fprintf(stderr, "-s, -i, -r, -f, -R and -F can't be combined with -P.\n");
+            return EXIT_FAILURE;
+        }
+        if (filterFpr && (filterFpr <= 0 || filterFpr >= 1)) {
+            fprintf(stderr, "Invalid filter false-positive rate %g.\n", filterFpr);
+            return EXIT_FAILURE;
+        }
+        MapConfig config = { pageModeName ? pageAllocator(pageMode) : NULL, filterFpr, filterBytes, compressBytes,
+                             chainLimit };
+        int status = runCores(cores, &config);
+        if (!traceWriterFree(trace))
+            fprintf(stderr, "Unable to write the trace %s.\n", tracePath);
+        return status;
+    }
+
+    Map* map = makeMapBackend(0, backend, pageModeName ? pageAllocator(pageMode) : NULL);
+    if (!map || !(latency = makeLatency())) {
+        fprintf(stderr, "Unable to allocate the map.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (compressBytes)
+        mapEnableCompression(map, compressBytes);
+    if (chainLimit >= 0)
+        mapSetChainLimit(map, chainLimit);
+
+    if ((index && !mapEnableIndex(map)) || (ordered && !mapEnableRangeIndex(map))) {
+        fprintf(stderr, "Unable to allocate the index.\n");
+        mapFree(map);
+        return EXIT_FAILURE;
+    }
+
+    if (filterFpr && !mapEnableFilter(map, filterFpr, filterBytes)) {
+        fprintf(stderr, "Invalid filter false-positive rate %g.\n", filterFpr);
+        mapFree(map);
+        return EXIT_FAILURE;
+    }
+
+    if (frozenPath && !(frozen = frozenOpen(frozenPath))) {
+        fprintf(stderr, "Unable to open frozen map %s.\n", frozenPath);
+        mapFree(map);
+        return EXIT_FAILURE;
+    }
+
+    if (load && access(snapshotPath, F_OK) == 0) {
+        long loaded = snapshotLoad(map, snapshotPath);
+        if (loaded < 0) {
+            fprintf(stderr, "Unable to load snapshot %s.\n", snapshotPath);
+            mapFree(map);
+            return EXIT_FAILURE;
+        }
+        printf("Loaded %ld entries from %s\n", loaded, snapshotPath);
+    }
+
+    long replicated = 0;
+    if (replicaPath && !(replica = replicaConnect(replicaPath, map, &replicated))) {
+        fprintf(stderr, "Unable to replicate the primary at %s.\n", replicaPath);
+        mapFree(map);
+        return EXIT_FAILURE;
+    }
+    if (replica)
+        printf("Replicated %ld entries from %s\n", replicated, replicaPath);
+    if (primaryPath && !(primary = makePrimary(primaryPath))) {
+        fprintf(stderr, "Unable to listen for replicas on %s.\n", primaryPath);
+        mapFree(map);
+        return EXIT_FAILURE;
+    }
+
+    static InputBuffer in;
     char cmd[20];
-    int key, value;
-    char input[100];
+    char* input = NULL;
+    size_t inputCapacity = 0;
+    CoreReply reply = { NULL, 0, 0, 0, REPLY_TEXT };
+    Applier applier = { map, { NULL, 0, 0, 0, REPLY_TEXT } };
+    // Command being timed, recorded once it has finished, and when it started.
+    char const* timed = NULL;
+    unsigned long long started = 0;
 
     while (1) {
+        if (timed) {
+            unsigned long long nanos = latencyClock() - started;
+            latencyRecord(latency, timed, nanos);
+            PROBE2(command_end, timed, nanos);
+        }
+        timed = NULL;
+        checkBgsave();
+        replicate(&applier, 0);
         printf("cmd> ");
-        if (fgets(input, sizeof(input), stdin) == NULL) {
-            printf("Error reading input.\n");
+        if (!inputWaiting(&in)) {
+            fflush(stdout);
+            waitForInput(&in, &applier);
+        }
+        int got = readInput(&in, &input, &inputCapacity);
+        if (!got)
+            break;
+        if (got < 0) {
+            printf("Line too long.\n");
             continue;
         }
+        recordCommand(input);
+        started = latencyClock();
 
         if (sscanf(input, "%19s", cmd) != 1) {
             printf("Invalid command.\n");
             continue;
         }
+        timed = cmd;
+        PROBE1(command_start, cmd);
+
+        char* pos = strstr(input, cmd) + strlen(cmd);
+        char* key;
+        char* value;
+        size_t keyLen, valueLen;
 
-        if (strcmp(cmd, "set") == 0) {
-            if (sscanf(input, "%*s %d %d", &key, &value) != 2) {
-                printf("Invalid 'set' command format.\n");
+        if (isKeyCommand(cmd)) {
+            _Bool read = strcmp(cmd, "get") == 0;
+            if (replica && !read) {
+                printf("Read-only replica.\n");
                 continue;
             }
-            set(key, input + strlen(cmd) + 4); // +4 accounts for spaces and key
-        } else if (strcmp(cmd, "get") == 0) {
-            if (sscanf(input, "%*s %d", &key) != 1) {
-                printf("Invalid 'get' command format.\n");
+            keyCommand(map, cmd, pos, &reply);
+            if (reply.len)
+                fputs(reply.text, stdout);
+            reply.len = 0;
+            if (primary && !read)
+                primaryLog(primary, input, strcspn(input, "\r\n"));
+        } else if (strcmp(cmd, "scan") == 0) {
+            if (!(key = nextWord(&pos, &keyLen)))
+                printf("Invalid 'scan' command format.\n");
+            else
+                runScan(map, cmd, key, keyLen, pos);
+        } else if (strcmp(cmd, "keys") == 0) {
+            runScan(map, cmd, "", 0, pos);
+        } else if (strcmp(cmd, "range") == 0) {
+            int lo, hi;
+            size_t limit = 0;
+            char* end = NULL;
+            if (!(key = nextWord(&pos, &keyLen)) || !parseInteger(key, keyLen, &lo) ||
+                !(value = nextWord(&pos, &valueLen)) || !parseInteger(value, valueLen, &hi) ||
+                ((value = nextWord(&pos, &valueLen)) &&
+                 ((limit = strtoul(value, &end, 10)), end != value + valueLen || limit == 0)) ||
+                restOfLine(pos, &valueLen)) {
+                printf("Invalid 'range' command format.\n");
+                continue;
+            }
+            if (mapRange(map, lo, hi, limit, printRanged, NULL) < 0)
+                printf("No range index; start the driver with -r to query ranges.\n");
+        } else if (strcmp(cmd, "min") == 0 || strcmp(cmd, "max") == 0 || strcmp(cmd, "succ") == 0) {
+            int integer = 0;
+            _Bool succ = strcmp(cmd, "succ") == 0;
+            if ((succ && (!(key = nextWord(&pos, &keyLen)) || !parseInteger(key, keyLen, &integer))) ||
+                restOfLine(pos, &valueLen)) {
+                printf("Invalid '%s' command format.\n", cmd);
                 continue;
             }
-            char *result = get(key);
-            if (result)
-                printf("%s\n", result);
+            BTreeStats range;
+            _Bool found = succ ? mapNextKey(map, integer, &integer)
+                               : strcmp(cmd, "min") == 0 ? mapMinKey(map, &integer) : mapMaxKey(map, &integer);
+            if (found)
+                printf("%d\n", integer);
+            else if (!mapRangeStats(map, &range))
+                printf("No range index; start the driver with -r to query ranges.\n");
             else
                 printf("Key not found.\n");
-        } else if (strcmp(cmd, "remove") == 0) {
-            if (sscanf(input, "%*s %d", &key) != 1) {
-                printf("Invalid 'remove' command format.\n");
+        } else if (strcmp(cmd, "size") == 0) {
+            printf("%zu\n\n", mapSize(map));
+        } else if (strcmp(cmd, "stats") == 0) {
+            printStats(map);
+        } else if (strcmp(cmd, "hotkeys") == 0) {
+            HotKeysArgs args;
+            if (!parseHotKeys(pos, &args)) {
+                printf("Invalid 'hotkeys' command format.\n");
                 continue;
             }
-            remove_entry(key);
-        } else if (strcmp(cmd, "size") == 0) {
-            int num_keys = size();
-            printf("%d\n\n", num_keys);
+            hotKeysCommand(map, &args, 0, &reply);
+            if (args.action == 'l')
+                printHotKeys(&reply, args.count);
+            else if (reply.len)
+                fputs(reply.text, stdout);
+            reply.len = 0;
+        } else if (strcmp(cmd, "latency") == 0) {
+            _Bool reset;
+            timed = NULL;
+            if (!parseLatency(pos, &reset)) {
+                printf("Invalid 'latency' command format.\n");
+            } else if (reset) {
+                latencyReset(latency);
+                printf("Latency window reset.\n");
+            } else {
+                printLatency(latency);
+            }
+        } else if (strcmp(cmd, "compact") == 0) {
+            if (mapCompact(map))
+                printf("Compacted %zu entries, %ld KB resident.\n", mapSize(map), residentKilobytes());
+            else
+                printf("Unable to compact the map.\n");
+        } else if (strcmp(cmd, "import") == 0) {
+            long threads = sysconf(_SC_NPROCESSORS_ONLN);
+            if (primary || replica) {
+                // The replicas would have to read the file too; load a primary with set commands instead.
+                printf("Not available with -R or -F.\n");
+                continue;
+            }
+            if (!(key = nextWord(&pos, &keyLen)) || ((value = nextWord(&pos, &valueLen)) && (threads = atoi(value)) < 1) ||
+                restOfLine(pos, &valueLen)) {
+                printf("Invalid 'import' command format.\n");
+                continue;
+            }
+            key[keyLen] = '\0';
+            long records = mapBulkLoad(map, key, threads);
+            if (records < 0)
+                printf("Unable to import %s.\n", key);
+            else
+                printf("Imported %ld records.\n", records);
+        } else if (strcmp(cmd, "bgsave") == 0) {
+            char const* path = snapshotPath;
+            if ((value = restOfLine(pos, &valueLen))) {
+                value[valueLen] = '\0';
+                path = value;
+            }
+            if (bgsaveRunning(&bgsave))
+                printf("Background save already in progress.\n");
+            else if (bgsaveStart(&bgsave, map, path))
+                printf("Background saving started.\n");
+            else
+                printf("Unable to start background save.\n");
+        } else if (strcmp(cmd, "bgstatus") == 0) {
+            if (bgsaveRunning(&bgsave))
+                printf("Background save in progress: %zu/%zu entries\n", bgsave.written, bgsave.total);
+            else
+                printf("No background save in progress.\n");
+        } else if (strcmp(cmd, "freeze") == 0) {
+            if (!(value = restOfLine(pos, &valueLen))) {
+                printf("Invalid 'freeze' command format.\n");
+                continue;
+            }
+            value[valueLen] = '\0';
+            FrozenMap* f = mapFreeze(map);
+            if (!f || !frozenSave(f, value)) {
+                printf("Unable to freeze the map into %s.\n", value);
+                frozenFree(f);
+                continue;
+            }
+            frozenFree(frozen);
+            frozen = f;
+            printf("Froze %zu entries into %s.\n", frozenSize(f), value);
+        } else if (strcmp(cmd, "fget") == 0) {
+            if (!(key = nextWord(&pos, &keyLen)) || restOfLine(pos, &valueLen)) {
+                printf("Invalid 'fget' command format.\n");
+                continue;
+            }
+            int integer;
+            VType result;
+            if (!frozen)
+                printf("No frozen map.\n");
+            else if (parseInteger(key, keyLen, &integer) ? frozenGetInt(frozen, integer, &result)
+                                                         : frozenGetText(frozen, key, keyLen, &result)) {
+                printVType(&result);
+                printf("\n");
+            } else
+                printf("Key not found.\n");
         } else if (strcmp(cmd, "quit") == 0) {
             break;
         } else {
+            timed = "unknown";
             printf("Unknown command.\n");
         }
     }
 
-    free_map();
+    // Let a running background save finish so its result is reported.
+    while (bgsaveRunning(&bgsave)) {
+        usleep(1000);
+        checkBgsave();
+    }
+
+    // Send replicas what is left of the log before disconnecting them.
+    replicate(&applier, 1);
+    free(input);
+    free(reply.text);
+    free(applier.reply.text);
+    primaryFree(primary);
+    replicaFree(replica);
+    latencyFree(latency);
+    if (!traceWriterFree(trace))
+        fprintf(stderr, "Unable to write the trace %s.\n", tracePath);
+    frozenFree(frozen);
+    mapFree(map);
     return 0;
 }
@@ -0,0 +1,556 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "frozen.h"
+#include "siphash.h"
+
+/**
+ * @file frozen.c
+ * @author Jason Wang
+ * This program freezes a map into an immutable image indexed by a minimal perfect hash, for data that is loaded once and
+ * then only read. The hash is built the way PTHash builds one: keys are split into buckets of about five, and each
+ * bucket gets a 32-bit pilot, found by trying 0, 1, 2, ... until every key of the bucket lands on a free slot, so the
+ * n keys fill exactly n slots. Big buckets are placed first, while most slots are free. A lookup then hashes the key
+ * once, reads its bucket's pilot, and compares the key in the one slot it can be in.
+ * The image is a header, the pilots, one 32-bit offset per slot and the packed pairs, in that order and with no
+ * pointers, so a file holding it can be mapped read-only and queried without being parsed. Numbers are stored in the
+ * byte order of the machine that froze the map.
+ */
+
+/** Magic string at the start of every frozen image. */
+#define FROZEN_MAGIC "HMFROZ01"
+
+/** Average number of keys per bucket of the perfect hash: more means fewer pilots but a longer search for them. */
+#define BUCKET_KEYS 5
+
+/** Number of fresh hash keys tried before giving up on building the perfect hash. */
+#define BUILD_ATTEMPTS 8
+
+/**
+ * Header at the start of an image.
+ */
+typedef struct {
+    char magic[8];
+    uint64_t count;
+    uint64_t buckets;
+    uint64_t sipKey[2];
+    uint64_t dataBytes;
+    uint64_t rawBytes;
+} Header;
+
+/**
+ * Define the FrozenMap structure.
+ */
+struct FrozenMapStruct {
+    /** The whole image, either malloc'ed or mapped from a file. */
+    unsigned char* image;
+
+    /** Size of the image in bytes. */
+    size_t length;
+
+    /** True if the image is mapped from a file. */
+    _Bool mapped;
+
+    /** Where the header, pilots, slot offsets and packed pairs are in the image. */
+    Header const* header;
+    uint32_t const* pilots;
+    uint32_t const* offsets;
+    unsigned char const* data;
+};
+
+/**
+ * Pairs gathered from a map before they are placed: each one packed as in the image, in the order visited.
+ */
+typedef struct {
+    unsigned char* data;
+    size_t length;
+    size_t capacity;
+    size_t* starts;
+    size_t count;
+    size_t rawBytes;
+    _Bool failed;
+} Collector;
+
+/**
+ * Spreads the bits of a 64-bit word over the whole word (the MurmurHash3 finalizer).
+ * @param x The word.
+ * @return The mixed word.
+ */
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/**
+ * Hashes a key with SipHash under the image's key, so lookups in any process find what the freezing process placed.
+ * @param key A pointer to the key.
+ * @param sipKey The image's 128-bit hash key.
+ * @return The 64-bit hash of the key.
+ */
+static uint64_t frozenHash(VType const* key, uint64_t const sipKey[2]) {
+    if (key->type == 'I') {
+        int32_t value = key->value.integer;
+        return sipHash(&value, sizeof(value), sipKey) ^ 0x49;
+    }
+    return sipHash(key->value.text, key->length, sipKey);
+}
+
+/**
+ * Picks the bucket of a key from the high half of its hash.
+ * @param hash The key's hash.
+ * @param buckets The number of buckets.
+ * @return The bucket index.
+ */
+static size_t bucketOf(uint64_t hash, size_t buckets) {
+    return (size_t)(((hash >> 32) * buckets) >> 32);
+}
+
+/**
+ * Picks the slot a pilot sends a key to.
+ * @param hash The key's hash.
+ * @param pilot The pilot of the key's bucket.
+ * @param count The number of slots.
+ * @return The slot index.
+ */
+static size_t slotOf(uint64_t hash, uint32_t pilot, size_t count) {
+    return (size_t)(((mix64(hash ^ (pilot * 0x9e3779b97f4a7c15ULL)) & 0xffffffffULL) * count) >> 32);
+}
+
+/**
+ * Counts the bytes a VType takes when packed: a type byte, then 4 bytes of integer or a 4-byte length, the characters
+ * and a terminating NUL, so a packed Text can be handed out as is.
+ * @param v A pointer to the VType.
+ * @return The packed size.
+ */
+static size_t packedSize(VType const* v) {
+    return v->type == 'I' ? 5 : 6 + v->length;
+}
+
+/**
+ * Packs a VType at p.
+ * @param p Where to write it, with room for packedSize(v) bytes.
+ * @param v A pointer to the VType.
+ */
+static void pack(unsigned char* p, VType const* v) {
+    *p = (unsigned char)v->type;
+    if (v->type == 'I') {
+        int32_t value = v->value.integer;
+        memcpy(p + 1, &value, 4);
+    } else {
+        uint32_t len = v->length;
+        memcpy(p + 1, &len, 4);
+        memcpy(p + 5, v->value.text, len);
+        p[5 + len] = '\0';
+    }
+}
+
+/**
+ * Reads a packed VType as a view: a Text's characters are left in place.
+ * @param p Where it starts.
+ * @param avail The number of bytes from p to the end of the packed pairs.
+ * @param v The VType to fill in.
+ * @return The number of bytes read, or 0 if the bytes don't hold a whole VType.
+ */
+static size_t unpack(unsigned char const* p, size_t avail, VType* v) {
+    if (avail < 5)
+        return 0;
+    v->type = (char)*p;
+    v->capacity = 0;
+    if (v->type == 'I') {
+        int32_t value;
+        memcpy(&value, p + 1, 4);
+        v->length = 0;
+        v->value.integer = value;
+        return 5;
+    }
+
+    uint32_t len;
+    memcpy(&len, p + 1, 4);
+    if (v->type != 'T' || len > avail - 6)
+        return 0;
+    v->length = len;
+    v->value.text = (char*)(p + 5);
+    return 6 + len;
+}
+
+/**
+ * Packs one pair into the collector, as a mapForEach callback.
+ * @param key A pointer to the key.
+ * @param value A pointer to the value, decompressed if it is stored compressed.
+ * @param ctx A pointer to the Collector.
+ * @return true to keep walking, false once memory runs out.
+ */
+static _Bool collectPair(VType const* key, VType const* value, void* ctx) {
+    Collector* c = (Collector*)ctx;
+    size_t need = packedSize(key) + packedSize(value);
+    if (c->length + need > c->capacity) {
+        size_t capacity = c->capacity ? c->capacity : 4096;
+        while (capacity < c->length + need)
+            capacity *= 2;
+        unsigned char* data = (unsigned char*)realloc(c->data, capacity);
+        if (!data) {
+            c->failed = 1;
+            return 0;
+        }
+        c->data = data;
+        c->capacity = capacity;
+    }
+
+    c->starts[c->count++] = c->length;
+    pack(c->data + c->length, key);
+    pack(c->data + c->length + packedSize(key), value);
+    c->length += need;
+    c->rawBytes += (key->type == 'I' ? 4 : key->length) + (value->type == 'I' ? 4 : value->length);
+    return 1;
+}
+
+/**
+ * Finds a pilot for every bucket so that the keys fill the slots one to one.
+ * @param hashes The hash of every key.
+ * @param count The number of keys, and of slots.
+ * @param buckets The number of buckets.
+ * @param pilots Where the pilot of each bucket is stored.
+ * @param slots Where the slot of each key is stored.
+ * @return true if every bucket got a pilot, false if some bucket has none or memory ran out.
+ */
+static _Bool placeKeys(uint64_t const* hashes, size_t count, size_t buckets, uint32_t* pilots, size_t* slots) {
+    size_t* starts = (size_t*)calloc(buckets + 1, sizeof(size_t));
+    size_t* members = (size_t*)malloc(count * sizeof(size_t));
+    size_t* order = (size_t*)malloc(buckets * sizeof(size_t));
+    uint64_t* taken = (uint64_t*)calloc((count + 63) / 64, sizeof(uint64_t));
+    size_t* sizes = NULL;
+    size_t* positions = NULL;
+    _Bool placed = 0;
+    if (!starts || !members || !order || !taken)
+        goto done;
+
+    // Group the keys by bucket.
+    for (size_t i = 0; i < count; i++)
+        starts[bucketOf(hashes[i], buckets) + 1]++;
+    size_t largest = 0;
+    for (size_t b = 0; b < buckets; b++) {
+        if (starts[b + 1] > largest)
+            largest = starts[b + 1];
+        starts[b + 1] += starts[b];
+    }
+    size_t* fill = (size_t*)malloc(buckets * sizeof(size_t));
+    if (!fill)
+        goto done;
+    memcpy(fill, starts, buckets * sizeof(size_t));
+    for (size_t i = 0; i < count; i++)
+        members[fill[bucketOf(hashes[i], buckets)]++] = i;
+    free(fill);
+
+    // Order the buckets from the largest to the smallest, with a counting sort on their sizes.
+    sizes = (size_t*)calloc(largest + 2, sizeof(size_t));
+    positions = (size_t*)malloc((largest + 1) * sizeof(size_t));
+    if (!sizes || !positions)
+        goto done;
+    for (size_t b = 0; b < buckets; b++)
+        sizes[largest - (starts[b + 1] - starts[b]) + 1]++;
+    for (size_t s = 0; s <= largest; s++)
+        sizes[s + 1] += sizes[s];
+    for (size_t b = 0; b < buckets; b++)
+        order[sizes[largest - (starts[b + 1] - starts[b])]++] = b;
+
+    for (size_t o = 0; o < buckets; o++) {
+        size_t b = order[o];
+        size_t n = starts[b + 1] - starts[b];
+        pilots[b] = 0;
+        if (n == 0)
+            continue;
+
+        uint64_t pilot = 0;
+        for (; pilot <= UINT32_MAX; pilot++) {
+            size_t k = 0;
+            for (; k < n; k++) {
+                size_t slot = slotOf(hashes[members[starts[b] + k]], (uint32_t)pilot, count);
+                if (taken[slot / 64] >> (slot % 64) & 1)
+                    break;
+                size_t j = 0;
+                while (j < k && positions[j] != slot)
+                    j++;
+                if (j < k)
+                    break;
+                positions[k] = slot;
+            }
+            if (k == n)
+                break;
+        }
+        if (pilot > UINT32_MAX)
+            goto done;
+
+        pilots[b] = (uint32_t)pilot;
+        for (size_t k = 0; k < n; k++) {
+            taken[positions[k] / 64] |= 1ULL << (positions[k] % 64);
+            slots[members[starts[b] + k]] = positions[k];
+        }
+    }
+    placed = 1;
+
+done:
+    free(starts);
+    free(members);
+    free(order);
+    free(taken);
+    free(sizes);
+    free(positions);
+    return placed;
+}
+
+/**
+ * Points a FrozenMap's section pointers into its image, checking that the sections fit.
+ * @param this A pointer to the FrozenMap, with image and length set.
+ * @return true if the image is well formed, false otherwise.
+ */
+static _Bool attachImage(FrozenMap* this) {
+    if (this->length < sizeof(Header))
+        return 0;
+    Header const* h = (Header const*)this->image;
+    if (memcmp(h->magic, FROZEN_MAGIC, 8) != 0 || h->count > UINT32_MAX || h->buckets > UINT32_MAX ||
+        (h->count == 0) != (h->buckets == 0))
+        return 0;
+    if (h->dataBytes > this->length || sizeof(Header) + 4 * (h->buckets + h->count) + h->dataBytes != this->length)
+        return 0;
+
+    this->header = h;
+    this->pilots = (uint32_t const*)(this->image + sizeof(Header));
+    this->offsets = this->pilots + h->buckets;
+    this->data = (unsigned char const*)(this->offsets + h->count);
+    return 1;
+}
+
+/**
+ * Builds an immutable copy of every pair in a Map, indexed by a minimal perfect hash, in one malloc'ed image.
+ * Compressed values are stored decompressed. The Map is left as it was and may be freed afterwards.
+ * @param map A pointer to the Map structure (hashmap).
+ * @return A pointer to the FrozenMap, or NULL on memory allocation failure or if the pairs don't fit the image format.
+ */
+FrozenMap* mapFreeze(Map* map) {
+    size_t count = mapSize(map);
+    Collector c = { NULL, 0, 0, (size_t*)malloc((count ? count : 1) * sizeof(size_t)), 0, 0, 0 };
+    uint64_t* hashes = (uint64_t*)malloc((count ? count : 1) * sizeof(uint64_t));
+    size_t* slots = (size_t*)malloc((count ? count : 1) * sizeof(size_t));
+    size_t* bySlot = (size_t*)malloc((count ? count : 1) * sizeof(size_t));
+    size_t buckets = count ? count / BUCKET_KEYS + 1 : 0;
+    uint32_t* pilots = (uint32_t*)malloc((buckets ? buckets : 1) * sizeof(uint32_t));
+    FrozenMap* this = NULL;
+    if (!c.starts || !hashes || !slots || !bySlot || !pilots)
+        goto done;
+
+    mapForEach(map, collectPair, &c);
+    if (c.failed || c.count != count || count > UINT32_MAX || c.length > UINT32_MAX)
+        goto done;
+
+    uint64_t sipKey[2];
+    _Bool placed = count == 0;
+    for (int attempt = 0; attempt < BUILD_ATTEMPTS && !placed; attempt++) {
+        randomHashKey(sipKey);
+        for (size_t i = 0; i < count; i++) {
+            VType key;
+            if (!unpack(c.data + c.starts[i], c.length - c.starts[i], &key))
+                goto done;
+            hashes[i] = frozenHash(&key, sipKey);
+        }
+        placed = placeKeys(hashes, count, buckets, pilots, slots);
+    }
+    if (!placed)
+        goto done;
+
+    this = (FrozenMap*)malloc(sizeof(FrozenMap));
+    if (!this)
+        goto done;
+    this->length = sizeof(Header) + 4 * (buckets + count) + c.length;
+    this->image = (unsigned char*)malloc(this->length);
+    this->mapped = 0;
+    if (!this->image) {
+        free(this);
+        this = NULL;
+        goto done;
+    }
+
+    Header h = { FROZEN_MAGIC, count, buckets, { 0, 0 }, c.length, c.rawBytes };
+    if (count) {
+        h.sipKey[0] = sipKey[0];
+        h.sipKey[1] = sipKey[1];
+    }
+    memcpy(this->image, &h, sizeof(h));
+    memcpy(this->image + sizeof(Header), pilots, 4 * buckets);
+
+    // Lay the pairs out in slot order, so neighbouring slots are neighbours in memory.
+    for (size_t i = 0; i < count; i++)
+        bySlot[slots[i]] = i;
+    uint32_t* offsets = (uint32_t*)(this->image + sizeof(Header) + 4 * buckets);
+    unsigned char* data = (unsigned char*)(offsets + count);
+    size_t at = 0;
+    for (size_t s = 0; s < count; s++) {
+        size_t i = bySlot[s];
+        size_t end = i + 1 < count ? c.starts[i + 1] : c.length;
+        offsets[s] = (uint32_t)at;
+        memcpy(data + at, c.data + c.starts[i], end - c.starts[i]);
+        at += end - c.starts[i];
+    }
+    attachImage(this);
+
+done:
+    free(c.data);
+    free(c.starts);
+    free(hashes);
+    free(slots);
+    free(bySlot);
+    free(pilots);
+    return this;
+}
+
+/**
+ * Writes a frozen map's image to a temporary file next to path and renames it into place.
+ * @param this A pointer to the FrozenMap.
+ * @param path The name of the file.
+ * @return true if the image was written, false on error.
+ */
+_Bool frozenSave(FrozenMap const* this, char const* path) {
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+        return 0;
+
+    FILE* fp = fopen(tmp, "wb");
+    if (!fp)
+        return 0;
+    _Bool ok = fwrite(this->image, 1, this->length, fp) == this->length;
+    if (fclose(fp) != 0 || !ok || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Maps a frozen image from a file, read-only and shared, so several processes opening the same file share its pages.
+ * Nothing is read up front beyond the header; pages are faulted in as lookups touch them.
+ * @param path The name of the file.
+ * @return A pointer to the FrozenMap, or NULL if the file can't be mapped or doesn't hold a frozen image.
+ */
+FrozenMap* frozenOpen(char const* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header)) {
+        close(fd);
+        return NULL;
+    }
+
+    void* image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED)
+        return NULL;
+
+    FrozenMap* this = (FrozenMap*)malloc(sizeof(FrozenMap));
+    if (this) {
+        this->image = (unsigned char*)image;
+        this->length = st.st_size;
+        this->mapped = 1;
+        if (attachImage(this))
+            return this;
+        free(this);
+    }
+    munmap(image, st.st_size);
+    return NULL;
+}
+
+/**
+ * Looks up a key: one hash, one pilot, one slot and one comparison.
+ * @param this A pointer to the FrozenMap.
+ * @param key A pointer to the key.
+ * @param value Where a view of the value is stored if the key is found. A Text value's characters stay in the image,
+ *              NUL-terminated, and are valid until the FrozenMap is freed; the view must not be freed.
+ * @return true if the key was found, false otherwise.
+ */
+_Bool frozenGet(FrozenMap const* this, VType const* key, VType* value) {
+    Header const* h = this->header;
+    if (h->count == 0)
+        return 0;
+    uint64_t hash = frozenHash(key, h->sipKey);
+    size_t slot = slotOf(hash, this->pilots[bucketOf(hash, h->buckets)], h->count);
+    uint32_t offset = this->offsets[slot];
+    if (offset >= h->dataBytes)
+        return 0;
+
+    VType found;
+    unsigned char const* p = this->data + offset;
+    size_t avail = h->dataBytes - offset;
+    size_t used = unpack(p, avail, &found);
+    if (!used || !equalsVType(&found, key))
+        return 0;
+    return unpack(p + used, avail - used, value) != 0;
+}
+
+/**
+ * Looks up a Text key given as raw characters, without creating a VType for it.
+ * @param this A pointer to the FrozenMap.
+ * @param text The key's characters.
+ * @param len The number of characters.
+ * @param value Where a view of the value is stored if the key is found.
+ * @return true if the key was found, false otherwise.
+ */
+_Bool frozenGetText(FrozenMap const* this, char const* text, size_t len, VType* value) {
+    VType key = { 'T', len, { .text = (char*)text }, 0 };
+    return frozenGet(this, &key, value);
+}
+
+/**
+ * Looks up an Integer key given as an int, without creating a VType for it.
+ * @param this A pointer to the FrozenMap.
+ * @param key The key.
+ * @param value Where a view of the value is stored if the key is found.
+ * @return true if the key was found, false otherwise.
+ */
+_Bool frozenGetInt(FrozenMap const* this, int key, VType* value) {
+    VType k = { 'I', 0, { .integer = key }, 0 };
+    return frozenGet(this, &k, value);
+}
+
+/**
+ * Returns the number of pairs in a frozen map.
+ * @param this A pointer to the FrozenMap.
+ * @return The number of pairs.
+ */
+size_t frozenSize(FrozenMap const* this) {
+    return this->header->count;
+}
+
+/**
+ * Reports the size of a frozen map and how much of its image is the pairs' own bytes.
+ * @param this A pointer to the FrozenMap.
+ * @param stats A pointer to the FrozenStats to be filled in.
+ */
+void frozenStats(FrozenMap const* this, FrozenStats* stats) {
+    stats->keys = this->header->count;
+    stats->buckets = this->header->buckets;
+    stats->rawBytes = this->header->rawBytes;
+    stats->bytes = this->length;
+    stats->mapped = this->mapped;
+}
+
+/**
+ * Frees a frozen map, unmapping its file or freeing its image. Views of its values become invalid.
+ * @param this A pointer to the FrozenMap.
+ */
+void frozenFree(FrozenMap* this) {
+    if (!this)
+        return;
+    if (this->mapped)
+        munmap(this->image, this->length);
+    else
+        free(this->image);
+    free(this);
+}
@@ -0,0 +1,46 @@
+#ifndef FROZEN_H
+#define FROZEN_H
+
+#include <stddef.h>
+#include "map.h"
+
+// Define your FrozenMap struct here
+typedef struct FrozenMapStruct FrozenMap;
+
+/** Size and memory use reported for a frozen map. */
+typedef struct {
+    /** Number of pairs. */
+    size_t keys;
+
+    /** Number of buckets of the perfect hash, each with a 32-bit pilot. */
+    size_t buckets;
+
+    /** Bytes of the key and value characters or integers themselves. */
+    size_t rawBytes;
+
+    /** Bytes of the whole image: header, pilots, offsets and packed pairs. */
+    size_t bytes;
+
+    /** True if the image is mapped from a file rather than built in memory. */
+    _Bool mapped;
+} FrozenStats;
+
+/* Build an immutable copy of every pair in map, indexed by a minimal perfect hash. Returns NULL on failure. */
+FrozenMap* mapFreeze(Map* map);
+
+/* Write a frozen map's image to path, replacing it atomically. Returns 0 on error. */
+_Bool frozenSave(FrozenMap const* this, char const* path);
+
+/* Map the frozen image in the file at path read-only, ready for lookups. Returns NULL on error. */
+FrozenMap* frozenOpen(char const* path);
+
+/* Look up key. Fills in *value as a view of the frozen value and returns 1 if found. */
+_Bool frozenGet(FrozenMap const* this, VType const* key, VType* value);
+_Bool frozenGetText(FrozenMap const* this, char const* text, size_t len, VType* value);
+_Bool frozenGetInt(FrozenMap const* this, int key, VType* value);
+
+size_t frozenSize(FrozenMap const* this);
+void frozenStats(FrozenMap const* this, FrozenStats* stats);
+void frozenFree(FrozenMap* this);
+
+#endif // FROZEN_H
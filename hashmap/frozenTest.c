@@ -0,0 +1,102 @@
+// Simple test program for frozen maps: freezing, lookups, and saving and mapping the image back.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "frozen.h"
+
+#define KEYS 200000
+
+// Checks that a frozen map holds exactly the pairs the test stored.
+static void checkFrozen(FrozenMap const* f) {
+    char text[64];
+    VType value;
+    assert(frozenSize(f) == KEYS);
+    for (int i = 0; i < KEYS; i++) {
+        if (i % 2) {
+            assert(frozenGetInt(f, i, &value));
+            assert(value.type == 'I' && value.value.integer == -i);
+        } else {
+            int len = snprintf(text, sizeof(text), "user:%d:name", i);
+            assert(frozenGetText(f, text, len, &value));
+            snprintf(text, sizeof(text), "name-%d", i);
+            assert(value.type == 'T' && value.length == strlen(text) && strcmp(value.value.text, text) == 0);
+        }
+    }
+
+    // Misses, including keys whose slot holds another key and keys of the other type.
+    for (int i = 0; i < KEYS; i++) {
+        assert(!frozenGetInt(f, KEYS + i, &value));
+        assert(!(i % 2 == 0 && frozenGetInt(f, i, &value)));
+        int len = snprintf(text, sizeof(text), "user:%d:name", i + 1);
+        assert(!((i + 1) % 2 && frozenGetText(f, text, len, &value)));
+    }
+}
+
+int main() {
+    Map* map = makeMap(0, NULL);
+    char text[64];
+    for (int i = 0; i < KEYS; i++) {
+        if (i % 2) {
+            mapSet(map, makeInteger(i), makeInteger(-i));
+        } else {
+            snprintf(text, sizeof(text), "user:%d:name", i);
+            VType* key = makeText(text);
+            snprintf(text, sizeof(text), "name-%d", i);
+            mapSet(map, key, makeText(text));
+        }
+    }
+
+    FrozenMap* f = mapFreeze(map);
+    assert(f);
+    checkFrozen(f);
+    FrozenStats stats;
+    frozenStats(f, &stats);
+    printf("%zu keys, %zu buckets, %zu bytes for %zu raw bytes\n", stats.keys, stats.buckets, stats.bytes,
+           stats.rawBytes);
+    assert(!stats.mapped && stats.keys == KEYS);
+    // Header, pilots and offsets add about 5 bytes a pair, and packing about 6 for Text or 2 for Integer.
+    assert(stats.bytes < stats.rawBytes + 12 * (size_t)KEYS);
+
+    // The image written to a file and mapped back answers the same way.
+    char path[] = "/tmp/frozenTestXXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    assert(frozenSave(f, path));
+    frozenFree(f);
+    f = frozenOpen(path);
+    assert(f);
+    frozenStats(f, &stats);
+    assert(stats.mapped);
+    checkFrozen(f);
+    frozenFree(f);
+
+    // A file that isn't a frozen image is refused.
+    FILE* fp = fopen(path, "r+b");
+    assert(fp && fputc('X', fp) != EOF && fclose(fp) == 0);
+    assert(!frozenOpen(path));
+    unlink(path);
+
+    // Compressed values are frozen decompressed, and an empty map freezes too.
+    mapEnableCompression(map, 64);
+    char big[1000];
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    mapSet(map, makeText("long"), makeText(big));
+    f = mapFreeze(map);
+    VType value;
+    assert(f && frozenGetText(f, "long", 4, &value) && value.length == sizeof(big) - 1 && strcmp(value.value.text, big) == 0);
+    frozenFree(f);
+    mapFree(map);
+
+    Map* empty = makeMap(0, NULL);
+    f = mapFreeze(empty);
+    assert(f && frozenSize(f) == 0 && !frozenGetInt(f, 1, &value));
+    frozenFree(f);
+    mapFree(empty);
+    return 0;
+}
@@ -0,0 +1,130 @@
+// Simple test program for the keyed hash and the Map's defence against colliding keys.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "map.h"
+#include "siphash.h"
+
+// "Az" and "BY" have the same djb2 value, so every string of BLOCKS such pairs collides with every other.
+#define BLOCKS 12
+#define KEYS (1 << BLOCKS)
+// Ordinary keys stored before the flood, so the switch has many buckets to move.
+#define FILLER 200000
+
+// Counts the pairs visited by a walk.
+static _Bool countPair(VType const* key, VType const* value, void* ctx) {
+    (*(size_t*)ctx)++;
+    return 1;
+}
+
+// Builds the i-th colliding key.
+static VType* collidingKey(int i) {
+    char text[2 * BLOCKS + 1];
+    for (int b = 0; b < BLOCKS; b++)
+        memcpy(text + 2 * b, (i >> b) & 1 ? "BY" : "Az", 2);
+    text[2 * BLOCKS] = '\0';
+    return makeText(text);
+}
+
+// Checks that a Map holds exactly the colliding keys from 'from' up, each mapped to its number.
+static void checkKeys(Map* map, int from) {
+    for (int i = 0; i < KEYS; i++) {
+        VType* key = collidingKey(i);
+        VType* value = mapGet(map, key);
+        assert(i < from ? !value : value && value->value.integer == i);
+        freeVType(key);
+    }
+}
+
+// Floods a Map with colliding keys and checks that it switches to its keyed hash without losing any.
+static void flood(MapBackend backend) {
+    Map* map = makeMapBackend(0, backend, NULL);
+    assert(map);
+    VType* first = collidingKey(0);
+    unsigned int h = hashVType(first);
+    freeVType(first);
+
+    for (int i = 0; i < FILLER; i++)
+        mapSet(map, makeInteger(i), makeInteger(i));
+    for (int i = 0; i < KEYS; i++) {
+        VType* key = collidingKey(i);
+        assert(hashVType(key) == h);
+        mapSet(map, key, makeInteger(i));
+    }
+
+    HashStats stats;
+    mapHashStats(map, &stats);
+    printf("%s: keyed %d, longest chain %zu (limit %zu), %zu rekeys, %zu buckets pending\n",
+           backend == MAP_CUCKOO ? "cuckoo" : "chained", stats.keyed, stats.longestChain, stats.chainLimit,
+           stats.rekeys, stats.rehashPending);
+    assert(stats.keyed && stats.rekeys == 1 && stats.longestChain > stats.chainLimit);
+
+    // Lookups and removes work while the rehash is still moving buckets, and each one moves some more.
+    if (backend == MAP_CHAINED)
+        assert(stats.rehashPending > 0);
+    checkKeys(map, 0);
+    for (int i = 0; i < KEYS / 4; i++) {
+        VType* key = collidingKey(i);
+        assert(mapRemove(map, key));
+        assert(!mapRemove(map, key));
+        freeVType(key);
+    }
+    checkKeys(map, KEYS / 4);
+    for (int i = 0; i < FILLER; i++) {
+        VType* value = mapGetInt(map, i);
+        assert(value && value->value.integer == i);
+    }
+    mapHashStats(map, &stats);
+    assert(stats.rekeys == 1 && stats.rehashPending == 0);
+
+    size_t count = 0;
+    mapForEach(map, countPair, &count);
+    assert(count == FILLER + KEYS - KEYS / 4);
+    mapFree(map);
+}
+
+int main() {
+    // The reference vectors from the SipHash paper, with key 00..0f and messages 00, 01, 02, ...
+    uint64_t key[2] = { 0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL };
+    unsigned char message[64];
+    for (int i = 0; i < 64; i++)
+        message[i] = (unsigned char)i;
+    assert(sipHash(message, 0, key) == 0x726fdb47dd0e0e31ULL);
+    assert(sipHash(message, 8, key) == 0x93f5f5799a932462ULL);
+    assert(sipHash(message, 15, key) == 0xa129ca6149be45e5ULL);
+    assert(sipHash(message, 63, key) == 0x958a324ceb064572ULL);
+
+    uint64_t random[2];
+    randomHashKey(random);
+    VType* a = makeText("user:42");
+    VType* b = makeTextLen("user:42 and more", 7);
+    assert(keyedHashVType(a, random) == keyedHashVType(b, random));
+    assert(keyedHashVType(a, random) != keyedHashVType(a, key));
+    freeVType(a);
+    freeVType(b);
+
+    // A Map below its limit keeps the seeded hash.
+    Map* quiet = makeMap(0, NULL);
+    for (int i = 0; i < 10000; i++)
+        mapSet(quiet, makeInteger(i), makeInteger(i));
+    HashStats stats;
+    mapHashStats(quiet, &stats);
+    assert(!stats.keyed && stats.rekeys == 0 && stats.longestChain <= stats.chainLimit);
+    mapFree(quiet);
+
+    // With the check turned off, colliding keys stay in one long chain.
+    Map* open = makeMap(0, NULL);
+    mapSetChainLimit(open, 0);
+    for (int i = 0; i < 200; i++)
+        mapSet(open, collidingKey(i), makeInteger(i));
+    mapHashStats(open, &stats);
+    assert(!stats.keyed && stats.longestChain == 200);
+    mapFree(open);
+
+    flood(MAP_CHAINED);
+    flood(MAP_CUCKOO);
+    return 0;
+}
@@ -0,0 +1,573 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "input.h"
+#include "map.h"
+#include "textops.h"
+
+/**
+ * @file hashcheck.c
+ * @author Jason Wang
+ * This program measures the quality of the hash functions the map has used, so the choice between them rests on data.
+ * Every registered hash is run over every key set: sequential and strided Integers, random Text, and the keys of any
+ * command files given, such as the input-NN.txt test inputs. For each pair it reports the hashing speed, how evenly
+ * the keys spread over tables of several sizes (a chi-square test, and the longest chain against the longest one
+ * expected from a random function), how often each output bit is set, and how much flipping one input bit changes
+ * each output bit (avalanche).
+ */
+
+/** Number of keys in the generated key sets when -n isn't given. */
+#define DEFAULT_KEYS 1000000
+
+/** Distance between consecutive keys of the strided key set, the old driver's table size. */
+#define STRIDE 1024
+
+/** Number of keys whose bits are flipped for the avalanche test. */
+#define AVALANCHE_KEYS 10000
+
+/** Largest number of input bits flipped per key for the avalanche test: every bit of an Integer, or of 8 characters. */
+#define MAX_INPUT_BITS 64
+
+/** Shortest time hashing is timed for, in nanoseconds. */
+#define TIMING_NANOS 200000000ULL
+
+/** Hash function under test. */
+typedef unsigned int (*HashFn)(VType const* key);
+
+/** One registered hash function. */
+typedef struct {
+    char const* name;
+    char const* description;
+    HashFn fn;
+    /** Set for hashes only defined on Integer keys. */
+    _Bool integersOnly;
+} Hash;
+
+/** Keys a hash is run over; Text keys point into 'text'. */
+typedef struct {
+    char const* name;
+    VType* keys;
+    size_t count;
+    char* text;
+} KeySet;
+
+/** SipHash key for the keyed hash; fixed, so runs are comparable. */
+static uint64_t const sipKey[2] = { 0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL };
+
+/** Sink for computed hashes, so the compiler can't drop the hashing being timed. */
+static volatile unsigned int sink;
+
+/** Whether to print the bit-bias and avalanche matrices in full, set with -v. */
+static _Bool verbose = 0;
+
+/**
+ * The hash vtype.c used before keys were seeded: djb2 over the characters of a Text, or over the decimal digits
+ * sprintf writes for an Integer, with no seed and no final mixing.
+ * @param key the key
+ * @return the hash
+ */
+static unsigned int djb2Digits(VType const* key) {
+    if (key->type == 'T')
+        return textHash(key->value.text, key->length);
+    char buffer[12];
+    int len = sprintf(buffer, "%d", key->value.integer);
+    return textHash(buffer, len);
+}
+
+/**
+ * The hash maps use now: djb2 mixed with the process's seed and the MurmurHash3 finalizer.
+ * @param key the key
+ * @return the hash
+ */
+static unsigned int seededDjb2(VType const* key) {
+    return hashVType(key);
+}
+
+/**
+ * The keyed hash maps switch to when chains grow too long: SipHash-2-4 under a fixed key.
+ * @param key the key
+ * @return the hash
+ */
+static unsigned int sipHash24(VType const* key) {
+    return keyedHashVType(key, sipKey);
+}
+
+/**
+ * The Integer class's hash method in integer.c: the int value itself.
+ * @param key the key, an Integer
+ * @return the hash
+ */
+static unsigned int identity(VType const* key) {
+    return (unsigned int)key->value.integer;
+}
+
+/**
+ * The bucket choice of the original driver's fixed table: the int value modulo its 1024 buckets.
+ * @param key the key, an Integer
+ * @return the hash
+ */
+static unsigned int modulo(VType const* key) {
+    return (unsigned int)key->value.integer % STRIDE;
+}
+
+/** Every hash function the program knows. */
+static Hash const hashes[] = {
+    { "djb2", "unseeded djb2 over characters or sprintf digits", djb2Digits, 0 },
+    { "seeded", "hashVType: seeded djb2 with a MurmurHash3 finalizer", seededDjb2, 0 },
+    { "siphash", "keyedHashVType: SipHash-2-4", sipHash24, 0 },
+    { "identity", "integer.c's hash: the int value", identity, 1 },
+    { "modulo", "the old driver's key % 1024", modulo, 1 },
+};
+
+/**
+ * Reads a clock for timing the hashes.
+ * @return the time in nanoseconds since an arbitrary point
+ */
+static uint64_t nowNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Makes a key set of Integers: 'stride' times 0, 1, 2, and so on.
+ * @param set where the key set is stored
+ * @param name the name of the key set
+ * @param count the number of keys
+ * @param stride the distance between consecutive keys
+ * @return true if the key set was made, false on memory allocation failure
+ */
+static _Bool makeIntegers(KeySet* set, char const* name, size_t count, int stride) {
+    set->name = name;
+    set->count = count;
+    set->text = NULL;
+    if (!(set->keys = (VType*)malloc(count * sizeof(VType))))
+        return 0;
+    for (size_t i = 0; i < count; i++)
+        set->keys[i] = (VType){ 'I', 0, { .integer = (int)(i * stride) }, 0 };
+    return 1;
+}
+
+/**
+ * Makes a key set of random Text keys of 8 to 16 lowercase letters and digits.
+ * @param set where the key set is stored
+ * @param count the number of keys
+ * @return true if the key set was made, false on memory allocation failure
+ */
+static _Bool makeRandomText(KeySet* set, size_t count) {
+    static char const alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    set->name = "random text";
+    set->count = count;
+    set->keys = (VType*)malloc(count * sizeof(VType));
+    set->text = (char*)malloc(count * 17);
+    if (!set->keys || !set->text)
+        return 0;
+    char* pos = set->text;
+    for (size_t i = 0; i < count; i++) {
+        int len = 8 + rand() % 9;
+        for (int j = 0; j < len; j++)
+            pos[j] = alphabet[rand() % (sizeof(alphabet) - 1)];
+        pos[len] = '\0';
+        set->keys[i] = (VType){ 'T', len, { .text = pos }, 0 };
+        pos += len + 1;
+    }
+    return 1;
+}
+
+/** State of copying the distinct keys of a Map into a key set. */
+typedef struct {
+    KeySet* set;
+    char* pos;
+} Collect;
+
+/**
+ * Adds the length of one key of a Map to a total, as a mapForEach callback.
+ * @param key the key
+ * @param value unused
+ * @param ctx a pointer to the total
+ * @return true, to visit every key
+ */
+static _Bool measureKey(VType const* key, VType const* value, void* ctx) {
+    if (key->type == 'T')
+        *(size_t*)ctx += key->length + 1;
+    return 1;
+}
+
+/**
+ * Copies one key of a Map into a key set, as a mapForEach callback.
+ * @param key the key
+ * @param value unused
+ * @param ctx a pointer to the Collect state
+ * @return true, to visit every key
+ */
+static _Bool collectKey(VType const* key, VType const* value, void* ctx) {
+    Collect* collect = (Collect*)ctx;
+    VType* copy = &collect->set->keys[collect->set->count++];
+    *copy = *key;
+    if (key->type == 'T') {
+        memcpy(collect->pos, key->value.text, key->length + 1);
+        copy->value.text = collect->pos;
+        collect->pos += key->length + 1;
+    }
+    return 1;
+}
+
+/**
+ * Makes a key set of the distinct keys of the commands in a file: the word after set, get, remove, incr, decr,
+ * incrby, append or fget on each line, or the key of a CSV line. Keys are Integers or Text as the driver makes them.
+ * @param set where the key set is stored
+ * @param path the file
+ * @return true if the key set was made, false if the file can't be read or memory runs out
+ */
+static _Bool loadKeys(KeySet* set, char const* path) {
+    static char const* const commands[] = { "set", "get", "remove", "incr", "decr", "incrby", "append", "fget" };
+    FILE* fp = fopen(path, "r");
+    Map* map = makeMap(0, NULL);
+    if (!fp || !map) {
+        if (fp)
+            fclose(fp);
+        if (map)
+            mapFree(map);
+        return 0;
+    }
+
+    char* line;
+    while ((line = readLine(fp))) {
+        char* word = strtok(line, " \t\r\n");
+        char* key = NULL;
+        for (size_t i = 0; word && i < sizeof(commands) / sizeof(commands[0]); i++) {
+            if (strcmp(word, commands[i]) == 0)
+                key = strtok(NULL, " \t\r\n");
+        }
+        char* comma = word && !key ? strchr(word, ',') : NULL;
+        if (comma) {
+            *comma = '\0';
+            key = word;
+        }
+        VType borrowed;
+        if (key) {
+            borrowValue(key, strlen(key), &borrowed);
+            if (!mapGet(map, &borrowed))
+                mapSet(map, parseValue(key, strlen(key)), makeInteger(0));
+        }
+        free(line);
+    }
+    fclose(fp);
+
+    size_t bytes = 0;
+    mapForEach(map, measureKey, &bytes);
+    set->name = path;
+    set->count = 0;
+    set->keys = (VType*)malloc((mapSize(map) ? mapSize(map) : 1) * sizeof(VType));
+    set->text = (char*)malloc(bytes ? bytes : 1);
+    if (!set->keys || !set->text) {
+        mapFree(map);
+        return 0;
+    }
+    Collect collect = { set, set->text };
+    mapForEach(map, collectKey, &collect);
+    mapFree(map);
+    return 1;
+}
+
+/**
+ * Computes the expected length of the longest chain when 'keys' keys are spread over 'buckets' buckets by a random
+ * function. The number of keys in one bucket is close to Poisson with mean keys / buckets, and treating the buckets
+ * as independent, the chance that the longest chain is at least k is 1 - (1 - P(X >= k))^buckets; the expected
+ * longest chain is the sum of these chances over k.
+ * @param keys the number of keys
+ * @param buckets the number of buckets
+ * @return the expected longest chain
+ */
+static double expectedMaxChain(size_t keys, size_t buckets) {
+    double lambda = (double)keys / buckets;
+    int top = (int)(lambda + 20 * sqrt(lambda) + 50);
+    double* tail = (double*)calloc(top + 2, sizeof(double));
+    if (!tail)
+        return 0;
+    for (int j = top; j >= 0; j--)
+        tail[j] = tail[j + 1] + exp(-lambda + j * log(lambda) - lgamma(j + 1.0));
+
+    double expected = 0;
+    for (int k = 1; k <= top; k++) {
+        double atLeast = 1 - exp(buckets * log1p(-fmin(tail[k], 1 - 1e-16)));
+        expected += atLeast;
+        if (k > lambda && atLeast < 1e-9)
+            break;
+    }
+    free(tail);
+    return expected;
+}
+
+/**
+ * Times a hash over a key set, going over the keys again until enough time has passed.
+ * @param hash the hash
+ * @param set the keys
+ * @return the average time per hash, in nanoseconds
+ */
+static double timeHash(Hash const* hash, KeySet const* set) {
+    uint64_t start = nowNanos();
+    uint64_t elapsed = 0;
+    size_t hashed = 0;
+    unsigned int sum = 0;
+    while (elapsed < TIMING_NANOS) {
+        for (size_t i = 0; i < set->count; i++)
+            sum += hash->fn(&set->keys[i]);
+        hashed += set->count;
+        elapsed = nowNanos() - start;
+    }
+    sink = sum;
+    return (double)elapsed / hashed;
+}
+
+/**
+ * Prints how the keys spread over tables of several sizes when the low bits of the hash pick the bucket, as the map
+ * does: the chi-square statistic over the degrees of freedom, which is close to 1 for a random function, its
+ * distance from 1 in standard deviations, and the longest chain seen next to the one expected.
+ * The tables range from about 16 keys per bucket to about half a key per bucket.
+ * @param hash the hash
+ * @param set the keys
+ * @param hashed the hash of every key
+ */
+static void printDistribution(Hash const* hash, KeySet const* set, unsigned int const* hashed) {
+    size_t first = 16;
+    while (first * 16 < set->count)
+        first *= 2;
+    printf("%10s %10s %10s %10s %10s %10s\n", "buckets", "load", "chi2/df", "z-score", "max chain", "expected");
+    for (size_t buckets = first; buckets < set->count * 8 && buckets <= (1u << 30); buckets *= 4) {
+        uint32_t* counts = (uint32_t*)calloc(buckets, sizeof(uint32_t));
+        if (!counts)
+            return;
+        for (size_t i = 0; i < set->count; i++)
+            counts[hashed[i] & (buckets - 1)]++;
+
+        double mean = (double)set->count / buckets;
+        double chi2 = 0;
+        uint32_t longest = 0;
+        for (size_t b = 0; b < buckets; b++) {
+            chi2 += (counts[b] - mean) * (counts[b] - mean) / mean;
+            if (counts[b] > longest)
+                longest = counts[b];
+        }
+        double df = buckets - 1.0;
+        printf("%10zu %10.2f %10.3f %10.1f %10u %10.1f\n", buckets, mean, chi2 / df, (chi2 - df) / sqrt(2 * df),
+               longest, expectedMaxChain(set->count, buckets));
+        free(counts);
+    }
+}
+
+/**
+ * Prints one row of a bit matrix, one character per output bit: '.' for a probability within 0.05 of one half,
+ * '-' within 0.15, '+' within 0.3 and '#' beyond.
+ * @param label the label of the row
+ * @param probabilities the probability for each of the 32 output bits
+ */
+static void printBitRow(char const* label, double const* probabilities) {
+    printf("%10s ", label);
+    for (int bit = 31; bit >= 0; bit--) {
+        double bias = fabs(probabilities[bit] - 0.5);
+        putchar(bias < 0.05 ? '.' : bias < 0.15 ? '-' : bias < 0.3 ? '+' : '#');
+    }
+    printf("\n");
+}
+
+/**
+ * Prints how often each output bit is set over the keys, which is one half for a random function.
+ * @param set the keys
+ * @param hashed the hash of every key
+ */
+static void printBitBias(KeySet const* set, unsigned int const* hashed) {
+    double probabilities[32] = { 0 };
+    for (size_t i = 0; i < set->count; i++) {
+        for (int bit = 0; bit < 32; bit++)
+            probabilities[bit] += (hashed[i] >> bit) & 1;
+    }
+    int worst = 0;
+    for (int bit = 0; bit < 32; bit++) {
+        probabilities[bit] /= set->count;
+        if (fabs(probabilities[bit] - 0.5) > fabs(probabilities[worst] - 0.5))
+            worst = bit;
+    }
+    printf("bit bias: worst %.4f (bit %d set in %.1f%% of keys)\n", fabs(probabilities[worst] - 0.5), worst,
+           100 * probabilities[worst]);
+    if (verbose) {
+        printf("%10s %s\n", "", "bit 31 ... bit 0");
+        printBitRow("set", probabilities);
+    }
+}
+
+/**
+ * Flips one bit of a key and hashes the result: a bit of the int of an Integer, or of one of the first 8 characters of
+ * a Text.
+ * @param hash the hash
+ * @param key the key
+ * @param bit the input bit to flip
+ * @return the hash of the changed key
+ */
+static unsigned int hashFlipped(Hash const* hash, VType const* key, int bit) {
+    VType flipped = *key;
+    char buffer[MAX_INPUT_BITS / 8];
+    if (key->type == 'I') {
+        flipped.value.integer = (int)((unsigned int)key->value.integer ^ (1u << bit));
+    } else {
+        char* text = key->length > sizeof(buffer) ? (char*)malloc(key->length) : buffer;
+        memcpy(text, key->value.text, key->length);
+        text[bit / 8] ^= (char)(1 << (bit % 8));
+        flipped.value.text = text;
+        unsigned int h = hash->fn(&flipped);
+        if (text != buffer)
+            free(text);
+        return h;
+    }
+    return hash->fn(&flipped);
+}
+
+/**
+ * Prints how often flipping each input bit flips each output bit, which is one half for a good hash; a bit that
+ * rarely or always flips shows a pattern the bucket choice can inherit.
+ * @param hash the hash
+ * @param set the keys; the first AVALANCHE_KEYS are flipped
+ */
+static void printAvalanche(Hash const* hash, KeySet const* set) {
+    static double flips[MAX_INPUT_BITS][32];
+    int inputBits = set->keys[0].type == 'I' ? 32 : MAX_INPUT_BITS;
+    size_t tried[MAX_INPUT_BITS] = { 0 };
+    memset(flips, 0, sizeof(flips));
+
+    size_t count = set->count < AVALANCHE_KEYS ? set->count : AVALANCHE_KEYS;
+    for (size_t i = 0; i < count; i++) {
+        VType const* key = &set->keys[i];
+        int bits = key->type == 'I' ? 32 : 8 * (int)(key->length < 8 ? key->length : 8);
+        unsigned int h = hash->fn(key);
+        for (int in = 0; in < bits; in++) {
+            unsigned int changed = h ^ hashFlipped(hash, key, in);
+            tried[in]++;
+            for (int out = 0; out < 32; out++)
+                flips[in][out] += (changed >> out) & 1;
+        }
+    }
+
+    double worst = 0, total = 0;
+    int cells = 0;
+    for (int in = 0; in < inputBits; in++) {
+        for (int out = 0; out < 32 && tried[in]; out++) {
+            flips[in][out] /= tried[in];
+            double bias = fabs(flips[in][out] - 0.5);
+            worst = bias > worst ? bias : worst;
+            total += bias;
+            cells++;
+        }
+    }
+    printf("avalanche: %d input bits over %zu keys, worst bias %.3f, mean bias %.3f\n", inputBits, count, worst,
+           cells ? total / cells : 0.0);
+    if (verbose) {
+        printf("%10s %s\n", "input bit", "output bit 31 ... bit 0");
+        for (int in = 0; in < inputBits; in++) {
+            char label[12];
+            snprintf(label, sizeof(label), "%d", in);
+            if (tried[in])
+                printBitRow(label, flips[in]);
+        }
+    }
+}
+
+/**
+ * Runs every test of one hash over one key set and prints the results.
+ * @param hash the hash
+ * @param set the keys
+ */
+static void analyze(Hash const* hash, KeySet const* set) {
+    printf("== %s on %s (%zu keys) ==\n", hash->name, set->name, set->count);
+    for (size_t i = 0; hash->integersOnly && i < set->count; i++) {
+        if (set->keys[i].type != 'I') {
+            printf("not defined on Text keys\n\n");
+            return;
+        }
+    }
+    if (set->count == 0) {
+        printf("no keys\n\n");
+        return;
+    }
+
+    unsigned int* hashed = (unsigned int*)malloc(set->count * sizeof(unsigned int));
+    if (!hashed)
+        return;
+    for (size_t i = 0; i < set->count; i++)
+        hashed[i] = hash->fn(&set->keys[i]);
+
+    printf("speed: %.1f ns per hash\n", timeHash(hash, set));
+    printDistribution(hash, set, hashed);
+    printBitBias(set, hashed);
+    printAvalanche(hash, set);
+    printf("\n");
+    free(hashed);
+}
+
+/**
+ * Starting point for the program: builds the key sets and analyzes every chosen hash on every key set.
+ * With -n <keys>, the generated key sets have that many keys; with -H <name>, only that hash is analyzed; with
+ * -S <seed>, the seeded hash uses that seed instead of a random one; with -v, the bit matrices are printed in full.
+ * Files named after the options are command files, such as input-NN.txt, whose keys form one more key set each.
+ * @param argc number of command-line arguments
+ * @param argv list of command-line arguments
+ * @return Exit status: 0 for success, non-zero for errors.
+ */
+int main(int argc, char* argv[]) {
+    size_t keys = DEFAULT_KEYS;
+    char const* only = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:H:S:v")) != -1) {
+        if (opt == 'n' && atol(optarg) > 0) {
+            keys = atol(optarg);
+        } else if (opt == 'H') {
+            only = optarg;
+        } else if (opt == 'S') {
+            setHashSeed((unsigned int)strtoul(optarg, NULL, 0));
+        } else if (opt == 'v') {
+            verbose = 1;
+        } else {
+            fprintf(stderr, "usage: %s [-n keys] [-H hash] [-S seed] [-v] [command files...]\n", argv[0]);
+            for (size_t i = 0; i < sizeof(hashes) / sizeof(hashes[0]); i++)
+                fprintf(stderr, "  %-10s %s\n", hashes[i].name, hashes[i].description);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int setCount = 3 + (argc - optind);
+    KeySet* sets = (KeySet*)calloc(setCount, sizeof(KeySet));
+    if (!sets || !makeIntegers(&sets[0], "sequential integers", keys, 1) ||
+        !makeIntegers(&sets[1], "integers strided by 1024", keys, STRIDE) || !makeRandomText(&sets[2], keys)) {
+        fprintf(stderr, "Unable to make the key sets.\n");
+        return EXIT_FAILURE;
+    }
+    for (int i = optind; i < argc; i++) {
+        if (!loadKeys(&sets[3 + i - optind], argv[i])) {
+            fprintf(stderr, "Unable to read keys from %s.\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    _Bool found = 0;
+    for (size_t h = 0; h < sizeof(hashes) / sizeof(hashes[0]); h++) {
+        if (only && strcmp(only, hashes[h].name) != 0)
+            continue;
+        found = 1;
+        for (int s = 0; s < setCount; s++)
+            analyze(&hashes[h], &sets[s]);
+    }
+    if (!found) {
+        fprintf(stderr, "Unknown hash %s.\n", only);
+        return EXIT_FAILURE;
+    }
+
+    for (int s = 0; s < setCount; s++) {
+        free(sets[s].keys);
+        free(sets[s].text);
+    }
+    free(sets);
+    return EXIT_SUCCESS;
+}
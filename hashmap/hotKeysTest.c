@@ -0,0 +1,91 @@
+// Simple test program for the hot-key tracker: finding the heavy hitters, sampling, decay and the Map hooks.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "map.h"
+
+#define OPERATIONS 1000000
+
+// Feeds a skewed stream: "hot" gets half of the operations, "warm" a tenth, and the rest go to 100000 cold keys.
+static void feed(HotKeys* tracker, int operations) {
+    char name[16];
+    for (int i = 0; i < operations; i++) {
+        VType key = { 'T', 0, { .text = name }, 0 };
+        if (i % 2 == 0)
+            key.length = snprintf(name, sizeof(name), "hot");
+        else if (i % 10 == 1)
+            key.length = snprintf(name, sizeof(name), "warm");
+        else
+            key.length = snprintf(name, sizeof(name), "cold:%d", (int)(i * 7919LL % 100000));
+        hotKeysRecord(tracker, &key);
+    }
+}
+
+// Tells whether a reported key is the given text.
+static _Bool isKey(HotKey const* hot, char const* text) {
+    return hot->key->type == 'T' && hot->key->length == strlen(text) && memcmp(hot->key->value.text, text, hot->key->length) == 0;
+}
+
+int main() {
+    assert(!makeHotKeys(0, 1, 1000) && !makeHotKeys(10, 0, 1000) && !makeHotKeys(10, 1, 0));
+
+    // Sampling every operation, the two heavy hitters come out on top with about their share of the operations.
+    HotKeys* tracker = makeHotKeys(8, 1, 60000);
+    feed(tracker, OPERATIONS);
+    HotKey top[8];
+    size_t n = hotKeysTop(tracker, top, 8);
+    assert(n == 8 && isKey(&top[0], "hot") && isKey(&top[1], "warm"));
+    assert(top[0].count >= OPERATIONS / 2 && top[0].count < OPERATIONS / 2 * 1.05);
+    assert(top[1].count >= OPERATIONS / 10 && top[1].count < OPERATIONS / 10 * 1.5);
+    assert(top[0].rate > top[1].rate && top[2].count < top[1].count / 4);
+    printf("hot: ~%llu operations, %.0f/s\n", top[0].count, top[0].rate);
+    hotKeysFree(tracker);
+
+    // Sampling one operation in 16 still finds them, with counts scaled back up.
+    tracker = makeHotKeys(8, 16, 60000);
+    feed(tracker, OPERATIONS);
+    n = hotKeysTop(tracker, top, 2);
+    assert(n == 2 && isKey(&top[0], "hot") && isKey(&top[1], "warm"));
+    assert(top[0].count > OPERATIONS / 2 * 0.9 && top[0].count < OPERATIONS / 2 * 1.1);
+    HotKeysStats stats;
+    hotKeysStats(tracker, &stats);
+    assert(stats.samples > OPERATIONS / 16 * 0.9 && stats.samples < OPERATIONS / 16 * 1.1 && stats.sampleRate == 16);
+    hotKeysFree(tracker);
+
+    // Counts halve every window, so a key that stops being used fades out and a new hot key takes over.
+    tracker = makeHotKeys(4, 1, 20);
+    VType old = { 'T', 3, { .text = "old" }, 0 };
+    VType now = { 'T', 3, { .text = "new" }, 0 };
+    for (int i = 0; i < 100000; i++)
+        hotKeysRecord(tracker, &old);
+    usleep(200 * 1000);
+    for (int i = 0; i < 1000; i++)
+        hotKeysRecord(tracker, &now);
+    n = hotKeysTop(tracker, top, 4);
+    assert(n >= 1 && isKey(&top[0], "new"));
+    assert(n == 1 || top[1].count < 1000);
+    hotKeysStats(tracker, &stats);
+    assert(stats.windows >= 8);
+    hotKeysFree(tracker);
+
+    // A Map samples its lookups and updates once tracking is switched on, and stops when it is switched off.
+    Map* map = makeMap(0, NULL);
+    assert(mapHotKeys(map, top, 4) == -1);
+    assert(mapEnableHotKeys(map, 4, 1));
+    mapSet(map, makeInteger(7), makeInteger(0));
+    for (int i = 0; i < 1000; i++) {
+        mapGetInt(map, 7);
+        mapGetInt(map, i);
+    }
+    assert(mapHotKeys(map, top, 4) >= 1 && top[0].key->type == 'I' && top[0].key->value.integer == 7);
+    assert(top[0].count == 1002 && mapHotKeysStats(map, &stats) && stats.samples == 2001);
+    mapDisableHotKeys(map);
+    assert(mapHotKeys(map, top, 4) == -1 && !mapHotKeysStats(map, &stats));
+    mapFree(map);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,345 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hotkeys.h"
+
+/**
+ * @file hotkeys.c
+ * @author Jason Wang
+ * This program provides a fixed-memory tracker of the most frequent keys, fed from a sample of the map's operations.
+ * A count-min sketch estimates how often each sampled key was seen, and a min-heap keeps the keys with the highest
+ * estimates. Counts are halved at the end of every decay window, so the estimates follow the current traffic and old
+ * hot keys fade out.
+ */
+
+/** Number of rows of the count-min sketch; an estimate is the smallest of the key's counters in them. */
+#define DEPTH 4
+
+/** Number of counters per row, a power of two. */
+#define WIDTH 1024
+
+/** Number of samples between two readings of the clock to see whether a decay window has ended. */
+#define CLOCK_SAMPLES 64
+
+/** Largest number of heavy hitters a tracker keeps. */
+#define MAX_HITTERS 1024
+
+/**
+ * One key in the heap of heavy hitters, with its hash and its estimate when it was last sampled.
+ */
+typedef struct {
+    VType* key;
+    unsigned int hash;
+    uint32_t count;
+} Hitter;
+
+/**
+ * HotKeysStruct holding the sketch, the heap of heavy hitters ordered by smallest estimate first, and the sampling
+ * and decay state.
+ */
+struct HotKeysStruct {
+    uint32_t counters[DEPTH][WIDTH];
+    Hitter* heap;
+    size_t capacity;
+    size_t used;
+
+    /** One in 'sampleRate' operations is sampled on average; 'skip' more are left out before the next sample. */
+    unsigned int sampleRate;
+    unsigned int skip;
+    uint32_t random;
+
+    /** Length of a decay window, when the current one started, and the decayed length of the earlier ones. */
+    uint64_t windowNanos;
+    uint64_t windowStart;
+    uint64_t pastNanos;
+
+    size_t samples;
+    size_t windows;
+};
+
+/**
+ * Reads a clock for the decay windows and the rate estimates.
+ * @return The time in nanoseconds since an arbitrary point.
+ */
+static uint64_t nowNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Spreads a 32-bit key hash over 64 bits with the splitmix64 finalizer, so each row takes its column from its own bits.
+ * @param hash The hash of the key.
+ * @return A well-mixed 64-bit value derived from the hash.
+ */
+static uint64_t mix(unsigned int hash) {
+    uint64_t x = hash + 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * Picks how many operations to leave out before the next sample, at random so periodic access patterns can't hide.
+ * The gap is uniform between 0 and twice the sample rate, so one operation in 'sampleRate' is sampled on average.
+ * @param this A pointer to the tracker.
+ * @return The number of operations to skip.
+ */
+static unsigned int nextSkip(HotKeys* this) {
+    this->random ^= this->random << 13;
+    this->random ^= this->random >> 17;
+    this->random ^= this->random << 5;
+    return this->random % (2 * this->sampleRate - 1);
+}
+
+/**
+ * Finds the sketch counters of a key, one per row.
+ * @param this A pointer to the tracker.
+ * @param hash The hash of the key.
+ * @param cells Where the pointers to the counters are stored.
+ * @return The key's estimate, the smallest of its counters.
+ */
+static uint32_t findCounters(HotKeys* this, unsigned int hash, uint32_t* cells[DEPTH]) {
+    uint64_t x = mix(hash);
+    uint32_t estimate = UINT32_MAX;
+    for (int d = 0; d < DEPTH; d++) {
+        cells[d] = &this->counters[d][(x >> (16 * d)) & (WIDTH - 1)];
+        if (*cells[d] < estimate)
+            estimate = *cells[d];
+    }
+    return estimate;
+}
+
+/**
+ * Halves every count once per decay window that has ended, and the time the counts cover with them, so a rate
+ * estimate weighs recent windows most. A tracker left idle for many windows simply ends up with every count at 0.
+ * @param this A pointer to the tracker.
+ * @param now The current time.
+ */
+static void decay(HotKeys* this, uint64_t now) {
+    uint64_t elapsed = now - this->windowStart;
+    if (elapsed < this->windowNanos)
+        return;
+
+    uint64_t ended = elapsed / this->windowNanos;
+    int shift = ended < 32 ? (int)ended : 32;
+    for (int d = 0; d < DEPTH; d++) {
+        for (int i = 0; i < WIDTH; i++)
+            this->counters[d][i] = shift < 32 ? this->counters[d][i] >> shift : 0;
+    }
+    for (size_t i = 0; i < this->used; i++)
+        this->heap[i].count = shift < 32 ? this->heap[i].count >> shift : 0;
+    this->pastNanos = shift < 32 ? (this->pastNanos + elapsed) >> shift : 0;
+    this->windowStart = now;
+    this->windows += ended;
+}
+
+/**
+ * Swaps two entries of the heap.
+ * @param this A pointer to the tracker.
+ * @param i The index of one entry.
+ * @param j The index of the other.
+ */
+static void swapHitters(HotKeys* this, size_t i, size_t j) {
+    Hitter t = this->heap[i];
+    this->heap[i] = this->heap[j];
+    this->heap[j] = t;
+}
+
+/**
+ * Moves an entry of the heap towards the root while its estimate is smaller than its parent's.
+ * @param this A pointer to the tracker.
+ * @param i The index of the entry.
+ */
+static void siftUp(HotKeys* this, size_t i) {
+    while (i > 0 && this->heap[i].count < this->heap[(i - 1) / 2].count) {
+        swapHitters(this, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+/**
+ * Moves an entry of the heap towards the leaves while its estimate is larger than one of its children's.
+ * @param this A pointer to the tracker.
+ * @param i The index of the entry.
+ */
+static void siftDown(HotKeys* this, size_t i) {
+    while (1) {
+        size_t smallest = i;
+        for (size_t c = 2 * i + 1; c <= 2 * i + 2 && c < this->used; c++) {
+            if (this->heap[c].count < this->heap[smallest].count)
+                smallest = c;
+        }
+        if (smallest == i)
+            return;
+        swapHitters(this, i, smallest);
+        i = smallest;
+    }
+}
+
+/**
+ * Counts one sampled operation on a key and updates the heavy hitters.
+ * Reading the clock costs about as much as the rest of a sample, so the end of a decay window is only checked for
+ * every CLOCK_SAMPLES samples, and when the hot keys are reported.
+ * The sketch uses conservative update: only the counters at the key's current estimate are raised, which keeps
+ * keys sharing a counter from inflating each other's estimates. A key already in the heap gets its new estimate; a
+ * new key replaces the heap's smallest entry once its estimate is larger, or fills a free entry.
+ * @param this A pointer to the tracker.
+ * @param key A pointer to the key.
+ */
+static void sample(HotKeys* this, VType const* key) {
+    if (this->samples++ % CLOCK_SAMPLES == 0)
+        decay(this, nowNanos());
+
+    unsigned int hash = hashVType(key);
+    uint32_t* cells[DEPTH];
+    uint32_t estimate = findCounters(this, hash, cells);
+    if (estimate < UINT32_MAX)
+        estimate++;
+    for (int d = 0; d < DEPTH; d++) {
+        if (*cells[d] < estimate)
+            *cells[d] = estimate;
+    }
+
+    for (size_t i = 0; i < this->used; i++) {
+        if (this->heap[i].hash == hash && equalsVType(this->heap[i].key, key)) {
+            this->heap[i].count = estimate;
+            siftDown(this, i);
+            return;
+        }
+    }
+
+    if (this->used == this->capacity && estimate <= this->heap[0].count)
+        return;
+    VType* copy = copyVType(key);
+    if (!copy)
+        return;
+    if (this->used < this->capacity) {
+        this->heap[this->used] = (Hitter){ copy, hash, estimate };
+        siftUp(this, this->used++);
+    } else {
+        freeVType(this->heap[0].key);
+        this->heap[0] = (Hitter){ copy, hash, estimate };
+        siftDown(this, 0);
+    }
+}
+
+/**
+ * Creates a new hot-key tracker on the heap.
+ * The sketch takes a fixed DEPTH x WIDTH counters whatever the number of distinct keys, and the heap keeps copies of
+ * the 'capacity' keys with the highest estimates.
+ * Memory allocated for the tracker should be freed by the caller with 'hotKeysFree' when no longer needed.
+ * @param capacity The number of heavy hitters to keep, at most MAX_HITTERS.
+ * @param sampleRate One in this many operations is sampled on average; 1 samples every operation.
+ * @param windowMillis The length of a decay window, after which every count is halved.
+ * @return A pointer to the tracker, or NULL on invalid arguments or memory allocation failure.
+ */
+HotKeys* makeHotKeys(size_t capacity, unsigned int sampleRate, unsigned int windowMillis) {
+    if (capacity == 0 || capacity > MAX_HITTERS || sampleRate == 0 || sampleRate > 1u << 30 || windowMillis == 0)
+        return NULL;
+
+    HotKeys* tracker = (HotKeys*)calloc(1, sizeof(HotKeys));
+    if (!tracker)
+        return NULL;
+    if (!(tracker->heap = (Hitter*)malloc(capacity * sizeof(Hitter)))) {
+        free(tracker);
+        return NULL;
+    }
+    tracker->capacity = capacity;
+    tracker->sampleRate = sampleRate;
+    tracker->random = 2463534242u;
+    tracker->skip = nextSkip(tracker);
+    tracker->windowNanos = windowMillis * 1000000ULL;
+    tracker->windowStart = nowNanos();
+    return tracker;
+}
+
+/**
+ * Records one operation on a key. Only a sample of the operations reaches the sketch; the others just count down
+ * to the next sample, so recording costs a decrement and a branch for most operations.
+ * @param this A pointer to the tracker.
+ * @param key A pointer to the key, which is only borrowed.
+ */
+void hotKeysRecord(HotKeys* this, VType const* key) {
+    if (this->skip) {
+        this->skip--;
+        return;
+    }
+    this->skip = nextSkip(this);
+    sample(this, key);
+}
+
+/**
+ * Orders two hot keys by estimated count, largest first, as a qsort comparator.
+ * @param a A pointer to one HotKey.
+ * @param b A pointer to the other.
+ * @return A negative number if 'a' comes first, a positive one if 'b' does, 0 if they are tied.
+ */
+static int byCount(void const* a, void const* b) {
+    unsigned long long x = ((HotKey const*)a)->count;
+    unsigned long long y = ((HotKey const*)b)->count;
+    return (x < y) - (x > y);
+}
+
+/**
+ * Reports the most frequent keys seen recently, most frequent first.
+ * Each key's count is read from the sketch at the time of the call, scaled up by the sample rate, and its rate is
+ * that count over the decayed time the counts cover.
+ * @param this A pointer to the tracker.
+ * @param top Where the keys are stored, room for 'k' of them.
+ * @param k The largest number of keys to report.
+ * @return The number of keys stored in 'top', fewer than 'k' if fewer keys were seen since they last decayed to 0.
+ */
+size_t hotKeysTop(HotKeys* this, HotKey* top, size_t k) {
+    uint64_t now = nowNanos();
+    decay(this, now);
+    HotKey* all = (HotKey*)malloc((this->used ? this->used : 1) * sizeof(HotKey));
+    if (!all)
+        return 0;
+
+    double seconds = (this->pastNanos + (now - this->windowStart)) / 1e9;
+    size_t n = 0;
+    for (size_t i = 0; i < this->used; i++) {
+        uint32_t* cells[DEPTH];
+        unsigned long long count = (unsigned long long)findCounters(this, this->heap[i].hash, cells) * this->sampleRate;
+        if (count == 0)
+            continue;
+        all[n].key = this->heap[i].key;
+        all[n].count = count;
+        all[n].rate = seconds > 0 ? count / seconds : 0;
+        n++;
+    }
+    qsort(all, n, sizeof(HotKey), byCount);
+    if (n > k)
+        n = k;
+    memcpy(top, all, n * sizeof(HotKey));
+    free(all);
+    return n;
+}
+
+/**
+ * Reports the sizing and sampling counters of the tracker.
+ * @param this A pointer to the tracker.
+ * @param stats A pointer to the HotKeysStats to be filled in.
+ */
+void hotKeysStats(HotKeys const* this, HotKeysStats* stats) {
+    stats->capacity = this->capacity;
+    stats->sampleRate = this->sampleRate;
+    stats->samples = this->samples;
+    stats->windows = this->windows;
+    stats->bytes = sizeof(HotKeys) + this->capacity * sizeof(Hitter);
+}
+
+/**
+ * Frees the tracker and the keys it keeps.
+ * @param this A pointer to the tracker, or NULL.
+ */
+void hotKeysFree(HotKeys* this) {
+    if (!this)
+        return;
+    for (size_t i = 0; i < this->used; i++)
+        freeVType(this->heap[i].key);
+    free(this->heap);
+    free(this);
+}
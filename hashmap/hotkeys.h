@@ -0,0 +1,47 @@
+#ifndef HOTKEYS_H
+#define HOTKEYS_H
+
+#include <stddef.h>
+#include "vtype.h"
+
+// Define your HotKeys struct here
+typedef struct HotKeysStruct HotKeys;
+
+/** One of the most frequent keys reported by a hot-key tracker. */
+typedef struct {
+    /** The key; the tracker owns it and it stays valid until the tracker next records or reports. */
+    VType const* key;
+
+    /** Estimated number of operations on the key in the decayed window, counting unsampled ones. */
+    unsigned long long count;
+
+    /** Estimated operations on the key per second. */
+    double rate;
+} HotKey;
+
+/** Sizing and sampling counters reported for a hot-key tracker. */
+typedef struct {
+    /** Number of heavy hitters tracked. */
+    size_t capacity;
+
+    /** One in this many operations is sampled on average. */
+    unsigned int sampleRate;
+
+    /** Number of operations sampled so far. */
+    size_t samples;
+
+    /** Number of decay windows that have ended so far. */
+    size_t windows;
+
+    /** Memory used by the sketch and the heap, not counting the tracked keys. */
+    size_t bytes;
+} HotKeysStats;
+
+/*Function prototypes*/
+HotKeys* makeHotKeys(size_t capacity, unsigned int sampleRate, unsigned int windowMillis);
+void hotKeysRecord(HotKeys* this, VType const* key);
+size_t hotKeysTop(HotKeys* this, HotKey* top, size_t k);
+void hotKeysStats(HotKeys const* this, HotKeysStats* stats);
+void hotKeysFree(HotKeys* this);
+
+#endif // HOTKEYS_H
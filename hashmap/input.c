@@ -1,5 +1,8 @@
 #include "input.h"
+#include <ctype.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 
 /** 
  * @file input.c
@@ -59,3 +62,118 @@ char* readLine(FILE* fp) {
     return line;
 }
 
+
+/**
+ * Parses a token that is entirely a decimal integer in the range of an int.
+ * The token doesn't need to be NUL-terminated.
+ * @param token A pointer to the first character of the token.
+ * @param len The number of characters in the token.
+ * @param result Where the integer is stored.
+ * @return true if the token is an int, false otherwise.
+ */
+_Bool parseInteger(char const* token, size_t len, int* result) {
+    // An int has at most 11 characters, so anything longer isn't one.
+    if (len == 0 || len > 11 || isspace((unsigned char)token[0]))
+        return 0;
+
+    char buffer[12];
+    memcpy(buffer, token, len);
+    buffer[len] = '\0';
+
+    char* end;
+    long val = strtol(buffer, &end, 10);
+    if (*end != '\0' || val < INT_MIN || val > INT_MAX)
+        return 0;
+    *result = (int)val;
+    return 1;
+}
+
+/**
+ * Makes a VType from a token of a command or record.
+ * A token that is entirely a decimal integer in the range of an int becomes an Integer, anything else becomes Text.
+ * The token doesn't need to be NUL-terminated.
+ * @param token A pointer to the first character of the token.
+ * @param len The number of characters in the token.
+ * @return A pointer to the new VType, or NULL on memory allocation failure.
+ */
+VType* parseValue(char const* token, size_t len) {
+    int val;
+    if (parseInteger(token, len, &val))
+        return makeInteger(val);
+    return makeTextLen(token, len);
+}
+
+/**
+ * Fills in a VType for a token the same way 'parseValue' would, without allocating anything.
+ * A Text result points into the token itself, so it is only valid while the token is and must never be freed;
+ * it is meant for looking up keys.
+ * @param token A pointer to the first character of the token.
+ * @param len The number of characters in the token.
+ * @param v Where the VType is stored.
+ */
+void borrowValue(char const* token, size_t len, VType* v) {
+    v->capacity = 0;
+    if (parseInteger(token, len, &v->value.integer)) {
+        v->type = 'I';
+        v->length = 0;
+    } else {
+        v->type = 'T';
+        v->length = len;
+        v->value.text = (char*)token;
+    }
+}
+
+/**
+ * Parses one line of an import file into a new key and value.
+ * Two formats are accepted: the driver's own "set <key> <value>" command, where the value is the rest of the line,
+ * and a CSV record "<key>,<value>", where the value is everything after the first comma.
+ * Surrounding whitespace is ignored, and the key and value are parsed with 'parseValue'.
+ * @param line A pointer to the first character of the line, which need not be NUL-terminated.
+ * @param len The number of characters in the line, not counting the newline.
+ * @param key Where the new key is stored.
+ * @param value Where the new value is stored.
+ * @return true if the line held a key and a value, false if it is blank or malformed.
+ */
+_Bool parseRecord(char const* line, size_t len, VType** key, VType** value) {
+    char const* end = line + len;
+    while (line < end && isspace((unsigned char)*line))
+        line++;
+    while (end > line && isspace((unsigned char)end[-1]))
+        end--;
+
+    char const* keyStart;
+    char const* keyEnd;
+    char const* valueStart;
+    if (end - line > 4 && memcmp(line, "set", 3) == 0 && isspace((unsigned char)line[3])) {
+        keyStart = line + 4;
+        while (keyStart < end && isspace((unsigned char)*keyStart))
+            keyStart++;
+        keyEnd = keyStart;
+        while (keyEnd < end && !isspace((unsigned char)*keyEnd))
+            keyEnd++;
+        valueStart = keyEnd;
+    } else {
+        char const* comma = memchr(line, ',', end - line);
+        if (!comma)
+            return 0;
+        keyStart = line;
+        keyEnd = comma;
+        while (keyEnd > keyStart && isspace((unsigned char)keyEnd[-1]))
+            keyEnd--;
+        valueStart = comma + 1;
+    }
+
+    while (valueStart < end && isspace((unsigned char)*valueStart))
+        valueStart++;
+    if (keyStart == keyEnd || valueStart == end)
+        return 0;
+
+    *key = parseValue(keyStart, keyEnd - keyStart);
+    *value = parseValue(valueStart, end - valueStart);
+    if (!*key || !*value) {
+        freeVType(*key);
+        freeVType(*value);
+        return 0;
+    }
+    return 1;
+}
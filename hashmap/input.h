@@ -2,9 +2,22 @@
 #define INPUT_H
 
 #include <stdio.h>
+#include "vtype.h"
 
 /* Function to read a single line of input from the given file and return it as a dynamically allocated string. */
 char* readLine(FILE* fp);
 
+/* Parse a token that is entirely a decimal int. Returns 0 if it isn't one. */
+_Bool parseInteger(char const* token, size_t len, int* result);
+
+/* Make an Integer from a token that is entirely a decimal int, or a Text holding the token otherwise. */
+VType* parseValue(char const* token, size_t len);
+
+/* Fill in a VType like parseValue, with Text pointing into the token instead of a copy of it. */
+void borrowValue(char const* token, size_t len, VType* v);
+
+/* Parse a "set <key> <value>" command or a "<key>,<value>" CSV line into a new key and value. */
+_Bool parseRecord(char const* line, size_t len, VType** key, VType** value);
+
 #endif // INPUT_H
 
@@ -0,0 +1,103 @@
+// Stress test for the lock-free int table: many threads updating the same keys at once.
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "inttable.h"
+
+#define THREADS 8
+#define COUNTERS 1000
+#define ROUNDS 200
+#define PRIVATE 20000
+
+// What each thread is given to work on.
+typedef struct {
+    IntTable* table;
+    int id;
+} Worker;
+
+// Increments every shared counter by one and by the thread's id, in an order of its own, then stores and removes keys
+// no other thread touches, reading each back.
+static void* work(void* arg) {
+    Worker* w = (Worker*)arg;
+    unsigned int state = w->id * 2654435761U + 1;
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < COUNTERS; i++) {
+            int key = (int)((i * 7 + r + w->id * 31) % COUNTERS);
+            assert(intTableIncr(w->table, key, 1, NULL));
+            assert(intTableIncr(w->table, -1 - key, w->id, NULL));
+        }
+    }
+
+    int base = 1000000 * (w->id + 1);
+    for (int i = 0; i < PRIVATE; i++) {
+        int value;
+        assert(intTableSet(w->table, base + i, i));
+        assert(intTableGet(w->table, base + i, &value) && value == i);
+        state = state * 1103515245U + 12345U;
+        if (state >> 31) {
+            assert(intTableRemove(w->table, base + i));
+            assert(!intTableGet(w->table, base + i, &value));
+            assert(!intTableRemove(w->table, base + i));
+        }
+    }
+    return NULL;
+}
+
+int main() {
+    // One thread: the basic operations and the edge cases.
+    IntTable* t = makeIntTable(100);
+    assert(t && intTableCapacity(t) >= 100);
+    int value, result;
+    assert(!intTableGet(t, 5, &value));
+    assert(intTableSet(t, 5, 50) && intTableGet(t, 5, &value) && value == 50);
+    assert(intTableSet(t, 5, 51) && intTableGet(t, 5, &value) && value == 51);
+    assert(intTableIncr(t, 5, -1, &result) && result == 50);
+    assert(intTableIncr(t, 6, 3, &result) && result == 3);
+    assert(intTableSize(t) == 2);
+    assert(!intTableSet(t, INT_TABLE_EMPTY, 1) && !intTableSet(t, 1, INT_TABLE_EMPTY));
+    assert(intTableSet(t, 7, INT_MAX) && intTableIncr(t, 7, -1, &result) && result == INT_MAX - 1);
+    assert(intTableSet(t, 8, INT_MIN + 1) && !intTableIncr(t, 8, -1, NULL));
+    assert(intTableGet(t, 8, &value) && value == INT_MIN + 1);
+    assert(intTableRemove(t, 5) && !intTableRemove(t, 5) && !intTableGet(t, 5, &value));
+    assert(intTableIncr(t, 5, 2, &result) && result == 2);
+    assert(intTableSize(t) == 4);
+
+    // A full table turns new keys away but still serves the ones it has.
+    size_t capacity = intTableCapacity(t);
+    size_t stored = 4;
+    for (int k = 100; stored < capacity; k++)
+        stored += intTableSet(t, k, k);
+    assert(!intTableSet(t, -5, 1) && !intTableIncr(t, -5, 1, NULL) && !intTableGet(t, -5, &value));
+    assert(intTableGet(t, 6, &value) && value == 3);
+    intTableFree(t);
+
+    // Many threads: no increment may be lost and no key may get two slots.
+    IntTable* shared = makeIntTable(2 * COUNTERS + THREADS * PRIVATE);
+    pthread_t threads[THREADS];
+    Worker workers[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        workers[i].table = shared;
+        workers[i].id = i;
+        assert(pthread_create(&threads[i], NULL, work, &workers[i]) == 0);
+    }
+    for (int i = 0; i < THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    int idSum = THREADS * (THREADS - 1) / 2;
+    for (int key = 0; key < COUNTERS; key++) {
+        assert(intTableGet(shared, key, &value) && value == THREADS * ROUNDS);
+        assert(intTableGet(shared, -1 - key, &value) && value == idSum * ROUNDS);
+    }
+    size_t kept = 0;
+    for (int id = 0; id < THREADS; id++) {
+        for (int i = 0; i < PRIVATE; i++)
+            kept += intTableGet(shared, 1000000 * (id + 1) + i, &value);
+    }
+    printf("%d threads: %zu keys, %zu slots\n", THREADS, intTableSize(shared), intTableCapacity(shared));
+    assert(intTableSize(shared) == 2 * COUNTERS + kept);
+    intTableFree(shared);
+    return 0;
+}
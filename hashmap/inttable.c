@@ -0,0 +1,238 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include "inttable.h"
+#include "siphash.h"
+
+/**
+ * @file inttable.c
+ * @author Jason Wang
+ * This program provides a lock-free hash table from ints to ints, for counters that many threads update at once.
+ * Slots are pairs of a key and a value in one flat array, probed linearly from the key's hash. A thread claims an
+ * empty slot for a key with a compare-and-swap on the key, and after that the key never changes, so readers and
+ * writers of the same key only ever race on its value, which is read, written, swapped or added to atomically.
+ * No operation takes a lock or waits for another thread, and a thread stalled in the middle of one holds nothing up.
+ * The price is that the table doesn't grow: a removed key gives up its value but keeps its slot, so the capacity
+ * bounds the number of distinct keys ever stored, not just those stored at once.
+ */
+
+/** Smallest number of slots in a table; the slot count is always a power of two. */
+#define MIN_SLOTS 64
+
+/**
+ * A key and its value, next to each other so a lookup reads one cache line.
+ */
+typedef struct {
+    int key;
+    int value;
+} Slot;
+
+/**
+ * Define the IntTable structure.
+ */
+struct IntTableStruct {
+    /** The slots, probed linearly. */
+    Slot* slots;
+
+    /** Number of slots less one, for masking a hash to a slot index. */
+    size_t mask;
+
+    /** Random seed mixed into every hash, so which keys share a probe sequence can't be planned. */
+    unsigned int seed;
+
+    /** Number of keys holding a value, updated atomically. */
+    size_t size;
+};
+
+/**
+ * Creates an empty table with room for a number of keys.
+ * The table gets a third more slots than that, rounded up to a power of two, so probe sequences stay short when full.
+ * @param capacity The number of distinct keys the table must be able to hold.
+ * @return A pointer to the table, or NULL if the memory can't be allocated.
+ */
+IntTable* makeIntTable(size_t capacity) {
+    size_t slots = MIN_SLOTS;
+    while (slots < capacity + capacity / 3) {
+        if (slots > SIZE_MAX / 2 / sizeof(Slot))
+            return NULL;
+        slots *= 2;
+    }
+
+    IntTable* this = (IntTable*)malloc(sizeof(IntTable));
+    if (!this)
+        return NULL;
+    this->slots = (Slot*)malloc(slots * sizeof(Slot));
+    if (!this->slots) {
+        free(this);
+        return NULL;
+    }
+    for (size_t i = 0; i < slots; i++) {
+        this->slots[i].key = INT_TABLE_EMPTY;
+        this->slots[i].value = INT_TABLE_EMPTY;
+    }
+    this->mask = slots - 1;
+    this->size = 0;
+
+    uint64_t key[2];
+    randomHashKey(key);
+    this->seed = (unsigned int)(key[0] ^ key[1]);
+    return this;
+}
+
+/**
+ * Picks the slot a key's probe sequence starts from, by mixing the key and the seed with murmur3's finalizer.
+ * @param this A pointer to the table.
+ * @param key The key.
+ * @return The index of the first slot to probe.
+ */
+static size_t startSlot(IntTable const* this, int key) {
+    unsigned int h = (unsigned int)key ^ this->seed;
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h & this->mask;
+}
+
+/**
+ * Finds the slot of a key, optionally claiming an empty one for it.
+ * Two threads claiming slots for the same key both end up with the one whose compare-and-swap won.
+ * @param this A pointer to the table.
+ * @param key The key, which must not be INT_TABLE_EMPTY.
+ * @param claim Whether to claim a slot for the key if it has none.
+ * @return A pointer to the key's slot, or NULL if it has none and either claim is false or the table is full.
+ */
+static Slot* findSlot(IntTable* this, int key, _Bool claim) {
+    size_t i = startSlot(this, key);
+    for (size_t probes = 0; probes <= this->mask; probes++, i = (i + 1) & this->mask) {
+        Slot* slot = &this->slots[i];
+        int found = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE);
+        if (found == key)
+            return slot;
+        if (found != INT_TABLE_EMPTY)
+            continue;
+
+        // Keys are only ever added to the end of a probe sequence, so an empty slot means the key isn't further on.
+        if (!claim)
+            return NULL;
+        if (__atomic_compare_exchange_n(&slot->key, &found, key, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ||
+            found == key)
+            return slot;
+    }
+    return NULL;
+}
+
+/**
+ * Stores a value for a key, replacing any value it had.
+ * @param this A pointer to the table.
+ * @param key The key.
+ * @param value The value.
+ * @return true if the value was stored, false if the key or value is INT_TABLE_EMPTY or the table is full.
+ */
+_Bool intTableSet(IntTable* this, int key, int value) {
+    if (key == INT_TABLE_EMPTY || value == INT_TABLE_EMPTY)
+        return 0;
+    Slot* slot = findSlot(this, key, 1);
+    if (!slot)
+        return 0;
+    if (__atomic_exchange_n(&slot->value, value, __ATOMIC_ACQ_REL) == INT_TABLE_EMPTY)
+        __atomic_fetch_add(&this->size, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/**
+ * Looks up the value of a key.
+ * @param this A pointer to the table.
+ * @param key The key.
+ * @param value Where the value is stored if the key has one.
+ * @return true if the key has a value, false otherwise.
+ */
+_Bool intTableGet(IntTable* this, int key, int* value) {
+    if (key == INT_TABLE_EMPTY)
+        return 0;
+    Slot* slot = findSlot(this, key, 0);
+    if (!slot)
+        return 0;
+    int found = __atomic_load_n(&slot->value, __ATOMIC_ACQUIRE);
+    if (found == INT_TABLE_EMPTY)
+        return 0;
+    *value = found;
+    return 1;
+}
+
+/**
+ * Adds to the value of a key atomically, treating a key without a value as 0.
+ * The sum wraps around like unsigned arithmetic.
+ * @param this A pointer to the table.
+ * @param key The key.
+ * @param delta The amount to add, which may be negative.
+ * @param result Where the new value is stored, or NULL.
+ * @return true if the value was updated, false if the key is INT_TABLE_EMPTY, the table is full or the sum would be
+ *         INT_TABLE_EMPTY, in which case the value is left as it was.
+ */
+_Bool intTableIncr(IntTable* this, int key, int delta, int* result) {
+    if (key == INT_TABLE_EMPTY)
+        return 0;
+    Slot* slot = findSlot(this, key, 1);
+    if (!slot)
+        return 0;
+
+    int old = __atomic_load_n(&slot->value, __ATOMIC_RELAXED);
+    int sum;
+    do {
+        sum = (int)((unsigned int)(old == INT_TABLE_EMPTY ? 0 : old) + (unsigned int)delta);
+        if (sum == INT_TABLE_EMPTY)
+            return 0;
+    } while (!__atomic_compare_exchange_n(&slot->value, &old, sum, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    if (old == INT_TABLE_EMPTY)
+        __atomic_fetch_add(&this->size, 1, __ATOMIC_RELAXED);
+    if (result)
+        *result = sum;
+    return 1;
+}
+
+/**
+ * Removes the value of a key. The key keeps its slot, so storing it again doesn't take another one.
+ * @param this A pointer to the table.
+ * @param key The key.
+ * @return true if the key had a value, false otherwise.
+ */
+_Bool intTableRemove(IntTable* this, int key) {
+    if (key == INT_TABLE_EMPTY)
+        return 0;
+    Slot* slot = findSlot(this, key, 0);
+    if (!slot || __atomic_exchange_n(&slot->value, INT_TABLE_EMPTY, __ATOMIC_ACQ_REL) == INT_TABLE_EMPTY)
+        return 0;
+    __atomic_fetch_sub(&this->size, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/**
+ * Counts the keys holding a value. While other threads are updating the table the count may be momentarily stale.
+ * @param this A pointer to the table.
+ * @return The number of keys with a value.
+ */
+size_t intTableSize(IntTable* this) {
+    return __atomic_load_n(&this->size, __ATOMIC_RELAXED);
+}
+
+/**
+ * Reports the number of slots, which bounds the number of distinct keys the table can ever hold.
+ * @param this A pointer to the table.
+ * @return The number of slots.
+ */
+size_t intTableCapacity(IntTable* this) {
+    return this->mask + 1;
+}
+
+/**
+ * Frees the table. No other thread may be using it.
+ * @param this A pointer to the table.
+ */
+void intTableFree(IntTable* this) {
+    if (!this)
+        return;
+    free(this->slots);
+    free(this);
+}
@@ -0,0 +1,23 @@
+#ifndef INTTABLE_H
+#define INTTABLE_H
+
+#include <limits.h>
+#include <stddef.h>
+
+// Key and value that mark an empty slot and a missing value; neither can be stored.
+#define INT_TABLE_EMPTY INT_MIN
+
+// Define your IntTable struct here
+typedef struct IntTableStruct IntTable;
+
+/*Function prototypes*/
+IntTable* makeIntTable(size_t capacity);
+_Bool intTableSet(IntTable* this, int key, int value);
+_Bool intTableGet(IntTable* this, int key, int* value);
+_Bool intTableIncr(IntTable* this, int key, int delta, int* result);
+_Bool intTableRemove(IntTable* this, int key);
+size_t intTableSize(IntTable* this);
+size_t intTableCapacity(IntTable* this);
+void intTableFree(IntTable* this);
+
+#endif // INTTABLE_H
@@ -0,0 +1,282 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "latency.h"
+
+/**
+ * @file latency.c
+ * @author Jason Wang
+ * This program keeps a latency histogram for every command a driver runs, cheap enough to stay on all the time.
+ * Each histogram is laid out like an HDR histogram: times below 64 ns get a bucket per nanosecond, and every power
+ * of two above is split into 32 buckets, so each bucket spans about 3% of the times in it and a percentile read from
+ * the buckets is that close to the true one. Recording a time is a bit scan, a shift and a few adds, with no
+ * allocation after the first time of a command.
+ * One thread records into a table. Its counters are written and read with relaxed atomic operations, so other
+ * threads can merge or summarize the table while it is being recorded into, which is how tables kept by several
+ * worker threads are added up; only the recording thread may reset it.
+ */
+
+/** Number of buckets every power of two is split into, and its logarithm. */
+#define SUB_BUCKET_BITS 5
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+
+/** Times below 2 to the power of one more than this, about half an hour, have buckets; longer ones share the last. */
+#define MAX_TIME_BITS 40
+
+/** Number of buckets: the exact ones below twice SUB_BUCKETS, then SUB_BUCKETS for every power of two above. */
+#define BUCKETS (2 * SUB_BUCKETS + (MAX_TIME_BITS - SUB_BUCKET_BITS) * SUB_BUCKETS)
+
+/** Longest name a command is timed under. */
+#define MAX_NAME 16
+
+/**
+ * Histogram of the times of one command.
+ */
+typedef struct {
+    unsigned long long counts[BUCKETS];
+    unsigned long long total;
+    unsigned long long sum;
+    unsigned long long max;
+} Histogram;
+
+/**
+ * Histograms of every command timed, by name.
+ */
+struct LatencyStruct {
+    /** Number of commands with a histogram, published after the name and histogram of the last one. */
+    size_t commands;
+    char names[LATENCY_COMMANDS][MAX_NAME];
+    Histogram* histograms[LATENCY_COMMANDS];
+    /** Time the window started, as read by latencyClock. */
+    unsigned long long since;
+};
+
+/**
+ * Reads the monotonic clock commands are timed with. Linux answers it from the vDSO, without a system call.
+ * @return nanoseconds since an arbitrary fixed point
+ */
+unsigned long long latencyClock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Finds the bucket a time is counted in.
+ * @param nanos the time
+ * @return the bucket
+ */
+static size_t bucketOf(unsigned long long nanos) {
+    if (nanos < 2 * SUB_BUCKETS)
+        return (size_t)nanos;
+    int shift = 63 - __builtin_clzll(nanos) - SUB_BUCKET_BITS;
+    size_t bucket = 2 * SUB_BUCKETS + (shift - 1) * SUB_BUCKETS + ((nanos >> shift) - SUB_BUCKETS);
+    return bucket < BUCKETS ? bucket : BUCKETS - 1;
+}
+
+/**
+ * Finds the longest time counted in a bucket.
+ * @param bucket the bucket
+ * @return the time
+ */
+static unsigned long long bucketTop(size_t bucket) {
+    if (bucket < 2 * SUB_BUCKETS)
+        return bucket;
+    int shift = (int)((bucket - 2 * SUB_BUCKETS) / SUB_BUCKETS) + 1;
+    unsigned long long top = SUB_BUCKETS + (bucket - 2 * SUB_BUCKETS) % SUB_BUCKETS;
+    return ((top + 1) << shift) - 1;
+}
+
+/**
+ * Adds to a counter only this thread writes, so others can read it at any time.
+ * @param counter the counter
+ * @param n the amount
+ */
+static void add(unsigned long long* counter, unsigned long long n) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+/**
+ * Reads a counter another thread may be writing.
+ * @param counter the counter
+ * @return its value
+ */
+static unsigned long long load(unsigned long long const* counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/**
+ * Makes an empty table of latency histograms, whose window starts now.
+ * @return the table, or NULL on memory allocation failure
+ */
+Latency* makeLatency() {
+    Latency* this = (Latency*)calloc(1, sizeof(Latency));
+    if (this)
+        this->since = latencyClock();
+    return this;
+}
+
+/**
+ * Finds the histogram of a command, adding one the first time the command is seen.
+ * @param this the table
+ * @param command the name of the command; names past the first LATENCY_COMMANDS - 1 share one called "other"
+ * @return the histogram, or NULL on memory allocation failure
+ */
+static Histogram* histogramOf(Latency* this, char const* command) {
+    size_t commands = __atomic_load_n(&this->commands, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < commands; i++) {
+        if (strncmp(this->names[i], command, MAX_NAME - 1) == 0)
+            return this->histograms[i];
+    }
+    if (commands == LATENCY_COMMANDS)
+        return this->histograms[LATENCY_COMMANDS - 1];
+
+    if (!(this->histograms[commands] = (Histogram*)calloc(1, sizeof(Histogram))))
+        return NULL;
+    strncpy(this->names[commands], commands == LATENCY_COMMANDS - 1 ? "other" : command, MAX_NAME - 1);
+    __atomic_store_n(&this->commands, commands + 1, __ATOMIC_RELEASE);
+    return this->histograms[commands];
+}
+
+/**
+ * Counts one run of a command. Only one thread may record into a table.
+ * @param this the table
+ * @param command the name of the command
+ * @param nanos the time it took
+ */
+void latencyRecord(Latency* this, char const* command, unsigned long long nanos) {
+    Histogram* h = histogramOf(this, command);
+    if (!h)
+        return;
+    add(&h->counts[bucketOf(nanos)], 1);
+    add(&h->total, 1);
+    add(&h->sum, nanos);
+    if (nanos > h->max)
+        __atomic_store_n(&h->max, nanos, __ATOMIC_RELAXED);
+}
+
+/**
+ * Empties every histogram of a table and starts a new window. Only the thread recording into it may reset it.
+ * @param this the table
+ */
+void latencyReset(Latency* this) {
+    size_t commands = __atomic_load_n(&this->commands, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < commands; i++) {
+        Histogram* h = this->histograms[i];
+        for (size_t b = 0; b < BUCKETS; b++) {
+            if (h->counts[b])
+                __atomic_store_n(&h->counts[b], 0, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&h->total, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&h->sum, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&h->max, 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&this->since, latencyClock(), __ATOMIC_RELAXED);
+}
+
+/**
+ * Adds the histograms of another table to a table, command by command, as if its commands had been recorded into
+ * it. The other table may be recorded into meanwhile. The window of the sum starts when the earlier one did.
+ * @param this the table added to; the calling thread must be the one recording into it
+ * @param other the table added
+ * @return false on memory allocation failure
+ */
+_Bool latencyMerge(Latency* this, Latency const* other) {
+    size_t commands = __atomic_load_n(&other->commands, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < commands; i++) {
+        Histogram const* from = other->histograms[i];
+        Histogram* into = histogramOf(this, other->names[i]);
+        if (!into)
+            return 0;
+        for (size_t b = 0; b < BUCKETS; b++) {
+            unsigned long long n = load(&from->counts[b]);
+            if (n)
+                add(&into->counts[b], n);
+        }
+        add(&into->total, load(&from->total));
+        add(&into->sum, load(&from->sum));
+        if (load(&from->max) > into->max)
+            __atomic_store_n(&into->max, load(&from->max), __ATOMIC_RELAXED);
+    }
+    unsigned long long since = __atomic_load_n(&other->since, __ATOMIC_RELAXED);
+    if (since < this->since)
+        __atomic_store_n(&this->since, since, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/**
+ * Reports how long the current window of a table has been running.
+ * @param this the table
+ * @return the time since it was made or last reset, in seconds
+ */
+double latencyWindow(Latency const* this) {
+    return (latencyClock() - __atomic_load_n(&this->since, __ATOMIC_RELAXED)) / 1e9;
+}
+
+/**
+ * Finds the time under which a given share of the counted times fall.
+ * @param counts the bucket counts
+ * @param total the number of times
+ * @param share the share, from 0 to 1
+ * @param max the longest time, which no percentile exceeds
+ * @return the longest time of the bucket the percentile falls in
+ */
+static unsigned long long percentile(unsigned long long const* counts, unsigned long long total, double share,
+                                     unsigned long long max) {
+    unsigned long long rank = (unsigned long long)(share * total + 0.5);
+    if (rank == 0)
+        rank = 1;
+    unsigned long long seen = 0;
+    for (size_t b = 0; b < BUCKETS; b++) {
+        seen += counts[b];
+        if (seen >= rank)
+            return bucketTop(b) < max ? bucketTop(b) : max;
+    }
+    return max;
+}
+
+/**
+ * Summarizes the histogram of every command of a table that ran in the current window, in the order the commands
+ * were first seen.
+ * @param this the table
+ * @param summaries where the summaries are stored
+ * @param max the most summaries to store
+ * @return the number of summaries stored
+ */
+size_t latencySummaries(Latency const* this, LatencySummary* summaries, size_t max) {
+    unsigned long long counts[BUCKETS];
+    size_t commands = __atomic_load_n(&this->commands, __ATOMIC_ACQUIRE);
+    size_t n = 0;
+    for (size_t i = 0; i < commands && n < max; i++) {
+        Histogram const* h = this->histograms[i];
+        // Add up a copy, so the percentiles agree with one another while the histogram is being recorded into.
+        unsigned long long total = 0;
+        for (size_t b = 0; b < BUCKETS; b++)
+            total += counts[b] = load(&h->counts[b]);
+        if (total == 0)
+            continue;
+
+        LatencySummary* s = &summaries[n++];
+        s->command = this->names[i];
+        s->count = total;
+        s->max = load(&h->max);
+        s->mean = (double)load(&h->sum) / total;
+        s->p50 = percentile(counts, total, 0.5, s->max);
+        s->p90 = percentile(counts, total, 0.9, s->max);
+        s->p99 = percentile(counts, total, 0.99, s->max);
+        s->p999 = percentile(counts, total, 0.999, s->max);
+    }
+    return n;
+}
+
+/**
+ * Frees a table of latency histograms.
+ * @param this the table
+ */
+void latencyFree(Latency* this) {
+    if (!this)
+        return;
+    for (size_t i = 0; i < this->commands; i++)
+        free(this->histograms[i]);
+    free(this);
+}
@@ -0,0 +1,41 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stddef.h>
+
+// Largest number of commands timed separately; later ones are counted together as "other"
+#define LATENCY_COMMANDS 32
+
+/** Latency percentiles of one command, in nanoseconds. */
+typedef struct {
+    /** Name of the command; valid as long as the table it came from. */
+    char const* command;
+
+    /** Number of times the command was timed in the window. */
+    unsigned long long count;
+
+    /** Mean time taken. */
+    double mean;
+
+    /** Median, 90th, 99th and 99.9th percentiles, each within about 3% of the true value, and the longest time. */
+    unsigned long long p50;
+    unsigned long long p90;
+    unsigned long long p99;
+    unsigned long long p999;
+    unsigned long long max;
+} LatencySummary;
+
+// Define your Latency struct here
+typedef struct LatencyStruct Latency;
+
+/*Function prototypes*/
+Latency* makeLatency();
+unsigned long long latencyClock();
+void latencyRecord(Latency* this, char const* command, unsigned long long nanos);
+void latencyReset(Latency* this);
+_Bool latencyMerge(Latency* this, Latency const* other);
+double latencyWindow(Latency const* this);
+size_t latencySummaries(Latency const* this, LatencySummary* summaries, size_t max);
+void latencyFree(Latency* this);
+
+#endif // LATENCY_H
@@ -0,0 +1,103 @@
+// Simple test program for the latency histograms: percentiles, resetting the window and merging tables across threads.
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "latency.h"
+
+#define THREADS 4
+#define RECORDS 1000000
+
+// Tells whether a reported time is within the histogram's 3% of the true one.
+static _Bool near(unsigned long long reported, unsigned long long actual) {
+    return reported >= actual * 0.97 && reported <= actual * 1.04;
+}
+
+// Finds the summary of a command.
+static LatencySummary const* find(LatencySummary const* summaries, size_t n, char const* command) {
+    for (size_t i = 0; i < n; i++) {
+        if (strcmp(summaries[i].command, command) == 0)
+            return &summaries[i];
+    }
+    return NULL;
+}
+
+// Records the times 1 to RECORDS ns as "get" and a fixed 1 ms as "set", into a table of the calling thread's own.
+static void* record(void* arg) {
+    Latency* table = (Latency*)arg;
+    for (unsigned long long i = 1; i <= RECORDS; i++)
+        latencyRecord(table, "get", i);
+    for (int i = 0; i < 1000; i++)
+        latencyRecord(table, "set", 1000000);
+    return NULL;
+}
+
+int main() {
+    LatencySummary summaries[LATENCY_COMMANDS];
+
+    // Percentiles of an even spread of times come out where they should, within the buckets' width.
+    Latency* table = makeLatency();
+    assert(table && latencySummaries(table, summaries, LATENCY_COMMANDS) == 0);
+    record(table);
+    latencyRecord(table, "size", 7);
+    size_t n = latencySummaries(table, summaries, LATENCY_COMMANDS);
+    assert(n == 3 && strcmp(summaries[0].command, "get") == 0);
+    LatencySummary const* get = find(summaries, n, "get");
+    assert(get->count == RECORDS && get->max == RECORDS);
+    assert(near(get->p50, RECORDS / 2) && near(get->p90, RECORDS * 9 / 10) && near(get->p99, RECORDS * 99 / 100));
+    assert(get->p999 <= RECORDS && near(get->p999, RECORDS * 999 / 1000));
+    assert(get->mean > RECORDS / 2 - 1 && get->mean < RECORDS / 2 + 1);
+    LatencySummary const* set = find(summaries, n, "set");
+    assert(set->count == 1000 && set->p50 == 1000000 && set->p999 == 1000000);
+    LatencySummary const* size = find(summaries, n, "size");
+    assert(size->p50 == 7 && size->max == 7);
+
+    // Resetting empties the window; a command not run since is left out.
+    latencyReset(table);
+    assert(latencySummaries(table, summaries, LATENCY_COMMANDS) == 0);
+    latencyRecord(table, "get", 100);
+    assert(latencySummaries(table, summaries, LATENCY_COMMANDS) == 1 && summaries[0].count == 1);
+    latencyFree(table);
+
+    // Commands past the limit share one histogram.
+    table = makeLatency();
+    char name[16];
+    for (int i = 0; i < LATENCY_COMMANDS + 10; i++) {
+        snprintf(name, sizeof(name), "cmd%d", i);
+        latencyRecord(table, name, 1000);
+    }
+    n = latencySummaries(table, summaries, LATENCY_COMMANDS);
+    assert(n == LATENCY_COMMANDS && strcmp(summaries[n - 1].command, "other") == 0 && summaries[n - 1].count == 11);
+    latencyFree(table);
+
+    // Tables recorded by several threads add up to one, while they are still being recorded into.
+    Latency* tables[THREADS];
+    pthread_t threads[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        tables[t] = makeLatency();
+        pthread_create(&threads[t], NULL, record, tables[t]);
+    }
+    Latency* merged = makeLatency();
+    for (int t = 0; t < THREADS; t++)
+        assert(latencyMerge(merged, tables[t]));
+    latencyFree(merged);
+    for (int t = 0; t < THREADS; t++)
+        pthread_join(threads[t], NULL);
+
+    merged = makeLatency();
+    for (int t = 0; t < THREADS; t++)
+        assert(latencyMerge(merged, tables[t]));
+    n = latencySummaries(merged, summaries, LATENCY_COMMANDS);
+    get = find(summaries, n, "get");
+    assert(n == 2 && get->count == (unsigned long long)THREADS * RECORDS && near(get->p50, RECORDS / 2));
+    double window = latencyWindow(tables[0]);
+    assert(find(summaries, n, "set")->count == THREADS * 1000 && latencyWindow(merged) >= window);
+    latencyFree(merged);
+    for (int t = 0; t < THREADS; t++)
+        latencyFree(tables[t]);
+
+    return EXIT_SUCCESS;
+}
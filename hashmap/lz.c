@@ -0,0 +1,216 @@
+#include <stdint.h>
+#include <string.h>
+#include "lz.h"
+
+/**
+ * @file lz.c
+ * @author Jason Wang
+ * This program provides the codec used to compress large Text values: a byte-oriented LZ77 in the style of LZ4.
+ * The input is a series of sequences, each a run of literal bytes followed by a copy of earlier output.
+ * A sequence starts with a token byte holding the literal count in its high 4 bits and the copy length minus 4 in its
+ * low 4 bits; a field of 15 continues in following bytes that are added to it, up to the first byte below 255.
+ * The literals come next, then the 2-byte little-endian distance back to the copy. The last sequence has only literals.
+ * Compression finds matches with a single hash table of recent positions, so it runs at memory speed and needs no state
+ * between calls; decompression is a loop of copies.
+ */
+
+/** Shortest copy worth encoding. */
+#define MIN_MATCH 4
+
+/** Number of bits of the hash used to index the table of recent positions. */
+#define HASH_BITS 12
+
+/** Farthest back a copy can reach, the largest 2-byte distance. */
+#define MAX_DISTANCE 65535
+
+/** Number of bytes at the end of the input that are always literals, so the match search never reads past the end. */
+#define LAST_LITERALS 5
+
+/** Inputs shorter than this are stored as a single run of literals. */
+#define MIN_INPUT (MIN_MATCH + LAST_LITERALS + 3)
+
+/**
+ * Reads 4 bytes from any address.
+ * @param p A pointer to the bytes.
+ * @return The bytes as an integer in native byte order.
+ */
+static uint32_t read32(uint8_t const* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/**
+ * Hashes the 4 bytes at a position to an index in the table of recent positions.
+ * @param seq The 4 bytes.
+ * @return The index.
+ */
+static uint32_t hashSequence(uint32_t seq) {
+    return (seq * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/**
+ * Writes a length that didn't fit in its 4-bit token field as a run of continuation bytes.
+ * @param op The output position.
+ * @param len The part of the length beyond 15.
+ * @return The output position after the continuation bytes.
+ */
+static uint8_t* writeLength(uint8_t* op, size_t len) {
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/**
+ * Writes one sequence: a token, a run of literals and, unless this is the last sequence, a copy.
+ * @param op The output position.
+ * @param oend The end of the output.
+ * @param lit A pointer to the literals.
+ * @param litLen The number of literals.
+ * @param distance The distance back to the copy, or 0 for the last sequence.
+ * @param matchLen The length of the copy.
+ * @return The output position after the sequence, or NULL if it doesn't fit.
+ */
+static uint8_t* writeSequence(uint8_t* op, uint8_t* oend, uint8_t const* lit, size_t litLen, size_t distance,
+                              size_t matchLen) {
+    // Token, literal length bytes, literals, distance and match length bytes.
+    size_t needed = 1 + litLen / 255 + 1 + litLen + (distance ? 2 + matchLen / 255 + 1 : 0);
+    if (needed > (size_t)(oend - op))
+        return NULL;
+
+    uint8_t* token = op++;
+    *token = (uint8_t)((litLen < 15 ? litLen : 15) << 4);
+    if (litLen >= 15)
+        op = writeLength(op, litLen - 15);
+    memcpy(op, lit, litLen);
+    op += litLen;
+    if (!distance)
+        return op;
+
+    *op++ = (uint8_t)distance;
+    *op++ = (uint8_t)(distance >> 8);
+    matchLen -= MIN_MATCH;
+    *token |= matchLen < 15 ? matchLen : 15;
+    if (matchLen >= 15)
+        op = writeLength(op, matchLen - 15);
+    return op;
+}
+
+/**
+ * Compresses a run of bytes.
+ * Positions are looked up by the hash of their next 4 bytes; a hit that really matches is extended as far as it goes.
+ * The scan takes bigger steps the longer it goes without a match, so incompressible input is given up on quickly.
+ * @param src The bytes to compress.
+ * @param len The number of bytes.
+ * @param dst Where the compressed bytes are written.
+ * @param cap The most bytes that may be written.
+ * @return The number of compressed bytes, or 0 if they don't fit in 'cap' bytes.
+ */
+size_t lzCompress(char const* src, size_t len, char* dst, size_t cap) {
+    uint8_t const* base = (uint8_t const*)src;
+    uint8_t const* ip = base;
+    uint8_t const* anchor = base;
+    uint8_t const* end = base + len;
+    uint8_t* op = (uint8_t*)dst;
+    uint8_t* oend = op + cap;
+
+    if (len >= MIN_INPUT) {
+        uint32_t table[1 << HASH_BITS] = { 0 };
+        uint8_t const* limit = end - LAST_LITERALS - MIN_MATCH;
+        ip++;
+        while (ip < limit) {
+            uint32_t seq = read32(ip);
+            uint32_t h = hashSequence(seq);
+            uint8_t const* ref = base + table[h];
+            table[h] = ip - base;
+            if (ref >= ip || ip - ref > MAX_DISTANCE || read32(ref) != seq) {
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            size_t matchLen = MIN_MATCH;
+            while (ip + matchLen < end - LAST_LITERALS && ip[matchLen] == ref[matchLen])
+                matchLen++;
+            if (!(op = writeSequence(op, oend, anchor, ip - anchor, ip - ref, matchLen)))
+                return 0;
+            ip += matchLen;
+            anchor = ip;
+        }
+    }
+
+    if (!(op = writeSequence(op, oend, anchor, end - anchor, 0, 0)))
+        return 0;
+    return op - (uint8_t*)dst;
+}
+
+/**
+ * Reads a length continued past its 4-bit token field.
+ * @param ip A pointer to the input position, advanced past the continuation bytes.
+ * @param iend The end of the input.
+ * @param len The length so far, 15.
+ * @return The whole length, or SIZE_MAX if the input ends first.
+ */
+static size_t readLength(uint8_t const** ip, uint8_t const* iend, size_t len) {
+    uint8_t b;
+    do {
+        if (*ip == iend)
+            return SIZE_MAX;
+        b = *(*ip)++;
+        len += b;
+    } while (b == 255);
+    return len;
+}
+
+/**
+ * Decompresses bytes written by 'lzCompress'.
+ * Every length and distance is checked against the input and output, so corrupt input is rejected rather than
+ * read or written out of bounds.
+ * @param src The compressed bytes.
+ * @param clen The number of compressed bytes.
+ * @param dst Where the original bytes are written.
+ * @param len The number of original bytes.
+ * @return true if exactly 'len' bytes were decompressed, false if the input is corrupt.
+ */
+_Bool lzDecompress(char const* src, size_t clen, char* dst, size_t len) {
+    uint8_t const* ip = (uint8_t const*)src;
+    uint8_t const* iend = ip + clen;
+    uint8_t* op = (uint8_t*)dst;
+    uint8_t* oend = op + len;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        size_t litLen = token >> 4;
+        if (litLen == 15 && (litLen = readLength(&ip, iend, litLen)) == SIZE_MAX)
+            return 0;
+        if (litLen > (size_t)(iend - ip) || litLen > (size_t)(oend - op))
+            return 0;
+        memcpy(op, ip, litLen);
+        ip += litLen;
+        op += litLen;
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return 0;
+        size_t distance = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t matchLen = token & 15;
+        if (matchLen == 15 && (matchLen = readLength(&ip, iend, matchLen)) == SIZE_MAX)
+            return 0;
+        matchLen += MIN_MATCH;
+        if (distance == 0 || distance > (size_t)(op - (uint8_t*)dst) || matchLen > (size_t)(oend - op))
+            return 0;
+
+        uint8_t const* ref = op - distance;
+        if (distance >= matchLen) {
+            memcpy(op, ref, matchLen);
+            op += matchLen;
+        } else {
+            // The copy overlaps its own output, repeating the last 'distance' bytes.
+            while (matchLen--)
+                *op++ = *ref++;
+        }
+    }
+    return op == oend;
+}
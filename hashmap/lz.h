@@ -0,0 +1,12 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+
+/* Compress len bytes of src into at most cap bytes of dst. Returns the compressed size, or 0 if it doesn't fit. */
+size_t lzCompress(char const* src, size_t len, char* dst, size_t cap);
+
+/* Decompress clen bytes of src into exactly len bytes of dst. Returns 0 if the input is corrupt. */
+_Bool lzDecompress(char const* src, size_t clen, char* dst, size_t len);
+
+#endif // LZ_H
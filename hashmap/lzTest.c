@@ -0,0 +1,78 @@
+// Simple test program for the LZ codec and compressed Text values.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lz.h"
+#include "map.h"
+
+// Compresses and decompresses len bytes of src and checks they come back unchanged.
+static size_t roundTrip(char const* src, size_t len) {
+    size_t cap = len + len / 255 + 16;
+    char* packed = (char*)malloc(cap);
+    char* unpacked = (char*)malloc(len + 1);
+    size_t clen = lzCompress(src, len, packed, cap);
+    assert(clen > 0);
+    assert(lzDecompress(packed, clen, unpacked, len));
+    assert(memcmp(src, unpacked, len) == 0);
+
+    // Truncated or damaged input must be rejected, never overrun the output.
+    if (clen > 1)
+        assert(!lzDecompress(packed, clen - 1, unpacked, len) || len == 0);
+    assert(!lzDecompress(packed, clen, unpacked, len + 1));
+
+    free(packed);
+    free(unpacked);
+    return clen;
+}
+
+int main() {
+    static char buffer[200000];
+
+    // Short, empty, random and highly repetitive input all round-trip.
+    assert(roundTrip("", 0) == 1);
+    assert(roundTrip("abc", 3) == 4);
+    for (size_t i = 0; i < sizeof(buffer); i++)
+        buffer[i] = (char)rand();
+    roundTrip(buffer, sizeof(buffer));
+    memset(buffer, 'x', sizeof(buffer));
+    assert(roundTrip(buffer, sizeof(buffer)) < 1000);
+    for (size_t len = 1; len < 100; len++)
+        roundTrip(buffer, len);
+
+    // JSON-like text compresses well.
+    size_t len = 0;
+    for (int i = 0; len < 8000; i++)
+        len += sprintf(buffer + len, "{\"id\":%d,\"name\":\"user%d\",\"active\":true,\"tags\":[\"a\",\"b\"]},", i, i * 7);
+    size_t clen = roundTrip(buffer, len);
+    printf("json: %zu -> %zu bytes\n", len, clen);
+    assert(clen < len / 3);
+
+    // Output that doesn't fit is reported, not written past the end.
+    assert(lzCompress(buffer, len, buffer + 100000, 10) == 0);
+
+    // A Map with compression hands back the original text, stores it smaller and can still update it.
+    Map* map = makeMap(0, NULL);
+    mapEnableCompression(map, 1024);
+    mapSet(map, makeText("blob"), makeTextLen(buffer, len));
+    mapSet(map, makeText("small"), makeText("{\"id\":1}"));
+    VType* v = mapGetText(map, "blob", 4);
+    assert(v && v->type == 'T' && v->length == len && memcmp(v->value.text, buffer, len) == 0);
+    assert(strcmp(mapGetText(map, "small", 5)->value.text, "{\"id\":1}") == 0);
+
+    CompressionStats stats;
+    assert(mapCompressionStats(map, &stats));
+    assert(stats.values == 1 && stats.rawBytes == len && stats.storedBytes < len / 3);
+    assert(stats.compressions == 1 && stats.decompressions == 1);
+
+    // Random text doesn't shrink, so it is stored as it is.
+    for (size_t i = 0; i < 4096; i++)
+        buffer[i] = 'a' + rand() % 26 + (rand() % 2) * ('A' - 'a');
+    mapSet(map, makeText("noise"), makeTextLen(buffer, 4096));
+    assert(mapCompressionStats(map, &stats) && stats.values == 1);
+
+    mapFree(map);
+    return EXIT_SUCCESS;
+}
@@ -1,9 +1,57 @@
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #include "map.h"
+#include "input.h"
+#include "probes.h"
+#include "siphash.h"
 
+/** Semaphores of the static tracepoints, when they are compiled in. */
+PROBE_SEMAPHORES
+
+/** Smallest number of buckets in a table; the bucket count is always a power of two. */
 #define TABLE_SIZE 1024
 
+/** Smallest size of a block slab; slabs are also at least one page of the Map's allocator. */
+#define SLAB_BYTES (64 * 1024)
+
+/** Number of pairs a bucket block holds. */
+#define BLOCK_SLOTS 3
+
+/** Average number of keys per bucket above which the table doubles. */
+#define MAX_LOAD 2
+
+/** The table shrinks once it has more than this many buckets per key. */
+#define SHRINK_LOAD 4
+
+/** Number of buckets from which the bucket index supplies every hash bit the tags leave out. */
+#define FULL_HASH_BUCKETS (1 << 16)
+
+/** Largest number of threads a bulk load uses. */
+#define MAX_LOAD_THREADS 64
+
+/** Smallest number of keys a Bloom filter is sized for. */
+#define FILTER_MIN_KEYS 1024
+
+/** Longest chain, or fullest cuckoo stash, a Map accepts before it switches to its keyed hash. */
+#define CHAIN_LIMIT 32
+
+/** Number of buckets moved to the new table by each operation while a Map rehashes. */
+#define REHASH_STEP 16
+
+/** Length of a hot-key tracker's decay window, after which its counts are halved. */
+#define HOT_WINDOW_MILLIS 1000
+
 /** 
  * @file map.c
  * @author Jason Wang
@@ -11,51 +59,927 @@
  */
 
 /**
- * Node struct for creating linked list elements to store key-value pairs.
- * Each node contains pointers to the key and value (VType objects) and a pointer to the next node in the linked list.
+ * Block struct holding up to three key-value pairs of one bucket in a single 64-byte cache line.
+ * Each pair has a tag, the top 16 bits of its key's hash, so a lookup compares all the tags in the line at once and
+ * only calls 'equalsVType' for a matching one. The bucket array is itself an array of blocks; a bucket holding more
+ * pairs links overflow blocks from the Map's pool. Pairs are packed from the front: every block of a chain but the
+ * last is full, and only the block in the bucket array may be empty.
  */
-typedef struct NodeStruct {
-    VType* key;
-    VType* value;
-    struct NodeStruct* next;
-} Node;
+typedef struct BlockStruct {
+    struct BlockStruct* next;
+    uint16_t tags[BLOCK_SLOTS];
+    uint16_t count;
+    VType* keys[BLOCK_SLOTS];
+    VType* values[BLOCK_SLOTS];
+} __attribute__((aligned(64))) Block;
+
+/**
+ * Header at the start of every slab of blocks; it takes a whole block so the blocks after it stay line-aligned.
+ */
+typedef struct SlabStruct {
+    struct SlabStruct* next;
+    size_t bytes;
+} __attribute__((aligned(64))) Slab;
+
+/**
+ * Pool overflow blocks are carved from. Blocks come from large slabs obtained from the Map's allocator,
+ * so they sit close together (on huge pages, if the allocator provides them) and are never returned one at a time;
+ * emptied blocks go on a free list for reuse.
+ */
+typedef struct {
+    Block* freeList;
+    char* bump;
+    char* bumpEnd;
+    Slab* slabs;
+} BlockPool;
 
 /**
  * MapStruct for creating a hashmap data structure.
- * The MapStruct contains an array of Node pointers (table) to store key-value pairs in a hash table format.
- * It also keeps track of the number of key-value pairs stored (size).
+ * The MapStruct contains an array of bucket blocks (table) to store key-value pairs in a hash table format.
+ * It also keeps track of the number of key-value pairs stored (size) and the number of buckets (capacity).
+ * The table doubles whenever there are more than MAX_LOAD keys per bucket, so nearly every bucket fits in its block.
+ * A Map using the cuckoo backend keeps its pairs in a cuckoo table instead and has no bucket array.
  */
 struct MapStruct {
-    Node* table[TABLE_SIZE];
+    Block* table;
+    size_t capacity;
     size_t size;
+
+    /** Cuckoo table holding the pairs instead of the bucket array, or NULL for chained buckets. */
+    Cuckoo* cuckoo;
+
+    /** Allocator the bucket array and block slabs come from. */
+    MapAllocator const* allocator;
+    /** Pool the overflow blocks come from. */
+    BlockPool pool;
+
+    /** Optional Bloom filter checked before probing the table, or NULL. */
+    Bloom* filter;
+    /** Target false-positive rate and memory cap the filter was enabled with. */
+    double filterFpr;
+    size_t filterMaxBytes;
+    /** Number of keys the current filter was sized for, and whether the memory cap kept it smaller than that. */
+    size_t filterCapacity;
+    _Bool filterCapped;
+    /** Number of keys removed since the filter was last rebuilt; their bits are still set. */
+    size_t filterStale;
+    /** Number of lookups checked against the filter and how many it rejected. */
+    size_t filterLookups;
+    size_t filterRejected;
+
+    /** Length from which Text values are stored compressed, or 0 to store them as they are. */
+    size_t compressThreshold;
+    /** Number of values compressed and decompressed, and the time spent doing it. */
+    size_t compressions;
+    uint64_t compressNanos;
+    size_t decompressions;
+    uint64_t decompressNanos;
+
+    /** Optional radix tree over the keys for prefix scans, or NULL. */
+    Art* index;
+    /** Optional B+-tree over the Integer keys for range queries, or NULL. */
+    BTree* ordered;
+    /** Optional tracker of the most frequent keys, fed a sample of lookups and updates, or NULL. */
+    HotKeys* hot;
+
+    /** Whether keys are hashed with SipHash under 'sipKey' instead of the seeded djb2 of 'hashVType'. */
+    _Bool keyed;
+    uint64_t sipKey[2];
+    /** Longest chain (or cuckoo stash) allowed before switching to the keyed hash, 0 to never switch. */
+    size_t chainLimit;
+    /** Longest chain or stash seen, and how many times the Map has switched hashes. */
+    size_t longestChain;
+    size_t rekeys;
+    /** While switching hashes or shrinking, the table whose pairs are still to be moved, whether they were stored
+        under the keyed hash, and the next of its buckets to move. */
+    Block* oldTable;
+    size_t oldCapacity;
+    _Bool oldKeyed;
+    size_t rehashIndex;
+    /** Number of times the table shrank on its own after keys were removed, and was compacted. */
+    size_t shrinks;
+    size_t compactions;
 };
 
 /**
- * Hashes the given VType key to calculate the index in the hashmap's table.
- * The hashing is performed using the 'hashVType' function on the key and then taking the modulo TABLE_SIZE.
+ * Maps the hash of a key to the index in the hashmap's table.
+ * The hash of the key is computed once with 'hashVType' and shared by the filter and the table probe.
  * @param this A pointer to the Map structure (hashmap).
- * @param key A pointer to the VType object representing the key to be hashed.
+ * @param h The hash of the key.
  * @return The index in the hashmap's table where the key-value pair will be stored.
  */
-static unsigned int hash(Map* this, VType* key) {
-    return hashVType(key) % TABLE_SIZE;
+static unsigned int bucketIndex(Map* this, unsigned int h) {
+    return h & (this->capacity - 1);
+}
+
+/**
+ * Hashes a key the way the Map currently hashes its keys.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param key A pointer to the VType object representing the key.
+ * @return The hash of the key.
+ */
+static unsigned int keyHash(Map* this, VType const* key) {
+    return this->keyed ? keyedHashVType(key, this->sipKey) : hashVType(key);
+}
+
+/**
+ * Hashes a key the way the pairs of the old table were hashed, while the Map moves them to a new table.
+ * A shrinking Map keeps its hash, so the key's current hash is reused; a switch always starts from seeded djb2.
+ * @param this A pointer to the Map structure (hashmap), which must have an old table.
+ * @param key A pointer to the VType object representing the key.
+ * @param h The hash of the key under the Map's current hash.
+ * @return The hash the key has in the old table.
+ */
+static unsigned int oldHash(Map* this, VType const* key, unsigned int h) {
+    return this->oldKeyed == this->keyed ? h : hashVType(key);
+}
+
+/**
+ * Takes an overflow block from a pool, carving a new slab from the Map's allocator when the pool is empty.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param pool A pointer to the pool.
+ * @return A pointer to the empty, unlinked block, or NULL on memory allocation failure.
+ */
+static Block* allocBlock(Map* this, BlockPool* pool) {
+    Block* block = pool->freeList;
+    if (block) {
+        pool->freeList = block->next;
+    } else {
+        if (pool->bump == pool->bumpEnd) {
+            size_t bytes = this->allocator->pageSize > SLAB_BYTES ? this->allocator->pageSize : SLAB_BYTES;
+            Slab* slab = (Slab*)this->allocator->allocLarge(this->allocator->ctx, bytes);
+            if (!slab) {
+                PROBE2(alloc_failure, this, bytes);
+                return NULL;
+            }
+            slab->next = pool->slabs;
+            slab->bytes = bytes;
+            pool->slabs = slab;
+            pool->bump = (char*)(slab + 1);
+            pool->bumpEnd = pool->bump + (bytes - sizeof(Slab)) / sizeof(Block) * sizeof(Block);
+        }
+        block = (Block*)pool->bump;
+        pool->bump += sizeof(Block);
+    }
+    block->next = NULL;
+    block->count = 0;
+    return block;
+}
+
+/**
+ * Returns an overflow block to a pool's free list.
+ * @param pool A pointer to the pool.
+ * @param block A pointer to the block.
+ */
+static void freeBlock(BlockPool* pool, Block* block) {
+    block->next = pool->freeList;
+    pool->freeList = block;
+}
+
+/**
+ * Moves every slab and free block of one pool into another.
+ * Blocks not yet carved from the source's current slab go on the destination's free list.
+ * @param to A pointer to the pool receiving the blocks.
+ * @param from A pointer to the pool being emptied.
+ */
+static void mergePool(BlockPool* to, BlockPool* from) {
+    for (; from->bump < from->bumpEnd; from->bump += sizeof(Block))
+        freeBlock(to, (Block*)from->bump);
+    while (from->freeList) {
+        Block* block = from->freeList;
+        from->freeList = block->next;
+        freeBlock(to, block);
+    }
+    while (from->slabs) {
+        Slab* slab = from->slabs;
+        from->slabs = slab->next;
+        slab->next = to->slabs;
+        to->slabs = slab;
+    }
+}
+
+/**
+ * Returns every slab of a pool to the Map's allocator, along with all the blocks carved from them, and empties the pool.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param pool A pointer to the pool.
+ */
+static void freeSlabs(Map* this, BlockPool* pool) {
+    while (pool->slabs) {
+        Slab* slab = pool->slabs;
+        pool->slabs = slab->next;
+        this->allocator->freeLarge(this->allocator->ctx, slab, slab->bytes);
+    }
+    *pool = (BlockPool){ NULL, NULL, NULL, NULL };
+}
+
+/**
+ * Allocates a zero-filled bucket array, one empty block per bucket, from the Map's allocator.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param capacity The number of buckets.
+ * @return A pointer to the bucket array, or NULL on memory allocation failure.
+ */
+static Block* allocTable(Map* this, size_t capacity) {
+    Block* table = (Block*)this->allocator->allocLarge(this->allocator->ctx, capacity * sizeof(Block));
+    if (!table)
+        PROBE2(alloc_failure, this, capacity * sizeof(Block));
+    return table;
+}
+
+/**
+ * Returns a bucket array to the Map's allocator.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param table A pointer to the bucket array.
+ * @param capacity The number of buckets it was allocated with.
+ */
+static void freeTable(Map* this, Block* table, size_t capacity) {
+    this->allocator->freeLarge(this->allocator->ctx, table, capacity * sizeof(Block));
+}
+
+/**
+ * Rounds a number of keys up to the power-of-two bucket count that holds them at the maximum load.
+ * @param count The number of keys.
+ * @return The bucket count, at least TABLE_SIZE.
+ */
+static size_t capacityFor(size_t count) {
+    size_t capacity = TABLE_SIZE;
+    while (capacity * MAX_LOAD < count)
+        capacity *= 2;
+    return capacity;
+}
+
+/**
+ * Takes the tag stored with a pair from the hash of its key.
+ * @param h The hash of the key.
+ * @return The top 16 bits of the hash.
+ */
+static uint16_t hashTag(unsigned int h) {
+    return (uint16_t)(h >> 16);
+}
+
+/**
+ * Finds a key in the chain of blocks of one bucket.
+ * Each block's tags are compared with the key's tag all at once into a bit mask, and only the pairs whose tag
+ * matches have their keys compared, so a miss usually reads the bucket's line and no key at all.
+ * @param bucket A pointer to the bucket's block in the bucket array.
+ * @param key A pointer to the VType object representing the key.
+ * @param h The hash the key was stored with.
+ * @param slot Where the key's position in the block is stored.
+ * @return A pointer to the block holding the key, or NULL if the key is not in the bucket.
+ */
+static Block* findInBucket(Block* bucket, VType const* key, unsigned int h, int* slot) {
+    uint16_t tag = hashTag(h);
+    for (Block* block = bucket; block; block = block->next) {
+        unsigned int match = (block->tags[0] == tag) | (block->tags[1] == tag) << 1 | (block->tags[2] == tag) << 2;
+        match &= (1u << block->count) - 1;
+        while (match) {
+            int i = __builtin_ctz(match);
+            if (equalsVType(block->keys[i], key)) {
+                *slot = i;
+                return block;
+            }
+            match &= match - 1;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Appends a pair to the chain of one bucket, linking an overflow block from a pool when the last block is full.
+ * The caller has already checked that the key isn't in the bucket.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param pool A pointer to the pool overflow blocks come from.
+ * @param bucket A pointer to the bucket's block in the bucket array.
+ * @param tag The tag of the key's hash.
+ * @param key A pointer to the VType object representing the key.
+ * @param value A pointer to the VType object representing the value.
+ * @return The number of pairs in the bucket afterwards, or 0 on memory allocation failure.
+ */
+static size_t appendPair(Map* this, BlockPool* pool, Block* bucket, uint16_t tag, VType* key, VType* value) {
+    size_t chain = 1;
+    Block* block = bucket;
+    while (block->count == BLOCK_SLOTS) {
+        chain += BLOCK_SLOTS;
+        if (!block->next && !(block->next = allocBlock(this, pool)))
+            return 0;
+        block = block->next;
+    }
+
+    int i = block->count++;
+    block->tags[i] = tag;
+    block->keys[i] = key;
+    block->values[i] = value;
+    return chain + i;
+}
+
+/**
+ * Finds the last block of a bucket's chain, which holds the bucket's last pair.
+ * @param bucket A pointer to the bucket's block in the bucket array.
+ * @param prev Where the block linking to the last one is stored, or NULL if the bucket has no overflow block.
+ * @return A pointer to the last block.
+ */
+static Block* lastBlock(Block* bucket, Block** prev) {
+    *prev = NULL;
+    Block* block = bucket;
+    while (block->next) {
+        *prev = block;
+        block = block->next;
+    }
+    return block;
+}
+
+/**
+ * Drops the last pair of a bucket, returning its overflow block to the Map's pool if that leaves the block empty.
+ * The caller reads the pair first.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param bucket A pointer to the bucket's block in the bucket array, which must not be empty.
+ */
+static void dropLastPair(Map* this, Block* bucket) {
+    Block* prev;
+    Block* block = lastBlock(bucket, &prev);
+    if (--block->count == 0 && prev) {
+        prev->next = NULL;
+        freeBlock(&this->pool, block);
+    }
+}
+
+/**
+ * Recovers the full hash of a pair in the Map's current table from its tag and its bucket.
+ * Once there are at least FULL_HASH_BUCKETS buckets the bucket index holds every bit below the tag; smaller tables
+ * are cheap enough to rehash the key.
+ * @param this A pointer to the Map structure (hashmap), which must not be switching hashes.
+ * @param index The index of the pair's bucket.
+ * @param tag The pair's tag.
+ * @param key A pointer to the pair's key.
+ * @return The hash of the key.
+ */
+static unsigned int storedHash(Map* this, size_t index, uint16_t tag, VType const* key) {
+    if (this->capacity >= FULL_HASH_BUCKETS)
+        return (unsigned int)tag << 16 | (unsigned int)(index & (FULL_HASH_BUCKETS - 1));
+    return keyHash(this, key);
+}
+
+/**
+ * Returns every overflow block of a bucket array to the Map's pool, leaving the pairs in the array's own blocks.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param table A pointer to the bucket array.
+ * @param capacity The number of buckets.
+ */
+static void freeOverflow(Map* this, Block* table, size_t capacity) {
+    for (size_t i = 0; i < capacity; i++) {
+        Block* block = table[i].next;
+        while (block) {
+            Block* next = block->next;
+            freeBlock(&this->pool, block);
+            block = next;
+        }
+        table[i].next = NULL;
+    }
+}
+
+/**
+ * Moves every pair into a new table with the given number of buckets.
+ * A pair keeps its tag, and its full hash comes from 'storedHash', so no key is copied. The pairs are linked into the
+ * new table before any block of the old one is freed, so if an overflow block can't be allocated the new table is
+ * dropped and the Map keeps its current one whole; overflow blocks are rare at MAX_LOAD, so holding both sets for the
+ * length of the move costs little. A Map still switching hashes keeps its size, and if the new table can't be
+ * allocated the Map keeps its current one.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param capacity The new number of buckets, a power of two larger than the current one.
+ */
+static void resize(Map* this, size_t capacity) {
+    if (this->oldTable)
+        return;
+    Block* table = allocTable(this, capacity);
+    if (!table)
+        return;
+
+    for (size_t i = 0; i < this->capacity; i++) {
+        for (Block* block = &this->table[i]; block; block = block->next) {
+            for (int j = 0; j < block->count; j++) {
+                unsigned int h = storedHash(this, i, block->tags[j], block->keys[j]);
+                if (!appendPair(this, &this->pool, &table[h & (capacity - 1)], block->tags[j], block->keys[j],
+                                block->values[j])) {
+                    freeOverflow(this, table, capacity);
+                    freeTable(this, table, capacity);
+                    return;
+                }
+            }
+        }
+    }
+
+    PROBE3(resize, this, this->capacity, capacity);
+    freeOverflow(this, this->table, this->capacity);
+    freeTable(this, this->table, this->capacity);
+    this->table = table;
+    this->capacity = capacity;
+}
+
+/**
+ * Checks the Map's Bloom filter, if it has one, before the table is probed for a key.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param h The hash of the key.
+ * @return true if the key is definitely absent, false if the table has to be probed.
+ */
+static _Bool filterRejects(Map* this, unsigned int h) {
+    if (!this->filter)
+        return 0;
+
+    this->filterLookups++;
+    if (bloomMayContain(this->filter, h))
+        return 0;
+    this->filterRejected++;
+    return 1;
+}
+
+/**
+ * Adds the hash of one key of a cuckoo table to a Bloom filter, as a cuckooForEach callback.
+ * @param key Unused.
+ * @param value Unused.
+ * @param hash The hash of the key.
+ * @param ctx A pointer to the Bloom filter.
+ * @return true, to visit every key.
+ */
+static _Bool addToFilter(VType* key, VType* value, unsigned int hash, void* ctx) {
+    bloomAdd((Bloom*)ctx, hash);
+    return 1;
+}
+
+/**
+ * Replaces the Map's Bloom filter with a fresh one holding only the keys currently stored.
+ * The new filter is sized for twice the current number of keys so it can absorb growth before the next rebuild;
+ * once the memory cap keeps it smaller than that, growth no longer rebuilds it.
+ * If the new filter can't be allocated, or the Map is still switching hashes, the Map keeps working without one.
+ * @param this A pointer to the Map structure (hashmap).
+ */
+static void rebuildFilter(Map* this) {
+    bloomFree(this->filter);
+    this->filter = NULL;
+    this->filterStale = 0;
+    if (this->oldTable)
+        return;
+    this->filterCapacity = this->size * 2 < FILTER_MIN_KEYS ? FILTER_MIN_KEYS : this->size * 2;
+    if (!(this->filter = makeBloom(this->filterCapacity, this->filterFpr, this->filterMaxBytes)))
+        return;
+    BloomStats stats;
+    bloomStats(this->filter, 0, &stats);
+    this->filterCapped = stats.capped;
+
+    if (this->cuckoo)
+        cuckooForEach(this->cuckoo, addToFilter, this->filter);
+    for (size_t i = 0; i < this->capacity; i++) {
+        for (Block* block = &this->table[i]; block; block = block->next) {
+            for (int j = 0; j < block->count; j++)
+                bloomAdd(this->filter, storedHash(this, i, block->tags[j], block->keys[j]));
+        }
+    }
+}
+
+/**
+ * Moves the pairs of up to 'steps' buckets of the old table into the new one.
+ * When switching hashes each key is rehashed with the keyed hash; when shrinking a key keeps its hash and tag, and
+ * since the new bucket count divides the old one, a whole old bucket lands in the new bucket its index maps to.
+ * Pairs are moved from the end of a bucket, so the old bucket stays packed and a pair is only dropped from it once it
+ * is in the new table. Empty buckets are cheap, so up to ten times as many of them may be skipped. Once the old table
+ * is empty it is freed and the Bloom filter, if it was dropped while keys had mixed hashes, is rebuilt.
+ * @param this A pointer to the Map structure (hashmap), which must have an old table.
+ * @param steps The number of non-empty buckets to move.
+ * @return true if the step made progress, false if an overflow block couldn't be allocated.
+ */
+static _Bool rehashStep(Map* this, size_t steps) {
+    size_t empty = steps * 10;
+    while (steps && this->rehashIndex < this->oldCapacity) {
+        Block* bucket = &this->oldTable[this->rehashIndex];
+        if (!bucket->count && empty) {
+            this->rehashIndex++;
+            empty--;
+            continue;
+        }
+        if (!bucket->count)
+            break;
+        while (bucket->count) {
+            Block* prev;
+            Block* block = lastBlock(bucket, &prev);
+            int last = block->count - 1;
+            uint16_t tag = block->tags[last];
+            Block* to = &this->table[this->rehashIndex & (this->capacity - 1)];
+            if (this->oldKeyed != this->keyed) {
+                unsigned int h = keyHash(this, block->keys[last]);
+                tag = hashTag(h);
+                to = &this->table[bucketIndex(this, h)];
+            }
+            if (!appendPair(this, &this->pool, to, tag, block->keys[last], block->values[last]))
+                return 0;
+            dropLastPair(this, bucket);
+        }
+        this->rehashIndex++;
+        steps--;
+    }
+
+    PROBE3(rehash_step, this, this->rehashIndex, this->oldCapacity);
+    if (this->rehashIndex == this->oldCapacity) {
+        freeTable(this, this->oldTable, this->oldCapacity);
+        this->oldTable = NULL;
+        if (this->filterFpr > 0 && !this->filter)
+            rebuildFilter(this);
+    }
+    return 1;
+}
+
+/**
+ * Moves every pair still in the old table, so the rest of the Map only has one table to deal with.
+ * Only running out of memory can leave pairs behind; they stay in the old table, where lookups still find them.
+ * @param this A pointer to the Map structure (hashmap).
+ */
+static void finishRehash(Map* this) {
+    while (this->oldTable && rehashStep(this, this->oldCapacity))
+        ;
+}
+
+/**
+ * Adds one pair of a cuckoo table to another under the Map's keyed hash, as a cuckooForEach callback.
+ * @param key A pointer to the key.
+ * @param value A pointer to the value.
+ * @param hash Unused.
+ * @param ctx A pointer to the Map structure (hashmap), whose 'cuckoo' is the new table.
+ * @return true to go on, false once a pair couldn't be added.
+ */
+static _Bool rekeyPair(VType* key, VType* value, unsigned int hash, void* ctx) {
+    Map* map = (Map*)ctx;
+    return cuckooInsert(map->cuckoo, key, value, keyHash(map, key));
+}
+
+/**
+ * Switches the Map to SipHash under a fresh random key, because a chain or the cuckoo stash grew past the limit,
+ * which seeded djb2 should practically never allow unless the keys were chosen to collide.
+ * Chained buckets move to a new table a few buckets per operation, so no single operation pays for the whole table;
+ * until they are all moved, lookups check both tables. A shrink still under way is finished first. A cuckoo table
+ * can't be split that way, so it is rebuilt at once, and dropped again if it can't take every pair.
+ * If the new table can't be allocated or filled, the Map keeps its current table and hash.
+ * @param this A pointer to the Map structure (hashmap).
+ */
+static void startRehash(Map* this) {
+    uint64_t sipKey[2];
+    randomHashKey(sipKey);
+
+    if (this->cuckoo) {
+        CuckooStats stats;
+        cuckooStats(this->cuckoo, &stats);
+        Cuckoo* old = this->cuckoo;
+        if (!(this->cuckoo = makeCuckoo(stats.keys, this->allocator))) {
+            this->cuckoo = old;
+            return;
+        }
+        _Bool oldKeyed = this->keyed;
+        uint64_t oldSipKey[2];
+        memcpy(oldSipKey, this->sipKey, sizeof(oldSipKey));
+        this->keyed = 1;
+        memcpy(this->sipKey, sipKey, sizeof(sipKey));
+        cuckooForEach(old, rekeyPair, this);
+        size_t moved = stats.keys;
+        cuckooStats(this->cuckoo, &stats);
+        if (stats.keys != moved) {
+            cuckooFree(this->cuckoo);
+            this->cuckoo = old;
+            this->keyed = oldKeyed;
+            memcpy(this->sipKey, oldSipKey, sizeof(oldSipKey));
+            return;
+        }
+        cuckooFree(old);
+        this->rekeys++;
+        if (this->filter)
+            rebuildFilter(this);
+        return;
+    }
+
+    // A shrink under way moves its pairs under the current hash first.
+    finishRehash(this);
+    Block* table = this->oldTable ? NULL : allocTable(this, this->capacity);
+    if (!table)
+        return;
+    this->oldKeyed = this->keyed;
+    this->keyed = 1;
+    memcpy(this->sipKey, sipKey, sizeof(sipKey));
+    PROBE3(resize, this, this->capacity, this->capacity);
+    this->oldTable = this->table;
+    this->oldCapacity = this->capacity;
+    this->rehashIndex = 0;
+    this->table = table;
+    this->rekeys++;
+
+    // The filter holds the old hashes; lookups go without it until every key has its new hash.
+    bloomFree(this->filter);
+    this->filter = NULL;
+}
+
+/**
+ * Starts moving the pairs into a smaller table once removals have left more than SHRINK_LOAD buckets per key.
+ * The new table holds the remaining keys at no more than one per bucket, so they have to double before it grows back.
+ * Like a switch of hashes, the move is spread over the following operations and lookups check both tables meanwhile;
+ * keys keep their hash, so the Bloom filter stays valid throughout. If the new table can't be allocated, the Map keeps
+ * its current one.
+ * @param this A pointer to the Map structure (hashmap), which must use chained buckets and have no old table.
+ */
+static void startShrink(Map* this) {
+    size_t capacity = capacityFor(this->size * MAX_LOAD);
+    if (capacity >= this->capacity)
+        return;
+    Block* table = allocTable(this, capacity);
+    if (!table)
+        return;
+    this->oldTable = this->table;
+    this->oldCapacity = this->capacity;
+    this->oldKeyed = this->keyed;
+    this->rehashIndex = 0;
+    this->table = table;
+    this->capacity = capacity;
+    this->shrinks++;
+    PROBE3(resize, this, this->oldCapacity, capacity);
+}
+
+/**
+ * Adds one pair of a cuckoo table to another under the same hash, as a cuckooForEach callback.
+ * @param key A pointer to the key.
+ * @param value A pointer to the value.
+ * @param hash The hash of the key.
+ * @param ctx A pointer to the new cuckoo table.
+ * @return true to go on, false once a pair couldn't be added.
+ */
+static _Bool movePair(VType* key, VType* value, unsigned int hash, void* ctx) {
+    return cuckooInsert((Cuckoo*)ctx, key, value, hash);
+}
+
+/**
+ * Moves the pairs of the Map's cuckoo table into a new one sized for the keys it holds now. The objects are only
+ * linked into the new table, so if it can't take them all it is dropped and the Map keeps the current one.
+ * Unlike a chained shrink, the move is done at once, as a cuckoo table can't be looked up across two tables.
+ * @param this A pointer to the Map structure (hashmap), which must use the cuckoo backend.
+ * @return true if the pairs were moved, false on memory allocation failure, which leaves the Map as it was.
+ */
+static _Bool rebuildCuckoo(Map* this) {
+    Cuckoo* cuckoo = makeCuckoo(this->size, this->allocator);
+    if (!cuckoo)
+        return 0;
+    cuckooForEach(this->cuckoo, movePair, cuckoo);
+    CuckooStats stats;
+    cuckooStats(cuckoo, &stats);
+    if (stats.keys != this->size) {
+        cuckooFree(cuckoo);
+        return 0;
+    }
+    cuckooFree(this->cuckoo);
+    this->cuckoo = cuckoo;
+    return 1;
+}
+
+/**
+ * Records the length of a chain just added to, or of the cuckoo stash, and switches to the keyed hash if it is too long.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param length The length of the chain or stash.
+ */
+static void checkChain(Map* this, size_t length) {
+    if (length > this->longestChain)
+        this->longestChain = length;
+    if (this->chainLimit && length > this->chainLimit && !this->keyed)
+        startRehash(this);
+}
+
+/**
+ * Finds the slot holding the value of a key, in whichever backend the Map uses.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param key A pointer to the VType object representing the key.
+ * @param h The hash of the key.
+ * @return A pointer to the slot holding the key's value, which may be updated in place, or NULL if the key is not found.
+ */
+static VType** findSlot(Map* this, VType const* key, unsigned int h) {
+    if (this->cuckoo)
+        return cuckooFind(this->cuckoo, key, h);
+
+    int i;
+    Block* block = findInBucket(&this->table[bucketIndex(this, h)], key, h, &i);
+    if (block)
+        return &block->values[i];
+
+    // While switching hashes or shrinking, a key not moved yet is in the old table under its old hash.
+    if (this->oldTable) {
+        unsigned int old = oldHash(this, key, h);
+        if ((block = findInBucket(&this->oldTable[old & (this->oldCapacity - 1)], key, old, &i)))
+            return &block->values[i];
+    }
+    return NULL;
+}
+
+#ifdef HASHMAP_USDT
+/**
+ * Measures how much of the table a lookup had to search, for the lookup_end tracepoint: the pairs in the key's
+ * chain, and in its old chain while the Map moves to a new table, or with the cuckoo backend the keys in the stash.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param key A pointer to the VType object representing the key.
+ * @param h The hash of the key.
+ * @return The number of pairs.
+ */
+static size_t probeLength(Map* this, VType const* key, unsigned int h) {
+    if (this->cuckoo) {
+        CuckooStats stats;
+        cuckooStats(this->cuckoo, &stats);
+        return stats.stashed;
+    }
+    size_t pairs = 0;
+    for (Block* block = &this->table[bucketIndex(this, h)]; block; block = block->next)
+        pairs += block->count;
+    if (this->oldTable) {
+        unsigned int old = oldHash(this, key, h);
+        for (Block* block = &this->oldTable[old & (this->oldCapacity - 1)]; block; block = block->next)
+            pairs += block->count;
+    }
+    return pairs;
+}
+#endif
+
+/**
+ * Reads a clock for timing compression and decompression.
+ * @return The time in nanoseconds since an arbitrary point.
+ */
+static uint64_t nowNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Compresses a Text value in place if the Map compresses values and the value is long enough.
+ * The counters are passed in so bulk load threads can keep their own and add them up afterwards.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param value A pointer to the VType object representing the value.
+ * @param count The number of values compressed so far, incremented for this one.
+ * @param nanos The time spent compressing so far, increased by the time spent on this one.
+ */
+static void compressValue(Map* this, VType* value, size_t* count, uint64_t* nanos) {
+    if (!this->compressThreshold || !value || value->type != 'T' || value->length < this->compressThreshold)
+        return;
+
+    uint64_t start = nowNanos();
+    compressText(value);
+    *nanos += nowNanos() - start;
+    (*count)++;
+}
+
+/** Buffer each thread decompresses values into, and its size. */
+static __thread char* inflateBuffer = NULL;
+static __thread size_t inflateSize = 0;
+
+/** Plain Text view of the value last decompressed by each thread. */
+static __thread VType inflated;
+
+/**
+ * Returns a value as callers see it: a compressed Text value is decompressed into the calling thread's buffer
+ * and returned as a plain Text view of it, anything else is returned as it is.
+ * The buffer only grows, so after the first few lookups decompressing allocates nothing.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param value A pointer to the VType object representing the stored value, or NULL.
+ * @return A pointer to the value or its view, valid until the thread's next lookup; NULL on memory allocation failure.
+ */
+static VType* viewValue(Map* this, VType* value) {
+    if (!value || value->type != 'Z')
+        return value;
+
+    size_t needed = (size_t)value->length + 1;
+    if (needed > inflateSize) {
+        size_t size = inflateSize ? inflateSize * 2 : 4096;
+        while (size < needed)
+            size *= 2;
+        char* buffer = (char*)realloc(inflateBuffer, size);
+        if (!buffer)
+            return NULL;
+        inflateBuffer = buffer;
+        inflateSize = size;
+    }
+
+    uint64_t start = nowNanos();
+    if (!inflateText(value, inflateBuffer))
+        return NULL;
+    this->decompressNanos += nowNanos() - start;
+    this->decompressions++;
+    inflated = (VType){ 'T', value->length, { .text = inflateBuffer }, 0 };
+    return &inflated;
+}
+
+/**
+ * Stores a new key-value pair, growing the table and updating the filter as needed.
+ * With chained buckets the pair goes in the first free slot of its bucket's blocks; with the cuckoo backend it goes in
+ * the cuckoo table.
+ * The caller has already checked that the key isn't in the Map.
+ * A chain (or cuckoo stash) that ends up longer than the Map's chain limit switches the Map to its keyed hash.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param h The hash of the key.
+ * @param key A pointer to the VType object representing the key.
+ * @param value A pointer to the VType object representing the value associated with the key.
+ * @return true if the pair was stored, false on memory allocation failure.
+ */
+static _Bool insertNew(Map* this, unsigned int h, VType* key, VType* value) {
+    size_t chain = 0;
+    if (this->cuckoo) {
+        if (!cuckooInsert(this->cuckoo, key, value, h))
+            return 0;
+        this->size++;
+        CuckooStats stats;
+        cuckooStats(this->cuckoo, &stats);
+        chain = stats.stashed;
+    } else {
+        chain = appendPair(this, &this->pool, &this->table[bucketIndex(this, h)], hashTag(h), key, value);
+        if (!chain)
+            return 0;
+        this->size++;
+        if (this->size > this->capacity * MAX_LOAD) {
+            finishRehash(this);
+            resize(this, this->capacity * 2);
+        }
+    }
+
+    if (this->index)
+        artInsert(this->index, key);
+    if (this->ordered && key->type == 'I')
+        btreeInsert(this->ordered, key->value.integer);
+    if (this->filter) {
+        if (this->size > this->filterCapacity && !this->filterCapped)
+            rebuildFilter(this);
+        else
+            bloomAdd(this->filter, h);
+    }
+    PROBE3(insert, this, h, chain);
+    checkChain(this, chain);
+    return 1;
 }
 
 /**
- * Creates a new Map (hashmap) on the heap and initializes its fields.
- * The Map is represented by an array of NULL pointers (table) to store key-value pairs in a hash table format.
- * The initial size of the Map is specified by the 'len' parameter.
+ * Creates a new Map (hashmap) with chained buckets on the heap and initializes its fields.
+ * The Map is represented by an array of empty bucket blocks (table) to store key-value pairs in a hash table format.
+ * The initial number of buckets is enough for 'len' keys, rounded up to a power of two of at least TABLE_SIZE.
+ * The bucket array and the slabs overflow blocks are carved from come from the given allocator, which lets them
+ * live on huge pages.
  * The returned Map pointer can be used to interact with the Map.
  * Memory allocated for the Map should be freed by the caller when no longer needed.
- * @param len The initial size of the Map (number of buckets in the hashmap).
+ * @param len The number of keys expected; the Map grows past it as needed.
+ * @param allocator The allocator for the bucket array and block slabs, or NULL for malloc.
  * @return A pointer to the Map structure, representing the created hashmap, or NULL on memory allocation failure.
  */
-Map* makeMap(int len) {
+Map* makeMap(int len, MapAllocator const* allocator) {
+    return makeMapBackend(len, MAP_CHAINED, allocator);
+}
+
+/**
+ * Creates a new Map (hashmap) with the given backend on the heap and initializes its fields.
+ * With MAP_CHAINED this is the same as 'makeMap'. With MAP_CUCKOO the pairs live in a bucketized cuckoo table
+ * sized for 'len' keys, so every lookup checks at most two cache lines however the keys collide.
+ * @param len The number of keys expected; the Map grows past it as needed.
+ * @param backend The way the Map stores its keys.
+ * @param allocator The allocator for the buckets and block slabs, or NULL for malloc.
+ * @return A pointer to the Map structure, representing the created hashmap, or NULL on memory allocation failure.
+ */
+Map* makeMapBackend(int len, MapBackend backend, MapAllocator const* allocator) {
     Map* map = (Map*)malloc(sizeof(Map));
     if (map) {
-        for (int i = 0; i < TABLE_SIZE; i++)
-            map->table[i] = NULL;
-        map->size = len;
+        map->allocator = allocator ? allocator : &mallocAllocator;
+        map->pool = (BlockPool){ NULL, NULL, NULL, NULL };
+        map->cuckoo = NULL;
+        map->table = NULL;
+        map->capacity = 0;
+        if (backend == MAP_CUCKOO)
+            map->cuckoo = makeCuckoo(len > 0 ? len : 0, map->allocator);
+        else {
+            map->capacity = capacityFor(len > 0 ? len : 0);
+            map->table = allocTable(map, map->capacity);
+        }
+        if (!map->table && !map->cuckoo) {
+            free(map);
+            return NULL;
+        }
+        map->size = 0;
+        map->filter = NULL;
+        map->filterFpr = 0;
+        map->filterMaxBytes = 0;
+        map->filterCapacity = 0;
+        map->filterCapped = 0;
+        map->filterStale = 0;
+        map->filterLookups = 0;
+        map->filterRejected = 0;
+        map->compressThreshold = 0;
+        map->compressions = 0;
+        map->compressNanos = 0;
+        map->decompressions = 0;
+        map->decompressNanos = 0;
+        map->index = NULL;
+        map->ordered = NULL;
+        map->hot = NULL;
+        map->keyed = 0;
+        map->chainLimit = CHAIN_LIMIT;
+        map->longestChain = 0;
+        map->rekeys = 0;
+        map->oldTable = NULL;
+        map->oldCapacity = 0;
+        map->oldKeyed = 0;
+        map->rehashIndex = 0;
+        map->shrinks = 0;
+        map->compactions = 0;
     }
     return map;
 }
@@ -73,33 +997,46 @@ size_t mapSize(Map* this) {
  * Sets a key-value pair in the Map (hashmap).
  * The key-value pair is associated with a specific bucket determined by the hash of the key.
  * If the key already exists in the hashmap, the existing value is replaced with the new value.
- * If the key does not exist, a new Node is created and added to the corresponding bucket in the hashmap.
- * The function uses the 'hash' function to calculate the index in the hashmap's table for the key.
+ * If the key does not exist, the pair is added to the corresponding bucket in the hashmap,
+ * and the table doubles once there are more than MAX_LOAD keys per bucket.
+ * The function uses the 'bucketIndex' function to calculate the index in the hashmap's table for the key.
  * The function uses the 'equalsVType' function to check for key equality in the hashmap.
- * The caller is responsible for memory management of the VType objects.
+ * The Map takes ownership of both VType objects; when the key is already present the new key is freed.
+ * When compression is enabled, a long enough Text value is compressed in place before it is stored.
+ * When hot keys are tracked, the key counts towards them.
  * @param this A pointer to the Map structure (hashmap).
  * @param key A pointer to the VType object representing the key.
  * @param value A pointer to the VType object representing the value associated with the key.
+ * @return true if the pair was stored; false if either object is NULL or on memory allocation failure, in which
+ *         case both are freed and the Map is unchanged.
  */
-void mapSet(Map* this, VType* key, VType* value) {
-    int index = hash(this, key) % TABLE_SIZE;
-    Node* node = this->table[index];
-    while (node) {
-        if (equalsVType(node->key, key)) {
-            freeVType(node->value);
-            node->value = value;
-            return;
-        }
-        node = node->next;
+_Bool mapSet(Map* this, VType* key, VType* value) {
+    if (!key || !value) {
+        freeVType(key);
+        freeVType(value);
+        return 0;
+    }
+    if (this->oldTable)
+        rehashStep(this, REHASH_STEP);
+    if (this->hot)
+        hotKeysRecord(this->hot, key);
+    compressValue(this, value, &this->compressions, &this->compressNanos);
+    unsigned int h = keyHash(this, key);
+    VType** slot = findSlot(this, key, h);
+    if (slot) {
+        PROBE2(replace, this, h);
+        freeVType(*slot);
+        *slot = value;
+        freeVType(key);
+        return 1;
     }
 
-    node = (Node*)malloc(sizeof(Node));
-    if (node) {
-        node->key = key;
-        node->value = value;
-        node->next = this->table[index];
-        this->table[index] = node;
+    if (!insertNew(this, h, key, value)) {
+        freeVType(key);
+        freeVType(value);
+        return 0;
     }
+    return 1;
 }
 
 /**
@@ -107,75 +1044,1191 @@ void mapSet(Map* this, VType* key, VType* value) {
  * The function searches for the key in the corresponding bucket, determined by the hash of the key.
  * If the key is found in the hashmap, the associated value is returned.
  * If the key is not found, the function returns NULL.
- * The function uses the 'hash' function to calculate the index in the hashmap's table for the key.
+ * When a filter is enabled, keys it rules out are answered without touching the table.
+ * A compressed value is returned as a Text view decompressed into a per-thread buffer; it is only valid until the
+ * calling thread's next lookup and must not be modified or freed.
+ * When hot keys are tracked, the key counts towards them whether it is found or not.
+ * The function uses the 'bucketIndex' function to calculate the index in the hashmap's table for the key.
  * The function uses the 'equalsVType' function to check for key equality in the hashmap.
  * @param this A pointer to the Map structure (hashmap).
  * @param key A pointer to the VType object representing the key to be retrieved.
  * @return A pointer to the VType object representing the value associated with the key, or NULL if the key is not found.
  */
-VType* mapGet(Map* this, VType* key) {
-    int index = hash(this, key) % TABLE_SIZE;
-    Node* node = this->table[index];
-    while (node) {
-        if (equalsVType(node->key, key))
-            return node->value;
-        node = node->next;
+VType* mapGet(Map* this, VType const* key) {
+    PROBE1(lookup_start, this);
+    if (this->oldTable)
+        rehashStep(this, REHASH_STEP);
+    if (this->hot)
+        hotKeysRecord(this->hot, key);
+    unsigned int h = keyHash(this, key);
+    if (filterRejects(this, h)) {
+        PROBE4(lookup_end, this, h, 0, 0);
+        return NULL;
     }
-    return NULL;
+
+    VType** slot = findSlot(this, key, h);
+    if (PROBE_ENABLED(lookup_end))
+        PROBE4(lookup_end, this, h, slot != NULL, probeLength(this, key, h));
+    return slot ? viewValue(this, *slot) : NULL;
 }
 
 /**
- * Removes the key-value pair associated with the given key from the Map (hashmap).
- * The function searches for the key in the corresponding bucket, determined by the hash of the key.
- * If the key is found in the hashmap, the associated key-value pair is removed.
- * Memory allocated for the removed key and value (VType objects) is freed.
- * The function uses the 'hash' function to calculate the index in the hashmap's table for the key.
- * The function uses the 'equalsVType' function to check for key equality in the hashmap.
+ * Retrieves the value associated with a Text key given as raw characters, without making a VType for it.
+ * Hashing and comparison are the same as for a Text VType with those characters, so this finds exactly what
+ * 'mapGet' would, and a lookup allocates nothing.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param text The characters of the key, which need not be NUL-terminated.
+ * @param len The number of characters in the key.
+ * @return A pointer to the VType object representing the value associated with the key, or NULL if the key is not found.
+ */
+VType* mapGetText(Map* this, char const* text, size_t len) {
+    VType key = { 'T', len, { .text = (char*)text }, 0 };
+    return mapGet(this, &key);
+}
+
+/**
+ * Retrieves the value associated with an Integer key given as an int, without making a VType for it.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param key The integer value of the key.
+ * @return A pointer to the VType object representing the value associated with the key, or NULL if the key is not found.
+ */
+VType* mapGetInt(Map* this, int key) {
+    VType k = { 'I', 0, { .integer = key }, 0 };
+    return mapGet(this, &k);
+}
+
+/**
+ * Finds or creates the slot for a key and lets a callback update its value in place, in a single probe of the table.
+ * The callback gets a pointer to the value stored for the key, or to NULL when the key is new; it may modify that value,
+ * or store a new one and free the old one. If it returns false the Map is left as it was.
+ * The key is only borrowed: a copy is made when a new slot is created, so updating an existing key allocates nothing.
+ * A compressed value is decompressed in place before the callback sees it and compressed again afterwards.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param key A pointer to the VType object representing the key.
+ * @param fn The callback updating the value.
+ * @param ctx Arbitrary pointer passed to the callback.
+ * @return A pointer to the key's value after the update, or NULL if the callback declined a new key or on memory allocation failure.
+ */
+VType* mapUpsert(Map* this, VType const* key, MapUpdater fn, void* ctx) {
+    if (this->oldTable)
+        rehashStep(this, REHASH_STEP);
+    if (this->hot)
+        hotKeysRecord(this->hot, key);
+    unsigned int h = keyHash(this, key);
+    VType** slot = findSlot(this, key, h);
+    if (slot) {
+        PROBE2(replace, this, h);
+        VType* value = *slot;
+        if (value->type == 'Z' && !expandText(value))
+            return NULL;
+        if (fn(&value, ctx) && value)
+            *slot = value;
+        compressValue(this, *slot, &this->compressions, &this->compressNanos);
+        return viewValue(this, *slot);
+    }
+
+    VType* value = NULL;
+    if (!fn(&value, ctx) || !value)
+        return NULL;
+
+    compressValue(this, value, &this->compressions, &this->compressNanos);
+    VType* copy = copyVType(key);
+    if (!copy || !insertNew(this, h, copy, value)) {
+        freeVType(copy);
+        freeVType(value);
+        return NULL;
+    }
+    return viewValue(this, value);
+}
+
+/**
+ * Removes a key from one bucket, keeping the bucket packed: the bucket's last pair moves into the slot the key leaves,
+ * so the gap closes within the block, and an overflow block left empty goes back to the pool.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param bucket A pointer to the bucket's block in the bucket array.
+ * @param key A pointer to the VType object representing the key.
+ * @param h The hash the key was stored with.
+ * @param oldKey Where the stored key is put.
+ * @param oldValue Where the stored value is put.
+ * @return true if the key was removed, false if it is not in the bucket.
+ */
+static _Bool removeFromBucket(Map* this, Block* bucket, VType const* key, unsigned int h, VType** oldKey,
+                              VType** oldValue) {
+    int i;
+    Block* block = findInBucket(bucket, key, h, &i);
+    if (!block)
+        return 0;
+    *oldKey = block->keys[i];
+    *oldValue = block->values[i];
+
+    Block* prev;
+    Block* last = lastBlock(bucket, &prev);
+    int j = last->count - 1;
+    block->tags[i] = last->tags[j];
+    block->keys[i] = last->keys[j];
+    block->values[i] = last->values[j];
+    dropLastPair(this, bucket);
+    return 1;
+}
+
+/**
+ * Removes the key-value pair associated with the given key from the Map (hashmap).
+ * The function searches for the key in the corresponding bucket, determined by the hash of the key.
+ * If the key is found in the hashmap, the associated key-value pair is removed and the bucket's last pair takes its slot.
+ * Memory allocated for the removed key and value (VType objects) is freed.
+ * The function uses the 'bucketIndex' function to calculate the index in the hashmap's table for the key.
+ * The function uses the 'equalsVType' function to check for key equality in the hashmap.
+ * A Bloom filter can't forget a key, so once the removed keys outnumber the live ones the filter is rebuilt.
+ * Once there are more than SHRINK_LOAD buckets per key, chained buckets start moving into a smaller table; a cuckoo
+ * table with more than SHRINK_LOAD slots per key is rebuilt at once for the keys left.
+ * When the Map has a prefix or range index, the key is removed from it too.
  * @param this A pointer to the Map structure (hashmap).
  * @param key A pointer to the VType object representing the key to be removed.
  * @return 1 if the key-value pair is successfully removed, 0 otherwise (key not found).
  */
 
-_Bool mapRemove(Map* this, VType* key) {
-    int index = hash(this, key) % TABLE_SIZE;
-    Node* prev = NULL;
-    Node* node = this->table[index];
-    while (node) {
-        if (equalsVType(node->key, key)) {
-            if (prev)
-                prev->next = node->next;
-            else
-                this->table[index] = node->next;
-            freeVType(node->key);
-            freeVType(node->value);
-            free(node);
-            this->size--;
-            return 1;
+_Bool mapRemove(Map* this, VType const* key) {
+    if (this->oldTable)
+        rehashStep(this, REHASH_STEP);
+    unsigned int h = keyHash(this, key);
+    if (filterRejects(this, h)) {
+        PROBE3(remove, this, h, 0);
+        return 0;
+    }
+
+    VType* oldKey;
+    VType* oldValue;
+    if (this->cuckoo) {
+        if (!cuckooRemove(this->cuckoo, key, h, &oldKey, &oldValue)) {
+            PROBE3(remove, this, h, 0);
+            return 0;
+        }
+    } else {
+        _Bool found = removeFromBucket(this, &this->table[bucketIndex(this, h)], key, h, &oldKey, &oldValue);
+        if (!found && this->oldTable) {
+            unsigned int old = oldHash(this, key, h);
+            found = removeFromBucket(this, &this->oldTable[old & (this->oldCapacity - 1)], key, old, &oldKey,
+                                     &oldValue);
+        }
+        if (!found) {
+            PROBE3(remove, this, h, 0);
+            return 0;
+        }
+    }
+    PROBE3(remove, this, h, 1);
+
+    if (this->index)
+        artRemove(this->index, oldKey);
+    if (this->ordered && oldKey->type == 'I')
+        btreeRemove(this->ordered, oldKey->value.integer);
+    freeVType(oldKey);
+    freeVType(oldValue);
+    this->size--;
+    if (this->filter && ++this->filterStale > this->size)
+        rebuildFilter(this);
+    if (this->cuckoo) {
+        CuckooStats stats;
+        cuckooStats(this->cuckoo, &stats);
+        if (this->size * SHRINK_LOAD < stats.slots && stats.slots > TABLE_SIZE && rebuildCuckoo(this))
+            this->shrinks++;
+    } else if (!this->oldTable && this->size * SHRINK_LOAD < this->capacity && this->capacity > TABLE_SIZE) {
+        startShrink(this);
+    }
+    return 1;
+}
+
+/**
+ * Removes the key-value pair associated with a Text key given as raw characters, without making a VType for it.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param text The characters of the key, which need not be NUL-terminated.
+ * @param len The number of characters in the key.
+ * @return 1 if the key-value pair is successfully removed, 0 otherwise (key not found).
+ */
+_Bool mapRemoveText(Map* this, char const* text, size_t len) {
+    VType key = { 'T', len, { .text = (char*)text }, 0 };
+    return mapRemove(this, &key);
+}
+
+/**
+ * Removes the key-value pair associated with an Integer key given as an int, without making a VType for it.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param key The integer value of the key.
+ * @return 1 if the key-value pair is successfully removed, 0 otherwise (key not found).
+ */
+_Bool mapRemoveInt(Map* this, int key) {
+    VType k = { 'I', 0, { .integer = key }, 0 };
+    return mapRemove(this, &k);
+}
+
+/**
+ * Puts a Bloom filter in front of the Map so lookups for absent keys usually cost a single cache line.
+ * The filter is sized from the target false-positive rate and rebuilt as the Map grows or as removed keys accumulate.
+ * With a nonzero memory cap the filter stops growing at that size and its false-positive rate rises instead.
+ * Enabling the filter again replaces the previous one with the new settings.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param fpr The target false-positive rate, between 0 and 1.
+ * @param maxBytes The largest filter allowed, in bytes, or 0 for no limit.
+ * @return true if the filter was created, false on invalid arguments or memory allocation failure.
+ */
+_Bool mapEnableFilter(Map* this, double fpr, size_t maxBytes) {
+    if (fpr <= 0 || fpr >= 1)
+        return 0;
+
+    finishRehash(this);
+    this->filterFpr = fpr;
+    this->filterMaxBytes = maxBytes;
+    rebuildFilter(this);
+    return this->filter != NULL;
+}
+
+/**
+ * Reports the sizing and hit counters of the Map's Bloom filter.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param stats A pointer to the BloomStats to be filled in.
+ * @return true if the Map has a filter, false otherwise.
+ */
+_Bool mapFilterStats(Map* this, BloomStats* stats) {
+    if (!this->filter)
+        return 0;
+    bloomStats(this->filter, this->size + this->filterStale, stats);
+    stats->lookups = this->filterLookups;
+    stats->rejected = this->filterRejected;
+    return 1;
+}
+
+/**
+ * Reports the sizing and relocation counters of the Map's cuckoo table.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param stats A pointer to the CuckooStats to be filled in.
+ * @return true if the Map uses the cuckoo backend, false otherwise.
+ */
+_Bool mapCuckooStats(Map* this, CuckooStats* stats) {
+    if (!this->cuckoo)
+        return 0;
+    cuckooStats(this->cuckoo, stats);
+    return 1;
+}
+
+/**
+ * Sets how long a chain, or the cuckoo stash, may grow before the Map switches to hashing its keys with SipHash under
+ * a random key. With seeded djb2 a bucket holds about two keys, so a long chain means the keys were picked to collide.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param limit The longest chain allowed, or 0 to never switch.
+ */
+void mapSetChainLimit(Map* this, size_t limit) {
+    this->chainLimit = limit;
+}
+
+/**
+ * Reports which hash the Map uses, the longest chain it has seen and the progress of a switch to the keyed hash.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param stats A pointer to the HashStats to be filled in.
+ */
+void mapHashStats(Map* this, HashStats* stats) {
+    stats->keyed = this->keyed;
+    stats->chainLimit = this->chainLimit;
+    stats->longestChain = this->longestChain;
+    stats->rekeys = this->rekeys;
+    stats->rehashPending = this->oldTable ? this->oldCapacity - this->rehashIndex : 0;
+}
+
+/**
+ * Reports how much memory the chained buckets of the Map take and how often the table was shrunk or compacted.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param stats A pointer to the MemoryStats to be filled in.
+ * @return true if the Map uses chained buckets, false for the cuckoo backend.
+ */
+_Bool mapMemoryStats(Map* this, MemoryStats* stats) {
+    if (this->cuckoo)
+        return 0;
+    stats->buckets = this->capacity;
+    stats->tableBytes = (this->capacity + (this->oldTable ? this->oldCapacity : 0)) * sizeof(Block);
+    stats->blocks = 0;
+    Block* tables[] = { this->table, this->oldTable };
+    size_t capacities[] = { this->capacity, this->oldTable ? this->oldCapacity : 0 };
+    for (int t = 0; t < 2; t++) {
+        for (size_t i = 0; i < capacities[t]; i++) {
+            for (Block* block = tables[t][i].next; block; block = block->next)
+                stats->blocks++;
+        }
+    }
+    stats->freeBlocks = (this->pool.bumpEnd - this->pool.bump) / sizeof(Block);
+    for (Block* block = this->pool.freeList; block; block = block->next)
+        stats->freeBlocks++;
+    stats->slabBytes = 0;
+    for (Slab* slab = this->pool.slabs; slab; slab = slab->next)
+        stats->slabBytes += slab->bytes;
+    stats->shrinks = this->shrinks;
+    stats->compactions = this->compactions;
+    return 1;
+}
+
+/**
+ * Starts tracking the keys the Map is asked for most often, by sampling 'mapGet', 'mapSet' and 'mapUpsert'.
+ * The tracker takes fixed memory however many keys there are, and its counts halve every HOT_WINDOW_MILLIS so they
+ * follow the current traffic. Tracking again replaces the tracker, and with it the counts so far.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param capacity The number of hot keys to keep.
+ * @param sampleRate One in this many operations is sampled on average.
+ * @return true if tracking started, false on invalid arguments or memory allocation failure.
+ */
+_Bool mapEnableHotKeys(Map* this, size_t capacity, unsigned int sampleRate) {
+    HotKeys* hot = makeHotKeys(capacity, sampleRate, HOT_WINDOW_MILLIS);
+    if (!hot)
+        return 0;
+    hotKeysFree(this->hot);
+    this->hot = hot;
+    return 1;
+}
+
+/**
+ * Stops tracking hot keys and frees the tracker.
+ * @param this A pointer to the Map structure (hashmap).
+ */
+void mapDisableHotKeys(Map* this) {
+    hotKeysFree(this->hot);
+    this->hot = NULL;
+}
+
+/**
+ * Reports the keys the Map was asked for most often recently, most frequent first, with their estimated rates.
+ * The keys belong to the tracker and are only valid until the Map's next operation.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param top Where the keys are stored, room for 'k' of them.
+ * @param k The largest number of keys to report.
+ * @return The number of keys stored in 'top', or -1 if the Map isn't tracking hot keys.
+ */
+long mapHotKeys(Map* this, HotKey* top, size_t k) {
+    if (!this->hot)
+        return -1;
+    return (long)hotKeysTop(this->hot, top, k);
+}
+
+/**
+ * Reports the sizing and sampling counters of the Map's hot-key tracker.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param stats A pointer to the HotKeysStats to be filled in.
+ * @return true if the Map is tracking hot keys, false otherwise.
+ */
+_Bool mapHotKeysStats(Map* this, HotKeysStats* stats) {
+    if (!this->hot)
+        return 0;
+    hotKeysStats(this->hot, stats);
+    return 1;
+}
+
+/**
+ * Walks every pair of the Map, in the cuckoo table or in the bucket blocks of both tables while switching hashes.
+ * Chained buckets only keep a tag of each hash, so the hash passed to the callback for their pairs is 0.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param fn The callback invoked with each pair; returning false from it stops the walk.
+ * @param ctx An arbitrary pointer passed through to the callback.
+ */
+static void forEachPair(Map* this, CuckooVisitor fn, void* ctx) {
+    if (this->cuckoo) {
+        cuckooForEach(this->cuckoo, fn, ctx);
+        return;
+    }
+    Block* tables[] = { this->table, this->oldTable };
+    size_t capacities[] = { this->capacity, this->oldTable ? this->oldCapacity : 0 };
+    for (int t = 0; t < 2; t++) {
+        for (size_t i = 0; i < capacities[t]; i++) {
+            for (Block* block = &tables[t][i]; block; block = block->next) {
+                for (int j = 0; j < block->count; j++) {
+                    if (!fn(block->keys[j], block->values[j], 0, ctx))
+                        return;
+                }
+            }
         }
-        prev = node;
-        node = node->next;
     }
-    return 0;
+}
+
+/**
+ * Compresses one value of the Map, as a forEachPair callback.
+ * @param key Unused.
+ * @param value A pointer to the value.
+ * @param hash Unused.
+ * @param ctx A pointer to the Map structure (hashmap).
+ * @return true, to visit every pair.
+ */
+static _Bool compressPair(VType* key, VType* value, unsigned int hash, void* ctx) {
+    Map* map = (Map*)ctx;
+    compressValue(map, value, &map->compressions, &map->compressNanos);
+    return 1;
+}
+
+/**
+ * Makes the Map store Text values of at least 'threshold' characters compressed, and compresses those it holds.
+ * Values are compressed with a built-in LZ codec when they are stored and decompressed when they are looked up,
+ * so callers never see the difference. Values that don't shrink by at least an eighth are stored as they are.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param threshold The shortest Text value to compress, or 0 to stop compressing new values.
+ */
+void mapEnableCompression(Map* this, size_t threshold) {
+    finishRehash(this);
+    this->compressThreshold = threshold;
+    forEachPair(this, compressPair, this);
+}
+
+/**
+ * Adds up the sizes of one value for the compression statistics, as a forEachPair callback.
+ * @param key Unused.
+ * @param value A pointer to the value.
+ * @param hash Unused.
+ * @param ctx A pointer to the CompressionStats.
+ * @return true, to visit every pair.
+ */
+static _Bool measurePair(VType* key, VType* value, unsigned int hash, void* ctx) {
+    CompressionStats* stats = (CompressionStats*)ctx;
+    if (value->type == 'Z') {
+        stats->values++;
+        stats->rawBytes += value->length;
+        stats->storedBytes += value->capacity;
+    }
+    return 1;
+}
+
+/**
+ * Reports how well the Map's values compress and how much time compression and decompression took.
+ * The sizes are added up over the values currently stored, so this walks the whole Map.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param stats A pointer to the CompressionStats to be filled in.
+ * @return true if the Map compresses values, false otherwise.
+ */
+_Bool mapCompressionStats(Map* this, CompressionStats* stats) {
+    if (!this->compressThreshold)
+        return 0;
+
+    finishRehash(this);
+    *stats = (CompressionStats){ this->compressThreshold, 0, 0, 0, this->compressions, this->compressNanos,
+                                 this->decompressions, this->decompressNanos };
+    forEachPair(this, measurePair, stats);
+    return 1;
+}
+
+/**
+ * Adds one key of the Map to a radix tree, as a forEachPair callback.
+ * @param key A pointer to the key.
+ * @param value Unused.
+ * @param hash Unused.
+ * @param ctx A pointer to the radix tree.
+ * @return true, to visit every pair.
+ */
+static _Bool indexPair(VType* key, VType* value, unsigned int hash, void* ctx) {
+    artInsert((Art*)ctx, key);
+    return 1;
+}
+
+/**
+ * Gives the Map a radix tree index over its keys so 'mapScan' can find the keys with a prefix in order.
+ * The index points at the Map's own key objects and is kept in sync by every insert and remove. Enabling it again
+ * rebuilds it from scratch.
+ * @param this A pointer to the Map structure (hashmap).
+ * @return true if the index was built, false on memory allocation failure.
+ */
+_Bool mapEnableIndex(Map* this) {
+    finishRehash(this);
+    artFree(this->index);
+    if (!(this->index = makeArt()))
+        return 0;
+
+    forEachPair(this, indexPair, this->index);
+    return 1;
+}
+
+/**
+ * Reports the size counters of the Map's prefix index.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param stats A pointer to the ArtStats to be filled in.
+ * @return true if the Map has an index, false otherwise.
+ */
+_Bool mapIndexStats(Map* this, ArtStats* stats) {
+    if (!this->index)
+        return 0;
+    artStats(this->index, stats);
+    return 1;
+}
+
+/**
+ * State of a prefix scan, passed through a walk of the radix tree.
+ */
+typedef struct {
+    Map* map;
+    char const* prefix;
+    size_t prefixLen;
+    size_t limit;
+    long count;
+    MapVisitor fn;
+    void* ctx;
+} PrefixScan;
+
+/**
+ * Passes one key of a prefix scan and its value on to a MapVisitor, as an ArtVisitor callback.
+ * Keys come in order, so the first key without the prefix ends the scan.
+ * @param key A pointer to the key.
+ * @param ctx A pointer to the PrefixScan.
+ * @return false once the scan is past the prefix, has reached its limit or the MapVisitor stops it.
+ */
+static _Bool scanKey(VType* key, void* ctx) {
+    PrefixScan* scan = (PrefixScan*)ctx;
+    char buffer[12];
+    char const* bytes = key->value.text;
+    size_t len = key->length;
+    if (key->type == 'I') {
+        len = sprintf(buffer, "%d", key->value.integer);
+        bytes = buffer;
+    }
+    if (len < scan->prefixLen || memcmp(bytes, scan->prefix, scan->prefixLen) != 0)
+        return 0;
+
+    VType** slot = findSlot(scan->map, key, keyHash(scan->map, key));
+    scan->count++;
+    if (!scan->fn(key, viewValue(scan->map, *slot), scan->ctx))
+        return 0;
+    return !scan->limit || (size_t)scan->count < scan->limit;
+}
+
+/**
+ * Visits the keys that start with a prefix in byte order, with their values, using the Map's prefix index.
+ * A scan can be continued where an earlier one stopped by passing the last key it visited as 'after'.
+ * Integer keys are matched and ordered by their decimal text. Compressed values are passed as decompressed views
+ * that are only valid during the call. The callback must not modify the Map; returning false from it stops the scan.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param prefix The characters every key visited starts with.
+ * @param prefixLen The number of characters in the prefix, 0 to visit every key.
+ * @param after The cursor: only keys after this one are visited; NULL to start at the prefix.
+ * @param afterLen The number of characters in the cursor.
+ * @param limit The most keys to visit, or 0 for no limit.
+ * @param fn The callback invoked with each key, its value and the 'ctx' pointer.
+ * @param ctx An arbitrary pointer passed through to the callback.
+ * @return The number of keys passed to the callback, or -1 if the Map has no index.
+ */
+long mapScan(Map* this, char const* prefix, size_t prefixLen, char const* after, size_t afterLen, size_t limit,
+             MapVisitor fn, void* ctx) {
+    if (!this->index)
+        return -1;
+
+    // A cursor before the prefix would only revisit keys without it, so the scan starts at the later of the two.
+    if (after) {
+        int cmp = memcmp(after, prefix, afterLen < prefixLen ? afterLen : prefixLen);
+        if (cmp < 0 || (cmp == 0 && afterLen < prefixLen))
+            after = NULL;
+    }
+
+    PrefixScan scan = { this, prefix, prefixLen, limit, 0, fn, ctx };
+    if (after)
+        artScan(this->index, after, afterLen, 0, scanKey, &scan);
+    else
+        artScan(this->index, prefix, prefixLen, 1, scanKey, &scan);
+    return scan.count;
+}
+
+/**
+ * Adds one key of the Map to a B+-tree if it is an Integer, as a forEachPair callback.
+ * @param key A pointer to the key.
+ * @param value Unused.
+ * @param hash Unused.
+ * @param ctx A pointer to the B+-tree.
+ * @return true, to visit every pair.
+ */
+static _Bool orderPair(VType* key, VType* value, unsigned int hash, void* ctx) {
+    if (key->type == 'I')
+        btreeInsert((BTree*)ctx, key->value.integer);
+    return 1;
+}
+
+/**
+ * Gives the Map a B+-tree over its Integer keys so 'mapRange', 'mapMinKey', 'mapMaxKey' and 'mapNextKey' can answer
+ * ordered queries the hash table can't. Text keys are not in it. The tree is kept in sync by every insert and remove;
+ * enabling it again rebuilds it from scratch.
+ * @param this A pointer to the Map structure (hashmap).
+ * @return true if the index was built, false on memory allocation failure.
+ */
+_Bool mapEnableRangeIndex(Map* this) {
+    finishRehash(this);
+    btreeFree(this->ordered);
+    if (!(this->ordered = makeBTree()))
+        return 0;
+
+    forEachPair(this, orderPair, this->ordered);
+    return 1;
+}
+
+/**
+ * Reports the size counters of the Map's range index.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param stats A pointer to the BTreeStats to be filled in.
+ * @return true if the Map has a range index, false otherwise.
+ */
+_Bool mapRangeStats(Map* this, BTreeStats* stats) {
+    if (!this->ordered)
+        return 0;
+    btreeStats(this->ordered, stats);
+    return 1;
+}
+
+/**
+ * State of a range query, passed through a walk of the B+-tree.
+ */
+typedef struct {
+    Map* map;
+    size_t limit;
+    long count;
+    MapVisitor fn;
+    void* ctx;
+} RangeQuery;
+
+/**
+ * Passes one key of a range query and its value on to a MapVisitor, as a BTreeVisitor callback.
+ * @param key The key.
+ * @param ctx A pointer to the RangeQuery.
+ * @return false once the query has reached its limit or the MapVisitor stops it.
+ */
+static _Bool rangeKey(int key, void* ctx) {
+    RangeQuery* query = (RangeQuery*)ctx;
+    VType k = { 'I', 0, { .integer = key }, 0 };
+    VType** slot = findSlot(query->map, &k, keyHash(query->map, &k));
+    query->count++;
+    if (!query->fn(&k, viewValue(query->map, *slot), query->ctx))
+        return 0;
+    return !query->limit || (size_t)query->count < query->limit;
+}
+
+/**
+ * Visits the Integer keys from 'lo' to 'hi', both inclusive, in ascending order, with their values.
+ * Pairs are passed to the callback as the tree's leaves are walked, so a large range is never collected in memory.
+ * The key passed to the callback and compressed values are only valid during the call.
+ * The callback must not modify the Map; returning false from it stops the query.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param lo The smallest key to visit.
+ * @param hi The largest key to visit.
+ * @param limit The most keys to visit, or 0 for no limit.
+ * @param fn The callback invoked with each key, its value and the 'ctx' pointer.
+ * @param ctx An arbitrary pointer passed through to the callback.
+ * @return The number of keys passed to the callback, or -1 if the Map has no range index.
+ */
+long mapRange(Map* this, int lo, int hi, size_t limit, MapVisitor fn, void* ctx) {
+    if (!this->ordered)
+        return -1;
+
+    RangeQuery query = { this, limit, 0, fn, ctx };
+    btreeRange(this->ordered, lo, hi, rangeKey, &query);
+    return query.count;
+}
+
+/**
+ * Finds the smallest Integer key in the Map, using its range index.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param key Where the key is stored.
+ * @return true if a key was found, false if there is none or the Map has no range index.
+ */
+_Bool mapMinKey(Map* this, int* key) {
+    return this->ordered && btreeMin(this->ordered, key);
+}
+
+/**
+ * Finds the largest Integer key in the Map, using its range index.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param key Where the key is stored.
+ * @return true if a key was found, false if there is none or the Map has no range index.
+ */
+_Bool mapMaxKey(Map* this, int* key) {
+    return this->ordered && btreeMax(this->ordered, key);
+}
+
+/**
+ * Finds the smallest Integer key in the Map greater than the given one, using its range index.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param key The key to start after, which need not be in the Map.
+ * @param next Where the key found is stored.
+ * @return true if a key was found, false if there is none or the Map has no range index.
+ */
+_Bool mapNextKey(Map* this, int key, int* next) {
+    return this->ordered && btreeNext(this->ordered, key, next);
+}
+
+/**
+ * One parsed record of a bulk load, waiting to be inserted.
+ */
+typedef struct {
+    VType* key;
+    VType* value;
+    unsigned int hash;
+} Record;
+
+/**
+ * A growable list of records headed for one partition of the table.
+ */
+typedef struct {
+    Record* items;
+    size_t count;
+    size_t capacity;
+} RecordList;
+
+/**
+ * Work and results of one bulk load thread.
+ * In the parse phase a task owns one chunk of the file and fills one record list per partition.
+ * In the build phase it owns one partition, a contiguous range of buckets no other task touches.
+ */
+typedef struct LoadTaskStruct {
+    Map* map;
+    char const* start;
+    char const* end;
+    int id;
+    int parts;
+    RecordList* lists;
+    struct LoadTaskStruct* tasks;
+    BlockPool pool;
+    size_t lines;
+    size_t records;
+    size_t added;
+    size_t longest;
+    size_t compressions;
+    uint64_t compressNanos;
+} LoadTask;
+
+/**
+ * Counts the lines in a task's chunk of the file, including a last line without a newline.
+ * @param arg A pointer to the LoadTask.
+ * @return NULL.
+ */
+static void* countLines(void* arg) {
+    LoadTask* task = (LoadTask*)arg;
+    char const* pos = task->start;
+    while (pos < task->end) {
+        char const* nl = memchr(pos, '\n', task->end - pos);
+        task->lines++;
+        pos = nl ? nl + 1 : task->end;
+    }
+    return NULL;
+}
+
+/**
+ * Parses every line in a task's chunk and hashes its key, appending each record to the list for the
+ * partition that owns its bucket. Records keep their file order within each list.
+ * Blank and malformed lines are skipped.
+ * @param arg A pointer to the LoadTask.
+ * @return NULL.
+ */
+static void* parseChunk(void* arg) {
+    LoadTask* task = (LoadTask*)arg;
+    Map* map = task->map;
+    char const* pos = task->start;
+
+    while (pos < task->end) {
+        char const* nl = memchr(pos, '\n', task->end - pos);
+        char const* lineEnd = nl ? nl : task->end;
+        Record r;
+        if (parseRecord(pos, lineEnd - pos, &r.key, &r.value)) {
+            compressValue(map, r.value, &task->compressions, &task->compressNanos);
+            r.hash = keyHash(map, r.key);
+            size_t part = map->cuckoo ? (size_t)((uint64_t)r.hash * task->parts >> 32)
+                                      : (size_t)bucketIndex(map, r.hash) * task->parts / map->capacity;
+            RecordList* list = &task->lists[part];
+            if (list->count == list->capacity) {
+                size_t capacity = list->capacity ? list->capacity * 2 : 256;
+                Record* items = (Record*)realloc(list->items, capacity * sizeof(Record));
+                if (!items) {
+                    freeVType(r.key);
+                    freeVType(r.value);
+                    break;
+                }
+                list->items = items;
+                list->capacity = capacity;
+            }
+            list->items[list->count++] = r;
+            task->records++;
+        }
+        pos = nl ? nl + 1 : task->end;
+    }
+    return NULL;
+}
+
+/**
+ * Inserts every record headed for one partition, taking the chunks in file order so a later duplicate of a key
+ * replaces an earlier one exactly as replaying the file one line at a time would.
+ * The partition's buckets belong to this task alone and its overflow blocks come from the task's own pool, so no
+ * locking is needed.
+ * @param arg A pointer to the LoadTask owning the partition.
+ * @return NULL.
+ */
+static void* buildPartition(void* arg) {
+    LoadTask* task = (LoadTask*)arg;
+    Map* map = task->map;
+
+    for (int t = 0; t < task->parts; t++) {
+        RecordList* list = &task->tasks[t].lists[task->id];
+        for (size_t i = 0; i < list->count; i++) {
+            Record* r = &list->items[i];
+            Block* bucket = &map->table[bucketIndex(map, r->hash)];
+            int slot;
+            Block* block = findInBucket(bucket, r->key, r->hash, &slot);
+            size_t chain;
+            if (block) {
+                freeVType(block->values[slot]);
+                block->values[slot] = r->value;
+                freeVType(r->key);
+            } else if ((chain = appendPair(map, &task->pool, bucket, hashTag(r->hash), r->key, r->value))) {
+                if (chain > task->longest)
+                    task->longest = chain;
+                task->added++;
+            } else {
+                freeVType(r->key);
+                freeVType(r->value);
+            }
+        }
+        free(list->items);
+    }
+    return NULL;
+}
+
+/**
+ * Inserts every parsed record into a Map using the cuckoo backend, on the calling thread.
+ * Inserting a key can move keys between any two buckets, so the table can't be split between threads the way
+ * chained buckets are; parsing and hashing still run in parallel. Records for a partition are taken in file order,
+ * so a later duplicate of a key replaces an earlier one.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param tasks The tasks of the load.
+ * @param count The number of tasks.
+ */
+static void buildCuckoo(Map* this, LoadTask* tasks, int count) {
+    for (int p = 0; p < count; p++) {
+        for (int t = 0; t < count; t++) {
+            RecordList* list = &tasks[t].lists[p];
+            for (size_t i = 0; i < list->count; i++) {
+                Record* r = &list->items[i];
+                VType** slot = cuckooFind(this->cuckoo, r->key, r->hash);
+                if (slot) {
+                    freeVType(*slot);
+                    *slot = r->value;
+                    freeVType(r->key);
+                } else if (cuckooInsert(this->cuckoo, r->key, r->value, r->hash)) {
+                    tasks[t].added++;
+                } else {
+                    freeVType(r->key);
+                    freeVType(r->value);
+                }
+            }
+            free(list->items);
+        }
+    }
+}
+
+/**
+ * Runs one phase of a bulk load on every task, each in its own thread.
+ * If a thread can't be started, its task runs on the calling thread instead.
+ * @param tasks The tasks.
+ * @param count The number of tasks.
+ * @param phase The function run for each task.
+ */
+static void runPhase(LoadTask* tasks, int count, void* (*phase)(void*)) {
+    pthread_t threads[MAX_LOAD_THREADS];
+    _Bool started[MAX_LOAD_THREADS];
+    for (int i = 0; i < count; i++) {
+        started[i] = pthread_create(&threads[i], NULL, phase, &tasks[i]) == 0;
+        if (!started[i])
+            phase(&tasks[i]);
+    }
+    for (int i = 0; i < count; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    }
+}
+
+/**
+ * Loads every record of a command or CSV file into the Map using several threads.
+ * Each line is either a "set <key> <value>" command or a "<key>,<value>" record; other lines are skipped.
+ * The file is split into one chunk per thread at line boundaries. The lines are counted first so the table
+ * can be sized once for the final number of keys. Each thread then parses and hashes its chunk and sorts the
+ * records by the range of buckets they fall in. Finally each thread inserts the records for one range of buckets,
+ * so no two threads ever touch the same chain and no locks are taken. Records for a range are inserted in file order,
+ * so the result is the same as replaying the file with mapSet, including which of several duplicates wins.
+ * The Map must not be used by anyone else while the load runs.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param path The name of the file to load.
+ * @param threads The number of threads to use; small files use fewer.
+ * @return The number of records loaded, or -1 if the file can't be read or memory runs out.
+ */
+long mapBulkLoad(Map* this, char const* path, int threads) {
+    finishRehash(this);
+    if (this->oldTable)
+        return -1;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    size_t length = st.st_size;
+    if (length == 0) {
+        close(fd);
+        return 0;
+    }
+
+    char const* data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return -1;
+    madvise((void*)data, length, MADV_SEQUENTIAL);
+
+    // Give each thread at least 64KB of input.
+    size_t maxThreads = length / (64 * 1024) + 1;
+    int count = threads < 1 ? 1 : threads > MAX_LOAD_THREADS ? MAX_LOAD_THREADS : threads;
+    if ((size_t)count > maxThreads)
+        count = maxThreads;
+
+    LoadTask tasks[MAX_LOAD_THREADS];
+    char const* pos = data;
+    char const* end = data + length;
+    for (int t = 0; t < count; t++) {
+        char const* chunkEnd = t == count - 1 ? end : data + length / count * (t + 1);
+        if (chunkEnd < pos)
+            chunkEnd = pos;
+        if (chunkEnd < end) {
+            char const* nl = memchr(chunkEnd, '\n', end - chunkEnd);
+            chunkEnd = nl ? nl + 1 : end;
+        }
+
+        tasks[t] = (LoadTask){ this, pos, chunkEnd, t, count, NULL, tasks, { NULL, NULL, NULL, NULL }, 0, 0, 0, 0, 0, 0 };
+        tasks[t].lists = (RecordList*)calloc(count, sizeof(RecordList));
+        if (!tasks[t].lists) {
+            for (int i = 0; i < t; i++)
+                free(tasks[i].lists);
+            munmap((void*)data, length);
+            return -1;
+        }
+        pos = chunkEnd;
+    }
+
+    runPhase(tasks, count, countLines);
+    size_t lines = 0;
+    for (int t = 0; t < count; t++)
+        lines += tasks[t].lines;
+    if (!this->cuckoo && this->size + lines > this->capacity * MAX_LOAD)
+        resize(this, capacityFor(this->size + lines));
+
+    runPhase(tasks, count, parseChunk);
+    munmap((void*)data, length);
+    if (this->cuckoo)
+        buildCuckoo(this, tasks, count);
+    else
+        runPhase(tasks, count, buildPartition);
+
+    long records = 0;
+    size_t longest = 0;
+    for (int t = 0; t < count; t++) {
+        records += tasks[t].records;
+        this->size += tasks[t].added;
+        if (tasks[t].longest > longest)
+            longest = tasks[t].longest;
+        this->compressions += tasks[t].compressions;
+        this->compressNanos += tasks[t].compressNanos;
+        mergePool(&this->pool, &tasks[t].pool);
+        free(tasks[t].lists);
+    }
+
+    // A file full of colliding keys switches the Map to its keyed hash; nobody is waiting on single operations,
+    // so the switch is finished here rather than spread out.
+    if (this->cuckoo) {
+        CuckooStats stats;
+        cuckooStats(this->cuckoo, &stats);
+        longest = stats.stashed;
+    }
+    checkChain(this, longest);
+    finishRehash(this);
+
+    if (this->filter)
+        rebuildFilter(this);
+    if (this->index)
+        mapEnableIndex(this);
+    if (this->ordered)
+        mapEnableRangeIndex(this);
+    return records;
+}
+
+/**
+ * A MapVisitor and its context, passed through a walk of the Map's pairs.
+ */
+typedef struct {
+    Map* map;
+    MapVisitor fn;
+    void* ctx;
+} Visit;
+
+/**
+ * Passes one pair of the Map on to a MapVisitor, as a forEachPair callback.
+ * @param key A pointer to the key.
+ * @param value A pointer to the value.
+ * @param hash Unused.
+ * @param ctx A pointer to the Visit.
+ * @return What the MapVisitor returns.
+ */
+static _Bool visitPair(VType* key, VType* value, unsigned int hash, void* ctx) {
+    Visit* visit = (Visit*)ctx;
+    return visit->fn(key, viewValue(visit->map, value), visit->ctx);
+}
+
+/**
+ * Frees the key and value of one pair of the Map, as a forEachPair callback.
+ * @param key A pointer to the key.
+ * @param value A pointer to the value.
+ * @param hash Unused.
+ * @param ctx Unused.
+ * @return true, to visit every pair.
+ */
+static _Bool freePair(VType* key, VType* value, unsigned int hash, void* ctx) {
+    freeVType(key);
+    freeVType(value);
+    return 1;
+}
+
+/**
+ * Visits every key-value pair stored in the Map (hashmap).
+ * The pairs are visited bucket by bucket, in no particular order. Compressed values are passed as decompressed views
+ * that are only valid during the call.
+ * The callback must not modify the Map; returning false from it stops the walk early.
+ * @param this A pointer to the Map structure (hashmap).
+ * @param fn The callback invoked with each key, its value and the 'ctx' pointer.
+ * @param ctx An arbitrary pointer passed through to the callback.
+ */
+void mapForEach(Map* this, MapVisitor fn, void* ctx) {
+    finishRehash(this);
+    Visit visit = { this, fn, ctx };
+    forEachPair(this, visitPair, &visit);
+}
+
+/**
+ * Replaces a key or value with a copy in an allocation of its exact size, freeing the original.
+ * @param v A pointer to the VType object.
+ * @return A pointer to the copy, or 'v' itself if the copy couldn't be allocated.
+ */
+static VType* repack(VType* v) {
+    VType* copy = copyVType(v);
+    if (!copy)
+        return v;
+    freeVType(v);
+    return copy;
+}
+
+/**
+ * Moves the chained buckets into a new table of the given size, with overflow blocks from fresh slabs, repacking
+ * every key and value along the way; the old table and slabs are freed once every pair has moved.
+ * The blocks the new table needs are counted and carved first, so the move itself can't fail halfway.
+ * @param this A pointer to the Map structure (hashmap), which must have no old table.
+ * @param capacity The new number of buckets.
+ * @return true if the pairs were moved, false on memory allocation failure, which leaves the Map as it was.
+ */
+static _Bool rebuildTable(Map* this, size_t capacity) {
+    Block* table = allocTable(this, capacity);
+    if (!table)
+        return 0;
+
+    // Count the pairs of each new bucket, then take the overflow blocks they need. A bucket can hold more pairs than
+    // a block's count can, so they are counted apart.
+    size_t* counts = (size_t*)calloc(capacity, sizeof(size_t));
+    if (!counts) {
+        freeTable(this, table, capacity);
+        return 0;
+    }
+    size_t needed = 0;
+    for (size_t i = 0; i < this->capacity; i++) {
+        for (Block* block = &this->table[i]; block; block = block->next) {
+            for (int j = 0; j < block->count; j++) {
+                size_t to = storedHash(this, i, block->tags[j], block->keys[j]) & (capacity - 1);
+                if (++counts[to] > BLOCK_SLOTS && counts[to] % BLOCK_SLOTS == 1)
+                    needed++;
+            }
+        }
+    }
+    free(counts);
+    BlockPool pool = { NULL, NULL, NULL, NULL };
+    for (size_t i = 0; i < needed; i++) {
+        Block* block = allocBlock(this, &pool);
+        if (!block) {
+            freeSlabs(this, &pool);
+            freeTable(this, table, capacity);
+            return 0;
+        }
+        freeBlock(&pool, block);
+    }
+
+    for (size_t i = 0; i < this->capacity; i++) {
+        for (Block* block = &this->table[i]; block; block = block->next) {
+            for (int j = 0; j < block->count; j++) {
+                unsigned int h = storedHash(this, i, block->tags[j], block->keys[j]);
+                appendPair(this, &pool, &table[h & (capacity - 1)], block->tags[j], repack(block->keys[j]),
+                           repack(block->values[j]));
+            }
+        }
+    }
+
+    freeSlabs(this, &this->pool);
+    freeTable(this, this->table, this->capacity);
+    this->pool = pool;
+    this->table = table;
+    this->capacity = capacity;
+    return 1;
+}
+
+/**
+ * Rebuilds the Map in fresh memory so the space left behind by removed keys can go back to the system.
+ * Removing keys frees their objects and overflow blocks, but the survivors stay scattered among the holes, which keeps
+ * the heap's pages in use. Compacting first finishes any move between tables, then moves the pairs into a table
+ * sized like a shrink's, with overflow blocks from new slabs, and copies every key and value in table order into an
+ * allocation of its exact size, so the survivors end up packed together; the old table, slabs and objects are then
+ * freed and, with glibc, the free memory at the top of the heap is trimmed. A cuckoo table is rebuilt for its current
+ * keys the same way. The prefix index is rebuilt over the new keys and the Bloom filter drops the removed keys' bits.
+ * Values returned by earlier lookups are no longer valid afterwards.
+ * @param this A pointer to the Map structure (hashmap).
+ * @return true if the Map was compacted, false on memory allocation failure, which leaves it working as it was.
+ */
+_Bool mapCompact(Map* this) {
+    finishRehash(this);
+    if (this->oldTable)
+        return 0;
+
+    if (this->cuckoo) {
+        if (!rebuildCuckoo(this))
+            return 0;
+        cuckooReplaceObjects(this->cuckoo, repack);
+    } else if (!rebuildTable(this, capacityFor(this->size * MAX_LOAD))) {
+        return 0;
+    }
+
+    if (this->index)
+        mapEnableIndex(this);
+    if (this->filterFpr > 0)
+        rebuildFilter(this);
+    this->compactions++;
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    return 1;
 }
 
 /**
  * Frees the memory occupied by the Map (hashmap) and all its key-value pairs.
  * The function iterates through the hashmap's table and deallocates memory for each key-value pair.
- * Memory allocated for the Map and all its nodes (key-value pairs) is freed.
+ * Memory allocated for the Map and all its key-value pairs is freed; overflow blocks go back to the allocator a slab at a time.
  * The caller is responsible for ensuring that the Map and all its keys and values are no longer in use.
  * @param this A pointer to the Map structure (hashmap) to be freed.
  */
 void mapFree(Map* this) {
-    for (int i = 0; i < TABLE_SIZE; i++) {
-        Node* node = this->table[i];
-        while (node) {
-            Node* temp = node;
-            node = node->next;
-            freeVType(temp->key);
-            freeVType(temp->value);
-            free(temp);
-        }
-    }
+    forEachPair(this, freePair, NULL);
+    freeSlabs(this, &this->pool);
+    if (this->cuckoo)
+        cuckooFree(this->cuckoo);
+    artFree(this->index);
+    btreeFree(this->ordered);
+    hotKeysFree(this->hot);
+    bloomFree(this->filter);
+    if (this->table)
+        freeTable(this, this->table, this->capacity);
+    if (this->oldTable)
+        freeTable(this, this->oldTable, this->oldCapacity);
     free(this);
 }
 
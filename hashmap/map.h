@@ -3,16 +3,109 @@
 
 #include <stddef.h>
 #include "vtype.h"
+#include "bloom.h"
+#include "cuckoo.h"
+#include "art.h"
+#include "btree.h"
+#include "hotkeys.h"
 
 // Define your Map struct here
 typedef struct MapStruct Map;
 
+// Ways a Map can store its keys.
+typedef enum {
+    // Chained buckets: one 64-byte block of up to three pairs per bucket, linking overflow blocks as needed.
+    MAP_CHAINED,
+    // Bucketized cuckoo hashing: every key in one of two 4-way buckets.
+    MAP_CUCKOO
+} MapBackend;
+
+// Compression counters reported for a Map.
+typedef struct {
+    // Shortest Text value that is compressed.
+    size_t threshold;
+    // Number of values stored compressed, their original size and their compressed size in bytes.
+    size_t values;
+    size_t rawBytes;
+    size_t storedBytes;
+    // Number of values compressed and decompressed so far, and the time spent on each in nanoseconds.
+    size_t compressions;
+    unsigned long long compressNanos;
+    size_t decompressions;
+    unsigned long long decompressNanos;
+} CompressionStats;
+
+// Hashing counters reported for a Map.
+typedef struct {
+    // Whether keys are hashed with SipHash under a secret key rather than seeded djb2.
+    _Bool keyed;
+    // Longest chain (or cuckoo stash) allowed before switching to SipHash, 0 for never.
+    size_t chainLimit;
+    // Longest chain or stash seen so far, and how many times the Map has switched.
+    size_t longestChain;
+    size_t rekeys;
+    // Buckets of the old table still to be moved while a switch or a shrink is under way.
+    size_t rehashPending;
+} HashStats;
+
+// Memory counters reported for a Map with chained buckets.
+typedef struct {
+    // Number of buckets, and the bytes of the bucket array plus the old table while one is being moved.
+    size_t buckets;
+    size_t tableBytes;
+    // Overflow blocks holding pairs, blocks free for reuse, and the bytes of the slabs they are carved from.
+    size_t blocks;
+    size_t freeBlocks;
+    size_t slabBytes;
+    // Number of times the table shrank after keys were removed, and how many times the Map was compacted.
+    size_t shrinks;
+    size_t compactions;
+} MemoryStats;
+
+// Callback used by mapForEach; return 0 to stop the walk.
+typedef _Bool (*MapVisitor)(VType const* key, VType const* value, void* ctx);
+
+// Callback used by mapUpsert; *value is the key's value, or NULL for a new key. It may change the value in place or
+// store a new one, freeing the one it replaces. Return 0 to leave the map unchanged.
+typedef _Bool (*MapUpdater)(VType** value, void* ctx);
+
 /*Function prototypes*/ 
-Map* makeMap(int len);
+Map* makeMap(int len, MapAllocator const* allocator);
+Map* makeMapBackend(int len, MapBackend backend, MapAllocator const* allocator);
 size_t mapSize(Map* this);
-void mapSet(Map* this, VType* key, VType* value);
-VType* mapGet(Map* this, VType* key);
-_Bool mapRemove(Map* this, VType* key);
+_Bool mapSet(Map* this, VType* key, VType* value);
+VType* mapGet(Map* this, VType const* key);
+VType* mapGetText(Map* this, char const* text, size_t len);
+VType* mapGetInt(Map* this, int key);
+VType* mapUpsert(Map* this, VType const* key, MapUpdater fn, void* ctx);
+_Bool mapRemove(Map* this, VType const* key);
+_Bool mapRemoveText(Map* this, char const* text, size_t len);
+_Bool mapRemoveInt(Map* this, int key);
+_Bool mapEnableFilter(Map* this, double fpr, size_t maxBytes);
+_Bool mapFilterStats(Map* this, BloomStats* stats);
+_Bool mapCuckooStats(Map* this, CuckooStats* stats);
+void mapSetChainLimit(Map* this, size_t limit);
+void mapHashStats(Map* this, HashStats* stats);
+_Bool mapMemoryStats(Map* this, MemoryStats* stats);
+_Bool mapCompact(Map* this);
+_Bool mapEnableHotKeys(Map* this, size_t capacity, unsigned int sampleRate);
+void mapDisableHotKeys(Map* this);
+long mapHotKeys(Map* this, HotKey* top, size_t k);
+_Bool mapHotKeysStats(Map* this, HotKeysStats* stats);
+void mapEnableCompression(Map* this, size_t threshold);
+_Bool mapCompressionStats(Map* this, CompressionStats* stats);
+_Bool mapEnableIndex(Map* this);
+_Bool mapIndexStats(Map* this, ArtStats* stats);
+long mapScan(Map* this, char const* prefix, size_t prefixLen, char const* after, size_t afterLen, size_t limit,
+             MapVisitor fn, void* ctx);
+_Bool mapEnableRangeIndex(Map* this);
+_Bool mapRangeStats(Map* this, BTreeStats* stats);
+long mapRange(Map* this, int lo, int hi, size_t limit, MapVisitor fn, void* ctx);
+_Bool mapMinKey(Map* this, int* key);
+_Bool mapMaxKey(Map* this, int* key);
+_Bool mapNextKey(Map* this, int key, int* next);
+long mapBulkLoad(Map* this, char const* path, int threads);
+void mapForEach(Map* this, MapVisitor fn, void* ctx);
 void mapFree(Map* this);
 
 #endif // MAP_H
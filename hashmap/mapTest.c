@@ -1,8 +1,90 @@
+#include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "map.h"
 
+// Number of VType objects and texts allocated so far.
+static int allocations = 0;
+
+static void* countingAlloc(void* ctx, size_t size) {
+    allocations++;
+    return malloc(size);
+}
+
+static void countingFree(void* ctx, void* ptr, size_t size) {
+    free(ptr);
+}
+
+static MapAllocator const countingAllocator = { countingAlloc, countingFree, NULL, NULL, 0, NULL };
+
+// Number of bucket arrays and slabs the limited allocator still hands out before failing.
+static int largeBudget = 0;
+
+static void* limitedAllocLarge(void* ctx, size_t size) {
+    void* ptr;
+    if (largeBudget-- <= 0 || posix_memalign(&ptr, 64, size) != 0)
+        return NULL;
+    return memset(ptr, 0, size);
+}
+
+static void limitedFreeLarge(void* ctx, void* ptr, size_t size) {
+    free(ptr);
+}
+
+static MapAllocator const limitedAllocator = { countingAlloc, countingFree, limitedAllocLarge, limitedFreeLarge, 4096,
+                                               NULL };
+
+// Number of large regions the checking allocator handed out.
+static int largeRegions = 0;
+
+// Takes a large region from the default allocator, checking it starts on a cache line and is zero-filled.
+static void* alignedAllocLarge(void* ctx, size_t size) {
+    unsigned char* ptr = (unsigned char*)mallocAllocator.allocLarge(mallocAllocator.ctx, size);
+    assert(ptr && ((uintptr_t)ptr & 63) == 0);
+    for (size_t i = 0; i < size; i++)
+        assert(ptr[i] == 0);
+    largeRegions++;
+    return ptr;
+}
+
+static MapAllocator const checkingAllocator = { countingAlloc, countingFree, alignedAllocLarge, limitedFreeLarge, 0,
+                                                NULL };
+
+// mapUpsert callback adding 1 to an Integer, starting new keys at 1.
+static _Bool addOne(VType** value, void* ctx) {
+    if (!*value) {
+        *value = makeInteger(1);
+        return *value != NULL;
+    }
+    if ((*value)->type != 'I')
+        return 0;
+    (*value)->value.integer++;
+    return 1;
+}
+
+// mapUpsert callback appending the text in ctx, leaving new keys out.
+static _Bool appendExisting(VType** value, void* ctx) {
+    char const* text = (char const*)ctx;
+    return *value && appendText(*value, text, strlen(text));
+}
+
+// mapScan callback visiting every key.
+static _Bool visitAll(VType const* key, VType const* value, void* ctx) {
+    return 1;
+}
+
+// Writes the i-th of 32 keys that share a bucket: "Az" and "BY" have the same djb2 value, so all strings of five
+// such pairs collide.
+static void collidingKey(char* text, int i) {
+    for (int b = 0; b < 5; b++)
+        memcpy(text + 2 * b, (i >> b) & 1 ? "BY" : "Az", 2);
+}
+
 int main() {
-    Map* map = makeMap(3);
+    setVTypeAllocator(&countingAllocator);
+    Map* map = makeMap(3, NULL);
 
     mapSet(map, makeText("key1"), makeInteger(42));
     mapSet(map, makeText("key2"), makeInteger(123));
@@ -10,7 +92,7 @@ int main() {
 
     printf("Size: %zu\n", mapSize(map));
 
-    VType* value = mapGet(map, makeText("key1"));
+    VType* value = mapGetText(map, "key1", 4);
     if (value) {
         printf("Value: ");
         printVType(value);
@@ -19,11 +101,11 @@ int main() {
         printf("Key not found.\n");
     }
 
-    mapRemove(map, makeText("key2"));
+    mapRemoveText(map, "key2", 4);
 
     printf("Size: %zu\n", mapSize(map));
 
-    value = mapGet(map, makeText("key2"));
+    value = mapGetText(map, "key2", 4);
     if (value) {
         printf("Value: ");
         printVType(value);
@@ -32,6 +114,168 @@ int main() {
         printf("Key not found.\n");
     }
 
+    // Borrowed-key lookups find what VType lookups find and allocate nothing.
+    mapSet(map, makeInteger(-17), makeText("negative"));
+    int before = allocations;
+    assert(mapGetInt(map, -17) && mapGetInt(map, -17)->type == 'T');
+    assert(mapGetText(map, "key1", 4)->value.integer == 42);
+    assert(mapGetText(map, "key1, not key3", 4) == mapGetText(map, "key1", 4));
+    assert(!mapGetText(map, "key", 3));
+    assert(!mapGetInt(map, 17));
+    assert(!mapGetText(map, "-17", 3));
+    assert(!mapRemoveInt(map, 17));
+    assert(mapRemoveInt(map, -17) && !mapGetInt(map, -17));
+    assert(allocations == before);
+
+    // Compressing a value takes its scratch space and its new text from the VType allocator too.
+    char repeated[401];
+    for (int i = 0; i < 400; i++)
+        repeated[i] = "abcd"[i % 4];
+    repeated[400] = '\0';
+    VType* packed = makeText(repeated);
+    before = allocations;
+    assert(compressText(packed) && packed->type == 'Z' && allocations == before + 2);
+    assert(expandText(packed) && strcmp(packed->value.text, repeated) == 0);
+    freeVType(packed);
+
+    // Upserts update the stored value in place and only copy the key for a new slot.
+    VType counter = { 'T', 7, { .text = "counter" } };
+    VType* first = mapUpsert(map, &counter, addOne, NULL);
+    assert(first && first->value.integer == 1);
+    for (int i = 0; i < 99; i++)
+        assert(mapUpsert(map, &counter, addOne, NULL) == first);
+    assert(first->value.integer == 100);
+    assert(mapGet(map, &counter) == first);
+
+    // A declined update leaves the value alone, and a declined new key isn't created.
+    VType key3 = { 'T', 4, { .text = "key3" } };
+    VType* hello = mapGet(map, &key3);
+    assert(mapUpsert(map, &key3, addOne, NULL) == hello);
+    VType missing = { 'T', 7, { .text = "missing" } };
+    size_t size = mapSize(map);
+    assert(!mapUpsert(map, &missing, appendExisting, "x"));
+    assert(mapSize(map) == size);
+
+    // Appends grow the text geometrically, so its buffer is replaced only a few times.
+    int moves = 0;
+    char* text = hello->value.text;
+    for (int i = 0; i < 1000; i++) {
+        mapUpsert(map, &key3, appendExisting, "ab");
+        if (hello->value.text != text) {
+            moves++;
+            text = hello->value.text;
+        }
+    }
+    assert(hello->length == 2005 && hello->capacity >= 2006);
+    assert(strncmp(hello->value.text, "helloabab", 9) == 0);
+    assert(moves <= 12);
+
+    // Keys sharing one bucket spill into overflow blocks, and removing them in any order keeps the rest reachable.
+    char colliding[10];
+    size = mapSize(map);
+    for (int i = 0; i < 32; i++) {
+        collidingKey(colliding, i);
+        mapSet(map, makeTextLen(colliding, 10), makeInteger(i));
+    }
+    for (int round = 0; round < 2; round++) {
+        for (int i = round; i < 32; i += 2) {
+            collidingKey(colliding, i);
+            assert(mapRemoveText(map, colliding, 10) && !mapGetText(map, colliding, 10));
+        }
+        for (int i = 0; i < 32; i++) {
+            collidingKey(colliding, i);
+            value = mapGetText(map, colliding, 10);
+            assert(i % 2 < round + 1 ? !value : value && value->value.integer == i);
+        }
+    }
+    assert(mapSize(map) == size);
+
+    mapFree(map);
+
+    // The default allocator puts every bucket array and block slab on a cache line, as the blocks in them expect.
+    map = makeMap(0, &checkingAllocator);
+    mapSetChainLimit(map, 0);
+    for (int i = 0; i < 20000; i++)
+        mapSet(map, makeInteger(i), makeInteger(i));
+    for (int i = 0; i < 32; i++) {
+        collidingKey(colliding, i);
+        mapSet(map, makeTextLen(colliding, 10), makeInteger(i));
+    }
+    assert(largeRegions > 2 && mapSize(map) == 20032);
+    mapFree(map);
+
+    // A pair that can't be stored is freed and reported, and leaves the Map as it was.
+    largeBudget = 1;
+    map = makeMap(0, &limitedAllocator);
+    assert(!mapSet(map, NULL, makeInteger(1)) && mapSize(map) == 0);
+    int stored = 0;
+    for (int i = 0; i < 32; i++) {
+        collidingKey(colliding, i);
+        if (!mapSet(map, makeTextLen(colliding, 10), makeInteger(i)))
+            break;
+        stored++;
+    }
+    assert(stored > 0 && stored < 32 && mapSize(map) == (size_t)stored);
+    collidingKey(colliding, stored);
+    assert(!mapGetText(map, colliding, 10));
+    collidingKey(colliding, 0);
+    assert(mapSet(map, makeTextLen(colliding, 10), makeInteger(-1)));
+    assert(mapGetText(map, colliding, 10)->value.integer == -1);
+    mapFree(map);
+
+    // Growing the table past a bucket too long for the overflow blocks at hand keeps every pair it can't move.
+    // Strings of twelve "Az"/"BY" pairs all collide, and with no chain limit they stay in one bucket.
+    largeBudget = 3;
+    map = makeMap(0, &limitedAllocator);
+    mapSetChainLimit(map, 0);
+    char longColliding[24];
+    stored = 0;
+    for (int i = 0; i < 4096; i++) {
+        for (int b = 0; b < 12; b++)
+            memcpy(longColliding + 2 * b, (i >> b) & 1 ? "BY" : "Az", 2);
+        if (!mapSet(map, makeTextLen(longColliding, 24), makeInteger(i)))
+            break;
+        stored++;
+    }
+    assert(stored > 2048 && stored < 4096 && mapSize(map) == (size_t)stored);
+    for (int i = 0; i < stored; i++) {
+        for (int b = 0; b < 12; b++)
+            memcpy(longColliding + 2 * b, (i >> b) & 1 ? "BY" : "Az", 2);
+        value = mapGetText(map, longColliding, 24);
+        assert(value && value->value.integer == i);
+    }
+    mapFree(map);
+
+    // After a mass removal the table shrinks on its own as operations go on, and compacting repacks what is left.
+    map = makeMap(0, NULL);
+    mapEnableIndex(map);
+    char name[16];
+    for (int i = 0; i < 100000; i++) {
+        snprintf(name, sizeof(name), "user:%d", i);
+        mapSet(map, makeText(name), makeInteger(i));
+    }
+    MemoryStats peak, shrunk, compacted;
+    assert(mapMemoryStats(map, &peak) && peak.buckets >= 50000 && peak.shrinks == 0);
+    for (int i = 0; i < 100000; i++) {
+        snprintf(name, sizeof(name), "user:%d", i);
+        assert(i % 100 == 0 || mapRemoveText(map, name, strlen(name)));
+    }
+    for (int i = 0; i < 100000; i += 100) {
+        snprintf(name, sizeof(name), "user:%d", i);
+        value = mapGetText(map, name, strlen(name));
+        assert(value && value->value.integer == i);
+    }
+    HashStats hash;
+    mapHashStats(map, &hash);
+    assert(mapMemoryStats(map, &shrunk) && shrunk.shrinks >= 2 && hash.rehashPending == 0);
+    assert(shrunk.buckets >= mapSize(map) && shrunk.buckets < peak.buckets / 32);
+
+    assert(mapCompact(map) && mapMemoryStats(map, &compacted) && compacted.compactions == 1);
+    assert(compacted.buckets == shrunk.buckets && compacted.slabBytes < shrunk.slabBytes);
+    assert(compacted.blocks + compacted.freeBlocks < shrunk.blocks + shrunk.freeBlocks);
+    assert(mapSize(map) == 1000 && mapGetText(map, "user:99900", 10)->value.integer == 99900);
+    assert(mapScan(map, "user:999", 8, NULL, 0, 0, visitAll, NULL) == 1);
+    assert(mapScan(map, "user:", 5, NULL, 0, 0, visitAll, NULL) == 1000);
     mapFree(map);
 
     return 0;
@@ -0,0 +1,56 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+// Static tracepoints (USDT) for bpftrace and perf under the provider "hashmap". They are compiled in only with
+// HASHMAP_USDT defined ('make USDT=1'), which needs <sys/sdt.h> from systemtap-sdt-dev; otherwise every probe macro
+// expands to nothing and its arguments are never evaluated. A compiled-in probe is a single nop until a tracer
+// attaches to it. Probes whose arguments take work to compute check PROBE_ENABLED first, which reads the probe's
+// semaphore: tracers raise it while attached, so the work is skipped the rest of the time.
+//
+// Probes and their arguments:
+//   lookup_start(map)                          mapGet called
+//   lookup_end(map, hash, found, probes)       mapGet returning; probes is the number of pairs in the key's chain,
+//                                              or the cuckoo stash length, and 0 if the Bloom filter ruled it out
+//   insert(map, hash, chain)                   new key stored; chain is its bucket's length afterwards
+//   replace(map, hash)                         existing key's value replaced by mapSet or updated by mapUpsert
+//   remove(map, hash, found)                   mapRemove returning
+//   resize(map, from, to)                      bucket array replaced, or a move to a new one started, from/to buckets
+//   rehash_step(map, moved, total)             buckets of an old table moved so far, out of all of them
+//   alloc_failure(map, bytes)                  bucket array or block slab allocation failed
+//   command_start(command)                     driver starts running a command, named by its first word
+//   command_end(command, nanos)                driver finished it, in that many nanoseconds
+
+// Every probe, for declaring and defining their semaphores.
+#define HASHMAP_PROBES(X) \
+    X(lookup_start) X(lookup_end) X(insert) X(replace) X(remove) X(resize) X(rehash_step) X(alloc_failure) \
+    X(command_start) X(command_end)
+
+#ifdef HASHMAP_USDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define PROBE_DECLARE_SEMAPHORE(name) extern unsigned short hashmap_##name##_semaphore;
+#define PROBE_DEFINE_SEMAPHORE(name) unsigned short hashmap_##name##_semaphore __attribute__((section(".probes")));
+HASHMAP_PROBES(PROBE_DECLARE_SEMAPHORE)
+
+// Defines the semaphores of every probe; map.c does this once for the whole program.
+#define PROBE_SEMAPHORES HASHMAP_PROBES(PROBE_DEFINE_SEMAPHORE)
+#define PROBE_ENABLED(name) __builtin_expect(hashmap_##name##_semaphore != 0, 0)
+#define PROBE1(name, a) DTRACE_PROBE1(hashmap, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(hashmap, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(hashmap, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(hashmap, name, a, b, c, d)
+
+#else
+
+#define PROBE_SEMAPHORES
+#define PROBE_ENABLED(name) 0
+#define PROBE1(name, a) do { } while (0)
+#define PROBE2(name, a, b) do { } while (0)
+#define PROBE3(name, a, b, c) do { } while (0)
+#define PROBE4(name, a, b, c, d) do { } while (0)
+
+#endif // HASHMAP_USDT
+
+#endif // PROBES_H
@@ -0,0 +1,488 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "input.h"
+#include "trace.h"
+#include "vtype.h"
+
+/**
+ * @file replay.c
+ * @author Jason Wang
+ * This program replays a trace recorded by the driver with -t against fresh driver processes and reports the
+ * throughput and the latency of every kind of command.
+ * Commands are sent at the times they were recorded, scaled by a speed factor, or as fast as the drivers take them.
+ * With several clients, each one is a driver process of its own fed through a pipe: every command on a key goes to
+ * the client owning the key, so each driver holds a disjoint share of the keys and sees that share's commands in
+ * trace order, and other commands go to a client chosen by their connection.
+ * A command counts as answered when the driver prints the prompt after its response, which the driver flushes
+ * whenever it runs out of commands to read. Paced commands are timed from the moment they were due rather than the
+ * moment they were written, so a driver that falls behind shows up in the latencies instead of slowing the replay.
+ */
+
+/** Prompt the driver prints before reading each command. */
+#define PROMPT "cmd> "
+
+/** Longest command the driver reads as one line. */
+#define MAX_COMMAND 1022
+
+/** Largest number of commands sent to one client and not yet answered, when -w isn't given. */
+#define DEFAULT_WINDOW 128
+
+/** Number of kinds of commands reported separately; the rest are reported together. */
+#define MAX_KINDS 16
+
+/** Size of the buffer a client's responses are read into. */
+#define READ_BUFFER 65536
+
+/** One command of the trace. */
+typedef struct {
+    /** The command line with its newline. */
+    char* line;
+    size_t len;
+    /** Time the command was recorded at, since the first command. */
+    unsigned long long nanos;
+    /** Time the latency is counted from, and the latency once answered. */
+    unsigned long long start;
+    unsigned long long latency;
+    int kind;
+} Command;
+
+/** A driver process and the commands sent to it. */
+typedef struct {
+    pid_t pid;
+    /** Pipe to the driver's standard input, and from its standard output. */
+    int in;
+    int out;
+    Command** commands;
+    size_t count;
+    size_t capacity;
+    /** Commands written, and commands answered; the sender waits while too many are outstanding. */
+    size_t sent;
+    size_t answered;
+    /** Set once the driver printed its first prompt, and once it exited. */
+    _Bool ready;
+    _Bool exited;
+    pthread_mutex_t lock;
+    pthread_cond_t room;
+    pthread_t sender;
+    pthread_t reader;
+} Client;
+
+/** Names of the kinds of commands seen, by their first word. */
+static char kinds[MAX_KINDS + 1][20];
+static int kindCount = 0;
+
+/** Speed the trace is replayed at: 2 for twice as fast as it was recorded, 0 for as fast as possible. */
+static double speed = 1;
+
+/** Largest number of unanswered commands per client. */
+static size_t window = DEFAULT_WINDOW;
+
+/** Time the replay started. */
+static unsigned long long startNanos;
+
+/**
+ * Finds the kind of a command by its first word, adding new kinds until there are MAX_KINDS.
+ * @param line the command line
+ * @return the kind; the last one, "other", gathers the commands beyond MAX_KINDS kinds
+ */
+static int kindOf(char const* line) {
+    char word[20];
+    if (sscanf(line, "%19s", word) != 1)
+        strcpy(word, "(blank)");
+    for (int i = 0; i < kindCount; i++) {
+        if (strcmp(kinds[i], word) == 0)
+            return i;
+    }
+    if (kindCount == MAX_KINDS)
+        return MAX_KINDS;
+    strcpy(kinds[kindCount], word);
+    return kindCount++;
+}
+
+/**
+ * Chooses the client a command goes to: the owner of the key for a command on a single key, as the driver's -P
+ * chooses a core, and otherwise one chosen by the connection.
+ * @param command the command
+ * @param connection the connection it was recorded on
+ * @param clients the number of clients
+ * @return the client
+ */
+static size_t route(char const* command, unsigned int connection, size_t clients) {
+    static char const* const keyCommands[] = { "set", "get", "remove", "incr", "decr", "incrby", "append" };
+    char const* pos = command;
+    while (isspace((unsigned char)*pos))
+        pos++;
+    size_t len = 0;
+    while (pos[len] && !isspace((unsigned char)pos[len]))
+        len++;
+    for (size_t i = 0; i < sizeof(keyCommands) / sizeof(keyCommands[0]); i++) {
+        if (len != strlen(keyCommands[i]) || strncmp(pos, keyCommands[i], len) != 0)
+            continue;
+        char const* key = pos + len;
+        while (isspace((unsigned char)*key))
+            key++;
+        size_t keyLen = 0;
+        while (key[keyLen] && !isspace((unsigned char)key[keyLen]))
+            keyLen++;
+        VType k;
+        borrowValue(key, keyLen, &k);
+        return hashVType(&k) % clients;
+    }
+    return connection % clients;
+}
+
+/**
+ * Adds a command to the list of a client.
+ * @param client the client
+ * @param command the command
+ * @return false on memory allocation failure
+ */
+static _Bool addCommand(Client* client, Command* command) {
+    if (client->count == client->capacity) {
+        size_t capacity = client->capacity ? client->capacity * 2 : 1024;
+        Command** grown = (Command**)realloc(client->commands, capacity * sizeof(Command*));
+        if (!grown)
+            return 0;
+        client->commands = grown;
+        client->capacity = capacity;
+    }
+    client->commands[client->count++] = command;
+    return 1;
+}
+
+/**
+ * Starts the driver of a client with its standard input and output connected to pipes.
+ * @param client the client
+ * @param argv the driver's command line
+ * @return false if it couldn't be started
+ */
+static _Bool startDriver(Client* client, char* const* argv) {
+    int toDriver[2], fromDriver[2];
+    if (pipe(toDriver) != 0)
+        return 0;
+    if (pipe(fromDriver) != 0) {
+        close(toDriver[0]);
+        close(toDriver[1]);
+        return 0;
+    }
+    // Keep the other drivers from inheriting this one's pipes, so closing its input ends it.
+    fcntl(toDriver[1], F_SETFD, FD_CLOEXEC);
+    fcntl(fromDriver[0], F_SETFD, FD_CLOEXEC);
+    client->pid = fork();
+    if (client->pid == 0) {
+        dup2(toDriver[0], STDIN_FILENO);
+        dup2(fromDriver[1], STDOUT_FILENO);
+        close(toDriver[0]);
+        close(toDriver[1]);
+        close(fromDriver[0]);
+        close(fromDriver[1]);
+        execvp(argv[0], argv);
+        fprintf(stderr, "Unable to run %s: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+    close(toDriver[0]);
+    close(fromDriver[1]);
+    client->in = toDriver[1];
+    client->out = fromDriver[0];
+    if (client->pid < 0) {
+        close(client->in);
+        close(client->out);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Sends a client's commands to its driver, each at its time in the trace scaled by the speed, or at once at speed
+ * 0, never letting more than the window go unanswered. Closing the pipe at the end makes the driver exit.
+ * @param arg the client
+ * @return NULL
+ */
+static void* sendCommands(void* arg) {
+    Client* client = (Client*)arg;
+    for (size_t i = 0; i < client->count; i++) {
+        Command* command = client->commands[i];
+        pthread_mutex_lock(&client->lock);
+        while (client->sent - client->answered >= window && !client->exited)
+            pthread_cond_wait(&client->room, &client->lock);
+        _Bool exited = client->exited;
+        pthread_mutex_unlock(&client->lock);
+        if (exited)
+            break;
+
+        if (speed > 0) {
+            unsigned long long due = startNanos + (unsigned long long)(command->nanos / speed);
+            struct timespec ts = { (time_t)(due / 1000000000ULL), (long)(due % 1000000000ULL) };
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+                ;
+            command->start = due;
+        } else {
+            command->start = traceClock();
+        }
+
+        pthread_mutex_lock(&client->lock);
+        client->sent++;
+        pthread_mutex_unlock(&client->lock);
+        size_t written = 0;
+        while (written < command->len) {
+            ssize_t n = write(client->in, command->line + written, command->len - written);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            written += n;
+        }
+        if (written < command->len)
+            break;
+    }
+    close(client->in);
+    return NULL;
+}
+
+/**
+ * Reads a client's driver's output until it exits, timing each command when the prompt after its response appears:
+ * the first prompt comes before any command, and the prompt after that ends the response to the first one.
+ * @param arg the client
+ * @return NULL
+ */
+static void* readResponses(void* arg) {
+    Client* client = (Client*)arg;
+    static char const prompt[] = PROMPT;
+    char* buffer = (char*)malloc(READ_BUFFER);
+    size_t matched = 0;
+    size_t prompts = 0;
+    ssize_t n;
+    while (buffer && ((n = read(client->out, buffer, READ_BUFFER)) > 0 || (n < 0 && errno == EINTR))) {
+        unsigned long long now = traceClock();
+        for (ssize_t i = 0; i < n; i++) {
+            if (buffer[i] == prompt[matched])
+                matched++;
+            else
+                matched = buffer[i] == prompt[0];
+            if (matched < sizeof(prompt) - 1)
+                continue;
+            matched = 0;
+            if (prompts++ == 0) {
+                pthread_mutex_lock(&client->lock);
+                client->ready = 1;
+                pthread_cond_signal(&client->room);
+                pthread_mutex_unlock(&client->lock);
+                continue;
+            }
+
+            pthread_mutex_lock(&client->lock);
+            if (client->answered < client->sent) {
+                Command* command = client->commands[client->answered++];
+                command->latency = now > command->start ? now - command->start : 0;
+                pthread_cond_signal(&client->room);
+            }
+            pthread_mutex_unlock(&client->lock);
+        }
+    }
+    free(buffer);
+    close(client->out);
+
+    pthread_mutex_lock(&client->lock);
+    client->exited = 1;
+    pthread_cond_signal(&client->room);
+    pthread_mutex_unlock(&client->lock);
+    return NULL;
+}
+
+/**
+ * Compares two latencies for sorting in ascending order.
+ * @param a the first latency
+ * @param b the second latency
+ * @return negative, zero or positive as the first is shorter, equal or longer
+ */
+static int byLatency(void const* a, void const* b) {
+    unsigned long long x = *(unsigned long long const*)a, y = *(unsigned long long const*)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Prints the count and latency percentiles of one kind of command, in microseconds.
+ * @param name the kind
+ * @param latencies the latencies of the commands answered, sorted in place
+ * @param count the number of latencies
+ */
+static void printLatencies(char const* name, unsigned long long* latencies, size_t count) {
+    if (count == 0)
+        return;
+    qsort(latencies, count, sizeof(unsigned long long), byLatency);
+    static double const percentiles[] = { 0.50, 0.90, 0.99, 0.999 };
+    printf("%-10s %10zu", name, count);
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+        printf(" %10.1f", latencies[(size_t)(percentiles[i] * (count - 1))] / 1000.0);
+    printf(" %10.1f\n", latencies[count - 1] / 1000.0);
+}
+
+/**
+ * Starting point for the program: reads the trace, starts the drivers, replays the commands and prints the report.
+ * With -s <speed>, the trace is replayed that many times as fast as it was recorded; 0 sends every command as soon
+ * as the window allows. With -c <clients>, the commands are spread over that many driver processes. With -w
+ * <window>, at most that many commands per client are sent without an answer. The driver's command line follows the
+ * trace and defaults to ./driver; it must not use -t. quit commands are left out of the replay.
+ * @param argc number of command-line arguments
+ * @param argv list of command-line arguments
+ * @return Exit status: 0 for success, non-zero for errors.
+ */
+int main(int argc, char* argv[]) {
+    size_t clientCount = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "+s:c:w:")) != -1) {
+        if (opt == 's' && (speed = atof(optarg)) >= 0) {
+            continue;
+        } else if (opt == 'c' && atol(optarg) > 0) {
+            clientCount = atol(optarg);
+        } else if (opt == 'w' && atol(optarg) > 0) {
+            window = atol(optarg);
+        } else {
+            fprintf(stderr, "usage: %s [-s speed] [-c clients] [-w window] trace [driver [options...]]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-s speed] [-c clients] [-w window] trace [driver [options...]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    char const* path = argv[optind];
+    char* defaultDriver[] = { "./driver", NULL };
+    char* const* driverArgv = optind + 1 < argc ? argv + optind + 1 : defaultDriver;
+
+    // Every run splits the keys over the clients the same way.
+    setHashSeed(0);
+    TraceReader* reader = traceOpen(path);
+    Client* clients = (Client*)calloc(clientCount, sizeof(Client));
+    if (!reader || !clients) {
+        fprintf(stderr, "Unable to read trace %s.\n", path);
+        return EXIT_FAILURE;
+    }
+
+    // Read the whole trace first, so reading it doesn't hold up the replay.
+    Command* commands = NULL;
+    size_t count = 0, capacity = 0, skipped = 0;
+    TraceRecord record;
+    int got;
+    while ((got = traceNext(reader, &record)) == 1) {
+        char word[20];
+        if (record.len > MAX_COMMAND || (sscanf(record.command, "%19s", word) == 1 && strcmp(word, "quit") == 0)) {
+            skipped++;
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            Command* grown = (Command*)realloc(commands, capacity * sizeof(Command));
+            if (!grown) {
+                got = -1;
+                break;
+            }
+            commands = grown;
+        }
+        Command* command = &commands[count++];
+        if (!(command->line = (char*)malloc(record.len + 2))) {
+            got = -1;
+            break;
+        }
+        memcpy(command->line, record.command, record.len);
+        command->line[record.len] = '\n';
+        command->line[record.len + 1] = '\0';
+        command->len = record.len + 1;
+        command->nanos = record.nanos;
+        command->latency = 0;
+        command->kind = kindOf(command->line);
+        // Remember the route in the start field until the commands stop moving.
+        command->start = route(command->line, record.connection, clientCount);
+    }
+    traceReaderFree(reader);
+    if (got < 0) {
+        fprintf(stderr, "Trace %s is damaged or too large; replaying the %zu commands before that.\n", path, count);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (!addCommand(&clients[commands[i].start], &commands[i])) {
+            fprintf(stderr, "Unable to allocate the replay.\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    for (size_t c = 0; c < clientCount; c++) {
+        if (!startDriver(&clients[c], driverArgv)) {
+            fprintf(stderr, "Unable to start %s.\n", driverArgv[0]);
+            return EXIT_FAILURE;
+        }
+        pthread_mutex_init(&clients[c].lock, NULL);
+        pthread_cond_init(&clients[c].room, NULL);
+    }
+
+    // Start the clock once every driver is up and waiting for its first command.
+    for (size_t c = 0; c < clientCount; c++)
+        pthread_create(&clients[c].reader, NULL, readResponses, &clients[c]);
+    for (size_t c = 0; c < clientCount; c++) {
+        pthread_mutex_lock(&clients[c].lock);
+        while (!clients[c].ready && !clients[c].exited)
+            pthread_cond_wait(&clients[c].room, &clients[c].lock);
+        pthread_mutex_unlock(&clients[c].lock);
+    }
+    startNanos = traceClock();
+    for (size_t c = 0; c < clientCount; c++)
+        pthread_create(&clients[c].sender, NULL, sendCommands, &clients[c]);
+    size_t answered = 0;
+    for (size_t c = 0; c < clientCount; c++) {
+        pthread_join(clients[c].sender, NULL);
+        pthread_join(clients[c].reader, NULL);
+        waitpid(clients[c].pid, NULL, 0);
+        answered += clients[c].answered;
+        if (clients[c].answered < clients[c].count)
+            fprintf(stderr, "Client %zu's driver exited after %zu of %zu commands.\n", c, clients[c].answered,
+                    clients[c].count);
+    }
+    double seconds = (traceClock() - startNanos) / 1e9;
+
+    double traced = count ? commands[count - 1].nanos / 1e9 : 0;
+    printf("Replayed %zu commands on %zu client%s in %.3f s: %.0f commands/s.\n", answered, clientCount,
+           clientCount == 1 ? "" : "s", seconds, seconds > 0 ? answered / seconds : 0);
+    if (speed > 0)
+        printf("The trace spans %.3f s, replayed at %gx.\n", traced, speed);
+    else
+        printf("The trace spans %.3f s, replayed as fast as possible with %zu commands in flight per client.\n",
+               traced, window);
+    if (skipped)
+        printf("Left out %zu quit or overlong commands.\n", skipped);
+
+    printf("%-10s %10s %10s %10s %10s %10s %10s\n", "latency us", "count", "p50", "p90", "p99", "p99.9", "max");
+    unsigned long long* latencies = (unsigned long long*)malloc((count ? count : 1) * sizeof(unsigned long long));
+    if (!latencies)
+        return EXIT_FAILURE;
+    for (int kind = -1; kind <= kindCount; kind++) {
+        size_t n = 0;
+        for (size_t c = 0; c < clientCount; c++) {
+            for (size_t i = 0; i < clients[c].answered; i++) {
+                if (kind < 0 || clients[c].commands[i]->kind == kind)
+                    latencies[n++] = clients[c].commands[i]->latency;
+            }
+        }
+        printLatencies(kind < 0 ? "all" : kind == kindCount ? "other" : kinds[kind], latencies, n);
+    }
+
+    free(latencies);
+    for (size_t i = 0; i < count; i++)
+        free(commands[i].line);
+    free(commands);
+    for (size_t c = 0; c < clientCount; c++) {
+        free(clients[c].commands);
+        pthread_mutex_destroy(&clients[c].lock);
+        pthread_cond_destroy(&clients[c].room);
+    }
+    free(clients);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,585 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "replication.h"
+#include "snapshot.h"
+
+/**
+ * @file replication.c
+ * @author Jason Wang
+ * This program streams the changes made to a primary driver's map to replica drivers on the same machine, so reads
+ * can be spread over several processes that each hold a full copy.
+ * The primary listens on a Unix socket and numbers every command that changes the map; the numbers are offsets in
+ * its log. A replica that connects is bootstrapped by a forked child, which sees the map exactly as it was at the
+ * current offset and sends it as a snapshot, preceded by "HMREPL01", the offset and the snapshot's length. Commands
+ * logged while the child runs are queued for the replica and streamed after it, as command lines, so the replica
+ * applies precisely the commands its snapshot doesn't contain. The primary never waits on a replica: the stream is
+ * written without blocking whenever the driver asks, and a replica more than MAX_QUEUE bytes behind is dropped.
+ * A replica reads everything that has arrived at once and applies it as one batch, then acknowledges the offset it
+ * reached with "ack <offset>", so a replica that falls behind catches up with fewer, larger batches, and the
+ * primary knows how far behind each replica is.
+ */
+
+/** Magic string before the snapshot sent to a new replica. */
+#define REPLICATION_MAGIC "HMREPL01"
+
+/** Largest number of replicas connected at once. */
+#define MAX_REPLICAS 16
+
+/** Bytes of log a replica may fall behind by before the primary drops it. */
+#define MAX_QUEUE (64 << 20)
+
+/** Bytes of log queued for a replica after which it is sent even if the driver didn't ask. */
+#define FLUSH_BYTES 65536
+
+/** Bytes a replica reads at a time, and the most it reads into one batch. */
+#define READ_CHUNK (256 << 10)
+#define MAX_BATCH_BYTES (4 << 20)
+
+/**
+ * A replica connected to the primary.
+ */
+typedef struct {
+    int id;
+    int fd;
+    /** Child writing the replica's snapshot, or 0 once the log is being streamed. */
+    pid_t child;
+    /** Log not yet sent: its bytes from 'sent' to 'len'. */
+    char* queue;
+    size_t sent;
+    size_t len;
+    size_t capacity;
+    unsigned long long acked;
+    unsigned long long ackedAt;
+    /** Acknowledgement read in part. */
+    char ack[32];
+    size_t ackLen;
+} Link;
+
+/**
+ * The listening socket and the replicas of a primary.
+ */
+struct PrimaryStruct {
+    int listenFd;
+    char* path;
+    unsigned long long offset;
+    Link* links[MAX_REPLICAS];
+    size_t count;
+    int nextId;
+};
+
+/**
+ * A replica's connection to its primary and the log read but not applied yet.
+ */
+struct ReplicaStruct {
+    int fd;
+    char* buffer;
+    size_t len;
+    size_t capacity;
+    unsigned long long snapshotOffset;
+    unsigned long long applied;
+    unsigned long long batches;
+    unsigned long long largestBatch;
+    unsigned long long batchAt;
+};
+
+/**
+ * Reads the monotonic clock.
+ * @return nanoseconds since an arbitrary fixed point
+ */
+static unsigned long long now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Writes all of a buffer to a socket, waiting as long as it takes.
+ * @param fd the socket
+ * @param data the bytes
+ * @param len the number of bytes
+ * @return false if the socket failed
+ */
+static _Bool sendAll(int fd, void const* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        data = (char const*)data + n;
+        len -= n;
+    }
+    return 1;
+}
+
+/**
+ * Reads exactly a number of bytes from a socket, waiting as long as it takes.
+ * @param fd the socket
+ * @param data where the bytes are stored
+ * @param len the number of bytes
+ * @return false if the socket failed or was closed first
+ */
+static _Bool recvAll(int fd, void* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = recv(fd, data, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        data = (char*)data + n;
+        len -= n;
+    }
+    return 1;
+}
+
+/**
+ * Makes a Unix socket address for a path.
+ * @param path the path
+ * @param addr the address filled in
+ * @return false if the path is too long
+ */
+static _Bool socketAddress(char const* path, struct sockaddr_un* addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path))
+        return 0;
+    strcpy(addr->sun_path, path);
+    return 1;
+}
+
+/**
+ * Starts a primary listening for replicas on a Unix socket. A stale socket file at the path is replaced.
+ * @param path the path of the socket
+ * @return the primary, or NULL if the socket couldn't be made
+ */
+Primary* makePrimary(char const* path) {
+    struct sockaddr_un addr;
+    if (!socketAddress(path, &addr))
+        return NULL;
+    Primary* this = (Primary*)calloc(1, sizeof(Primary));
+    if (!this || !(this->path = strdup(path))) {
+        free(this);
+        return NULL;
+    }
+    this->listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (this->listenFd < 0 || bind(this->listenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(this->listenFd, MAX_REPLICAS) != 0) {
+        if (this->listenFd >= 0)
+            close(this->listenFd);
+        free(this->path);
+        free(this);
+        return NULL;
+    }
+    fcntl(this->listenFd, F_SETFL, O_NONBLOCK);
+    fcntl(this->listenFd, F_SETFD, FD_CLOEXEC);
+    this->nextId = 1;
+    return this;
+}
+
+/**
+ * Disconnects a replica, stopping the child writing its snapshot if it is still running.
+ * @param this the primary
+ * @param i the index of the replica
+ */
+static void dropLink(Primary* this, size_t i) {
+    Link* link = this->links[i];
+    if (link->child > 0) {
+        kill(link->child, SIGKILL);
+        waitpid(link->child, NULL, 0);
+    }
+    close(link->fd);
+    free(link->queue);
+    free(link);
+    this->links[i] = this->links[--this->count];
+}
+
+/**
+ * Writes a replica's snapshot in a forked child: the map as it is at this offset, which the child sees frozen while
+ * the primary carries on. The snapshot is built in memory first so its length can be sent ahead of it.
+ * @param fd the replica's socket
+ * @param map the map
+ * @param offset the offset the snapshot is taken at
+ */
+static void writeBootstrap(int fd, Map* map, unsigned long long offset) {
+    char* image = NULL;
+    size_t size = 0;
+    FILE* fp = open_memstream(&image, &size);
+    long written = fp ? snapshotWrite(map, fp) : -1;
+    if (!fp || fclose(fp) != 0 || written < 0)
+        _exit(1);
+    uint64_t header[2] = { offset, size };
+    _exit(sendAll(fd, REPLICATION_MAGIC, 8) && sendAll(fd, header, sizeof(header)) && sendAll(fd, image, size) ? 0
+                                                                                                             : 1);
+}
+
+/**
+ * Accepts replicas waiting to connect and starts a child writing the snapshot of each.
+ * @param this the primary
+ * @param map the map
+ */
+static void acceptReplicas(Primary* this, Map* map) {
+    int fd;
+    while ((fd = accept(this->listenFd, NULL, NULL)) >= 0) {
+        Link* link = this->count < MAX_REPLICAS ? (Link*)calloc(1, sizeof(Link)) : NULL;
+        if (!link) {
+            close(fd);
+            continue;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        pid_t pid = fork();
+        if (pid == 0)
+            writeBootstrap(fd, map, this->offset);
+        if (pid < 0) {
+            close(fd);
+            free(link);
+            continue;
+        }
+        link->id = this->nextId++;
+        link->fd = fd;
+        link->child = pid;
+        link->acked = this->offset;
+        link->ackedAt = now();
+        this->links[this->count++] = link;
+    }
+}
+
+/**
+ * Reads the acknowledgements a replica has sent.
+ * @param link the replica
+ * @return false if the replica disconnected
+ */
+static _Bool readAcks(Link* link) {
+    char data[256];
+    ssize_t n;
+    while ((n = recv(link->fd, data, sizeof(data), MSG_DONTWAIT)) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            if (data[i] != '\n') {
+                if (link->ackLen < sizeof(link->ack) - 1)
+                    link->ack[link->ackLen++] = data[i];
+                continue;
+            }
+            link->ack[link->ackLen] = '\0';
+            unsigned long long acked;
+            if (sscanf(link->ack, "ack %llu", &acked) == 1) {
+                link->acked = acked;
+                link->ackedAt = now();
+            }
+            link->ackLen = 0;
+        }
+    }
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+}
+
+/**
+ * Sends as much of a replica's queued log as its socket takes without blocking.
+ * @param link the replica
+ * @return false if the socket failed
+ */
+static _Bool sendQueued(Link* link) {
+    while (link->sent < link->len) {
+        ssize_t n = send(link->fd, link->queue + link->sent, link->len - link->sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0)
+            return 0;
+        link->sent += n;
+    }
+    if (link->sent == link->len)
+        link->sent = link->len = 0;
+    return 1;
+}
+
+/**
+ * Appends a command that changed the map to the log, queuing it for every replica.
+ * @param this the primary
+ * @param command the command line, without its newline
+ * @param len its length
+ */
+void primaryLog(Primary* this, char const* command, size_t len) {
+    this->offset++;
+    for (size_t i = 0; i < this->count;) {
+        Link* link = this->links[i];
+        if (link->len + len + 1 > link->capacity) {
+            // Reuse the space of the part already sent before growing.
+            if (link->sent > 0) {
+                memmove(link->queue, link->queue + link->sent, link->len - link->sent);
+                link->len -= link->sent;
+                link->sent = 0;
+            }
+            size_t capacity = link->capacity ? link->capacity : FLUSH_BYTES;
+            while (capacity < link->len + len + 1)
+                capacity *= 2;
+            char* grown = link->len + len + 1 <= MAX_QUEUE ? (char*)realloc(link->queue, capacity) : NULL;
+            if (!grown) {
+                fprintf(stderr, "Replica %d fell too far behind; dropped it.\n", link->id);
+                dropLink(this, i);
+                continue;
+            }
+            link->queue = grown;
+            link->capacity = capacity;
+        }
+        memcpy(link->queue + link->len, command, len);
+        link->queue[link->len + len] = '\n';
+        link->len += len + 1;
+        i++;
+    }
+}
+
+/**
+ * Lists the sockets the primary waits on while the driver is idle: new replicas, acknowledgements, and room to
+ * send queued log. A replica's bootstrap child can't be waited on, so the caller should poll with a timeout.
+ * @param this the primary
+ * @param fds where the sockets are stored
+ * @param max the most that can be stored
+ * @return the number stored
+ */
+int primaryPollFds(Primary* this, struct pollfd* fds, int max) {
+    int n = 0;
+    if (n < max)
+        fds[n++] = (struct pollfd){ this->listenFd, POLLIN, 0 };
+    for (size_t i = 0; i < this->count && n < max; i++) {
+        Link* link = this->links[i];
+        if (!link->child)
+            fds[n++] = (struct pollfd){ link->fd, POLLIN | (link->len > link->sent ? POLLOUT : 0), 0 };
+    }
+    return n;
+}
+
+/**
+ * Does whatever replication work is ready without blocking: accepts new replicas, starts streaming to those whose
+ * snapshot is done, reads acknowledgements and sends queued log. Log is sent when asked, or once enough of it is
+ * queued, so a busy primary sends it in large writes.
+ * @param this the primary
+ * @param map the map, for the snapshots of new replicas
+ * @param flush whether to send all queued log now
+ */
+void primaryService(Primary* this, Map* map, _Bool flush) {
+    acceptReplicas(this, map);
+    for (size_t i = 0; i < this->count;) {
+        Link* link = this->links[i];
+        int status;
+        if (link->child > 0 && waitpid(link->child, &status, WNOHANG) == link->child) {
+            link->child = 0;
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                fprintf(stderr, "Unable to send replica %d its snapshot; dropped it.\n", link->id);
+                dropLink(this, i);
+                continue;
+            }
+        }
+        if (!link->child &&
+            (!readAcks(link) || ((flush || link->len - link->sent >= FLUSH_BYTES) && !sendQueued(link)))) {
+            dropLink(this, i);
+            continue;
+        }
+        i++;
+    }
+}
+
+/**
+ * Reports the offset of the primary's log: the number of commands that changed the map since it started.
+ * @param this the primary
+ * @return the offset
+ */
+unsigned long long primaryOffset(Primary const* this) {
+    return this->offset;
+}
+
+/**
+ * Reports the state of every connected replica.
+ * @param this the primary
+ * @param status where the states are stored
+ * @param max the most that can be stored
+ * @return the number of replicas connected
+ */
+size_t primaryReplicas(Primary const* this, ReplicaStatus* status, size_t max) {
+    unsigned long long time = now();
+    for (size_t i = 0; i < this->count && i < max; i++) {
+        Link const* link = this->links[i];
+        status[i].id = link->id;
+        status[i].bootstrapping = link->child != 0;
+        status[i].acked = link->acked;
+        status[i].lag = this->offset - link->acked;
+        status[i].queued = link->len - link->sent;
+        status[i].ackAge = (time - link->ackedAt) / 1e9;
+    }
+    return this->count;
+}
+
+/**
+ * Disconnects every replica, stops listening and removes the socket file.
+ * @param this the primary
+ */
+void primaryFree(Primary* this) {
+    if (!this)
+        return;
+    while (this->count)
+        dropLink(this, this->count - 1);
+    close(this->listenFd);
+    unlink(this->path);
+    free(this->path);
+    free(this);
+}
+
+/**
+ * Tells the primary the offset a replica has reached.
+ * @param this the replica
+ */
+static void sendAck(Replica* this) {
+    char line[32];
+    int len = snprintf(line, sizeof(line), "ack %llu\n", this->applied);
+    if (send(this->fd, line, len, MSG_DONTWAIT | MSG_NOSIGNAL) != len) {
+        // The primary learns the offset from the next acknowledgement instead.
+    }
+}
+
+/**
+ * Connects to a primary as a replica and loads the snapshot it sends into a map, waiting until it has.
+ * @param path the path of the primary's socket
+ * @param map the map, normally empty
+ * @param loaded where the number of pairs loaded is stored
+ * @return the replica, or NULL if the primary couldn't be reached or its snapshot was damaged
+ */
+Replica* replicaConnect(char const* path, Map* map, long* loaded) {
+    struct sockaddr_un addr;
+    if (!socketAddress(path, &addr))
+        return NULL;
+    Replica* this = (Replica*)calloc(1, sizeof(Replica));
+    if (!this)
+        return NULL;
+    this->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    char magic[8];
+    uint64_t header[2];
+    char* image = NULL;
+    FILE* fp = NULL;
+    *loaded = -1;
+    if (this->fd >= 0 && connect(this->fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 &&
+        recvAll(this->fd, magic, sizeof(magic)) && memcmp(magic, REPLICATION_MAGIC, 8) == 0 &&
+        recvAll(this->fd, header, sizeof(header)) && (image = (char*)malloc(header[1] ? header[1] : 1)) &&
+        recvAll(this->fd, image, header[1]) && (fp = fmemopen(image, header[1], "rb")))
+        *loaded = snapshotRead(map, fp);
+    if (fp)
+        fclose(fp);
+    free(image);
+    if (*loaded < 0) {
+        if (this->fd >= 0)
+            close(this->fd);
+        free(this);
+        return NULL;
+    }
+    fcntl(this->fd, F_SETFD, FD_CLOEXEC);
+    this->snapshotOffset = this->applied = header[0];
+    this->batchAt = now();
+    sendAck(this);
+    return this;
+}
+
+/**
+ * Reports the socket a replica reads the log from, to wait on while the driver is idle.
+ * @param this the replica
+ * @return the socket, or -1 once the primary has gone
+ */
+int replicaFd(Replica const* this) {
+    return this->fd;
+}
+
+/**
+ * Applies all the log that has arrived from the primary as one batch, without blocking, and acknowledges it.
+ * If the primary has gone, the replica keeps its map as it is and stops reading.
+ * @param this the replica
+ * @param apply the function applying each command
+ * @param ctx passed to the function
+ * @return the number of commands applied
+ */
+size_t replicaApply(Replica* this, ReplicaApply apply, void* ctx) {
+    if (this->fd < 0)
+        return 0;
+    size_t received = 0;
+    _Bool closed = 0;
+    while (received < MAX_BATCH_BYTES) {
+        if (this->len + READ_CHUNK > this->capacity) {
+            size_t capacity = this->capacity ? this->capacity * 2 : 2 * READ_CHUNK;
+            char* grown = (char*)realloc(this->buffer, capacity);
+            if (!grown)
+                break;
+            this->buffer = grown;
+            this->capacity = capacity;
+        }
+        ssize_t n = recv(this->fd, this->buffer + this->len, READ_CHUNK, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0) {
+            closed = 1;
+            break;
+        }
+        this->len += n;
+        received += n;
+    }
+
+    size_t applied = 0, start = 0;
+    char* nl;
+    while ((nl = memchr(this->buffer + start, '\n', this->len - start))) {
+        *nl = '\0';
+        apply(this->buffer + start, nl - (this->buffer + start), ctx);
+        start = nl + 1 - this->buffer;
+        applied++;
+    }
+    memmove(this->buffer, this->buffer + start, this->len - start);
+    this->len -= start;
+
+    if (applied) {
+        this->applied += applied;
+        this->batches++;
+        if (applied > this->largestBatch)
+            this->largestBatch = applied;
+        this->batchAt = now();
+        sendAck(this);
+    }
+    if (closed) {
+        fprintf(stderr, "Lost the primary at offset %llu; serving the data as of then.\n", this->applied);
+        close(this->fd);
+        this->fd = -1;
+    }
+    return applied;
+}
+
+/**
+ * Reports how far a replica has got.
+ * @param this the replica
+ * @param stats where the report is stored
+ */
+void replicaStats(Replica const* this, ReplicaStats* stats) {
+    stats->connected = this->fd >= 0;
+    stats->snapshotOffset = this->snapshotOffset;
+    stats->applied = this->applied;
+    stats->batches = this->batches;
+    stats->largestBatch = this->largestBatch;
+    stats->batchAge = (now() - this->batchAt) / 1e9;
+}
+
+/**
+ * Disconnects a replica from its primary.
+ * @param this the replica
+ */
+void replicaFree(Replica* this) {
+    if (!this)
+        return;
+    if (this->fd >= 0)
+        close(this->fd);
+    free(this->buffer);
+    free(this);
+}
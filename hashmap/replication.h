@@ -0,0 +1,66 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <poll.h>
+#include <stddef.h>
+#include "map.h"
+
+/** State of one replica as the primary sees it. */
+typedef struct {
+    /** Number the primary gave the replica when it connected. */
+    int id;
+
+    /** True while the replica's snapshot is still being written, before the log is streamed to it. */
+    _Bool bootstrapping;
+
+    /** Offset of the log the replica has acknowledged applying, and how many entries it is behind. */
+    unsigned long long acked;
+    unsigned long long lag;
+
+    /** Bytes of the log waiting to be sent to it. */
+    size_t queued;
+
+    /** Seconds since its last acknowledgement. */
+    double ackAge;
+} ReplicaStatus;
+
+/** State of a replica as it sees itself. */
+typedef struct {
+    /** True while the primary is still connected. */
+    _Bool connected;
+
+    /** Offset of the log the snapshot was taken at, and of the last entry applied. */
+    unsigned long long snapshotOffset;
+    unsigned long long applied;
+
+    /** Number of batches applied, and entries in the largest. */
+    unsigned long long batches;
+    unsigned long long largestBatch;
+
+    /** Seconds since the last batch was applied. */
+    double batchAge;
+} ReplicaStats;
+
+// Applies one entry of the log, a NUL-terminated command line without its newline.
+typedef void (*ReplicaApply)(char* command, size_t len, void* ctx);
+
+// Define your Primary and Replica structs here
+typedef struct PrimaryStruct Primary;
+typedef struct ReplicaStruct Replica;
+
+/*Function prototypes*/
+Primary* makePrimary(char const* path);
+void primaryLog(Primary* this, char const* command, size_t len);
+int primaryPollFds(Primary* this, struct pollfd* fds, int max);
+void primaryService(Primary* this, Map* map, _Bool flush);
+unsigned long long primaryOffset(Primary const* this);
+size_t primaryReplicas(Primary const* this, ReplicaStatus* status, size_t max);
+void primaryFree(Primary* this);
+
+Replica* replicaConnect(char const* path, Map* map, long* loaded);
+int replicaFd(Replica const* this);
+size_t replicaApply(Replica* this, ReplicaApply apply, void* ctx);
+void replicaStats(Replica const* this, ReplicaStats* stats);
+void replicaFree(Replica* this);
+
+#endif // REPLICATION_H
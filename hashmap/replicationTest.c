@@ -0,0 +1,132 @@
+// Simple test program for replication: a replica loading the primary's snapshot, then following its log.
+
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "input.h"
+#include "replication.h"
+
+#define PATH "replicationTest.sock"
+#define KEYS 20000
+#define UPDATES 50000
+
+// Arguments and result of connecting a replica on its own thread, while the primary serves it.
+typedef struct {
+    Map* map;
+    Replica* replica;
+    long loaded;
+    volatile sig_atomic_t done;
+} Connection;
+
+static void* connectReplica(void* arg) {
+    Connection* connection = (Connection*)arg;
+    connection->replica = replicaConnect(PATH, connection->map, &connection->loaded);
+    connection->done = 1;
+    return NULL;
+}
+
+// Applies a "set <key> <value>" or "remove <key>" line to the map in ctx.
+static void applyLine(char* command, size_t len, void* ctx) {
+    Map* map = (Map*)ctx;
+    assert(strlen(command) == len);
+    char* key = strchr(command, ' ') + 1;
+    char* value = strchr(key, ' ');
+    if (strncmp(command, "remove ", 7) == 0) {
+        VType probe;
+        borrowValue(key, strlen(key), &probe);
+        assert(mapRemove(map, &probe));
+        return;
+    }
+    assert(strncmp(command, "set ", 4) == 0 && value);
+    mapSet(map, parseValue(key, value - key), parseValue(value + 1, strlen(value + 1)));
+}
+
+// Applies a command to the primary's map and logs it.
+static void run(Primary* primary, Map* map, char* command) {
+    size_t len = strlen(command);
+    applyLine(command, len, map);
+    primaryLog(primary, command, len);
+}
+
+// mapForEach callback checking every pair of one map is in the map in ctx.
+static _Bool sameIn(VType const* key, VType const* value, void* ctx) {
+    VType* other = mapGet((Map*)ctx, key);
+    assert(other && equalsVType(value, other));
+    return 1;
+}
+
+int main() {
+    char line[64];
+    Map* map = makeMap(0, NULL);
+    for (int i = 0; i < KEYS; i++) {
+        snprintf(line, sizeof(line), "set key:%d %d", i, i);
+        applyLine(line, strlen(line), map);
+    }
+    Primary* primary = makePrimary(PATH);
+    assert(primary && primaryOffset(primary) == 0);
+    snprintf(line, sizeof(line), "set key:%d first", KEYS);
+    run(primary, map, line);
+
+    // The replica loads the map as it was when it connected, at the offset of the log then.
+    Connection connection = { makeMap(0, NULL), NULL, -1, 0 };
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, connectReplica, &connection) == 0);
+    while (!connection.done) {
+        primaryService(primary, map, 1);
+        usleep(1000);
+    }
+    pthread_join(thread, NULL);
+    Replica* replica = connection.replica;
+    assert(replica && connection.loaded == KEYS + 1 && mapSize(connection.map) == KEYS + 1);
+    ReplicaStats stats;
+    replicaStats(replica, &stats);
+    assert(stats.connected && stats.snapshotOffset == 1 && stats.applied == 1 && stats.batches == 0);
+
+    // Later changes reach the replica through the log, in order, and it acknowledges them all.
+    for (int i = 0; i < UPDATES; i++) {
+        if (i % 5 == 4)
+            snprintf(line, sizeof(line), "remove key:%d", i / 5);
+        else
+            snprintf(line, sizeof(line), "set key:%d %d", i % (KEYS * 2), -i);
+        run(primary, map, line);
+    }
+    assert(primaryOffset(primary) == UPDATES + 1);
+    size_t applied = 0;
+    ReplicaStatus status[2];
+    for (int tries = 0; tries < 10000; tries++) {
+        primaryService(primary, map, 1);
+        applied += replicaApply(replica, applyLine, connection.map);
+        if (applied == UPDATES && primaryReplicas(primary, status, 2) == 1 && status[0].lag == 0)
+            break;
+        usleep(1000);
+    }
+    assert(applied == UPDATES);
+    assert(primaryReplicas(primary, status, 2) == 1 && !status[0].bootstrapping && status[0].id == 1);
+    assert(status[0].acked == UPDATES + 1 && status[0].lag == 0 && status[0].queued == 0);
+    replicaStats(replica, &stats);
+    assert(stats.applied == UPDATES + 1 && stats.batches >= 1 && stats.largestBatch <= UPDATES);
+    assert(mapSize(connection.map) == mapSize(map));
+    mapForEach(map, sameIn, connection.map);
+
+    // A replica that disconnects is dropped, and none can connect once the primary has gone.
+    replicaFree(replica);
+    for (int tries = 0; tries < 1000 && primaryReplicas(primary, status, 2) != 0; tries++) {
+        primaryService(primary, map, 1);
+        usleep(1000);
+    }
+    assert(primaryReplicas(primary, status, 2) == 0);
+    primaryFree(primary);
+    assert(access(PATH, F_OK) != 0);
+    long loaded;
+    assert(!replicaConnect(PATH, connection.map, &loaded) && loaded == -1);
+    assert(mapSize(connection.map) == mapSize(map));
+
+    mapFree(connection.map);
+    mapFree(map);
+    return EXIT_SUCCESS;
+}
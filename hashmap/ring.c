@@ -0,0 +1,228 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ring.h"
+#include "siphash.h"
+
+/**
+ * @file ring.c
+ * @author Jason Wang
+ * This program provides a consistent-hashing ring that spreads keys over a changing set of nodes.
+ * Every node is placed on a circle of 32-bit hashes at many points, its virtual nodes, and a key belongs to the node
+ * of the first point at or after the key's hash, wrapping around. Adding a node only takes over the arcs just before
+ * its own points, and removing one only hands its arcs to the points after them, so either moves about one key in
+ * the number of nodes and leaves every other key where it was. With enough points per node, each node's share of the
+ * circle stays close to an even one.
+ * Points and keys are hashed with SipHash under a fixed key, so every ring with the same nodes places keys the same
+ * way, in every process and every run.
+ */
+
+/** Key the points and the keys are hashed under. */
+static uint64_t const ringKey[2] = { 0x736f6d6570736575ULL, 0x646f72616e646f6dULL };
+
+/**
+ * One point of a node on the circle.
+ */
+typedef struct {
+    unsigned int hash;
+    int node;
+} Point;
+
+/**
+ * The points of every node, sorted by hash.
+ */
+struct RingStruct {
+    int replicas;
+    Point* points;
+    size_t count;
+    size_t capacity;
+    size_t nodes;
+};
+
+/**
+ * Makes a ring with no nodes.
+ * @param replicas the number of points each node gets, or 0 for RING_REPLICAS
+ * @return the ring, or NULL on memory allocation failure
+ */
+Ring* makeRing(int replicas) {
+    Ring* this = (Ring*)calloc(1, sizeof(Ring));
+    if (this)
+        this->replicas = replicas > 0 ? replicas : RING_REPLICAS;
+    return this;
+}
+
+/**
+ * Makes a copy of a ring, which places every key the same way until either one changes.
+ * @param this the ring
+ * @return the copy, or NULL on memory allocation failure
+ */
+Ring* ringCopy(Ring const* this) {
+    Ring* copy = (Ring*)malloc(sizeof(Ring));
+    if (!copy)
+        return NULL;
+    *copy = *this;
+    copy->points = NULL;
+    if (this->count && !(copy->points = (Point*)malloc(this->count * sizeof(Point)))) {
+        free(copy);
+        return NULL;
+    }
+    if (this->count)
+        memcpy(copy->points, this->points, this->count * sizeof(Point));
+    copy->capacity = this->count;
+    return copy;
+}
+
+/**
+ * Compares two points for sorting around the circle; points with equal hashes are ordered by node, so the owner of
+ * such a hash doesn't depend on the order the nodes were added in.
+ * @param a the first point
+ * @param b the second point
+ * @return negative, zero or positive as the first comes before, with or after the second
+ */
+static int byHash(void const* a, void const* b) {
+    Point const* x = (Point const*)a;
+    Point const* y = (Point const*)b;
+    if (x->hash != y->hash)
+        return x->hash < y->hash ? -1 : 1;
+    return (x->node > y->node) - (x->node < y->node);
+}
+
+/**
+ * Tells whether a node is on a ring.
+ * @param this the ring
+ * @param node the node
+ * @return true if it has points on the ring
+ */
+_Bool ringHas(Ring const* this, int node) {
+    for (size_t i = 0; i < this->count; i++) {
+        if (this->points[i].node == node)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Adds a node to a ring, taking over about one key in the new number of nodes from the others.
+ * @param this the ring
+ * @param node the node, a number of the caller's choosing
+ * @return false if the node is already on the ring or on memory allocation failure
+ */
+_Bool ringAdd(Ring* this, int node) {
+    if (ringHas(this, node))
+        return 0;
+    if (this->count + this->replicas > this->capacity) {
+        size_t capacity = this->capacity ? this->capacity * 2 : (size_t)this->replicas * 4;
+        while (capacity < this->count + this->replicas)
+            capacity *= 2;
+        Point* grown = (Point*)realloc(this->points, capacity * sizeof(Point));
+        if (!grown)
+            return 0;
+        this->points = grown;
+        this->capacity = capacity;
+    }
+    for (int i = 0; i < this->replicas; i++) {
+        uint32_t id[2] = { (uint32_t)node, (uint32_t)i };
+        this->points[this->count++] = (Point){ (unsigned int)sipHash(id, sizeof(id), ringKey), node };
+    }
+    qsort(this->points, this->count, sizeof(Point), byHash);
+    this->nodes++;
+    return 1;
+}
+
+/**
+ * Removes a node from a ring, handing its keys to the nodes whose points follow its own.
+ * @param this the ring
+ * @param node the node
+ * @return false if the node isn't on the ring
+ */
+_Bool ringRemove(Ring* this, int node) {
+    size_t kept = 0;
+    for (size_t i = 0; i < this->count; i++) {
+        if (this->points[i].node != node)
+            this->points[kept++] = this->points[i];
+    }
+    if (kept == this->count)
+        return 0;
+    this->count = kept;
+    this->nodes--;
+    return 1;
+}
+
+/**
+ * Reports the number of nodes on a ring.
+ * @param this the ring
+ * @return the number of nodes
+ */
+size_t ringNodes(Ring const* this) {
+    return this->nodes;
+}
+
+/**
+ * Hashes a key to its place on the circle. Integer keys hash like the Text of their digits.
+ * @param key the key
+ * @return the hash
+ */
+unsigned int ringHash(VType const* key) {
+    return keyedHashVType(key, ringKey);
+}
+
+/**
+ * Finds the node owning a place on the circle: the node of the first point at or after it, wrapping around.
+ * @param this the ring
+ * @param hash the place
+ * @return the node, or -1 if the ring has none
+ */
+int ringOwner(Ring const* this, unsigned int hash) {
+    if (this->count == 0)
+        return -1;
+    size_t lo = 0, hi = this->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (this->points[mid].hash < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return this->points[lo == this->count ? 0 : lo].node;
+}
+
+/**
+ * Finds the node owning a key.
+ * @param this the ring
+ * @param key the key
+ * @return the node, or -1 if the ring has none
+ */
+int ringKeyOwner(Ring const* this, VType const* key) {
+    return ringOwner(this, ringHash(key));
+}
+
+/**
+ * Measures the share of the circle a node owns, which is the share of keys it can expect.
+ * @param this the ring
+ * @param node the node
+ * @return the share, from 0 to 1
+ */
+double ringShare(Ring const* this, int node) {
+    double owned = 0;
+    for (size_t i = 0; i < this->count; i++) {
+        if (this->points[i].node != node)
+            continue;
+        // A point owns the arc from the point before it, exclusive, up to itself.
+        unsigned int previous = this->points[i == 0 ? this->count - 1 : i - 1].hash;
+        owned += (unsigned int)(this->points[i].hash - previous);
+    }
+    if (this->nodes == 1 && owned == 0)
+        return 1;
+    return owned / 4294967296.0;
+}
+
+/**
+ * Frees a ring.
+ * @param this the ring
+ */
+void ringFree(Ring* this) {
+    if (!this)
+        return;
+    free(this->points);
+    free(this);
+}
@@ -0,0 +1,26 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+#include "vtype.h"
+
+// Number of points each node gets on the ring when makeRing is given 0.
+#define RING_REPLICAS 160
+
+// Define your Ring struct here
+typedef struct RingStruct Ring;
+
+/*Function prototypes*/
+Ring* makeRing(int replicas);
+Ring* ringCopy(Ring const* this);
+_Bool ringAdd(Ring* this, int node);
+_Bool ringRemove(Ring* this, int node);
+_Bool ringHas(Ring const* this, int node);
+size_t ringNodes(Ring const* this);
+unsigned int ringHash(VType const* key);
+int ringOwner(Ring const* this, unsigned int hash);
+int ringKeyOwner(Ring const* this, VType const* key);
+double ringShare(Ring const* this, int node);
+void ringFree(Ring* this);
+
+#endif // RING_H
@@ -0,0 +1,87 @@
+// Simple test program for the consistent-hashing ring: even shares, and adding or removing a node moving only its keys.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "input.h"
+#include "ring.h"
+
+#define NODES 8
+#define KEYS 100000
+
+// Finds the owner of the key "key:<i>", or of the Integer i when integer is set.
+static int ownerOf(Ring const* ring, int i, _Bool integer) {
+    char text[32];
+    int len = integer ? snprintf(text, sizeof(text), "%d", i) : snprintf(text, sizeof(text), "key:%d", i);
+    VType key;
+    borrowValue(text, len, &key);
+    return ringKeyOwner(ring, &key);
+}
+
+int main() {
+    static int owners[KEYS];
+
+    // An empty ring has no owners.
+    Ring* ring = makeRing(0);
+    assert(ring && ringNodes(ring) == 0 && ringOwner(ring, 12345) == -1);
+
+    // A single node owns everything.
+    assert(ringAdd(ring, 3) && !ringAdd(ring, 3) && ringNodes(ring) == 1);
+    assert(ownerOf(ring, 1, 0) == 3 && ringShare(ring, 3) == 1);
+
+    // Every node gets close to an even share of the keys.
+    for (int node = 0; node < NODES; node++) {
+        if (node != 3)
+            assert(ringAdd(ring, node));
+    }
+    int counts[NODES + 1] = { 0 };
+    double shares = 0;
+    for (int node = 0; node < NODES; node++)
+        shares += ringShare(ring, node);
+    assert(shares > 0.999999 && shares < 1.000001);
+    for (int i = 0; i < KEYS; i++) {
+        owners[i] = ownerOf(ring, i, 0);
+        assert(owners[i] >= 0 && owners[i] < NODES);
+        counts[owners[i]]++;
+    }
+    for (int node = 0; node < NODES; node++) {
+        assert(counts[node] > KEYS / NODES * 3 / 4 && counts[node] < KEYS / NODES * 5 / 4);
+        double share = (double)counts[node] / KEYS;
+        assert(share > ringShare(ring, node) - 0.01 && share < ringShare(ring, node) + 0.01);
+    }
+
+    // Integer keys go where the Text of their digits does, and a copy places keys the same way.
+    Ring* copy = ringCopy(ring);
+    for (int i = 0; i < 1000; i++) {
+        assert(ownerOf(ring, i, 1) == ownerOf(copy, i, 1));
+        assert(ownerOf(copy, i, 0) == owners[i]);
+    }
+
+    // Adding a node moves about an even share of the keys, all of them to the new node.
+    assert(ringAdd(ring, NODES));
+    int moved = 0;
+    for (int i = 0; i < KEYS; i++) {
+        int owner = ownerOf(ring, i, 0);
+        if (owner != owners[i]) {
+            assert(owner == NODES);
+            moved++;
+        }
+    }
+    assert(moved > KEYS / (NODES + 1) * 3 / 4 && moved < KEYS / (NODES + 1) * 5 / 4);
+
+    // Removing a node moves only its own keys, and removing the added one puts every key back.
+    assert(ringRemove(ring, 5) && !ringRemove(ring, 5) && !ringHas(ring, 5) && ringNodes(ring) == NODES);
+    for (int i = 0; i < KEYS; i++) {
+        int owner = ownerOf(ring, i, 0);
+        assert(owner != 5);
+        assert(owners[i] == 5 || owner == owners[i] || owner == NODES);
+    }
+    assert(ringRemove(ring, NODES) && ringAdd(ring, 5));
+    for (int i = 0; i < KEYS; i++)
+        assert(ownerOf(ring, i, 0) == owners[i]);
+
+    ringFree(copy);
+    ringFree(ring);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,986 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "input.h"
+#include "ring.h"
+
+/**
+ * @file router.c
+ * @author Jason Wang
+ * This program spreads the keys of one map over several driver processes on the same machine and reads commands
+ * like a single driver, so a client sees one map and never the partitioning.
+ * Each backend is a driver started with -i whose standard input and output are one end of a Unix socket pair. A
+ * consistent-hashing ring with many points per backend chooses the backend owning each key. Commands on a key are
+ * written to their backend without waiting for earlier answers, so the backends work in parallel while the router
+ * reads on; a response ends where the backend prints its next prompt, and responses are printed in the order the
+ * commands were read. size is sent to every backend and the counts are added up; stats, compact, hotkeys and latency
+ * are sent to every backend and their answers printed one after another.
+ * backend add starts a new backend and backend remove <id> retires one. The ring changes at once, but keys move in
+ * small batches between client commands and whenever no command is waiting: the router lists a source backend's
+ * keys in byte order with keys, copies the ones now owned elsewhere with get and set, and removes them from the
+ * source. Until a key's batch has moved, commands on it still go to the backend it was on, which the router tells
+ * from how far through the source's keys the move has got, so every command sees every key throughout.
+ */
+
+/** Prompt a driver prints before reading each command. */
+#define PROMPT "cmd> "
+#define PROMPT_LEN (sizeof(PROMPT) - 1)
+
+/** Longest command line a driver reads, with its newline; it rejects longer ones whole. */
+#define MAX_LINE (1024 * 1024)
+
+/** Largest number of backends at once; their ids are below it. */
+#define MAX_BACKENDS 64
+
+/** Number of backends started when -n isn't given. */
+#define DEFAULT_BACKENDS 2
+
+/** Number of keys listed and moved at a time, and the client commands run between two such batches. */
+#define MOVE_BATCH 64
+#define MOVE_EVERY 32
+
+/** Size of the buffer a backend's output is read into. */
+#define READ_BUFFER 65536
+
+/**
+ * Growable text.
+ */
+typedef struct {
+    char* data;
+    size_t len;
+    size_t capacity;
+} Buffer;
+
+/**
+ * How the answers to a request are put together: the answer of its one backend, the sum of the numbers every
+ * backend answered, or every backend's answer under a heading.
+ */
+enum { FORWARD, SUM, GATHER };
+
+/**
+ * A command waiting for the answers of its backends.
+ */
+typedef struct RequestStruct {
+    int kind;
+    /** Number of answers still to come. */
+    int pending;
+    long long number;
+    /** Answer of a FORWARD request, or the router's own answer. */
+    Buffer text;
+    /** Answer of each backend to a GATHER request, by id. */
+    Buffer* parts;
+    /** Next client request, in the order they were read. */
+    struct RequestStruct* next;
+} Request;
+
+/**
+ * A driver process and the requests it hasn't answered yet.
+ */
+typedef struct {
+    int id;
+    pid_t pid;
+    /** The router's end of the socket pair; -1 once the driver has exited. */
+    int fd;
+    /** Set once the driver printed its first prompt. */
+    _Bool ready;
+    /** Number of characters of a prompt just read, and the output since the last prompt. */
+    size_t matched;
+    Buffer response;
+    /** Requests sent to the driver, in the order its answers will come, in a circular array. */
+    Request** waiting;
+    size_t first;
+    size_t count;
+    size_t capacity;
+    /** Set while keys are to be moved off this backend, and the last key moved so far once one batch has been. */
+    _Bool moving;
+    _Bool started;
+    Buffer cursor;
+} Backend;
+
+/** Backends by id; NULL for unused ids. */
+static Backend* backends[MAX_BACKENDS];
+
+/** Ring keys belong to, and while keys are being moved, the ring they belonged to before. */
+static Ring* ring;
+static Ring* previous = NULL;
+
+/** Backend being removed, or -1. */
+static int leaving = -1;
+
+/** Keys moved by the current or last change of backends. */
+static unsigned long long movedKeys = 0;
+
+/** Command line the backends are started with. */
+static char** driverArgv;
+
+/** Client requests not printed yet, oldest first. */
+static Request* oldest = NULL;
+static Request* newest = NULL;
+
+/** Whether the prompt for the next response was already printed. */
+static _Bool prompted = 0;
+
+/**
+ * Allocates memory, ending the program if there is none; the router can't drop a request and stay consistent.
+ * @param size the number of bytes, set to zero
+ * @return the memory
+ */
+static void* allocate(size_t size) {
+    void* memory = calloc(1, size);
+    if (!memory) {
+        fprintf(stderr, "Unable to allocate memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    return memory;
+}
+
+/**
+ * Appends bytes to a buffer, keeping it NUL-terminated.
+ * @param buffer the buffer
+ * @param data the bytes
+ * @param len the number of bytes
+ */
+static void bufferAppend(Buffer* buffer, void const* data, size_t len) {
+    if (buffer->len + len + 1 > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 64;
+        while (capacity < buffer->len + len + 1)
+            capacity *= 2;
+        char* grown = (char*)realloc(buffer->data, capacity);
+        if (!grown) {
+            fprintf(stderr, "Unable to allocate memory.\n");
+            exit(EXIT_FAILURE);
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+    buffer->data[buffer->len] = '\0';
+}
+
+/**
+ * Appends formatted text to a buffer.
+ * @param buffer the buffer
+ * @param format the format, as for printf
+ */
+static void bufferPrintf(Buffer* buffer, char const* format, ...) {
+    char text[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    bufferAppend(buffer, text, len < (int)sizeof(text) ? (size_t)len : sizeof(text) - 1);
+}
+
+/**
+ * Makes a request. A client request is queued to be printed in turn; the router waits on others itself.
+ * @param kind FORWARD, SUM or GATHER
+ * @param client whether a client sent it
+ * @return the request
+ */
+static Request* makeRequest(int kind, _Bool client) {
+    Request* request = (Request*)allocate(sizeof(Request));
+    request->kind = kind;
+    if (kind == GATHER)
+        request->parts = (Buffer*)allocate(MAX_BACKENDS * sizeof(Buffer));
+    if (client) {
+        if (newest)
+            newest->next = request;
+        else
+            oldest = request;
+        newest = request;
+    }
+    return request;
+}
+
+/**
+ * Frees a request.
+ * @param request the request
+ */
+static void freeRequest(Request* request) {
+    for (int id = 0; request->parts && id < MAX_BACKENDS; id++)
+        free(request->parts[id].data);
+    free(request->parts);
+    free(request->text.data);
+    free(request);
+}
+
+/**
+ * Answers a client command from the router itself.
+ * @param text the answer
+ */
+static void reply(char const* text) {
+    bufferAppend(&makeRequest(FORWARD, 1)->text, text, strlen(text));
+}
+
+/**
+ * Adds one backend's answer to the request it answers.
+ * @param request the request
+ * @param backend the backend
+ * @param text the answer
+ * @param len its length
+ */
+static void answer(Request* request, Backend* backend, char const* text, size_t len) {
+    if (request->kind == SUM)
+        request->number += strtoll(text, NULL, 10);
+    else if (request->kind == GATHER)
+        bufferAppend(&request->parts[backend->id], text, len);
+    else
+        bufferAppend(&request->text, text, len);
+    request->pending--;
+}
+
+/**
+ * Prints the responses to client commands that are complete, up to the first that isn't, each after its prompt.
+ */
+static void printReady() {
+    while (oldest && oldest->pending == 0) {
+        Request* request = oldest;
+        if (!prompted)
+            printf(PROMPT);
+        prompted = 0;
+        if (request->kind == SUM) {
+            printf("%lld\n\n", request->number);
+        } else if (request->kind == GATHER) {
+            for (int id = 0; id < MAX_BACKENDS; id++) {
+                if (request->parts[id].data)
+                    printf("backend %d:\n%s", id, request->parts[id].data);
+            }
+        } else if (request->text.len) {
+            fwrite(request->text.data, 1, request->text.len, stdout);
+        }
+        if (!(oldest = request->next))
+            newest = NULL;
+        freeRequest(request);
+    }
+}
+
+/**
+ * Takes the oldest request a backend hasn't answered off its queue.
+ * @param backend the backend
+ * @return the request, or NULL if none is waiting
+ */
+static Request* nextWaiting(Backend* backend) {
+    if (backend->count == 0)
+        return NULL;
+    Request* request = backend->waiting[backend->first];
+    backend->first = (backend->first + 1) % backend->capacity;
+    backend->count--;
+    return request;
+}
+
+/**
+ * Marks a backend whose driver exited or whose socket failed, and answers everything it still owed with an error.
+ * @param backend the backend
+ */
+static void backendExited(Backend* backend) {
+    if (backend->fd < 0)
+        return;
+    close(backend->fd);
+    backend->fd = -1;
+    waitpid(backend->pid, NULL, 0);
+    fprintf(stderr, "Backend %d exited.\n", backend->id);
+    char text[64];
+    int len = snprintf(text, sizeof(text), "Backend %d exited.\n", backend->id);
+    Request* request;
+    while ((request = nextWaiting(backend)))
+        answer(request, backend, text, len);
+}
+
+/**
+ * Reads what a backend's driver has printed, handing each response to the request it answers once the prompt after
+ * it arrives. The first prompt comes before any command.
+ * @param backend the backend
+ */
+static void readBackend(Backend* backend) {
+    static char data[READ_BUFFER];
+    ssize_t n = read(backend->fd, data, sizeof(data));
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+        return;
+    if (n <= 0) {
+        backendExited(backend);
+        return;
+    }
+
+    static char const prompt[] = PROMPT;
+    ssize_t from = 0;
+    for (ssize_t i = 0; i < n; i++) {
+        if (data[i] == prompt[backend->matched])
+            backend->matched++;
+        else
+            backend->matched = data[i] == prompt[0];
+        if (backend->matched < PROMPT_LEN)
+            continue;
+
+        // The prompt may have started in an earlier read, so take it off the response after appending.
+        bufferAppend(&backend->response, data + from, i + 1 - from);
+        backend->response.len -= PROMPT_LEN;
+        backend->response.data[backend->response.len] = '\0';
+        from = i + 1;
+        backend->matched = 0;
+        Request* request = backend->ready ? nextWaiting(backend) : NULL;
+        if (request)
+            answer(request, backend, backend->response.data, backend->response.len);
+        backend->ready = 1;
+        backend->response.len = 0;
+    }
+    bufferAppend(&backend->response, data + from, n - from);
+}
+
+/**
+ * Waits until a backend has something to read, or one given can be written to, and reads what has arrived.
+ * Complete client responses are printed.
+ * @param writer the backend to wait to write to, or NULL
+ * @return false if no backend is left to wait for
+ */
+static _Bool pump(Backend* writer) {
+    struct pollfd fds[MAX_BACKENDS];
+    Backend* polled[MAX_BACKENDS];
+    int n = 0;
+    for (int id = 0; id < MAX_BACKENDS; id++) {
+        Backend* backend = backends[id];
+        if (!backend || backend->fd < 0)
+            continue;
+        fds[n] = (struct pollfd){ backend->fd, POLLIN | (backend == writer ? POLLOUT : 0), 0 };
+        polled[n++] = backend;
+    }
+    if (n == 0)
+        return 0;
+    if (poll(fds, n, -1) < 0)
+        return errno == EINTR;
+    for (int i = 0; i < n; i++) {
+        if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+            readBackend(polled[i]);
+    }
+    printReady();
+    return 1;
+}
+
+/**
+ * Writes a command to a backend for a request, reading from the backends whenever the socket is full so that no
+ * driver is ever left blocked on its output while the router is blocked on its input.
+ * @param backend the backend
+ * @param request the request it answers
+ * @param line the command, with its newline
+ * @param len its length
+ */
+static void sendTo(Backend* backend, Request* request, char const* line, size_t len) {
+    if (backend->fd < 0) {
+        bufferPrintf(request->kind == GATHER ? &request->parts[backend->id] : &request->text,
+                     "Backend %d exited.\n", backend->id);
+        return;
+    }
+    if (backend->count == backend->capacity) {
+        size_t capacity = backend->capacity ? backend->capacity * 2 : 64;
+        Request** grown = (Request**)allocate(capacity * sizeof(Request*));
+        for (size_t i = 0; i < backend->count; i++)
+            grown[i] = backend->waiting[(backend->first + i) % backend->capacity];
+        free(backend->waiting);
+        backend->waiting = grown;
+        backend->first = 0;
+        backend->capacity = capacity;
+    }
+    backend->waiting[(backend->first + backend->count++) % backend->capacity] = request;
+    request->pending++;
+
+    size_t written = 0;
+    while (written < len && backend->fd >= 0) {
+        ssize_t n = send(backend->fd, line + written, len - written, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n > 0)
+            written += n;
+        else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            backendExited(backend);
+        else
+            pump(backend);
+    }
+}
+
+/**
+ * Sends a command to every backend, in the order of their ids.
+ * @param request the request every backend answers
+ * @param line the command, with its newline
+ * @param len its length
+ */
+static void broadcast(Request* request, char const* line, size_t len) {
+    for (int id = 0; id < MAX_BACKENDS; id++) {
+        if (backends[id])
+            sendTo(backends[id], request, line, len);
+    }
+}
+
+/**
+ * Waits for every answer to a request.
+ * @param request the request
+ */
+static void await(Request* request) {
+    while (request->pending > 0 && pump(NULL))
+        ;
+}
+
+/**
+ * Waits for every backend to answer every command sent to it, printing the client responses.
+ */
+static void drain() {
+    for (int id = 0; id < MAX_BACKENDS; id++) {
+        while (backends[id] && backends[id]->count > 0 && pump(NULL))
+            ;
+    }
+    printReady();
+}
+
+/**
+ * Starts a backend: a driver whose standard input and output are one end of a Unix socket pair. Waits for its
+ * first prompt, so it is ready for commands.
+ * @param id the id of the backend
+ * @return the backend, or NULL if the driver couldn't be started
+ */
+static Backend* startBackend(int id) {
+    int ends[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, ends) != 0)
+        return NULL;
+    // Keep backends started later from inheriting this one's socket, so closing it ends the driver.
+    fcntl(ends[0], F_SETFD, FD_CLOEXEC);
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(ends[1], STDIN_FILENO);
+        dup2(ends[1], STDOUT_FILENO);
+        close(ends[0]);
+        close(ends[1]);
+        execvp(driverArgv[0], driverArgv);
+        fprintf(stderr, "Unable to run %s: %s\n", driverArgv[0], strerror(errno));
+        _exit(127);
+    }
+    close(ends[1]);
+    if (pid < 0) {
+        close(ends[0]);
+        return NULL;
+    }
+
+    Backend* backend = (Backend*)allocate(sizeof(Backend));
+    backend->id = id;
+    backend->pid = pid;
+    backend->fd = ends[0];
+    backends[id] = backend;
+    while (!backend->ready && backend->fd >= 0 && pump(NULL))
+        ;
+    if (!backend->ready) {
+        backends[id] = NULL;
+        free(backend->response.data);
+        free(backend);
+        return NULL;
+    }
+    return backend;
+}
+
+/**
+ * Stops a backend: closing its socket ends the driver's input, so it exits.
+ * @param backend the backend, which owes no answers
+ */
+static void stopBackend(Backend* backend) {
+    if (backend->fd >= 0) {
+        close(backend->fd);
+        waitpid(backend->pid, NULL, 0);
+    }
+    backends[backend->id] = NULL;
+    free(backend->waiting);
+    free(backend->response.data);
+    free(backend->cursor.data);
+    free(backend);
+}
+
+/**
+ * Compares a key to the last key moved off a backend in the byte order a driver lists keys in. Integer keys are
+ * listed by their decimal text, so they are compared that way.
+ * @param key the key as a client wrote it
+ * @param keyLen its length
+ * @param cursor the key moved last, as the backend listed it
+ * @return negative, zero or positive as the key comes before, is or comes after the cursor
+ */
+static int compareKey(char const* key, size_t keyLen, Buffer const* cursor) {
+    char digits[16];
+    int integer;
+    if (parseInteger(key, keyLen, &integer)) {
+        keyLen = snprintf(digits, sizeof(digits), "%d", integer);
+        key = digits;
+    }
+    int cmp = memcmp(key, cursor->data, keyLen < cursor->len ? keyLen : cursor->len);
+    if (cmp != 0)
+        return cmp;
+    return (keyLen > cursor->len) - (keyLen < cursor->len);
+}
+
+/**
+ * Finds the backend holding a key. While keys are being moved, a key that now belongs to another backend stays on
+ * the one it was on until its batch has been moved.
+ * @param key the key as a client wrote it
+ * @param keyLen its length
+ * @return the backend
+ */
+static Backend* ownerOf(char const* key, size_t keyLen) {
+    VType k;
+    borrowValue(key, keyLen, &k);
+    unsigned int hash = ringHash(&k);
+    Backend* owner = backends[ringOwner(ring, hash)];
+    if (previous) {
+        Backend* before = backends[ringOwner(previous, hash)];
+        if (before != owner && before->moving && (!before->started || compareKey(key, keyLen, &before->cursor) > 0))
+            return before;
+    }
+    return owner;
+}
+
+/**
+ * Tells whether a command reads or updates a single key, so it goes to the backend owning the key.
+ * @param cmd the command
+ * @return true for set, get, remove, incr, decr, incrby and append
+ */
+static _Bool isKeyCommand(char const* cmd) {
+    static char const* const commands[] = { "set", "get", "remove", "incr", "decr", "incrby", "append" };
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if (strcmp(cmd, commands[i]) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Splits the next whitespace-separated word off a line.
+ * @param pos a pointer to the current position in the line, advanced past the word
+ * @param len where the length of the word is stored
+ * @return a pointer to the first character of the word, or NULL if the rest of the line is blank
+ */
+static char* nextWord(char** pos, size_t* len) {
+    char* start = *pos;
+    while (isspace((unsigned char)*start))
+        start++;
+    if (*start == '\0')
+        return NULL;
+    char* end = start;
+    while (*end && !isspace((unsigned char)*end))
+        end++;
+    *len = end - start;
+    *pos = end;
+    return start;
+}
+
+/**
+ * Starts a command line on a key in a buffer, replacing what it held.
+ * @param line the buffer
+ * @param command the command
+ * @param key the key
+ */
+static void keyLine(Buffer* line, char const* command, char const* key) {
+    line->len = 0;
+    bufferAppend(line, command, strlen(command));
+    bufferAppend(line, " ", 1);
+    bufferAppend(line, key, strlen(key));
+}
+
+/**
+ * Copies a value to the backend that now owns its key. A value too long for one command line is sent as a set of
+ * its first part followed by appends of the rest, cut between two non-blank characters, since the driver trims the
+ * blanks around a value.
+ * @param to the backend
+ * @param request the request its answers are counted against
+ * @param key the key
+ * @param value the value as get printed it, without its newline
+ * @param len the length of the value
+ * @return false if the key is too long to leave room for any of the value
+ */
+static _Bool copyValue(Backend* to, Request* request, char const* key, char const* value, size_t len) {
+    static Buffer line;
+    size_t keyLen = strlen(key);
+    if (keyLen + sizeof("append  \n") >= MAX_LINE)
+        return 0;
+    size_t room = MAX_LINE - keyLen - sizeof("append  \n");
+    for (size_t start = 0; start < len || start == 0;) {
+        size_t end = len - start > room ? start + room : len;
+        while (end < len && end > start + 1 &&
+               (isspace((unsigned char)value[end - 1]) || isspace((unsigned char)value[end])))
+            end--;
+        keyLine(&line, start == 0 ? "set" : "append", key);
+        bufferAppend(&line, " ", 1);
+        bufferAppend(&line, value + start, end - start);
+        bufferAppend(&line, "\n", 1);
+        sendTo(to, request, line.data, line.len);
+        start = end;
+    }
+    return 1;
+}
+
+/**
+ * Finishes a change of backends once every key that had to move has: forgets the old ring and, once it has answered
+ * everything sent to it, stops the backend being removed.
+ */
+static void finishMove() {
+    drain();
+    ringFree(previous);
+    previous = NULL;
+    if (leaving >= 0) {
+        stopBackend(backends[leaving]);
+        leaving = -1;
+    }
+}
+
+/**
+ * Moves the next batch of keys while backends change: lists the next keys of the first backend keys are moving off,
+ * copies those owned elsewhere now to their new backends and removes them from it. No client command is sent while
+ * a batch moves, so none can see a key on both backends or on neither.
+ */
+static void moveKeys() {
+    Backend* from = NULL;
+    for (int id = 0; id < MAX_BACKENDS && !from; id++) {
+        if (backends[id] && backends[id]->moving)
+            from = backends[id];
+    }
+    if (!from) {
+        finishMove();
+        return;
+    }
+    drain();
+
+    static Buffer line;
+    line.len = 0;
+    bufferPrintf(&line, "keys %d", MOVE_BATCH);
+    if (from->started) {
+        bufferAppend(&line, " ", 1);
+        bufferAppend(&line, from->cursor.data, from->cursor.len);
+    }
+    bufferAppend(&line, "\n", 1);
+    Request* listing = makeRequest(FORWARD, 0);
+    sendTo(from, listing, line.data, line.len);
+    await(listing);
+
+    // Keys have no blanks, so any line with one is either the cursor or an error.
+    char* keys[MOVE_BATCH];
+    Request* values[MOVE_BATCH];
+    int count = 0;
+    char* cursor = NULL;
+    _Bool failed = 0;
+    for (char* key = strtok(listing->text.data ? listing->text.data : "", "\n"); key; key = strtok(NULL, "\n")) {
+        if (strncmp(key, "cursor: ", 8) == 0) {
+            cursor = key + 8;
+        } else if (strchr(key, ' ') || count == MOVE_BATCH) {
+            fprintf(stderr, "Unable to list the keys of backend %d: %s\n", from->id, key);
+            failed = 1;
+            break;
+        } else {
+            VType k;
+            borrowValue(key, strlen(key), &k);
+            if (ringKeyOwner(ring, &k) == from->id)
+                continue;
+            keys[count] = key;
+            values[count] = makeRequest(FORWARD, 0);
+            keyLine(&line, "get", key);
+            bufferAppend(&line, "\n", 1);
+            sendTo(from, values[count++], line.data, line.len);
+        }
+    }
+
+    Request* moves = makeRequest(FORWARD, 0);
+    for (int i = 0; i < count; i++) {
+        await(values[i]);
+        Buffer* value = &values[i]->text;
+        if (value->len > 0 && value->data[value->len - 1] == '\n')
+            value->len--;
+        if (value->len == 0 || (value->len == 14 && strncmp(value->data, "Key not found.", 14) == 0)) {
+            freeRequest(values[i]);
+            continue;
+        }
+        VType k;
+        borrowValue(keys[i], strlen(keys[i]), &k);
+        if (copyValue(backends[ringKeyOwner(ring, &k)], moves, keys[i], value->data, value->len)) {
+            keyLine(&line, "remove", keys[i]);
+            bufferAppend(&line, "\n", 1);
+            sendTo(from, moves, line.data, line.len);
+            movedKeys++;
+        } else {
+            fprintf(stderr, "Unable to move key %s: too long.\n", keys[i]);
+        }
+        freeRequest(values[i]);
+    }
+    await(moves);
+    freeRequest(moves);
+
+    if (cursor && !failed) {
+        from->cursor.len = 0;
+        bufferAppend(&from->cursor, cursor, strlen(cursor));
+        from->started = 1;
+    } else {
+        from->moving = 0;
+    }
+    freeRequest(listing);
+}
+
+/**
+ * Starts moving keys after the ring changed: every backend named starts from its first key.
+ * @param id the backend to move keys off, or -1 for every backend but the one added
+ * @param added the backend added, or -1
+ */
+static void startMove(int id, int added) {
+    movedKeys = 0;
+    for (int i = 0; i < MAX_BACKENDS; i++) {
+        Backend* backend = backends[i];
+        if (backend && i != added && (id < 0 || i == id)) {
+            backend->moving = 1;
+            backend->started = 0;
+        }
+    }
+}
+
+/**
+ * Runs a backend command: list, add or remove <id>. Only one change of backends runs at a time.
+ * @param pos the rest of the command line
+ */
+static void backendCommand(char* pos) {
+    size_t len, idLen;
+    char* action = nextWord(&pos, &len);
+    char* idText = action ? nextWord(&pos, &idLen) : NULL;
+    char text[160];
+    int id;
+    if (action && len == 4 && strncmp(action, "list", 4) == 0 && !idText) {
+        Request* request = makeRequest(FORWARD, 1);
+        for (id = 0; id < MAX_BACKENDS; id++) {
+            Backend* backend = backends[id];
+            if (!backend)
+                continue;
+            bufferPrintf(&request->text, "backend %d: pid %d, %.1f%% of keys%s%s\n", id, (int)backend->pid,
+                         100 * ringShare(ring, id), id == leaving ? ", leaving" : "",
+                         backend->fd < 0 ? ", exited" : "");
+        }
+        if (previous)
+            bufferPrintf(&request->text, "moving keys: %llu moved so far\n", movedKeys);
+    } else if (action && len == 3 && strncmp(action, "add", 3) == 0 && !idText) {
+        for (id = 0; id < MAX_BACKENDS && backends[id]; id++)
+            ;
+        if (previous) {
+            reply("Keys are still moving; try again later.\n");
+        } else if (id == MAX_BACKENDS) {
+            reply("Too many backends.\n");
+        } else if (!startBackend(id)) {
+            reply("Unable to start a backend.\n");
+        } else if (!(previous = ringCopy(ring)) || !ringAdd(ring, id)) {
+            fprintf(stderr, "Unable to allocate memory.\n");
+            exit(EXIT_FAILURE);
+        } else {
+            startMove(-1, id);
+            snprintf(text, sizeof(text), "Added backend %d.\n", id);
+            reply(text);
+        }
+    } else if (action && len == 6 && strncmp(action, "remove", 6) == 0 && idText &&
+               parseInteger(idText, idLen, &id) && !nextWord(&pos, &len)) {
+        if (previous) {
+            reply("Keys are still moving; try again later.\n");
+        } else if (id < 0 || id >= MAX_BACKENDS || !backends[id]) {
+            reply("No such backend.\n");
+        } else if (ringNodes(ring) == 1) {
+            reply("Unable to remove the last backend.\n");
+        } else if (!(previous = ringCopy(ring))) {
+            fprintf(stderr, "Unable to allocate memory.\n");
+            exit(EXIT_FAILURE);
+        } else {
+            ringRemove(ring, id);
+            leaving = id;
+            startMove(id, -1);
+            snprintf(text, sizeof(text), "Removing backend %d.\n", id);
+            reply(text);
+        }
+    } else {
+        reply("Invalid 'backend' command format.\n");
+    }
+}
+
+/**
+ * Routes one client command: a command on a key to the backend holding the key, size, stats, compact, hotkeys and
+ * latency to every backend, and backend to the router itself. Commands that need the whole map in one place are
+ * refused.
+ * @param input the command line, with its newline
+ * @return false for quit
+ */
+static _Bool route(char* input) {
+    char cmd[20];
+    size_t len = strlen(input);
+    if (sscanf(input, "%19s", cmd) != 1) {
+        reply("Invalid command.\n");
+        return 1;
+    }
+    char* pos = strstr(input, cmd) + strlen(cmd);
+
+    if (isKeyCommand(cmd)) {
+        size_t keyLen = 0;
+        char* key = nextWord(&pos, &keyLen);
+        sendTo(ownerOf(key ? key : "", keyLen), makeRequest(FORWARD, 1), input, len);
+    } else if (strcmp(cmd, "size") == 0) {
+        broadcast(makeRequest(SUM, 1), input, len);
+    } else if (strcmp(cmd, "stats") == 0 || strcmp(cmd, "compact") == 0 || strcmp(cmd, "hotkeys") == 0 ||
+               strcmp(cmd, "latency") == 0) {
+        broadcast(makeRequest(GATHER, 1), input, len);
+    } else if (strcmp(cmd, "backend") == 0) {
+        backendCommand(pos);
+    } else if (strcmp(cmd, "quit") == 0) {
+        return 0;
+    } else {
+        static char const* const wholeMap[] = { "scan", "keys", "range", "min", "max", "succ", "import", "bgsave",
+                                                "bgstatus", "freeze", "fget" };
+        char const* refusal = "Unknown command.\n";
+        for (size_t i = 0; i < sizeof(wholeMap) / sizeof(wholeMap[0]); i++) {
+            if (strcmp(cmd, wholeMap[i]) == 0)
+                refusal = "Not available through the router.\n";
+        }
+        reply(refusal);
+    }
+    return 1;
+}
+
+/**
+ * Input read ahead of the commands run, so the router can tell whether another command is waiting.
+ */
+typedef struct {
+    char data[65536];
+    size_t start;
+    size_t end;
+    _Bool eof;
+} InputBuffer;
+
+/**
+ * Tells whether a whole command, or the end of the input, can be read without blocking.
+ * @param in the input read ahead
+ * @return true if reading won't block
+ */
+static _Bool inputWaiting(InputBuffer* in) {
+    if (in->eof || memchr(in->data + in->start, '\n', in->end - in->start))
+        return 1;
+    struct pollfd fd = { STDIN_FILENO, POLLIN, 0 };
+    return poll(&fd, 1, 0) > 0;
+}
+
+/**
+ * Reads the next line of standard input, as getline would. A line longer than MAX_LINE is read to its end and
+ * dropped, as a driver drops it.
+ * @param in the input read ahead
+ * @param line where the line is stored, with its newline
+ * @return 1 if a line was read, 0 at the end of the input, or -1 if the line was too long
+ */
+static int readInput(InputBuffer* in, Buffer* line) {
+    line->len = 0;
+    _Bool dropped = 0;
+    while (1) {
+        size_t buffered = in->end - in->start;
+        char* nl = memchr(in->data + in->start, '\n', buffered);
+        size_t n = nl ? (size_t)(nl + 1 - (in->data + in->start)) : buffered;
+        if (line->len + n > MAX_LINE)
+            dropped = 1;
+        if (!dropped)
+            bufferAppend(line, in->data + in->start, n);
+        in->start += n;
+        if (nl || in->eof)
+            return dropped ? -1 : line->len > 0;
+
+        in->start = in->end = 0;
+        ssize_t got = read(STDIN_FILENO, in->data, sizeof(in->data));
+        if (got > 0)
+            in->end = got;
+        else if (got == 0 || errno != EINTR)
+            in->eof = 1;
+    }
+}
+
+/**
+ * Starting point for the program: starts the backends, then reads commands from standard input and prints the
+ * responses like a single driver would, until quit or the end of the input.
+ * With -n <backends>, that many backends are started (2 by default). With -v <points>, each backend gets that many
+ * points on the ring (160 by default). The driver's command line follows the options and defaults to ./driver; -i is
+ * added to it, and every backend gets the same options, so it must not use -P, -s or -t.
+ * @param argc number of command-line arguments
+ * @param argv list of command-line arguments
+ * @return Exit status: 0 for success, non-zero for errors.
+ */
+int main(int argc, char* argv[]) {
+    int count = DEFAULT_BACKENDS;
+    int points = RING_REPLICAS;
+    int opt;
+    while ((opt = getopt(argc, argv, "+n:v:")) != -1) {
+        if (opt == 'n' && atoi(optarg) > 0 && atoi(optarg) <= MAX_BACKENDS) {
+            count = atoi(optarg);
+        } else if (opt == 'v' && atoi(optarg) > 0) {
+            points = atoi(optarg);
+        } else {
+            fprintf(stderr, "usage: %s [-n backends] [-v points] [driver [options...]]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // The driver's own command line, with -i inserted so a backend can list its keys when they move.
+    int options = argc - optind;
+    driverArgv = (char**)allocate((options + 3) * sizeof(char*));
+    driverArgv[0] = options > 0 ? argv[optind] : "./driver";
+    driverArgv[1] = "-i";
+    for (int i = 1; i < options; i++)
+        driverArgv[i + 1] = argv[optind + i];
+
+    if (!(ring = makeRing(points))) {
+        fprintf(stderr, "Unable to allocate memory.\n");
+        return EXIT_FAILURE;
+    }
+    for (int id = 0; id < count; id++) {
+        if (!startBackend(id) || !ringAdd(ring, id)) {
+            fprintf(stderr, "Unable to start backend %d with %s.\n", id, driverArgv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    static InputBuffer in;
+    Buffer input = { NULL, 0, 0 };
+    int sinceMove = 0;
+    while (1) {
+        // Nothing to read: answer everything outstanding and use the pause to move keys.
+        if (!inputWaiting(&in)) {
+            drain();
+            while (previous && !inputWaiting(&in))
+                moveKeys();
+            if (!prompted)
+                printf(PROMPT);
+            prompted = 1;
+            fflush(stdout);
+        }
+        int got = readInput(&in, &input);
+        if (!got)
+            break;
+        if (got < 0) {
+            reply("Line too long.\n");
+            continue;
+        }
+        // Only a last line without a newline needs one for the backend to see it end.
+        if (input.data[input.len - 1] != '\n')
+            bufferAppend(&input, "\n", 1);
+        if (!route(input.data))
+            break;
+        printReady();
+        if (previous && ++sinceMove >= MOVE_EVERY) {
+            moveKeys();
+            sinceMove = 0;
+        }
+    }
+
+    drain();
+    if (!prompted)
+        printf(PROMPT);
+    fflush(stdout);
+    for (int id = 0; id < MAX_BACKENDS; id++) {
+        if (backends[id])
+            stopBackend(backends[id]);
+    }
+    ringFree(previous);
+    ringFree(ring);
+    free(input.data);
+    free(driverArgv);
+    return EXIT_SUCCESS;
+}
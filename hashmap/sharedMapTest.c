@@ -0,0 +1,156 @@
+// Simple test program for the shared map: one writer updating it while reader processes query it.
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "sharedmap.h"
+
+#define KEYS 50000
+#define ROUNDS 20
+#define READERS 3
+
+// Checks that an Integer key's value is a Text "v:<key>:<round>" for one of the rounds, and returns that round.
+static int checkValue(SharedMap* map, int key) {
+    VType k = { 'I', 0, { .integer = key }, 0 };
+    VType* value = sharedMapGet(map, &k);
+    assert(value && value->type == 'T');
+    int parsedKey, round, used = 0;
+    assert(sscanf(value->value.text, "v:%d:%d%n", &parsedKey, &round, &used) == 2);
+    assert(parsedKey == key && used == (int)value->length && round >= 0 && round < ROUNDS);
+    freeVType(value);
+    return round;
+}
+
+// Stores the value checkValue expects for a key in a round.
+static void setValue(SharedMap* map, int key, int round) {
+    char text[32];
+    snprintf(text, sizeof(text), "v:%d:%d", key, round);
+    VType k = { 'I', 0, { .integer = key }, 0 };
+    VType* value = makeText(text);
+    assert(sharedMapSet(map, &k, value));
+    freeVType(value);
+}
+
+// Reads random keys in a child process until the writer sets "done", then checks the final round everywhere.
+static int reader(char const* path, int id) {
+    SharedMap* map = sharedMapOpen(path, 0);
+    assert(map);
+    VType done = { 'T', 4, { .text = "done" }, 0 };
+    unsigned int state = id * 2654435761U + 1;
+    long reads = 0;
+    VType* flag;
+    while (!(flag = sharedMapGet(map, &done))) {
+        state = state * 1103515245U + 12345U;
+        checkValue(map, (int)((state >> 8) % KEYS));
+        reads++;
+    }
+    freeVType(flag);
+    for (int i = 0; i < KEYS; i++)
+        assert(checkValue(map, i) == ROUNDS - 1);
+
+    SharedStats stats;
+    sharedMapStats(map, &stats);
+    printf("reader %d: %ld reads while writing, %zu retried\n", id, reads, stats.retries);
+    sharedMapFree(map);
+    fflush(stdout);
+    return 0;
+}
+
+int main() {
+    char path[] = "/tmp/sharedMapTestXXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+
+    SharedMap* map = makeSharedMap(path, 64 << 20);
+    assert(map);
+    for (int i = 0; i < KEYS; i++)
+        setValue(map, i, 0);
+    assert(sharedMapSize(map) == KEYS);
+    for (int i = 0; i < KEYS; i++)
+        assert(checkValue(map, i) == 0);
+
+    // Text keys, Integer values, overwrites and removes.
+    VType* key = makeText("counter");
+    VType* one = makeInteger(1);
+    VType* two = makeInteger(2);
+    assert(sharedMapSet(map, key, one) && sharedMapSet(map, key, two));
+    VType* got = sharedMapGet(map, key);
+    assert(got && got->type == 'I' && got->value.integer == 2);
+    freeVType(got);
+    assert(sharedMapRemove(map, key) && !sharedMapRemove(map, key) && !sharedMapGet(map, key));
+    assert(sharedMapSize(map) == KEYS);
+
+    // Only one writer at a time, but any number of readers, and readers can't write.
+    assert(!sharedMapOpen(path, 1));
+    SharedMap* peek = sharedMapOpen(path, 0);
+    assert(peek && sharedMapSize(peek) == KEYS && !sharedMapSet(peek, key, one));
+    sharedMapFree(peek);
+
+    // Readers in other processes always see whole values while the writer rewrites every key, round after round.
+    pid_t pids[READERS];
+    for (int r = 0; r < READERS; r++) {
+        pids[r] = fork();
+        assert(pids[r] >= 0);
+        if (pids[r] == 0)
+            _exit(reader(path, r));
+    }
+    for (int round = 1; round < ROUNDS; round++) {
+        for (int i = 0; i < KEYS; i++)
+            setValue(map, i, round);
+    }
+    VType* doneKey = makeText("done");
+    assert(sharedMapSet(map, doneKey, one));
+    for (int r = 0; r < READERS; r++) {
+        int status;
+        assert(waitpid(pids[r], &status, 0) == pids[r]);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    SharedStats stats;
+    sharedMapStats(map, &stats);
+    printf("%zu keys, %zu buckets, %zu of %zu bytes, version %llu\n", stats.keys, stats.buckets, stats.bytes,
+           stats.maxBytes, (unsigned long long)stats.version);
+    assert(stats.buckets >= KEYS && stats.version % 2 == 0);
+    // Rewrites reuse the blocks they free, so the file doesn't grow with the number of rounds.
+    assert(stats.bytes < 8 << 20);
+    sharedMapFree(map);
+
+    // The table outlives its writer.
+    map = sharedMapOpen(path, 1);
+    assert(map && sharedMapSize(map) == KEYS + 1);
+    assert(checkValue(map, KEYS / 2) == ROUNDS - 1);
+    sharedMapFree(map);
+
+    // A writer that dies in the middle of an update leaves the version odd. The file is refused from then on, and a
+    // reader that already had it open gives up on lookups instead of waiting forever. The version follows the magic,
+    // the size cap and the SipHash key in the header.
+    SharedMap* stuck = sharedMapOpen(path, 0);
+    assert(stuck);
+    fd = open(path, O_RDWR);
+    uint64_t version;
+    assert(fd >= 0 && pread(fd, &version, sizeof(version), 32) == sizeof(version) && version % 2 == 0);
+    version++;
+    assert(pwrite(fd, &version, sizeof(version), 32) == sizeof(version));
+    assert(!sharedMapOpen(path, 0) && !sharedMapOpen(path, 1));
+    VType k = { 'I', 0, { .integer = 1 }, 0 };
+    assert(!sharedMapGet(stuck, &k));
+    version++;
+    assert(pwrite(fd, &version, sizeof(version), 32) == sizeof(version));
+    assert(checkValue(stuck, 1) == ROUNDS - 1);
+    close(fd);
+    sharedMapFree(stuck);
+
+    freeVType(key);
+    freeVType(one);
+    freeVType(two);
+    freeVType(doneKey);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,616 @@
+#include <fcntl.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sharedmap.h"
+#include "siphash.h"
+
+/**
+ * @file sharedmap.c
+ * @author Jason Wang
+ * This program provides a hash table that lives in a file mapped shared into every process that opens it, so many
+ * reader processes on one machine query a single copy of the data while one writer process updates it.
+ * Nothing in the file is a pointer: buckets and chain links are byte offsets from the start of the file, and keys and
+ * values are stored inline in their nodes, so every process can map the file at any address. Each process reserves
+ * the most the file may ever grow to when it maps it, so the file can grow without being remapped, and opening a
+ * table only reads its header, whatever its size.
+ * Readers never take a lock and never write to the file. The writer bumps a version counter to an odd value before it
+ * relinks anything and back to an even value after (a seqlock); a reader notes the version, copies out what it is
+ * looking for, and starts over if the version was odd or has changed since. Until then everything it reads may be
+ * half updated, so it checks every offset it follows against the size of the file before using it.
+ */
+
+/** Magic string at the start of every shared map file. */
+#define SHARED_MAGIC "HMSHM001"
+
+/** Bytes at the start of the file reserved for the header. */
+#define HEADER_BYTES 4096
+
+/** Number of buckets in a new table; the count is always a power of two, doubled when the keys outnumber it. */
+#define INITIAL_BUCKETS 1024
+
+/** Smallest block the file's allocator hands out; blocks are powers of two from this size up. */
+#define MIN_BLOCK 32
+
+/** Number of block sizes, and so of free lists. */
+#define BLOCK_CLASSES 48
+
+/** Number of times in a row a lookup finds an update under way before it checks whether the writer is still there. */
+#define WRITER_CHECK_SPINS 1024
+
+/**
+ * Header at the start of the file. The writer updates it; readers only read seq, fileBytes, table and buckets.
+ */
+typedef struct {
+    char magic[8];
+    uint64_t maxBytes;
+    uint64_t sipKey[2];
+
+    /** Version counter of the seqlock: odd while the writer is relinking nodes. */
+    uint64_t seq;
+
+    /** Current size of the file; offsets below it can be read without a fault. It only ever grows. */
+    uint64_t fileBytes;
+
+    /** Offset of the first byte never allocated. */
+    uint64_t top;
+
+    /** Offset and length of the bucket array. */
+    uint64_t table;
+    uint64_t buckets;
+
+    /** Number of pairs. */
+    uint64_t count;
+
+    /** First free block of each size, linked through the first 8 bytes of each. */
+    uint64_t freeLists[BLOCK_CLASSES];
+} Header;
+
+/**
+ * A pair in the file, followed directly by the key's bytes and then the value's: 4 bytes for an Integer, the
+ * characters for a Text.
+ */
+typedef struct {
+    uint64_t next;
+    uint64_t hash;
+    uint32_t keyLen;
+    uint32_t valueLen;
+    char keyType;
+    char valueType;
+    char pad[6];
+} Node;
+
+/**
+ * Define the SharedMap structure: one process's view of a shared map file.
+ */
+struct SharedMapStruct {
+    /** The open file, locked exclusively if this process is the writer. */
+    int fd;
+
+    /** Start of the mapping, which spans the most the file may grow to. */
+    unsigned char* base;
+    Header* header;
+
+    /** True if this process may update the table. */
+    _Bool writer;
+
+    /** Number of lookups retried because they overlapped an update. */
+    size_t retries;
+
+    /** Buffer values are copied into while a lookup is in progress. */
+    char* scratch;
+    size_t scratchSize;
+};
+
+/**
+ * Rounds a number of bytes up to the block size that holds it.
+ * @param bytes The number of bytes.
+ * @param cls Where the index of the block size is stored.
+ * @return The block size, a power of two.
+ */
+static size_t blockSize(size_t bytes, int* cls) {
+    size_t size = MIN_BLOCK;
+    *cls = 0;
+    while (size < bytes) {
+        size *= 2;
+        (*cls)++;
+    }
+    return size;
+}
+
+/**
+ * Grows the file so that it holds at least a number of bytes, doubling it to keep growth rare.
+ * @param this A pointer to the SharedMap, which must be the writer.
+ * @param needed The number of bytes the file must hold.
+ * @return true if the file is big enough, false if it may not grow that far or can't be extended.
+ */
+static _Bool growFile(SharedMap* this, uint64_t needed) {
+    Header* h = this->header;
+    if (needed <= h->fileBytes)
+        return 1;
+    if (needed > h->maxBytes)
+        return 0;
+
+    uint64_t size = h->fileBytes * 2;
+    if (size < needed)
+        size = needed;
+    long page = sysconf(_SC_PAGESIZE);
+    size = (size + page - 1) / page * page;
+    if (size > h->maxBytes)
+        size = h->maxBytes;
+    if (ftruncate(this->fd, size) != 0)
+        return 0;
+
+    // Readers may follow offsets below the new size as soon as they see it, so it is published after the file grows.
+    __atomic_store_n(&h->fileBytes, size, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/**
+ * Allocates a block in the file, from the free list of its size or past everything allocated so far.
+ * @param this A pointer to the SharedMap, which must be the writer.
+ * @param bytes The number of bytes needed.
+ * @return The offset of the block, or 0 if the file is full.
+ */
+static uint64_t allocBlock(SharedMap* this, size_t bytes) {
+    Header* h = this->header;
+    int cls;
+    size_t size = blockSize(bytes, &cls);
+    if (cls >= BLOCK_CLASSES)
+        return 0;
+
+    uint64_t off = h->freeLists[cls];
+    if (off) {
+        memcpy(&h->freeLists[cls], this->base + off, sizeof(uint64_t));
+        return off;
+    }
+    if (!growFile(this, h->top + size))
+        return 0;
+    off = h->top;
+    h->top += size;
+    return off;
+}
+
+/**
+ * Returns a block to the free list of its size. Readers still looking at it will see the version change and retry.
+ * @param this A pointer to the SharedMap, which must be the writer.
+ * @param off The offset of the block.
+ * @param bytes The number of bytes it was allocated for.
+ */
+static void freeBlock(SharedMap* this, uint64_t off, size_t bytes) {
+    int cls;
+    blockSize(bytes, &cls);
+    memcpy(this->base + off, &this->header->freeLists[cls], sizeof(uint64_t));
+    this->header->freeLists[cls] = off;
+}
+
+/**
+ * Starts an update that readers must not see half done, by making the version odd.
+ * @param h A pointer to the header.
+ */
+static void beginWrite(Header* h) {
+    __atomic_store_n(&h->seq, h->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/**
+ * Ends an update, making the version even again so readers can trust what they read.
+ * @param h A pointer to the header.
+ */
+static void endWrite(Header* h) {
+    __atomic_store_n(&h->seq, h->seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Hashes a key with SipHash under the key stored in the file, so every process places keys the same way.
+ * @param this A pointer to the SharedMap.
+ * @param key A pointer to the key.
+ * @return The 64-bit hash of the key.
+ */
+static uint64_t keyHash(SharedMap const* this, VType const* key) {
+    if (key->type == 'I') {
+        int32_t value = key->value.integer;
+        return sipHash(&value, sizeof(value), this->header->sipKey) ^ 0x49;
+    }
+    return sipHash(key->value.text, key->length, this->header->sipKey);
+}
+
+/**
+ * Gives the bytes a VType is stored as in a node.
+ * @param v A pointer to the VType.
+ * @param integer Storage for an Integer's 4 bytes.
+ * @param len Where the number of bytes is stored.
+ * @return A pointer to the bytes.
+ */
+static void const* payload(VType const* v, int32_t* integer, uint32_t* len) {
+    if (v->type == 'I') {
+        *integer = v->value.integer;
+        *len = sizeof(int32_t);
+        return integer;
+    }
+    *len = v->length;
+    return v->value.text;
+}
+
+/**
+ * Checks whether a node holds a key.
+ * @param node A pointer to the node's fields, which a reader has copied out of the file.
+ * @param stored A pointer to the key bytes stored after the node in the file.
+ * @param key A pointer to the key.
+ * @param hash The key's hash.
+ * @return true if the node's key is the key.
+ */
+static _Bool nodeHasKey(Node const* node, void const* stored, VType const* key, uint64_t hash) {
+    int32_t integer;
+    uint32_t len;
+    void const* bytes = payload(key, &integer, &len);
+    return node->hash == hash && node->keyType == key->type && node->keyLen == len && memcmp(stored, bytes, len) == 0;
+}
+
+/**
+ * Finds the link pointing at a key's node, for the writer, which needs no version checks.
+ * @param this A pointer to the SharedMap, which must be the writer.
+ * @param key A pointer to the key.
+ * @param hash The key's hash.
+ * @return A pointer to the bucket or next field holding the node's offset, or NULL if the key isn't in the table.
+ */
+static uint64_t* findLink(SharedMap* this, VType const* key, uint64_t hash) {
+    Header* h = this->header;
+    uint64_t* link = (uint64_t*)(this->base + h->table) + (hash & (h->buckets - 1));
+    while (*link) {
+        Node* node = (Node*)(this->base + *link);
+        if (nodeHasKey(node, node + 1, key, hash))
+            return link;
+        link = &node->next;
+    }
+    return NULL;
+}
+
+/**
+ * Doubles the buckets, relinking every node into the new array in one update.
+ * @param this A pointer to the SharedMap, which must be the writer.
+ * @return true if the buckets were doubled, false if the file is full.
+ */
+static _Bool growBuckets(SharedMap* this) {
+    Header* h = this->header;
+    uint64_t buckets = h->buckets * 2;
+    uint64_t table = allocBlock(this, buckets * sizeof(uint64_t));
+    if (!table)
+        return 0;
+    uint64_t* fresh = (uint64_t*)(this->base + table);
+    memset(fresh, 0, buckets * sizeof(uint64_t));
+
+    uint64_t oldTable = h->table;
+    uint64_t* old = (uint64_t*)(this->base + oldTable);
+    uint64_t oldBuckets = h->buckets;
+    beginWrite(h);
+    for (uint64_t b = 0; b < oldBuckets; b++) {
+        uint64_t off = old[b];
+        while (off) {
+            Node* node = (Node*)(this->base + off);
+            uint64_t next = node->next;
+            node->next = fresh[node->hash & (buckets - 1)];
+            fresh[node->hash & (buckets - 1)] = off;
+            off = next;
+        }
+    }
+    h->table = table;
+    h->buckets = buckets;
+    endWrite(h);
+    freeBlock(this, oldTable, oldBuckets * sizeof(uint64_t));
+    return 1;
+}
+
+/**
+ * Maps a shared map file, reserving the most it may grow to.
+ * @param fd The open file.
+ * @param maxBytes The most the file may grow to.
+ * @param writer Whether to map it writable.
+ * @return The start of the mapping, or NULL on failure.
+ */
+static unsigned char* mapFile(int fd, size_t maxBytes, _Bool writer) {
+    void* base = mmap(NULL, maxBytes, writer ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    return base == MAP_FAILED ? NULL : (unsigned char*)base;
+}
+
+/**
+ * Creates the handle for a mapped file.
+ * @param fd The open file.
+ * @param base The start of the mapping.
+ * @param writer Whether this process may update the table.
+ * @return A pointer to the SharedMap, or NULL on memory allocation failure.
+ */
+static SharedMap* makeHandle(int fd, unsigned char* base, _Bool writer) {
+    SharedMap* this = (SharedMap*)calloc(1, sizeof(SharedMap));
+    if (!this)
+        return NULL;
+    this->scratchSize = 256;
+    if (!(this->scratch = (char*)malloc(this->scratchSize))) {
+        free(this);
+        return NULL;
+    }
+    this->fd = fd;
+    this->base = base;
+    this->header = (Header*)base;
+    this->writer = writer;
+    return this;
+}
+
+/**
+ * Creates an empty shared map in a file, replacing whatever the file held, and opens it as its writer.
+ * No reader may have the file open while it is replaced.
+ * @param path The name of the file.
+ * @param maxBytes The most the file may grow to; address space for this much is reserved in every process using it.
+ * @return A pointer to the SharedMap, or NULL if the file can't be created or another process is writing it.
+ */
+SharedMap* makeSharedMap(char const* path, size_t maxBytes) {
+    size_t initial = HEADER_BYTES + INITIAL_BUCKETS * sizeof(uint64_t);
+    if (maxBytes < initial)
+        return NULL;
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return NULL;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0 || ftruncate(fd, 0) != 0 || ftruncate(fd, initial) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    unsigned char* base = mapFile(fd, maxBytes, 1);
+    SharedMap* this = base ? makeHandle(fd, base, 1) : NULL;
+    if (!this) {
+        if (base)
+            munmap(base, maxBytes);
+        close(fd);
+        return NULL;
+    }
+
+    // The file starts out zeroed, so the buckets are empty; the magic goes in last, once the header is complete.
+    Header* h = this->header;
+    h->maxBytes = maxBytes;
+    randomHashKey(h->sipKey);
+    h->fileBytes = initial;
+    h->top = initial;
+    h->table = HEADER_BYTES;
+    h->buckets = INITIAL_BUCKETS;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(h->magic, SHARED_MAGIC, 8);
+    return this;
+}
+
+/**
+ * Checks whether a writer has the file open; the writer holds its exclusive lock for as long as it does.
+ * A shared lock can only be taken when no process holds the exclusive one, and it is dropped again at once.
+ * @param fd The open file.
+ * @return true if a writer holds the file, false otherwise.
+ */
+static _Bool writerPresent(int fd) {
+    if (flock(fd, LOCK_SH | LOCK_NB) != 0)
+        return 1;
+    flock(fd, LOCK_UN);
+    return 0;
+}
+
+/**
+ * Opens an existing shared map file. Only the header is read, so this takes the same time whatever the table holds.
+ * @param path The name of the file.
+ * @param writer Whether to open it for updates; only one process may do so at a time.
+ * @return A pointer to the SharedMap, or NULL if the file isn't a shared map, another process is writing it, or the
+ *         last writer died in the middle of an update.
+ */
+SharedMap* sharedMapOpen(char const* path, _Bool writer) {
+    int fd = open(path, writer ? O_RDWR : O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    Header h;
+    if ((writer && flock(fd, LOCK_EX | LOCK_NB) != 0) || pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+        memcmp(h.magic, SHARED_MAGIC, 8) != 0 || ((h.seq & 1) && (writer || !writerPresent(fd)))) {
+        close(fd);
+        return NULL;
+    }
+
+    unsigned char* base = mapFile(fd, h.maxBytes, writer);
+    SharedMap* this = base ? makeHandle(fd, base, writer) : NULL;
+    if (!this) {
+        if (base)
+            munmap(base, h.maxBytes);
+        close(fd);
+    }
+    return this;
+}
+
+/**
+ * Stores a copy of a key and its value, replacing any value the key had. The new node is filled in before the update
+ * starts, so readers only ever wait for a relink.
+ * @param this A pointer to the SharedMap, which must be the writer.
+ * @param key A pointer to the key.
+ * @param value A pointer to the value.
+ * @return true if the pair was stored, false if this process isn't the writer, a VType is compressed or the file is full.
+ */
+_Bool sharedMapSet(SharedMap* this, VType const* key, VType const* value) {
+    if (!this->writer || (key->type != 'I' && key->type != 'T') || (value->type != 'I' && value->type != 'T'))
+        return 0;
+    Header* h = this->header;
+    uint64_t hash = keyHash(this, key);
+    uint64_t* link = findLink(this, key, hash);
+    if (!link && h->count >= h->buckets)
+        growBuckets(this);
+
+    int32_t keyInt, valueInt;
+    uint32_t keyLen, valueLen;
+    void const* keyBytes = payload(key, &keyInt, &keyLen);
+    void const* valueBytes = payload(value, &valueInt, &valueLen);
+    size_t bytes = sizeof(Node) + keyLen + valueLen;
+    uint64_t off = allocBlock(this, bytes);
+    if (!off)
+        return 0;
+
+    Node* node = (Node*)(this->base + off);
+    node->hash = hash;
+    node->keyLen = keyLen;
+    node->valueLen = valueLen;
+    node->keyType = key->type;
+    node->valueType = value->type;
+    memcpy(node + 1, keyBytes, keyLen);
+    memcpy((char*)(node + 1) + keyLen, valueBytes, valueLen);
+
+    if (link) {
+        Node* old = (Node*)(this->base + *link);
+        uint64_t oldOff = *link;
+        node->next = old->next;
+        beginWrite(h);
+        *link = off;
+        endWrite(h);
+        freeBlock(this, oldOff, sizeof(Node) + old->keyLen + old->valueLen);
+    } else {
+        uint64_t* bucket = (uint64_t*)(this->base + h->table) + (hash & (h->buckets - 1));
+        node->next = *bucket;
+        beginWrite(h);
+        *bucket = off;
+        h->count++;
+        endWrite(h);
+    }
+    return 1;
+}
+
+/**
+ * Looks up a key, retrying for as long as the lookup overlaps an update.
+ * An update that stays under way with no writer holding the file was left by a writer that died in it, and will
+ * never finish, so the lookup gives up.
+ * A handle must not be used by two threads at once, since lookups copy values through its scratch buffer.
+ * @param this A pointer to the SharedMap.
+ * @param key A pointer to the key.
+ * @return A new copy of the key's value, which the caller frees, or NULL if the key isn't in the table, memory runs
+ *         out or the last writer died in the middle of an update.
+ */
+VType* sharedMapGet(SharedMap* this, VType const* key) {
+    Header const* h = this->header;
+    uint64_t hash = keyHash(this, key);
+    for (size_t spins = 0;; this->retries++) {
+        uint64_t seq = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            if (++spins % WRITER_CHECK_SPINS == 0 && !writerPresent(this->fd))
+                return NULL;
+            sched_yield();
+            continue;
+        }
+
+        // Everything read from here to the second version check may be torn, so it is checked before being used.
+        uint64_t limit = __atomic_load_n(&h->fileBytes, __ATOMIC_ACQUIRE);
+        uint64_t table = __atomic_load_n(&h->table, __ATOMIC_RELAXED);
+        uint64_t buckets = __atomic_load_n(&h->buckets, __ATOMIC_RELAXED);
+        _Bool found = 0, torn = 0, tooBig = 0;
+        Node node = { 0 };
+        if (buckets == 0 || (buckets & (buckets - 1)) || table > limit || buckets > (limit - table) / sizeof(uint64_t)) {
+            torn = 1;
+        } else {
+            uint64_t off = __atomic_load_n((uint64_t*)(this->base + table) + (hash & (buckets - 1)), __ATOMIC_RELAXED);
+            for (uint64_t steps = 0; off && !found; steps++) {
+                if (off % 8 || off > limit - sizeof(Node) || steps > limit / sizeof(Node)) {
+                    torn = 1;
+                    break;
+                }
+                memcpy(&node, this->base + off, sizeof(Node));
+                if ((uint64_t)node.keyLen + node.valueLen > limit - off - sizeof(Node)) {
+                    torn = 1;
+                    break;
+                }
+                unsigned char const* stored = this->base + off + sizeof(Node);
+                if (nodeHasKey(&node, stored, key, hash)) {
+                    found = 1;
+                    if (node.valueLen > this->scratchSize)
+                        tooBig = 1;
+                    else
+                        memcpy(this->scratch, stored + node.keyLen, node.valueLen);
+                    break;
+                }
+                off = node.next;
+            }
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&h->seq, __ATOMIC_RELAXED) != seq || torn)
+            continue;
+        if (!found)
+            return NULL;
+        if (tooBig) {
+            char* scratch = (char*)realloc(this->scratch, node.valueLen);
+            if (!scratch)
+                return NULL;
+            this->scratch = scratch;
+            this->scratchSize = node.valueLen;
+            continue;
+        }
+
+        if (node.valueType == 'I' && node.valueLen == sizeof(int32_t)) {
+            int32_t value;
+            memcpy(&value, this->scratch, sizeof(value));
+            return makeInteger(value);
+        }
+        return makeTextLen(this->scratch, node.valueLen);
+    }
+}
+
+/**
+ * Removes a key and its value.
+ * @param this A pointer to the SharedMap, which must be the writer.
+ * @param key A pointer to the key.
+ * @return true if the key was removed, false if it wasn't in the table or this process isn't the writer.
+ */
+_Bool sharedMapRemove(SharedMap* this, VType const* key) {
+    if (!this->writer)
+        return 0;
+    Header* h = this->header;
+    uint64_t* link = findLink(this, key, keyHash(this, key));
+    if (!link)
+        return 0;
+
+    uint64_t off = *link;
+    Node* node = (Node*)(this->base + off);
+    beginWrite(h);
+    *link = node->next;
+    h->count--;
+    endWrite(h);
+    freeBlock(this, off, sizeof(Node) + node->keyLen + node->valueLen);
+    return 1;
+}
+
+/**
+ * Returns the number of pairs, as of the last completed update.
+ * @param this A pointer to the SharedMap.
+ * @return The number of pairs.
+ */
+size_t sharedMapSize(SharedMap* this) {
+    return __atomic_load_n(&this->header->count, __ATOMIC_RELAXED);
+}
+
+/**
+ * Reports the size of the table and how often this process's lookups had to be retried.
+ * @param this A pointer to the SharedMap.
+ * @param stats A pointer to the SharedStats to be filled in.
+ */
+void sharedMapStats(SharedMap* this, SharedStats* stats) {
+    Header const* h = this->header;
+    stats->keys = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    stats->buckets = __atomic_load_n(&h->buckets, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&h->top, __ATOMIC_RELAXED);
+    stats->maxBytes = h->maxBytes;
+    stats->version = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+    stats->retries = this->retries;
+}
+
+/**
+ * Unmaps the file and closes it, letting another process become the writer. The file and its contents stay.
+ * @param this A pointer to the SharedMap.
+ */
+void sharedMapFree(SharedMap* this) {
+    if (!this)
+        return;
+    munmap(this->base, this->header->maxBytes);
+    close(this->fd);
+    free(this->scratch);
+    free(this);
+}
@@ -0,0 +1,40 @@
+#ifndef SHAREDMAP_H
+#define SHAREDMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vtype.h"
+
+// Define your SharedMap struct here
+typedef struct SharedMapStruct SharedMap;
+
+/** Size and concurrency counters reported for a shared map. */
+typedef struct {
+    /** Number of pairs. */
+    size_t keys;
+
+    /** Number of buckets. */
+    size_t buckets;
+
+    /** Bytes of the file in use, and the most it may grow to. */
+    size_t bytes;
+    size_t maxBytes;
+
+    /** Number of completed updates; even whenever no update is in progress. */
+    uint64_t version;
+
+    /** Number of lookups by this process that overlapped an update and were retried. */
+    size_t retries;
+} SharedStats;
+
+/*Function prototypes*/
+SharedMap* makeSharedMap(char const* path, size_t maxBytes);
+SharedMap* sharedMapOpen(char const* path, _Bool writer);
+_Bool sharedMapSet(SharedMap* this, VType const* key, VType const* value);
+VType* sharedMapGet(SharedMap* this, VType const* key);
+_Bool sharedMapRemove(SharedMap* this, VType const* key);
+size_t sharedMapSize(SharedMap* this);
+void sharedMapStats(SharedMap* this, SharedStats* stats);
+void sharedMapFree(SharedMap* this);
+
+#endif // SHAREDMAP_H
@@ -0,0 +1,112 @@
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "siphash.h"
+
+/**
+ * @file siphash.c
+ * @author Jason Wang
+ * This program provides SipHash-2-4, the keyed hash a map switches to when its keys collide too much.
+ * Without the key, finding inputs that collide under SipHash is as hard as breaking a pseudorandom function,
+ * so chains stay short whatever keys an input stream sends. It is several times slower than djb2,
+ * which is why a map only switches to it once it sees a suspiciously long chain.
+ */
+
+/**
+ * Rotates a 64-bit word left.
+ * @param x The word.
+ * @param b The number of bits, 1 to 63.
+ * @return The rotated word.
+ */
+static uint64_t rotl(uint64_t x, int b) {
+    return (x << b) | (x >> (64 - b));
+}
+
+/**
+ * Reads 8 bytes from any address as a little-endian word.
+ * @param p A pointer to the bytes.
+ * @return The word.
+ */
+static uint64_t read64(unsigned char const* p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = v << 8 | p[i];
+    return v;
+}
+
+/**
+ * One SipRound, mixing the four words of state.
+ * @param v The state.
+ */
+static void sipRound(uint64_t v[4]) {
+    v[0] += v[1];
+    v[1] = rotl(v[1], 13);
+    v[1] ^= v[0];
+    v[0] = rotl(v[0], 32);
+    v[2] += v[3];
+    v[3] = rotl(v[3], 16);
+    v[3] ^= v[2];
+    v[0] += v[3];
+    v[3] = rotl(v[3], 21);
+    v[3] ^= v[0];
+    v[2] += v[1];
+    v[1] = rotl(v[1], 17);
+    v[1] ^= v[2];
+    v[2] = rotl(v[2], 32);
+}
+
+/**
+ * Hashes a run of bytes with SipHash-2-4: two rounds per 8-byte word of input and four to finish.
+ * @param data The bytes to hash.
+ * @param len The number of bytes.
+ * @param key The 128-bit key, as two words.
+ * @return The 64-bit hash.
+ */
+uint64_t sipHash(void const* data, size_t len, uint64_t const key[2]) {
+    unsigned char const* p = (unsigned char const*)data;
+    uint64_t v[4] = { key[0] ^ 0x736f6d6570736575ULL, key[1] ^ 0x646f72616e646f6dULL, key[0] ^ 0x6c7967656e657261ULL,
+                      key[1] ^ 0x7465646279746573ULL };
+
+    size_t words = len / 8;
+    for (size_t i = 0; i < words; i++, p += 8) {
+        uint64_t m = read64(p);
+        v[3] ^= m;
+        sipRound(v);
+        sipRound(v);
+        v[0] ^= m;
+    }
+
+    // The last word holds the leftover bytes and, in its top byte, the length.
+    uint64_t last = (uint64_t)len << 56;
+    for (size_t i = 0; i < len % 8; i++)
+        last |= (uint64_t)p[i] << (8 * i);
+    v[3] ^= last;
+    sipRound(v);
+    sipRound(v);
+    v[0] ^= last;
+
+    v[2] ^= 0xff;
+    for (int i = 0; i < 4; i++)
+        sipRound(v);
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+/**
+ * Fills a hash key with random bits from /dev/urandom. If that can't be read, the bits come from the clock
+ * and the process id instead, which still differ from run to run but are guessable.
+ * @param key Where the 128-bit key is stored, as two words.
+ */
+void randomHashKey(uint64_t key[2]) {
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0) {
+        ssize_t n = read(fd, key, 2 * sizeof(uint64_t));
+        close(fd);
+        if (n == 2 * sizeof(uint64_t))
+            return;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    key[0] = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    key[1] = ((uint64_t)getpid() << 32) ^ (uint64_t)time(NULL) ^ (uintptr_t)&ts;
+}
@@ -0,0 +1,13 @@
+#ifndef SIPHASH_H
+#define SIPHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Hash len bytes of data with SipHash-2-4 under a 128-bit key. */
+uint64_t sipHash(void const* data, size_t len, uint64_t const key[2]);
+
+/* Fill a 128-bit key with random bits from the kernel, or from the clock and pid if that fails. */
+void randomHashKey(uint64_t key[2]);
+
+#endif // SIPHASH_H
@@ -0,0 +1,372 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "snapshot.h"
+
+/**
+ * @file snapshot.c
+ * @author Jason Wang
+ * This program writes the contents of a map to a snapshot file and loads it back, either in the foreground or from a forked child.
+ * The snapshot starts with a magic string and the entry count, followed by each key and value as a type byte and its payload.
+ */
+
+/** Magic string at the start of every snapshot file. */
+#define SNAPSHOT_MAGIC "HMSNAP01"
+
+/** Number of entries written between two progress reports from the child. */
+#define PROGRESS_INTERVAL 65536
+
+/** Size of the stdio buffer used while writing or reading a snapshot. */
+#define IO_BUFFER_SIZE (1 << 20)
+
+/**
+ * Progress record sent from the child to the parent over the progress pipe.
+ */
+typedef struct {
+    uint64_t written;
+    uint64_t done;
+} Progress;
+
+/**
+ * State threaded through mapForEach while a snapshot is written.
+ */
+typedef struct {
+    FILE* fp;
+    size_t written;
+    int progressFd;
+    _Bool failed;
+} Writer;
+
+/**
+ * Returns the current monotonic clock reading in milliseconds.
+ * @return Milliseconds since an arbitrary fixed point.
+ */
+static long nowMillis() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/**
+ * Returns the number of minor page faults taken so far by the calling process.
+ * Right after a fork every private page is shared with the child, so the faults the parent takes afterwards
+ * are, for the most part, pages being copied on write.
+ * @return The ru_minflt counter of the calling process.
+ */
+static long minorFaults() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt;
+}
+
+/**
+ * Writes one VType to the snapshot as a type byte followed by its payload.
+ * Integers are stored as 4 bytes and Text as a 4-byte length followed by the characters.
+ * @param fp The file being written.
+ * @param v A pointer to the VType object to be written.
+ * @return true if the VType was written, false on an unsupported type or a write error.
+ */
+static _Bool writeVType(FILE* fp, VType const* v) {
+    if (fputc(v->type, fp) == EOF)
+        return 0;
+
+    if (v->type == 'I') {
+        int32_t val = v->value.integer;
+        return fwrite(&val, sizeof(val), 1, fp) == 1;
+    } else if (v->type == 'T') {
+        uint32_t len = v->length;
+        return fwrite(&len, sizeof(len), 1, fp) == 1 && fwrite(v->value.text, 1, len, fp) == len;
+    }
+
+    return 0;
+}
+
+/**
+ * Reads one VType written by writeVType and creates it on the heap.
+ * @param fp The file being read.
+ * @return A pointer to the new VType object, or NULL on a malformed record or read error.
+ */
+static VType* readVType(FILE* fp) {
+    int type = fgetc(fp);
+
+    if (type == 'I') {
+        int32_t val;
+        if (fread(&val, sizeof(val), 1, fp) != 1)
+            return NULL;
+        return makeInteger(val);
+    } else if (type == 'T') {
+        uint32_t len;
+        if (fread(&len, sizeof(len), 1, fp) != 1)
+            return NULL;
+
+        VType* v = makeTextSpace(len);
+        if (!v)
+            return NULL;
+        if (fread(v->value.text, 1, len, fp) != len) {
+            freeVType(v);
+            return NULL;
+        }
+        return v;
+    }
+
+    return NULL;
+}
+
+/**
+ * Reports how many entries have been written so far on the progress pipe, if there is one.
+ * The pipe is non-blocking, so a report is simply dropped if the parent has fallen behind.
+ * @param fd The write end of the progress pipe, or -1 for none.
+ * @param written The number of entries written so far.
+ * @param done Whether this is the final report.
+ */
+static void reportProgress(int fd, size_t written, _Bool done) {
+    if (fd < 0)
+        return;
+
+    Progress p = { written, done };
+    if (write(fd, &p, sizeof(p)) != sizeof(p)) {
+        // Progress is best effort; the exit status carries the real outcome.
+    }
+}
+
+/**
+ * mapForEach callback that appends one key-value pair to the snapshot.
+ * @param key The key of the pair.
+ * @param value The value of the pair.
+ * @param ctx A pointer to the Writer state.
+ * @return false to stop the walk once a write has failed.
+ */
+static _Bool writePair(VType const* key, VType const* value, void* ctx) {
+    Writer* w = (Writer*)ctx;
+    if (!writeVType(w->fp, key) || !writeVType(w->fp, value)) {
+        w->failed = 1;
+        return 0;
+    }
+
+    if (++w->written % PROGRESS_INTERVAL == 0)
+        reportProgress(w->progressFd, w->written, 0);
+    return 1;
+}
+
+/**
+ * Writes the whole map to an open stream: the magic string, the entry count and every pair.
+ * @param map A pointer to the Map structure (hashmap) to be written.
+ * @param fp The stream, left open.
+ * @param progressFd The write end of a progress pipe, or -1 for none.
+ * @return The number of entries written, or -1 on error.
+ */
+static long writeStream(Map* map, FILE* fp, int progressFd) {
+    Writer w = { fp, 0, progressFd, 0 };
+    uint64_t count = mapSize(map);
+    if (fwrite(SNAPSHOT_MAGIC, 1, 8, fp) != 8 || fwrite(&count, sizeof(count), 1, fp) != 1)
+        w.failed = 1;
+    if (!w.failed)
+        mapForEach(map, writePair, &w);
+    return w.failed || w.written != count ? -1 : (long)w.written;
+}
+
+/**
+ * Writes the whole map to a temporary file next to path and renames it into place.
+ * A reader never sees a partially written snapshot, and a failed save leaves the previous one untouched.
+ * @param map A pointer to the Map structure (hashmap) to be written.
+ * @param path The name of the snapshot file.
+ * @param progressFd The write end of a progress pipe, or -1 for none.
+ * @return The number of entries written, or -1 on error.
+ */
+static long writeSnapshot(Map* map, char const* path, int progressFd) {
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+        return -1;
+
+    FILE* fp = fopen(tmp, "wb");
+    if (!fp)
+        return -1;
+    setvbuf(fp, NULL, _IOFBF, IO_BUFFER_SIZE);
+
+    long written = writeStream(map, fp, progressFd);
+    if (fclose(fp) != 0 || written < 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+
+    reportProgress(progressFd, written, 1);
+    return written;
+}
+
+/**
+ * Writes every key-value pair in the Map to the snapshot file at path, blocking until it is done.
+ * @param map A pointer to the Map structure (hashmap) to be written.
+ * @param path The name of the snapshot file.
+ * @return The number of entries written, or -1 on error.
+ */
+long snapshotSave(Map* map, char const* path) {
+    return writeSnapshot(map, path, -1);
+}
+
+/**
+ * Writes every key-value pair in the Map to an open stream in the snapshot format, such as a memory buffer to be
+ * sent elsewhere. The stream is left open and may be buffered still.
+ * @param map A pointer to the Map structure (hashmap) to be written.
+ * @param fp The stream.
+ * @return The number of entries written, or -1 on error.
+ */
+long snapshotWrite(Map* map, FILE* fp) {
+    return writeStream(map, fp, -1);
+}
+
+/**
+ * Loads every key-value pair of a snapshot from an open stream into the Map.
+ * Pairs already in the Map with the same key are replaced.
+ * @param map A pointer to the Map structure (hashmap) to be filled.
+ * @param fp The stream, positioned at the start of the snapshot and left open.
+ * @return The number of entries loaded, or -1 if the snapshot is malformed.
+ */
+long snapshotRead(Map* map, FILE* fp) {
+    char magic[8];
+    uint64_t count;
+    if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, SNAPSHOT_MAGIC, 8) != 0 ||
+        fread(&count, sizeof(count), 1, fp) != 1)
+        return -1;
+
+    long loaded = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        VType* key = readVType(fp);
+        VType* value = key ? readVType(fp) : NULL;
+        if (!value) {
+            freeVType(key);
+            return -1;
+        }
+        if (!mapSet(map, key, value))
+            return -1;
+        loaded++;
+    }
+    return loaded;
+}
+
+/**
+ * Loads every key-value pair stored in the snapshot file at path into the Map.
+ * Pairs already in the Map with the same key are replaced.
+ * @param map A pointer to the Map structure (hashmap) to be filled.
+ * @param path The name of the snapshot file.
+ * @return The number of entries loaded, or -1 if the file is missing or malformed.
+ */
+long snapshotLoad(Map* map, char const* path) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp)
+        return -1;
+    setvbuf(fp, NULL, _IOFBF, IO_BUFFER_SIZE);
+    long loaded = snapshotRead(map, fp);
+    fclose(fp);
+    return loaded;
+}
+
+/**
+ * Starts a background save by forking a child that writes the Map to path.
+ * The child sees the Map as it was at the moment of the fork, and the kernel shares its pages with the parent
+ * copy-on-write, so the parent can keep modifying the Map while the snapshot is being written.
+ * Only one background save can run at a time.
+ * @param this A pointer to the BgSave state, which must be zeroed before the first use.
+ * @param map A pointer to the Map structure (hashmap) to be written.
+ * @param path The name of the snapshot file.
+ * @return true if the child was started, false if a save is already running or the fork failed.
+ */
+_Bool bgsaveStart(BgSave* this, Map* map, char const* path) {
+    if (this->pid > 0)
+        return 0;
+
+    int fds[2];
+    if (pipe(fds) != 0)
+        return 0;
+
+    // Make sure buffered output isn't duplicated into the child.
+    fflush(NULL);
+
+    struct timespec before, after;
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    pid_t pid = fork();
+    clock_gettime(CLOCK_MONOTONIC, &after);
+
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return 0;
+    }
+
+    if (pid == 0) {
+        // Child: write the snapshot and leave without running the parent's atexit handlers.
+        close(fds[0]);
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        signal(SIGINT, SIG_IGN);
+        long written = writeSnapshot(map, path, fds[1]);
+        _exit(written < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    close(fds[1]);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    this->pid = pid;
+    this->progressFd = fds[0];
+    this->written = 0;
+    this->total = mapSize(map);
+    this->forkMicros = (after.tv_sec - before.tv_sec) * 1000000L + (after.tv_nsec - before.tv_nsec) / 1000L;
+    this->parentFaultsAtFork = minorFaults();
+    this->startMillis = nowMillis();
+    return 1;
+}
+
+/**
+ * Collects progress reports from a running background save and checks whether the child has finished.
+ * This never blocks, so the driver can call it between commands.
+ * Once the child has exited, the result is filled in with the outcome and the page copy counts,
+ * and the BgSave state goes back to idle.
+ * @param this A pointer to the BgSave state.
+ * @param result A pointer to the BgSaveResult filled in when the save has finished.
+ * @return true if the save finished during this call, false if it is still running or none was started.
+ */
+_Bool bgsavePoll(BgSave* this, BgSaveResult* result) {
+    if (this->pid <= 0)
+        return 0;
+
+    Progress p;
+    while (read(this->progressFd, &p, sizeof(p)) == sizeof(p))
+        this->written = p.written;
+
+    int status;
+    struct rusage usage;
+    pid_t done = wait4(this->pid, &status, WNOHANG, &usage);
+    if (done == 0 || (done < 0 && errno == EINTR))
+        return 0;
+
+    // Pick up the final report, which may have arrived after the loop above.
+    while (read(this->progressFd, &p, sizeof(p)) == sizeof(p))
+        this->written = p.written;
+    close(this->progressFd);
+
+    result->ok = done == this->pid && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+    result->entries = this->written;
+    result->parentPagesCopied = minorFaults() - this->parentFaultsAtFork;
+    result->childPagesCopied = done == this->pid ? usage.ru_minflt : 0;
+    result->forkMicros = this->forkMicros;
+    result->elapsedMillis = nowMillis() - this->startMillis;
+
+    this->pid = 0;
+    this->progressFd = -1;
+    return 1;
+}
+
+/**
+ * Reports whether a background save is currently running.
+ * @param this A pointer to the BgSave state.
+ * @return true if a child is still writing a snapshot, false otherwise.
+ */
+_Bool bgsaveRunning(BgSave const* this) {
+    return this->pid > 0;
+}
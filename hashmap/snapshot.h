@@ -0,0 +1,75 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "map.h"
+
+/** State of a background save running in a forked child. */
+typedef struct {
+    /** Process id of the child writing the snapshot, or 0 when idle. */
+    pid_t pid;
+
+    /** Read end of the pipe the child reports progress on. */
+    int progressFd;
+
+    /** Number of entries the child has written so far. */
+    size_t written;
+
+    /** Number of entries in the map when the child was forked. */
+    size_t total;
+
+    /** Time taken by fork() itself, in microseconds. */
+    long forkMicros;
+
+    /** Parent minor page faults counted at fork time. */
+    long parentFaultsAtFork;
+
+    /** Monotonic clock reading at fork time, in milliseconds. */
+    long startMillis;
+} BgSave;
+
+/** Outcome of a finished background save, filled in by bgsavePoll(). */
+typedef struct {
+    /** True if the child wrote and renamed the snapshot successfully. */
+    _Bool ok;
+
+    /** Number of entries written to the snapshot. */
+    size_t entries;
+
+    /** Pages copied on write by the parent while the child was running. */
+    long parentPagesCopied;
+
+    /** Pages copied on write (or freshly touched) by the child. */
+    long childPagesCopied;
+
+    /** Time taken by fork() itself, in microseconds. */
+    long forkMicros;
+
+    /** Wall-clock time from fork to completion, in milliseconds. */
+    long elapsedMillis;
+} BgSaveResult;
+
+/* Write every pair in the map to path, replacing it atomically. Returns the number of entries written or -1 on error. */
+long snapshotSave(Map* map, char const* path);
+
+/* Load every pair stored in the snapshot at path into map. Returns the number of entries loaded or -1 on error. */
+long snapshotLoad(Map* map, char const* path);
+
+/* Write every pair in the map to an open stream in the snapshot format. Returns the number of entries written or -1 on error. */
+long snapshotWrite(Map* map, FILE* fp);
+
+/* Load every pair of a snapshot read from an open stream into map. Returns the number of entries loaded or -1 on error. */
+long snapshotRead(Map* map, FILE* fp);
+
+/* Fork a child that writes the map to path while the parent keeps running. Returns 0 if a save could not be started. */
+_Bool bgsaveStart(BgSave* this, Map* map, char const* path);
+
+/* Collect progress from a running background save. Returns 1 and fills in result once the child has finished. */
+_Bool bgsavePoll(BgSave* this, BgSaveResult* result);
+
+/* Report whether a background save is currently running. */
+_Bool bgsaveRunning(BgSave const* this);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,111 @@
+// Simple test program for snapshots: saving and loading a map, damaged files, and background saves.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+
+#define PATH "snapshotTest.snap"
+#define KEYS 20000
+
+// Stores key:<i> as Text with the Integer i * 3, and the Integer i with the Text value:<i>.
+static void fill(Map* map, int keys) {
+    char text[32];
+    for (int i = 0; i < keys; i++) {
+        snprintf(text, sizeof(text), "key:%d", i);
+        mapSet(map, makeText(text), makeInteger(i * 3));
+        snprintf(text, sizeof(text), "value:%d", i);
+        mapSet(map, makeInteger(i), makeText(text));
+    }
+}
+
+// Checks the map holds exactly what fill stored.
+static void check(Map* map, int keys) {
+    char text[32];
+    assert(mapSize(map) == (size_t)keys * 2);
+    for (int i = 0; i < keys; i++) {
+        snprintf(text, sizeof(text), "key:%d", i);
+        VType* value = mapGetText(map, text, strlen(text));
+        assert(value && value->type == 'I' && value->value.integer == i * 3);
+        snprintf(text, sizeof(text), "value:%d", i);
+        value = mapGetInt(map, i);
+        assert(value && value->type == 'T' && strcmp(value->value.text, text) == 0);
+    }
+}
+
+// Reports the size of a file.
+static long fileSize(char const* path) {
+    FILE* fp = fopen(path, "rb");
+    assert(fp);
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+    return size;
+}
+
+int main() {
+    // Integer and Text keys and values come back as they were saved.
+    Map* map = makeMap(0, NULL);
+    fill(map, KEYS);
+    assert(snapshotSave(map, PATH) == KEYS * 2);
+    Map* loaded = makeMap(0, NULL);
+    assert(snapshotLoad(loaded, PATH) == KEYS * 2);
+    check(loaded, KEYS);
+    mapFree(loaded);
+
+    // An empty map saves and loads as no pairs, and a missing file doesn't load.
+    Map* empty = makeMap(0, NULL);
+    assert(snapshotSave(empty, PATH) == 0);
+    assert(snapshotLoad(empty, PATH) == 0 && mapSize(empty) == 0);
+    assert(snapshotLoad(empty, "snapshotTest.missing") == -1);
+
+    // A truncated file and a file with a bad magic are rejected.
+    assert(snapshotSave(map, PATH) == KEYS * 2);
+    assert(truncate(PATH, fileSize(PATH) - 3) == 0);
+    assert(snapshotLoad(empty, PATH) == -1);
+    assert(truncate(PATH, 12) == 0);
+    assert(snapshotLoad(empty, PATH) == -1);
+    assert(snapshotSave(map, PATH) == KEYS * 2);
+    FILE* fp = fopen(PATH, "r+b");
+    assert(fp && fputc('X', fp) == 'X');
+    fclose(fp);
+    assert(snapshotLoad(empty, PATH) == -1);
+    mapFree(empty);
+
+    // A background save writes the map as it was at the fork while the parent keeps changing it.
+    BgSave save = { 0 };
+    BgSaveResult result;
+    assert(!bgsaveRunning(&save) && !bgsavePoll(&save, &result));
+    assert(bgsaveStart(&save, map, PATH) && bgsaveRunning(&save));
+    assert(!bgsaveStart(&save, map, PATH));
+    char text[32];
+    for (int i = 0; i < KEYS; i++) {
+        snprintf(text, sizeof(text), "key:%d", i);
+        mapSet(map, makeText(text), makeInteger(-i));
+        assert(mapRemoveInt(map, i));
+        snprintf(text, sizeof(text), "new:%d", i);
+        mapSet(map, makeText(text), makeInteger(i));
+    }
+    while (!bgsavePoll(&save, &result))
+        usleep(1000);
+    assert(result.ok && result.entries == KEYS * 2 && result.elapsedMillis >= 0);
+    assert(!bgsaveRunning(&save));
+    loaded = makeMap(0, NULL);
+    assert(snapshotLoad(loaded, PATH) == KEYS * 2);
+    check(loaded, KEYS);
+    mapFree(loaded);
+
+    // A save that can't write its file reports failure.
+    assert(bgsaveStart(&save, map, "snapshotTest.missing/dir.snap"));
+    while (!bgsavePoll(&save, &result))
+        usleep(1000);
+    assert(!result.ok);
+    assert(snapshotSave(map, "snapshotTest.missing/dir.snap") == -1);
+
+    mapFree(map);
+    unlink(PATH);
+    return EXIT_SUCCESS;
+}
@@ -140,6 +140,31 @@ runTest() {
     return 0
 }
 
+# Run a test of the driver program with the given options, checking its
+# output against expected-NN.txt and that it printed no errors.
+runDriverTest() {
+    TESTNO=$1
+    shift
+
+    echo "Test $TESTNO"
+    rm -f output.txt stderr.txt
+
+    echo "   ./driver $* < input-$TESTNO.txt > output.txt 2> stderr.txt"
+    ./driver "$@" < "input-$TESTNO.txt" > output.txt 2> stderr.txt
+    ASTATUS=$?
+
+    if [ $ASTATUS -ne 0 ] ||
+        ! checkFile "./driver $*" "expected-$TESTNO.txt" output.txt ||
+        ! checkEmpty "./driver $*" stderr.txt; then
+        FAIL=1
+        echo "Test $TESTNO FAIL"
+        return 1
+    fi
+
+    echo "Test $TESTNO PASS"
+    return 0
+}
+
 
 # make a fresh copy of the target program
 make clean
@@ -162,6 +187,7 @@ if [ -x driver ]; then
     runTest 10
     runTest 11
     runTest 12
+    runDriverTest 13 -z 256
 else
     fail "Your driver program didn't compile, so it couldn't be tested."
 fi
@@ -0,0 +1,76 @@
+// Simple test program for the Text hashing and comparison kernels.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "textops.h"
+#include "vtype.h"
+
+// djb2 the way hashVType computed it before lengths were stored.
+static unsigned int djb2(char const* str) {
+    unsigned int hash = 5381;
+    int c;
+    while ((c = *str++))
+        hash = ((hash << 5) + hash) + c;
+    return hash;
+}
+
+int main() {
+    int count;
+    TextKernel const* kernels = textKernels(&count);
+    assert(count >= 1);
+    printf("kernels: %d, selected: %s\n", count, textKernel()->name);
+
+    // Every kernel must give the original djb2 value for every length,
+    // including bytes above 127 and lengths around the block sizes.
+    char a[600], b[600];
+    for (int len = 0; len < 600; len++) {
+        for (int i = 0; i < len; i++)
+            a[i] = (char)(1 + rand() % 255);
+        a[len] = '\0';
+        memcpy(b, a, len + 1);
+
+        unsigned int expected = djb2(a);
+        for (int k = 0; k < count; k++) {
+            assert(kernels[k].hash(a, len) == expected);
+            assert(kernels[k].equal(a, b, len));
+            if (len > 0) {
+                // A difference anywhere must be found.
+                int pos = rand() % len;
+                b[pos] ^= 0x40;
+                assert(!kernels[k].equal(a, b, len));
+                b[pos] ^= 0x40;
+            }
+        }
+    }
+
+    // VType hashing and equality go through the kernels and keep their meaning.
+    VType* t1 = makeText("user:42:profile:settings:notifications:email:weekly-digest");
+    VType* t2 = makeTextLen("user:42:profile:settings:notifications:email:weekly-digest!!", 58);
+    VType* t3 = makeText("user:42:profile:settings:notifications:email:weekly-digesT");
+    assert(equalsVType(t1, t2));
+    assert(!equalsVType(t1, t3));
+    assert(textHash(t1->value.text, t1->length) == djb2(t1->value.text));
+    assert(hashVType(t1) == hashVType(t2));
+
+    // The process's seed is mixed in, so changing it moves keys.
+    unsigned int seeded = hashVType(t1);
+    setHashSeed(12345);
+    assert(hashVType(t1) != seeded && hashVType(t1) == hashVType(t2));
+
+    // Same characters with a different length are different keys.
+    VType* t4 = makeTextLen("user:42", 6);
+    VType* t5 = makeText("user:4");
+    assert(equalsVType(t4, t5));
+    assert(!equalsVType(t4, t1));
+
+    freeVType(t1);
+    freeVType(t2);
+    freeVType(t3);
+    freeVType(t4);
+    freeVType(t5);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,276 @@
+#include <stdint.h>
+#include <string.h>
+#include "textops.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TEXTOPS_X86 1
+#include <immintrin.h>
+#endif
+
+/**
+ * @file textops.c
+ * @author Jason Wang
+ * This program provides the kernels used to hash and compare Text values, with SSE4.2 and AVX2 versions
+ * picked at runtime from the CPU's features and a portable scalar version for everything else.
+ * Every kernel computes exactly the same djb2 hash, so the choice never changes where a key lands in a map.
+ */
+
+/**
+ * Powers of 33 used to hash a whole block of characters at once.
+ * djb2 is h = h * 33 + c for every character, which unrolls to h * 33^n plus each character times the power of 33
+ * matching its distance from the end. weights[j] holds 33^(31 - j), so the first 32 entries weigh a 32-character
+ * block and the last 16 entries weigh a 16-character block. All arithmetic wraps modulo 2^32, just like the loop.
+ */
+static uint32_t weights[32];
+
+/** 33^32 and 33^16, the factors that shift the running hash past a whole block. */
+static uint32_t pow32, pow16;
+
+/**
+ * Fills in the powers of 33 used by the block kernels.
+ */
+static void initWeights() {
+    uint32_t p = 1;
+    for (int j = 31; j >= 0; j--) {
+        weights[j] = p;
+        p *= 33;
+    }
+    pow32 = p;
+    pow16 = weights[15];
+}
+
+/**
+ * Hashes len characters one at a time with djb2, the same way hashVType always has.
+ * Characters are used with the signedness of char, so the value matches the original NUL-terminated loop.
+ * @param s The characters to hash.
+ * @param len The number of characters.
+ * @return The djb2 hash of the characters.
+ */
+static unsigned int hashScalar(char const* s, size_t len) {
+    unsigned int hash = 5381;
+    for (size_t i = 0; i < len; i++)
+        hash = ((hash << 5) + hash) + s[i]; // hash * 33 + c
+    return hash;
+}
+
+/**
+ * Compares len characters of a and b for equality with memcmp.
+ * @param a The first run of characters.
+ * @param b The second run of characters.
+ * @param len The number of characters.
+ * @return true if the characters are the same, false otherwise.
+ */
+static _Bool equalScalar(char const* a, char const* b, size_t len) {
+    return memcmp(a, b, len) == 0;
+}
+
+#ifdef TEXTOPS_X86
+
+/**
+ * Hashes len characters with djb2, 16 at a time, using SSE4.1/4.2 32-bit multiplies.
+ * Each block is sign-extended into four vectors of four lanes and multiplied by its weights; the lanes accumulate
+ * across blocks and are summed once at the end.
+ * @param s The characters to hash.
+ * @param len The number of characters.
+ * @return The djb2 hash of the characters.
+ */
+__attribute__((target("sse4.2")))
+static unsigned int hashSse42(char const* s, size_t len) {
+    uint32_t hash = 5381;
+    size_t i = 0;
+
+    if (len >= 16) {
+        __m128i w[4];
+        for (int q = 0; q < 4; q++)
+            w[q] = _mm_loadu_si128((__m128i const*)&weights[16 + q * 4]);
+        __m128i shift = _mm_set1_epi32(pow16);
+        __m128i acc = _mm_setzero_si128();
+
+        for (; i + 16 <= len; i += 16) {
+            acc = _mm_mullo_epi32(acc, shift);
+            for (int q = 0; q < 4; q++) {
+                int32_t chunk;
+                memcpy(&chunk, s + i + q * 4, 4);
+                __m128i c = _mm_cvtepi8_epi32(_mm_cvtsi32_si128(chunk));
+                acc = _mm_add_epi32(acc, _mm_mullo_epi32(c, w[q]));
+            }
+            hash *= pow16;
+        }
+
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+        hash += (uint32_t)_mm_cvtsi128_si32(acc);
+    }
+
+    for (; i < len; i++)
+        hash = hash * 33 + s[i];
+    return hash;
+}
+
+/**
+ * Compares len characters of a and b for equality, 16 at a time, with SSE byte compares.
+ * The last partial block is checked with one more load that overlaps the previous block, so there is no byte loop.
+ * @param a The first run of characters.
+ * @param b The second run of characters.
+ * @param len The number of characters.
+ * @return true if the characters are the same, false otherwise.
+ */
+__attribute__((target("sse4.2")))
+static _Bool equalSse42(char const* a, char const* b, size_t len) {
+    if (len < 16)
+        return memcmp(a, b, len) == 0;
+
+    for (size_t i = 0;; i += 16) {
+        if (i + 16 > len)
+            i = len - 16;
+        __m128i x = _mm_loadu_si128((__m128i const*)(a + i));
+        __m128i y = _mm_loadu_si128((__m128i const*)(b + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xFFFF)
+            return 0;
+        if (i + 16 == len)
+            return 1;
+    }
+}
+
+/**
+ * Hashes len characters with djb2, 32 at a time, using AVX2.
+ * Works like hashSse42 with eight lanes per vector, so a 32-character block takes four multiplies and adds.
+ * @param s The characters to hash.
+ * @param len The number of characters.
+ * @return The djb2 hash of the characters.
+ */
+__attribute__((target("avx2")))
+static unsigned int hashAvx2(char const* s, size_t len) {
+    uint32_t hash = 5381;
+    size_t i = 0;
+
+    if (len >= 32) {
+        __m256i w[4];
+        for (int q = 0; q < 4; q++)
+            w[q] = _mm256_loadu_si256((__m256i const*)&weights[q * 8]);
+        __m256i shift = _mm256_set1_epi32(pow32);
+        __m256i acc = _mm256_setzero_si256();
+
+        for (; i + 32 <= len; i += 32) {
+            acc = _mm256_mullo_epi32(acc, shift);
+            for (int q = 0; q < 4; q++) {
+                __m256i c = _mm256_cvtepi8_epi32(_mm_loadl_epi64((__m128i const*)(s + i + q * 8)));
+                acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(c, w[q]));
+            }
+            hash *= pow32;
+        }
+
+        __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+        hash += (uint32_t)_mm_cvtsi128_si32(sum);
+    }
+
+    for (; i < len; i++)
+        hash = hash * 33 + s[i];
+    return hash;
+}
+
+/**
+ * Compares len characters of a and b for equality, 32 at a time, with AVX2 byte compares.
+ * Like equalSse42, the last partial block is checked with an overlapping load; short keys go to memcmp.
+ * @param a The first run of characters.
+ * @param b The second run of characters.
+ * @param len The number of characters.
+ * @return true if the characters are the same, false otherwise.
+ */
+__attribute__((target("avx2")))
+static _Bool equalAvx2(char const* a, char const* b, size_t len) {
+    if (len < 32)
+        return memcmp(a, b, len) == 0;
+
+    for (size_t i = 0;; i += 32) {
+        if (i + 32 > len)
+            i = len - 32;
+        __m256i x = _mm256_loadu_si256((__m256i const*)(a + i));
+        __m256i y = _mm256_loadu_si256((__m256i const*)(b + i));
+        if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)) != 0xFFFFFFFFu)
+            return 0;
+        if (i + 32 == len)
+            return 1;
+    }
+}
+
+#endif // TEXTOPS_X86
+
+/** Every kernel compiled in, from the portable one up to the fastest. */
+static TextKernel const kernels[] = {
+    { "scalar", hashScalar, equalScalar },
+#ifdef TEXTOPS_X86
+    { "sse4.2", hashSse42, equalSse42 },
+    { "avx2", hashAvx2, equalAvx2 },
+#endif
+};
+
+/**
+ * Counts how many of the compiled kernels this CPU can run.
+ * The kernels are ordered by the instruction sets they need, so the ones it can run are a prefix of the list.
+ * @return The number of usable kernels, at least one.
+ */
+static int usableKernels() {
+#ifdef TEXTOPS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return 3;
+    if (__builtin_cpu_supports("sse4.2"))
+        return 2;
+#endif
+    return 1;
+}
+
+/** The number of kernels this CPU can run, and the fastest of them, which is the one in use. */
+static int usable;
+static TextKernel const* selected;
+
+/**
+ * Fills in the weights and picks the kernel before main runs, so threads hashing Text only ever read them.
+ */
+__attribute__((constructor)) static void initTextOps() {
+    initWeights();
+    usable = usableKernels();
+    selected = &kernels[usable - 1];
+}
+
+/**
+ * Returns the kernel selected for this CPU, the fastest usable one.
+ * @return A pointer to the selected kernel.
+ */
+TextKernel const* textKernel() {
+    return selected;
+}
+
+/**
+ * Returns every kernel this CPU can run, from the portable one up to the fastest.
+ * @param count Where the number of kernels is stored.
+ * @return A pointer to the first kernel.
+ */
+TextKernel const* textKernels(int* count) {
+    *count = usable;
+    return kernels;
+}
+
+/**
+ * Hashes len characters of s with djb2, using the fastest kernel this CPU supports.
+ * @param s The characters to hash.
+ * @param len The number of characters.
+ * @return The djb2 hash of the characters.
+ */
+unsigned int textHash(char const* s, size_t len) {
+    return textKernel()->hash(s, len);
+}
+
+/**
+ * Compares len characters of a and b for equality, using the fastest kernel this CPU supports.
+ * @param a The first run of characters.
+ * @param b The second run of characters.
+ * @param len The number of characters.
+ * @return true if the characters are the same, false otherwise.
+ */
+_Bool textEqual(char const* a, char const* b, size_t len) {
+    return textKernel()->equal(a, b, len);
+}
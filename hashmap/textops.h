@@ -0,0 +1,30 @@
+#ifndef TEXTOPS_H
+#define TEXTOPS_H
+
+#include <stddef.h>
+
+/** One implementation of the Text hashing and comparison kernels. */
+typedef struct {
+    /** Name of the instruction set the kernels use. */
+    char const* name;
+
+    /** djb2 hash of len characters. */
+    unsigned int (*hash)(char const* s, size_t len);
+
+    /** Compare len characters of a and b for equality. */
+    _Bool (*equal)(char const* a, char const* b, size_t len);
+} TextKernel;
+
+/* Hash len characters of s with djb2, using the fastest kernel this CPU supports. */
+unsigned int textHash(char const* s, size_t len);
+
+/* Compare len characters of a and b, using the fastest kernel this CPU supports. */
+_Bool textEqual(char const* a, char const* b, size_t len);
+
+/* Return the kernel selected for this CPU. */
+TextKernel const* textKernel();
+
+/* Return every kernel this CPU can run, from the portable one up to the fastest; count receives how many. */
+TextKernel const* textKernels(int* count);
+
+#endif // TEXTOPS_H
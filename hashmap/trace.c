@@ -0,0 +1,234 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "trace.h"
+
+/**
+ * @file trace.c
+ * @author Jason Wang
+ * This program writes the commands a driver receives to a trace file and reads them back for replay.
+ * A trace starts with a magic string, followed by one record per command: the nanoseconds since the previous
+ * command, the connection and the length of the command as variable-length integers, then the command's characters.
+ * Commands arrive microseconds apart on a handful of connections, so most records spend only a few bytes on them.
+ */
+
+/** Magic string at the start of every trace file. */
+#define TRACE_MAGIC "HMTRACE1"
+
+/** Size of the stdio buffer used while writing or reading a trace. */
+#define IO_BUFFER_SIZE (1 << 16)
+
+/** Longest command a trace may hold. */
+#define MAX_COMMAND (1 << 20)
+
+/**
+ * Trace being written.
+ */
+struct TraceWriterStruct {
+    FILE* fp;
+    /** Time of the last command written, or of the first one to come before anything was written. */
+    unsigned long long last;
+    size_t written;
+    _Bool failed;
+};
+
+/**
+ * Trace being read.
+ */
+struct TraceReaderStruct {
+    FILE* fp;
+    /** Time of the last command read, since the first. */
+    unsigned long long nanos;
+    /** Buffer the last command was read into. */
+    char* command;
+    size_t capacity;
+};
+
+/**
+ * Reads the monotonic clock the way trace timestamps are taken.
+ * @return nanoseconds since an arbitrary fixed point
+ */
+unsigned long long traceClock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Writes an unsigned integer seven bits at a time, low bits first, with the top bit of each byte set when more follow.
+ * @param fp the file being written
+ * @param n the integer
+ * @return true if it was written
+ */
+static _Bool writeNumber(FILE* fp, unsigned long long n) {
+    while (n >= 0x80) {
+        if (fputc((int)(n & 0x7f) | 0x80, fp) == EOF)
+            return 0;
+        n >>= 7;
+    }
+    return fputc((int)n, fp) != EOF;
+}
+
+/**
+ * Reads an unsigned integer written by writeNumber.
+ * @param fp the file being read
+ * @param n where the integer is stored
+ * @return 1 if it was read, 0 if the file ended before its first byte, -1 if it ended within it or is too long
+ */
+static int readNumber(FILE* fp, unsigned long long* n) {
+    *n = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = fgetc(fp);
+        if (c == EOF)
+            return shift == 0 ? 0 : -1;
+        *n |= (unsigned long long)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return 1;
+    }
+    return -1;
+}
+
+/**
+ * Creates a trace file, replacing any old one.
+ * @param path the file
+ * @return the trace, or NULL if the file can't be created
+ */
+TraceWriter* makeTraceWriter(char const* path) {
+    TraceWriter* this = (TraceWriter*)malloc(sizeof(TraceWriter));
+    if (!this)
+        return NULL;
+    if (!(this->fp = fopen(path, "wb"))) {
+        free(this);
+        return NULL;
+    }
+    setvbuf(this->fp, NULL, _IOFBF, IO_BUFFER_SIZE);
+    this->last = 0;
+    this->written = 0;
+    this->failed = fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), this->fp) != strlen(TRACE_MAGIC);
+    return this;
+}
+
+/**
+ * Appends a command to a trace. The first command's time is the start of the trace; a time earlier than the last
+ * command's is recorded as no gap.
+ * @param this the trace
+ * @param nanos the time the command arrived, as read by traceClock
+ * @param connection the connection the command arrived on
+ * @param command the command line without its newline
+ * @param len the length of the command
+ * @return false if the command is too long or couldn't be written
+ */
+_Bool traceWrite(TraceWriter* this, unsigned long long nanos, unsigned int connection, char const* command, size_t len) {
+    if (len > MAX_COMMAND)
+        return 0;
+    if (this->written == 0)
+        this->last = nanos;
+    unsigned long long gap = nanos > this->last ? nanos - this->last : 0;
+    this->last += gap;
+    if (!writeNumber(this->fp, gap) || !writeNumber(this->fp, connection) || !writeNumber(this->fp, len) ||
+        fwrite(command, 1, len, this->fp) != len) {
+        this->failed = 1;
+        return 0;
+    }
+    this->written++;
+    return 1;
+}
+
+/**
+ * Reports the number of commands written to a trace so far.
+ * @param this the trace
+ * @return the number of commands
+ */
+size_t traceWritten(TraceWriter const* this) {
+    return this->written;
+}
+
+/**
+ * Writes out anything buffered and closes a trace.
+ * @param this the trace
+ * @return false if any write failed
+ */
+_Bool traceWriterFree(TraceWriter* this) {
+    if (!this)
+        return 1;
+    _Bool ok = !this->failed;
+    if (fclose(this->fp) != 0)
+        ok = 0;
+    free(this);
+    return ok;
+}
+
+/**
+ * Opens a trace file for reading.
+ * @param path the file
+ * @return the trace, or NULL if the file can't be read or doesn't start like a trace
+ */
+TraceReader* traceOpen(char const* path) {
+    char magic[sizeof(TRACE_MAGIC)];
+    TraceReader* this = (TraceReader*)malloc(sizeof(TraceReader));
+    if (!this)
+        return NULL;
+    if (!(this->fp = fopen(path, "rb"))) {
+        free(this);
+        return NULL;
+    }
+    setvbuf(this->fp, NULL, _IOFBF, IO_BUFFER_SIZE);
+    if (fread(magic, 1, strlen(TRACE_MAGIC), this->fp) != strlen(TRACE_MAGIC) ||
+        memcmp(magic, TRACE_MAGIC, strlen(TRACE_MAGIC)) != 0) {
+        fclose(this->fp);
+        free(this);
+        return NULL;
+    }
+    this->nanos = 0;
+    this->command = NULL;
+    this->capacity = 0;
+    return this;
+}
+
+/**
+ * Reads the next command of a trace.
+ * @param this the trace
+ * @param record where the command is stored; its text stays valid until the next call
+ * @return 1 for a command, 0 at the end of the trace, -1 if the trace is damaged or memory runs out
+ */
+int traceNext(TraceReader* this, TraceRecord* record) {
+    unsigned long long gap, connection, len;
+    int got = readNumber(this->fp, &gap);
+    if (got <= 0)
+        return got;
+    if (readNumber(this->fp, &connection) != 1 || connection > UINT32_MAX || readNumber(this->fp, &len) != 1 ||
+        len > MAX_COMMAND)
+        return -1;
+
+    if (len + 1 > this->capacity) {
+        char* grown = (char*)realloc(this->command, len + 1);
+        if (!grown)
+            return -1;
+        this->command = grown;
+        this->capacity = len + 1;
+    }
+    if (fread(this->command, 1, len, this->fp) != len)
+        return -1;
+    this->command[len] = '\0';
+
+    this->nanos += gap;
+    record->nanos = this->nanos;
+    record->connection = (unsigned int)connection;
+    record->command = this->command;
+    record->len = len;
+    return 1;
+}
+
+/**
+ * Closes a trace opened for reading.
+ * @param this the trace
+ */
+void traceReaderFree(TraceReader* this) {
+    if (!this)
+        return;
+    fclose(this->fp);
+    free(this->command);
+    free(this);
+}
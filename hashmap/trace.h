@@ -0,0 +1,49 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+
+/** One command read back from a trace. */
+typedef struct {
+    /** Time the command arrived, in nanoseconds since the first command of the trace. */
+    unsigned long long nanos;
+
+    /** Connection the command arrived on. */
+    unsigned int connection;
+
+    /** The command line without its newline, NUL-terminated; valid until the next record is read. */
+    char* command;
+
+    /** Length of the command. */
+    size_t len;
+} TraceRecord;
+
+// Define your TraceWriter and TraceReader structs here
+typedef struct TraceWriterStruct TraceWriter;
+typedef struct TraceReaderStruct TraceReader;
+
+/* Read the monotonic clock the way trace timestamps are taken, in nanoseconds. */
+unsigned long long traceClock();
+
+/* Create a trace file at path, replacing any old one. Returns NULL if it can't be created. */
+TraceWriter* makeTraceWriter(char const* path);
+
+/* Append a command that arrived at time nanos, as read by traceClock, on a connection. Returns 0 on a write error. */
+_Bool traceWrite(TraceWriter* this, unsigned long long nanos, unsigned int connection, char const* command, size_t len);
+
+/* Report the number of commands written so far. */
+size_t traceWritten(TraceWriter const* this);
+
+/* Write out anything buffered and close the trace. Returns 0 if any write failed. */
+_Bool traceWriterFree(TraceWriter* this);
+
+/* Open a trace file for reading. Returns NULL if it can't be read or isn't a trace. */
+TraceReader* traceOpen(char const* path);
+
+/* Read the next command into record. Returns 1 for a command, 0 at the end of the trace and -1 if it is damaged. */
+int traceNext(TraceReader* this, TraceRecord* record);
+
+/* Close a trace opened with traceOpen. */
+void traceReaderFree(TraceReader* this);
+
+#endif // TRACE_H
@@ -0,0 +1,68 @@
+// Simple test program for command traces: writing and reading back commands, their times and connections.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define PATH "traceTest.trace"
+#define COMMANDS 10000
+
+int main() {
+    // Commands come back in order with their connections and their times since the first one.
+    TraceWriter* writer = makeTraceWriter(PATH);
+    assert(writer);
+    unsigned long long base = traceClock();
+    char line[64];
+    for (int i = 0; i < COMMANDS; i++) {
+        int len = snprintf(line, sizeof(line), "set key:%d %d", i, i * 3);
+        assert(traceWrite(writer, base + i * 1500ULL, i % 7, line, len));
+    }
+    // An empty command and a clock that went backwards are kept, as a blank line with no gap.
+    assert(traceWrite(writer, base + COMMANDS * 1500ULL, 0, "", 0));
+    assert(traceWrite(writer, base, 3, "size", 4));
+    assert(traceWritten(writer) == COMMANDS + 2);
+    assert(traceWriterFree(writer));
+
+    TraceReader* reader = traceOpen(PATH);
+    assert(reader);
+    TraceRecord record;
+    for (int i = 0; i < COMMANDS; i++) {
+        int len = snprintf(line, sizeof(line), "set key:%d %d", i, i * 3);
+        assert(traceNext(reader, &record) == 1);
+        assert(record.nanos == i * 1500ULL && record.connection == (unsigned int)(i % 7));
+        assert(record.len == (size_t)len && strcmp(record.command, line) == 0);
+    }
+    assert(traceNext(reader, &record) == 1 && record.len == 0 && record.command[0] == '\0');
+    assert(traceNext(reader, &record) == 1 && record.nanos == COMMANDS * 1500ULL && strcmp(record.command, "size") == 0);
+    assert(traceNext(reader, &record) == 0);
+    traceReaderFree(reader);
+
+    // Records take a few bytes besides their commands.
+    FILE* fp = fopen(PATH, "rb");
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+    assert(size < COMMANDS * (long)(strlen("set key:9999 29997") + 5));
+
+    // A trace cut short reports damage after its whole records.
+    assert(truncate(PATH, size - 2) == 0);
+    reader = traceOpen(PATH);
+    int got, records = 0;
+    while ((got = traceNext(reader, &record)) == 1)
+        records++;
+    assert(got == -1 && records == COMMANDS + 1);
+    traceReaderFree(reader);
+
+    // A file that isn't a trace doesn't open.
+    fp = fopen(PATH, "wb");
+    fputs("set 1 2\n", fp);
+    fclose(fp);
+    assert(!traceOpen(PATH) && !traceOpen("no-such-file.trace"));
+    remove(PATH);
+
+    return EXIT_SUCCESS;
+}
@@ -2,6 +2,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include "vtype.h"
+#include "alloc.h"
+#include "lz.h"
+#include "siphash.h"
+#include "textops.h"
 
 /** 
  * @file driver.c
@@ -11,6 +15,41 @@
  * commands.
 */
 
+/** Random seed mixed into every hash, so bucket positions differ from one process to the next. */
+static unsigned int hashSeed;
+
+/**
+ * Picks the process's hash seed before main runs, so every map in the process hashes the same way.
+ */
+__attribute__((constructor)) static void initHashSeed() {
+    uint64_t key[2];
+    randomHashKey(key);
+    hashSeed = (unsigned int)(key[0] ^ key[1]);
+}
+
+/**
+ * Replaces the process's hash seed, for runs that must place keys the same way every time.
+ * Every map hashes with the seed that is current when it hashes, so this has to be set before the first key is stored.
+ * @param seed The new seed.
+ */
+void setHashSeed(unsigned int seed) {
+    hashSeed = seed;
+}
+
+/** Allocator every VType object and its text come from. */
+static MapAllocator const* allocator = &mallocAllocator;
+
+/**
+ * Makes every VType object and its text, compressed or loaded from a snapshot, come from the given allocator instead
+ * of malloc.
+ * Objects are freed with the allocator that is current when they are freed, so this has to be set before the first
+ * VType is created and never changed afterwards.
+ * @param a A pointer to the allocator, or NULL for malloc.
+ */
+void setVTypeAllocator(MapAllocator const* a) {
+    allocator = a ? a : &mallocAllocator;
+}
+
 /**
  * Creates a new Text object on the heap and returns a pointer to the VType representing it.
  * The function allocates memory for the VType structure and the text content in the 'value.text' field.
@@ -21,10 +60,43 @@
  * @return A pointer to the VType representing the created Text object, or NULL on memory allocation failure.
  */
 VType* makeText(char* value) {
-    VType* v = (VType*)malloc(sizeof(VType));
+    return makeTextLen(value, strlen(value));
+}
+
+/**
+ * Creates a new Text object on the heap from the first 'len' characters of 'value'.
+ * The characters are copied and NUL-terminated, and the length is stored so comparisons and hashing never have to scan for the end.
+ * The caller is responsible for freeing the allocated memory when no longer needed.
+ * @param value The characters of the text content, which need not be NUL-terminated.
+ * @param len The number of characters to copy.
+ * @return A pointer to the VType representing the created Text object, or NULL on memory allocation failure.
+ */
+VType* makeTextLen(char const* value, size_t len) {
+    VType* v = makeTextSpace(len);
+    if (v)
+        memcpy(v->value.text, value, len);
+    return v;
+}
+
+/**
+ * Creates a new Text object on the heap with room for 'len' characters, for the caller to fill in.
+ * The characters are left as they are, and the terminating NUL is already in place after them.
+ * The caller is responsible for freeing the allocated memory when no longer needed.
+ * @param len The number of characters.
+ * @return A pointer to the VType representing the created Text object, or NULL on memory allocation failure.
+ */
+VType* makeTextSpace(size_t len) {
+    VType* v = (VType*)allocator->alloc(allocator->ctx, sizeof(VType));
     if (v) {
         v->type = 'T';
-        v->value.text = strdup(value);
+        v->length = len;
+        v->capacity = len + 1;
+        v->value.text = (char*)allocator->alloc(allocator->ctx, len + 1);
+        if (!v->value.text) {
+            allocator->free(allocator->ctx, v, sizeof(VType));
+            return NULL;
+        }
+        v->value.text[len] = '\0';
     }
     return v;
 }
@@ -39,14 +111,140 @@ VType* makeText(char* value) {
  * @return A pointer to the VType representing the created Integer object, or NULL on memory allocation failure.
  */
 VType* makeInteger(int value) {
-    VType* v = (VType*)malloc(sizeof(VType));
+    VType* v = (VType*)allocator->alloc(allocator->ctx, sizeof(VType));
     if (v) {
         v->type = 'I';
+        v->length = 0;
+        v->capacity = 0;
         v->value.integer = value;
     }
     return v;
 }
 
+/**
+ * Creates a new VType object on the heap holding the same type and data as 'v'.
+ * A Text copy gets a buffer just large enough for its characters, whatever the capacity of the original.
+ * The caller is responsible for freeing the allocated memory when no longer needed.
+ * @param v A pointer to the VType object to copy.
+ * @return A pointer to the copy, or NULL if 'v' is NULL or on memory allocation failure.
+ */
+VType* copyVType(const VType* v) {
+    if (!v)
+        return NULL;
+
+    if (v->type == 'T')
+        return makeTextLen(v->value.text, v->length);
+    if (v->type == 'Z') {
+        VType* c = makeTextLen(v->value.text, v->capacity);
+        if (c) {
+            c->type = 'Z';
+            c->length = v->length;
+        }
+        return c;
+    }
+    return makeInteger(v->value.integer);
+}
+
+/**
+ * Appends 'len' characters to a Text object in place.
+ * When the characters don't fit, the buffer is replaced with one at least twice as large, so a value built up by
+ * repeated appends is copied a logarithmic number of times rather than on every append.
+ * @param v A pointer to the VType object representing a Text object.
+ * @param value The characters to append, which need not be NUL-terminated.
+ * @param len The number of characters to append.
+ * @return true (1) if the characters were appended, false (0) if 'v' isn't Text or on memory allocation failure.
+ */
+_Bool appendText(VType* v, char const* value, size_t len) {
+    if (!v || v->type != 'T')
+        return 0;
+
+    size_t needed = (size_t)v->length + len + 1;
+    if (needed > v->capacity) {
+        size_t capacity = (size_t)v->capacity * 2;
+        if (capacity < needed)
+            capacity = needed;
+        char* text = (char*)allocator->alloc(allocator->ctx, capacity);
+        if (!text)
+            return 0;
+        memcpy(text, v->value.text, v->length);
+        allocator->free(allocator->ctx, v->value.text, v->capacity);
+        v->value.text = text;
+        v->capacity = capacity;
+    }
+
+    memcpy(v->value.text + v->length, value, len);
+    v->length += len;
+    v->value.text[v->length] = '\0';
+    return 1;
+}
+
+/**
+ * Compresses the characters of a Text object in place, turning it into a compressed Text ('Z').
+ * The object itself stays where it is, so pointers to it remain valid; only its buffer is replaced.
+ * Text that doesn't shrink by at least an eighth is left as it is, since it would cost decompression for little gain.
+ * @param v A pointer to the VType object representing a Text object.
+ * @return true (1) if the text was compressed, false (0) if it isn't Text, didn't shrink enough or on memory allocation failure.
+ */
+_Bool compressText(VType* v) {
+    if (!v || v->type != 'T' || v->length == 0)
+        return 0;
+
+    size_t cap = v->length - v->length / 8;
+    char* buffer = (char*)allocator->alloc(allocator->ctx, cap);
+    if (!buffer)
+        return 0;
+    size_t clen = lzCompress(v->value.text, v->length, buffer, cap);
+    char* text = clen ? (char*)allocator->alloc(allocator->ctx, clen) : NULL;
+    if (text)
+        memcpy(text, buffer, clen);
+    allocator->free(allocator->ctx, buffer, cap);
+    if (!text)
+        return 0;
+
+    allocator->free(allocator->ctx, v->value.text, v->capacity);
+    v->type = 'Z';
+    v->value.text = text;
+    v->capacity = clen;
+    return 1;
+}
+
+/**
+ * Decompresses the characters of a compressed Text object into a buffer, leaving the object as it is.
+ * @param v A pointer to the VType object representing a compressed Text object.
+ * @param out Where the characters are written, followed by a terminating NUL; it must hold length + 1 bytes.
+ * @return true (1) if the characters were written, false (0) if 'v' isn't compressed Text or its data is corrupt.
+ */
+_Bool inflateText(VType const* v, char* out) {
+    if (!v || v->type != 'Z' || !lzDecompress(v->value.text, v->capacity, out, v->length))
+        return 0;
+    out[v->length] = '\0';
+    return 1;
+}
+
+/**
+ * Decompresses a compressed Text object in place, turning it back into a plain Text ('T').
+ * @param v A pointer to the VType object representing a compressed Text object.
+ * @return true (1) if the object is plain Text now, false (0) if it isn't Text or on memory allocation failure.
+ */
+_Bool expandText(VType* v) {
+    if (!v || (v->type != 'T' && v->type != 'Z'))
+        return 0;
+    if (v->type == 'T')
+        return 1;
+
+    char* text = (char*)allocator->alloc(allocator->ctx, (size_t)v->length + 1);
+    if (!text || !inflateText(v, text)) {
+        if (text)
+            allocator->free(allocator->ctx, text, (size_t)v->length + 1);
+        return 0;
+    }
+    allocator->free(allocator->ctx, v->value.text, v->capacity);
+    v->type = 'T';
+    v->value.text = text;
+    v->capacity = v->length + 1;
+    return 1;
+}
+
 /**
  * Frees the memory occupied by a VType object and its associated data.
  * The function checks the type of the VType object and frees the associated data accordingly.
@@ -59,10 +257,10 @@ void freeVType(VType* v) {
     if (!v)
         return;
 
-    if (v->type == 'T')
-        free(v->value.text);
+    if (v->type == 'T' || v->type == 'Z')
+        allocator->free(allocator->ctx, v->value.text, v->capacity);
 
-    free(v);
+    allocator->free(allocator->ctx, v, sizeof(VType));
 }
 
 /**
@@ -88,7 +286,8 @@ void printVType(const VType* v) {
  * The function compares the types and associated data of the two VType objects.
  * If either of the provided pointers 'a' or 'b' is NULL, the function returns false (0).
  * If the types of 'a' and 'b' are different, the function returns false (0).
- * If both VType objects represent Text objects, the text contents are compared using 'strcmp'.
+ * If both VType objects represent Text objects, their lengths are compared first and then their contents with 'textEqual',
+ * which uses the widest vector compare the CPU supports.
  * If both VType objects represent Integer objects, the integer values are compared.
  * If the VType objects are equal in type and data, the function returns true (1), otherwise, it returns false (0).
  * @param a A pointer to the first VType object to compare.
@@ -103,19 +302,37 @@ _Bool equalsVType(const VType* a, const VType* b) {
         return 0;
 
     if (a->type == 'T')
-        return strcmp(a->value.text, b->value.text) == 0;
+        return a->length == b->length && textEqual(a->value.text, b->value.text, a->length);
     else if (a->type == 'I')
         return a->value.integer == b->value.integer;
 
     return 0;
 }
 
+/**
+ * Spreads the bits of a hash over the whole word (the MurmurHash3 finalizer), so the low bits that pick a bucket
+ * depend on every bit of the input.
+ * @param h The hash.
+ * @return The mixed hash.
+ */
+static unsigned int mixHash(unsigned int h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
 /**
  * Generates a hash value for a VType object.
  * The function calculates the hash value based on the VType object's type and associated data.
  * If the provided pointer 'v' is NULL, the function returns 0.
- * If the VType object represents a Text object, the hash value is calculated using the djb2 algorithm.
+ * If the VType object represents a Text object, the hash value is calculated using the djb2 algorithm with 'textHash',
+ * which hashes whole blocks of characters at once on CPUs with SSE4.2 or AVX2 and gives the same value everywhere.
  * If the VType object represents an Integer object, the integer value is converted to a string, and the hash is calculated using djb2.
+ * The djb2 value is then mixed with the process's random seed, so which keys share a bucket can't be worked out ahead of
+ * time from djb2 alone; keys whose djb2 values are equal still collide, which is what 'keyedHashVType' is for.
  * If the VType object's type is neither 'T' nor 'I', the function returns 0 (indicating an unsupported type).
  * @param v A pointer to the VType object for which the hash value is to be calculated.
  * @return The calculated hash value as an unsigned integer, or 0 if the VType object is NULL or has an unsupported type.
@@ -124,22 +341,37 @@ unsigned int hashVType(const VType* v) {
     if (!v)
         return 0;
 
-    unsigned int hash = 5381;
-    int c;
-    char* str;
-
     if (v->type == 'T')
-        str = v->value.text;
+        return mixHash(textHash(v->value.text, v->length) ^ hashSeed);
     else if (v->type == 'I') {
         char buffer[12];
-        sprintf(buffer, "%d", v->value.integer);
-        str = buffer;
-    } else {
-        return 0;
+        int len = sprintf(buffer, "%d", v->value.integer);
+        return mixHash(textHash(buffer, len) ^ hashSeed);
     }
 
-    while ((c = *str++))
-        hash = ((hash << 5) + hash) + c; // hash * 33 + c
+    return 0;
+}
 
-    return hash;
+/**
+ * Generates a hash value for a VType object with SipHash under a secret key.
+ * Keys are hashed from the same characters as 'hashVType' uses, but without the key nobody can find keys that collide,
+ * so this is the hash a map falls back on when it sees keys piling up in one place.
+ * @param v A pointer to the VType object for which the hash value is to be calculated.
+ * @param key The 128-bit SipHash key.
+ * @return The calculated hash value, or 0 if the VType object is NULL or has an unsupported type.
+ */
+unsigned int keyedHashVType(const VType* v, uint64_t const key[2]) {
+    uint64_t h;
+    if (!v)
+        return 0;
+
+    if (v->type == 'T')
+        h = sipHash(v->value.text, v->length, key);
+    else if (v->type == 'I') {
+        char buffer[12];
+        int len = sprintf(buffer, "%d", v->value.integer);
+        h = sipHash(buffer, len, key);
+    } else
+        return 0;
+    return (unsigned int)(h ^ h >> 32);
 }
\ No newline at end of file
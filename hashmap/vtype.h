@@ -1,23 +1,42 @@
 #ifndef VTYPE_H
 #define VTYPE_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include "alloc.h"
+
 // Define your VType struct here
 typedef struct VTypeStruct {
-    // Members of the VType struct
+    // Members of the VType struct: 'T' for Text, 'I' for Integer, 'Z' for Text held compressed
     char type;
+    // Number of characters in a Text value, before compression for a compressed one
+    unsigned int length;
     union {
         char* text;
         int integer;
     } value;
+    // Number of bytes allocated for a Text value's characters, including the terminating NUL;
+    // for a compressed Text, the number of compressed bytes
+    unsigned int capacity;
 } VType;
 
 // Function prototypes
 VType* makeText(char* value);
+VType* makeTextLen(char const* value, size_t len);
+VType* makeTextSpace(size_t len);
 VType* makeInteger(int value);
+VType* copyVType(const VType* v);
+_Bool appendText(VType* v, char const* value, size_t len);
+_Bool compressText(VType* v);
+_Bool expandText(VType* v);
+_Bool inflateText(VType const* v, char* out);
 void freeVType(VType* v);
 void printVType(const VType* v);
 _Bool equalsVType(const VType* a, const VType* b);
 unsigned int hashVType(const VType* v);
+unsigned int keyedHashVType(const VType* v, uint64_t const key[2]);
+void setHashSeed(unsigned int seed);
+void setVTypeAllocator(MapAllocator const* allocator);
 
 #endif // VTYPE_H
 